@@ -26,12 +26,10 @@
 #include <Magnum/Shaders/GenericGL.h>
 #include <Magnum/Trade/MeshData.h>
 
+#include "coll/BVH.h"
 #include "coll/CollidableWorld.h"
-#include "coll/CollidableWorld_Impl.h"
-#include "csgo_parsing/AssetFileReader.h"
-#include "csgo_parsing/AssetFinder.h"
+#include "coll/CollidableWorldCreator.h"
 #include "csgo_parsing/BspMap.h"
-#include "csgo_parsing/PhyModelParsing.h"
 #include "csgo_parsing/utils.h"
 #include "ren/GlidabilityShader3D.h"
 #include "ren/RenderableWorld.h"
@@ -196,11 +194,6 @@ WorldCreator::InitFromBspMap(
     std::shared_ptr<RenderableWorld> r_world = std::make_shared<RenderableWorld>();
     std::string error_msgs = "";
 
-    // Only look up assets in the game's directory and its VPK archives if it
-    // isn't an embedded map. Embedded maps are supposed to be independent and
-    // self-contained, not requiring any external files.
-    bool use_game_dir_assets = !bsp_map->is_embedded_map;
-
     {
         ZoneScopedN("GenDispFaceMesh");
         Debug{} << "Parsing displacement face mesh";
@@ -222,255 +215,26 @@ WorldCreator::InitFromBspMap(
             GenMeshWithVertAttr_Position(displacementBoundaryFaces);
     } // Destruct face array once it's no longer needed (reduce peak RAM usage)
 
-    // Init required displacement collision structures
-    std::vector<CDispCollTree> hull_disp_coll_trees;
-    size_t relevant_disp_cnt = 0;
-    for (size_t i = 0; i < bsp_map->dispinfos.size(); i++) {
-        if (bsp_map->dispinfos[i].HasFlag_NO_HULL_COLL())
-            continue;
-        relevant_disp_cnt++;
-    }
-    hull_disp_coll_trees.reserve(relevant_disp_cnt);
-    for (size_t i = 0; i < bsp_map->dispinfos.size(); i++) {
-        if (bsp_map->dispinfos[i].HasFlag_NO_HULL_COLL())
-            continue;
-        // @Optimization Only get disp vertices once and use it for mesh and coll init
-        hull_disp_coll_trees.emplace_back(i, *bsp_map);
-    }
-    
-    // ---- Collect all ".mdl" and ".phy" files from the packed files
-    std::vector<uint16_t> packed_mdl_file_indices; // indices into BspMap::packed_files
-    std::vector<uint16_t> packed_phy_file_indices; // indices into BspMap::packed_files
-    for (size_t i = 0; i < bsp_map->packed_files.size(); i++) {
-        const std::string& fname = bsp_map->packed_files[i].file_name;
-        if (fname.length() >= 5) {
-            if      (fname.ends_with(".mdl")) packed_mdl_file_indices.push_back(i);
-            else if (fname.ends_with(".phy")) packed_phy_file_indices.push_back(i);
-        }
-    }
-    // ---- Sort packed file indices by file name to enable fast lookup later
-    auto comp__packed_file_name = [&](uint16_t idx_a, uint16_t idx_b) {
-        return bsp_map->packed_files[idx_a].file_name < bsp_map->packed_files[idx_b].file_name;
-    };
-    std::sort(
-        packed_mdl_file_indices.begin(),
-        packed_mdl_file_indices.end(),
-        comp__packed_file_name);
-    std::sort(
-        packed_phy_file_indices.begin(),
-        packed_phy_file_indices.end(),
-        comp__packed_file_name);
-
-    for (auto packed_file_idx : packed_mdl_file_indices)
-        Debug{} << "packed MDL:" << bsp_map->packed_files[packed_file_idx].file_name.c_str();
-    for (auto packed_file_idx : packed_phy_file_indices)
-        Debug{} << "packed PHY:" << bsp_map->packed_files[packed_file_idx].file_name.c_str();
-
-    // predicate function used for binary lookup of packed file idx with file name
-    auto comp__find_packed_file_name_idx =
-        [&](uint16_t packed_file_idx, const std::string& file_name) {
-            return bsp_map->packed_files[packed_file_idx].file_name < file_name;
-        };
-
-    // ---- Load collision models of solid prop_static and prop_dynamic entities
-
-    // Get MDL paths referenced by at least one solid prop (static or dynamic)
-    std::set<std::string> solid_xprop_mdl_paths;
-    for (const BspMap::StaticProp& sprop : bsp_map->static_props)
-        if (sprop.IsSolidWithVPhysics())
-            solid_xprop_mdl_paths.insert(bsp_map->static_prop_model_dict[sprop.model_idx]);
-    for (const BspMap::Ent_prop_dynamic& dprop : bsp_map->relevant_dynamic_props)
-        solid_xprop_mdl_paths.insert(dprop.model);
+    // Create collision structures. Collision model meshes of solid props are
+    // also needed for rendering.
+    // Building the BVH of big maps takes a while, reuse previous builds.
+    BVH::BuildParams bvh_params;
+    bvh_params.cache_dir_path = BVH::GetDefaultCacheDirPath();
+    std::string coll_errors;
+    CollidableWorldCreator::XPropCollMeshes xprop_coll_tri_meshes;
+    std::shared_ptr<CollidableWorld> c_world = CollidableWorldCreator::InitFromBspMap(
+        bsp_map, bvh_params, &coll_errors, &xprop_coll_tri_meshes);
+    error_msgs += coll_errors;
 
     // key:   ".mdl" file path referenced by at least one solid prop (static or dynamic)
     // value: Corresponding collision model mesh
     std::map<std::string, GL::Mesh> xprop_coll_meshes;
-
-    // Collision models used in at least one solid prop (static or dynamic).
-    // Keys are MDL paths, values are collision models.
-    std::map<std::string, CollisionModel> xprop_coll_models;
-
-    // When loading regular (non-embedded) maps, a requirement to consider a
-    // prop as solid is the existence of the MDL file it references.
-    // This is done to faithfully represent how CSGO would load a map.
-    // When loading embedded maps, we don't require an MDL file for solid props
-    // because these maps are custom-made to only be loaded by DZSimulator and
-    // MDL files themselves are not read and they would unnecessarily increase
-    // embedded file size.
-    bool require_existing_mdl_file = !bsp_map->is_embedded_map;
-
-    // Now attempt to load required collision models
-    for (const std::string& mdl_path : solid_xprop_mdl_paths) {
-        ZoneScopedN("xprop phy load");
-
-        if (mdl_path.length() < 5) // Ensure valid file path
-            continue;
-        std::string phy_path = mdl_path;
-        phy_path[phy_path.length() - 3] = 'p';
-        phy_path[phy_path.length() - 2] = 'h';
-        phy_path[phy_path.length() - 1] = 'y';
-
-        // Search for MDL file in packed files
-        auto it_packed_mdl_idx = std::lower_bound(
-            packed_mdl_file_indices.begin(),
-            packed_mdl_file_indices.end(),
-            mdl_path,
-            comp__find_packed_file_name_idx);
-        bool is_mdl_in_packed_files =
-            it_packed_mdl_idx != packed_mdl_file_indices.end() &&
-            mdl_path.compare(bsp_map->packed_files[*it_packed_mdl_idx].file_name) == 0;
-
-        // Search for PHY file in packed files
-        auto it_packed_phy_idx = std::lower_bound(
-            packed_phy_file_indices.begin(),
-            packed_phy_file_indices.end(),
-            phy_path,
-            comp__find_packed_file_name_idx);
-        bool is_phy_in_packed_files =
-            it_packed_phy_idx != packed_phy_file_indices.end() &&
-            phy_path.compare(bsp_map->packed_files[*it_packed_phy_idx].file_name) == 0;
-
-        bool is_mdl_in_game_files = use_game_dir_assets ?
-            AssetFinder::ExistsInGameFiles(mdl_path) : false;
-
-        // Sometimes we require every prop to have an existing ".mdl" file
-        if (require_existing_mdl_file
-            && !is_mdl_in_game_files && !is_mdl_in_packed_files)
-        {
-            error_msgs += "Failed to find MDL file '" + mdl_path + "', "
-                "referenced by at least one solid prop. "
-                "All props with this model will be missing from the world.\n";
-            continue;
-        }
-
-        // Open the PHY file at the correct location
-        AssetFileReader phy_file_reader;
-        std::string phy_file_read_err = ""; // empty means no error occurred
-
-        if (is_phy_in_packed_files) {
-            // Depending on where we parsed the original '.bsp' file from,
-            // we need to read its packed files accordingly.
-            switch (bsp_map->file_origin.type) {
-            case BspMap::FileOrigin::FILE_SYSTEM: {
-                auto& abs_bsp_file_path = bsp_map->file_origin.abs_file_path;
-                if (!phy_file_reader.OpenFileFromAbsolutePath(abs_bsp_file_path))
-                    phy_file_read_err = "Failed to open BSP file for parsing a "
-                    "packed PHY file: " + abs_bsp_file_path;
-                break;
-            }
-            case BspMap::FileOrigin::MEMORY: {
-                auto& bsp_file_mem = bsp_map->file_origin.file_content_mem;
-                if (!phy_file_reader.OpenFileFromMemory(bsp_file_mem))
-                    phy_file_read_err = "Failed to open BSP file from memory to"
-                    " parse packed PHY file";
-                break;
-            }
-            default:
-                phy_file_read_err = "Failed to read packed PHY file: Unknown "
-                    "BSP file origin: " + std::to_string(bsp_map->file_origin.type);
-                break;
-            }
-
-            // If opening the original bsp file succeeded without errors
-            if (phy_file_read_err.empty()) {
-                bool x = phy_file_reader.OpenSubFileFromCurrentlyOpenedFile(
-                    bsp_map->packed_files[*it_packed_phy_idx].file_offset,
-                    bsp_map->packed_files[*it_packed_phy_idx].file_len
-                ); // This can't fail because phy_file_reader is opened in a file
-            }
-        }
-        else {
-            // Look for PHY file in game directory and VPK archives
-            bool is_phy_in_game_files = use_game_dir_assets ?
-                AssetFinder::ExistsInGameFiles(phy_path) : false;
-
-            // Prop is non-solid if their model's PHY doesn't exist anywhere
-            if (!is_phy_in_game_files)
-                continue; // Not an error, we just skip this non-solid model
-
-            if (!phy_file_reader.OpenFileFromGameFiles(phy_path))
-                phy_file_read_err = "Failed to open PHY file from game files";
-        }
-
-        if (phy_file_read_err.empty()) { // If no error occurred on file open
-            // A collision model consists of one or more "sections".
-            // A "section" is a triangle mesh that describes a convex shape.
-            std::vector<TriMesh> section_tri_meshes;
-            std::string surface_property;
-            // CSGO loads the phy model even if checksum of MDL and PHY are not identical.
-            // NOTE: If you change the way PHY models are parsed, please see
-            //       whether comments surrounding CollisionModel::section_tri_meshes
-            //       need to be updated! E.g. regarding edge duplicate-freeness guarantees.
-            // NOTE: Static props' phy model always have a single solid.
-            //       Dynamic props' phy model very rarely have multiple solids.
-            auto ret = ParseSingleSolidPhyModel(
-                &section_tri_meshes, &surface_property, phy_file_reader);
-
-            // Special case: We treat this error as a non-error because maps
-            // rarely have dynamic props with a phy model with multiple solids.
-            // These are mostly hostage/character models or an animated garage
-            // doors. It's not worth supporting these, so skip without error.
-            if (ret.code == csgo_parsing::utils::RetCode::ERROR_PHY_MULTIPLE_SOLIDS) {
-                Debug{} << "Skipped multi-solid collision model:" << phy_path.c_str();
-                continue; // Not an error
-            }
-
-            if (ret.successful()) {
-                ZoneScopedN("gen phy mesh + collmodel");
-                GL::Mesh phy_mesh = GenMeshWithVertAttr_Position_Normal(section_tri_meshes);
-                xprop_coll_meshes[mdl_path] = std::move(phy_mesh);
-
-                // For each section, get its AABB and create plane of each triangle
-                const size_t NUM_SECTIONS = section_tri_meshes.size();
-                std::vector<std::vector<BspMap::Plane>> section_planes(NUM_SECTIONS);
-                std::vector<CollisionModel::AABB>       section_aabbs (NUM_SECTIONS);
-                for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++) {
-                    const TriMesh& section_tri_mesh = section_tri_meshes[section_idx];
-                    const std::vector<Vector3>& section_vertices = section_tri_mesh.vertices;
-                    auto& planes_of_section = section_planes[section_idx];
-                    planes_of_section.reserve(section_tri_mesh.tris.size());
-
-                    Vector3 section_aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
-                    Vector3 section_aabb_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
-                    for (const Vector3& vert : section_vertices) {
-                        for (int axis = 0; axis < 3; axis++) { // Add vertex to section's AABB
-                            section_aabb_mins[axis] = Math::min(section_aabb_mins[axis], vert[axis]);
-                            section_aabb_maxs[axis] = Math::max(section_aabb_maxs[axis], vert[axis]);
-                        }
-                    }
-                    section_aabbs[section_idx].mins = section_aabb_mins;
-                    section_aabbs[section_idx].maxs = section_aabb_maxs;
-
-                    for (const TriMesh::Tri& triangle : section_tri_mesh.tris) {
-                        const Vector3& v1 = section_vertices[triangle.verts[0]];
-                        const Vector3& v2 = section_vertices[triangle.verts[1]];
-                        const Vector3& v3 = section_vertices[triangle.verts[2]];
-                        Vector3 plane_normal = CalcNormalCwFront(v1, v2, v3);
-                        float   plane_dist = Math::dot(plane_normal, v1);
-                        planes_of_section.push_back({
-                            .normal = plane_normal,
-                            .dist   = plane_dist
-                        });
-                    }
-                }
-                // Construct CollisionModel object
-                xprop_coll_models[mdl_path] = CollisionModel {
-                    .section_tri_meshes = std::move(section_tri_meshes),
-                    .section_planes     = std::move(section_planes),
-                    .section_aabbs      = std::move(section_aabbs)
-                };
-            }
-            else { // If parsing failed for other reasons, get error msg
-                phy_file_read_err = ret.desc_msg;
-            }
-        }
-
-        if (!phy_file_read_err.empty()) { // If anything failed
-            error_msgs += "All prop_static/prop_dynamic using the model '"
-                + mdl_path + "' will be missing from the world because loading "
-                "their collision model failed:\n    " + phy_file_read_err + "\n";
-        }
+    for (const auto& [mdl_path, section_tri_meshes] : xprop_coll_tri_meshes) {
+        ZoneScopedN("gen phy mesh");
+        xprop_coll_meshes[mdl_path] =
+            GenMeshWithVertAttr_Position_Normal(section_tri_meshes);
     }
+    xprop_coll_tri_meshes.clear(); // Reduce peak RAM usage
 
     struct InstanceData {
         // @Optimization Instead, represent transformation using
@@ -525,47 +289,6 @@ WorldCreator::InitFromBspMap(
 
         r_world->instanced_xprop_meshes.emplace_back(std::move(mesh));
     }
-    // Precompute collision caches of each solid prop (static or dynamic).
-    // MUST HAPPEN AFTER COLL MODEL CREATION!
-    Debug{} << "Creating collision caches of static props";
-    // Keys are indices into BspMap::static_props, values are the caches.
-    std::map<uint32_t, CollisionCache_XProp> coll_caches_sprop;
-    for (size_t sprop_idx = 0; sprop_idx < bsp_map->static_props.size(); sprop_idx++) {
-        const BspMap::StaticProp& sprop = bsp_map->static_props[sprop_idx];
-        if (!sprop.IsSolidWithVPhysics())
-            continue;
-
-        // Path to ".mdl" file used by static prop
-        const std::string& mdl_path = bsp_map->static_prop_model_dict[sprop.model_idx];
-
-        auto coll_model_it = xprop_coll_models.find(mdl_path);
-        if (coll_model_it == xprop_coll_models.end())
-            continue; // No collision model
-        const CollisionModel& cmodel = coll_model_it->second;
-
-        auto sprop_coll_cache = coll::Create_CollisionCache_StaticProp(sprop, cmodel);
-        if (sprop_coll_cache == Corrade::Containers::NullOpt)
-            continue; // Cache creation failed
-        coll_caches_sprop[sprop_idx] = std::move(*sprop_coll_cache);
-    }
-    Debug{} << "Creating collision caches of dynamic props";
-    // Keys are indices into BspMap::relevant_dynamic_props, values are the caches.
-    std::map<uint32_t, CollisionCache_XProp> coll_caches_dprop;
-    for (size_t dprop_idx = 0; dprop_idx < bsp_map->relevant_dynamic_props.size(); dprop_idx++) {
-        const BspMap::Ent_prop_dynamic& dprop = bsp_map->relevant_dynamic_props[dprop_idx];
-
-        auto coll_model_it = xprop_coll_models.find(dprop.model);
-        if (coll_model_it == xprop_coll_models.end())
-            continue; // No collision model
-        const CollisionModel& cmodel = coll_model_it->second;
-
-        auto dprop_coll_cache = coll::Create_CollisionCache_DynamicProp(dprop, cmodel);
-        if (dprop_coll_cache == Corrade::Containers::NullOpt)
-            continue; // Cache creation failed
-        coll_caches_dprop[dprop_idx] = std::move(*dprop_coll_cache);
-    }
-
-
 
     // ----- BRUSHES
     Debug{} << "Parsing model brush indices";
@@ -725,24 +448,6 @@ WorldCreator::InitFromBspMap(
         GenMeshWithVertAttr_Position_Normal(trigger_push_faces);
 
 
-    // Create CollidableWorld object and move all collision structures into it.
-    std::shared_ptr<CollidableWorld> c_world = std::make_shared<CollidableWorld>(bsp_map);
-    c_world->pImpl->hull_disp_coll_trees = std::move(hull_disp_coll_trees);
-    c_world->pImpl->xprop_coll_models    = std::move(xprop_coll_models);
-    c_world->pImpl->coll_caches_sprop    = std::move(coll_caches_sprop);
-    c_world->pImpl->coll_caches_dprop    = std::move(coll_caches_dprop);
-    // ...
-
-    // BVH must be created *after* all other collision structures were created
-    // and moved into the CollidableWorld object!
-    assert(c_world->pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
-    assert(c_world->pImpl->xprop_coll_models    != Corrade::Containers::NullOpt);
-    assert(c_world->pImpl->coll_caches_sprop    != Corrade::Containers::NullOpt);
-    assert(c_world->pImpl->coll_caches_dprop    != Corrade::Containers::NullOpt);
-    // ...
-    c_world->pImpl->bvh = BVH(*c_world);
-
-
     if (dest_errors)
         *dest_errors = std::move(error_msgs);
     return { r_world, c_world };
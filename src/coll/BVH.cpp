@@ -1,16 +1,26 @@
 #include "coll/BVH.h"
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <stack>
 #include <span>
+#include <thread>
 #include <vector>
 
 #include <Tracy.hpp>
 
+#include <Corrade/Containers/Array.h>
 #include <Corrade/Containers/Optional.h>
+#include <Corrade/Containers/String.h>
+#include <Corrade/Containers/StringStl.h>
+#include <Corrade/Utility/Path.h>
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Functions.h>
 #include <Magnum/Math/Vector3.h>
@@ -21,42 +31,75 @@
 #include "coll/CollidableWorld-xprop.h"
 #include "coll/Debugger.h"
 #include "coll/Trace.h"
-#include "csgo_parsing/BrushSeparation.h"
+#include "coll/TraceContext.h"
+#include "common.h"
 #include "csgo_parsing/BspMap.h"
 #include "csgo_parsing/utils.h"
 #include "utils_3d.h"
 
 using namespace coll;
+using namespace Corrade;
 using namespace Magnum;
 using namespace csgo_parsing;
 
 // @Optimization Is "Intel Embree" an option to speed up ray intersections?
 // @Optimization Look up BVH optimizations in https://github.com/brandonpelfrey/Fast-BVH
-// @Optimization Save memory: Store BVH AABB values as int16 (-32768 to 32767)
-//               instead of float. Increase exact AABB to nearest integers.
 
 #define PRINT_PREFIX "[BVH]"
 
-BVH::BVH(CollidableWorld& c_world)
+BVH::BVH(CollidableWorld& c_world) : BVH(c_world, BuildParams{})
 {
-    // @Optimization Is there potential to parallelize BVH creation?
+}
+
+BVH::BVH(CollidableWorld& c_world, const BuildParams& params)
+    : build_params{ params }
+{
+    WallClock::time_point build_start_time = WallClock::now();
+
     bool leaf_creation_success = CreateLeaves(c_world);
 
     total_leaf_cnt = leaves.size() - 1; // Don't count dummy leaf entry
     Debug{} << PRINT_PREFIX << total_leaf_cnt << "leafs were constructed";
 
     // Need at least 2 leaves to construct BVH
-    if (!leaf_creation_success || total_leaf_cnt < 2) {
+    if (!leaf_creation_success || total_leaf_cnt < 2
+            || total_leaf_cnt > MAX_LEAF_IDX) {
         // This is not a fatal error, the user is still able to enter the map.
         Debug{} << PRINT_PREFIX << "WARNING: BVH tree was not created since "
             "something went wrong during leaf creation. BVH traces will do nothing.";
         return; // nodes array is left empty, signaling BVH creation failure
     }
 
-    // Assuming every node has 2 children and each child is a node or a leaf
+    // Leaf trace costs are looked up many times while building and hashing,
+    // compute them only once
+    leaf_trace_costs.resize(leaves.size(), 0); // Dummy leaf has no cost
+    for (size_t i = 1; i < leaves.size(); i++)
+        leaf_trace_costs[i] = CalcLeafTraceCost(leaves[i], c_world);
+
+    // Try to skip building by loading the nodes of a previous build
+    uint64_t cache_key = 0;
+    std::string cache_file_path = "";
+    if (!build_params.cache_dir_path.empty()) {
+        cache_key = CalcCacheKey();
+        cache_file_path = GetCacheFilePath(cache_key);
+        if (LoadFromCacheFile(cache_file_path, cache_key)) {
+            was_loaded_from_cache = true;
+            MarkSharedLeaves();
+            using std::chrono::duration_cast;
+            using std::chrono::milliseconds;
+            Debug{} << PRINT_PREFIX << "Loaded" << GetNodeCount() << "nodes from"
+                << "cache file within" << duration_cast<milliseconds>(
+                    WallClock::now() - build_start_time).count() / 1000.0f
+                << "seconds, tree depth is" << tree_depth;
+            return;
+        }
+    }
+
+    // Assuming every node has 2 children and each child is a node or a leaf.
+    // (Spatial splits create additional nodes.)
     const size_t final_node_cnt = total_leaf_cnt - 1;
-    nodes.clear();
-    nodes.reserve(final_node_cnt);
+    std::vector<BuildNode> build_nodes;
+    build_nodes.reserve(final_node_cnt);
 
     // Create leaf reference arrays for each axis.
     // All 3 contain the index to every leaf.
@@ -69,75 +112,168 @@ BVH::BVH(CollidableWorld& c_world)
     }
 
     // Create root node
-    nodes.push_back({});
+    build_nodes.push_back({});
     const uint32_t root_node_idx = 0;
-    Node& root_node = nodes[root_node_idx];
+    BuildNode& root_node = build_nodes[root_node_idx];
     // Calc all-encompassing AABB
     CalcAabbOfBvhLeaves(leaf_refs[0], &root_node.mins, &root_node.maxs);
 
-    // Sort leafs in the X, Y and Z leaf reference arrays along their respective
-    // axis
-    Debug{} << PRINT_PREFIX << "Initial leaf sort along axes...";
-    for (int axis = 0; axis < 3; axis++) {
-        std::sort(leaf_refs[axis].begin(), leaf_refs[axis].end(),
-            [this, axis](uint32_t a, uint32_t b) { // Returns true if a is ordered before b
-                // Calculate a's and b's centroid position along the axis
-                const Leaf& a_leaf = this->leaves[a];
-                const Leaf& b_leaf = this->leaves[b];
-                float a_axis_pos = 0.5f * (a_leaf.mins[axis] + a_leaf.maxs[axis]);
-                float b_axis_pos = 0.5f * (b_leaf.mins[axis] + b_leaf.maxs[axis]);
-                return a_axis_pos < b_axis_pos;
+    const size_t thread_cnt = GetBuildThreadCount();
+
+    if (build_params.split_method == BuildParams::SplitMethod::SpatialSah) {
+        // Spatial splits don't use presorted leaf reference arrays
+        CreateNodeHierarchySpatial(build_nodes);
+    }
+    else {
+        // Sort leafs in the X, Y and Z leaf reference arrays along their
+        // respective axis
+        Debug{} << PRINT_PREFIX << "Initial leaf sort along axes...";
+        auto SortLeafRefsAlongAxis = [this, &leaf_refs](int axis) {
+            std::sort(leaf_refs[axis].begin(), leaf_refs[axis].end(),
+                [this, axis](uint32_t a, uint32_t b) { // Returns true if a is ordered before b
+                    // Calculate a's and b's centroid position along the axis
+                    const Leaf& a_leaf = this->leaves[a];
+                    const Leaf& b_leaf = this->leaves[b];
+                    float a_axis_pos = 0.5f * (a_leaf.mins[axis] + a_leaf.maxs[axis]);
+                    float b_axis_pos = 0.5f * (b_leaf.mins[axis] + b_leaf.maxs[axis]);
+                    return a_axis_pos < b_axis_pos;
+                }
+            );
+        };
+        if (thread_cnt >= 3) {
+            // Sorting of each axis is independent, sort all 3 axes concurrently
+            std::thread y_sort_thread(SortLeafRefsAlongAxis, 1);
+            std::thread z_sort_thread(SortLeafRefsAlongAxis, 2);
+            SortLeafRefsAlongAxis(0);
+            y_sort_thread.join();
+            z_sort_thread.join();
+        }
+        else {
+            for (int axis = 0; axis < 3; axis++)
+                SortLeafRefsAlongAxis(axis);
+        }
+
+        // Assign the entire leaf range to the root node
+        UnsplitNode unsplit_root_node = {
+            .build_node_idx = root_node_idx,
+            .depth = 1,
+            .leaf_refs_sorted_along_axis = {
+                std::span<uint32_t>{ leaf_refs[0].begin(), total_leaf_cnt }, // along X axis
+                std::span<uint32_t>{ leaf_refs[1].begin(), total_leaf_cnt }, // along Y axis
+                std::span<uint32_t>{ leaf_refs[2].begin(), total_leaf_cnt }, // along Z axis
             }
-        );
+        };
+
+        // Build BVH by iteratively splitting nodes down to the BVH leaves
+        if (thread_cnt > 1 && total_leaf_cnt > MT_SUBTREE_MAX_LEAF_CNT)
+            CreateNodeHierarchyMultithreaded(build_nodes, unsplit_root_node,
+                                             thread_cnt);
+        else
+            CreateNodeHierarchy(build_nodes, unsplit_root_node);
     }
 
-    // Assign the entire leaf range to the root node
-    std::span<uint32_t> leaf_refs_sorted_along_axis[3] = {
-        std::span<uint32_t>{ leaf_refs[0].begin(), total_leaf_cnt }, // along X axis
-        std::span<uint32_t>{ leaf_refs[1].begin(), total_leaf_cnt }, // along Y axis
-        std::span<uint32_t>{ leaf_refs[2].begin(), total_leaf_cnt }, // along Z axis
-    };
+    // Improve the top-down built tree by rearranging small treelets
+    if (build_params.treelet_optimization_passes > 0)
+        OptimizeTreelets(build_nodes);
 
-    // Build BVH by iteratively splitting nodes down to the BVH leaves
-    CreateNodeHierarchy(root_node_idx, leaf_refs_sorted_along_axis, c_world);
+    // Rearrange nodes into their final, compact depth-first layout
+    CreateCompactNodes(build_nodes);
 
     // Set information in each node about the leaves they contain.
     SetNodeContentsInfo();
 
-    Debug{} << PRINT_PREFIX << nodes.size() << "nodes were constructed";
+    // The 4-wide BVH is collapsed from the non-quantized nodes
+    if (build_params.collapse_to_bvh4) {
+        CreateBvh4Nodes();
+        Debug{} << PRINT_PREFIX << "Collapsed into" << nodes4.size() << "4-wide nodes";
+    }
+
+    if (build_params.quantize_node_aabbs)
+        QuantizeNodes();
+
+    MarkSharedLeaves();
+
+    Debug{} << PRINT_PREFIX << GetNodeCount() << "nodes were constructed, "
+        "tree depth is" << tree_depth << ", node memory:"
+        << GetNodeMemoryUsage() / 1024 << "KiB";
+    assert(tree_depth <= MAX_TREE_DEPTH);
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    const char* split_method_str = "exact SAH";
+    if (build_params.split_method == BuildParams::SplitMethod::BinnedSah)
+        split_method_str = "binned SAH";
+    else if (build_params.split_method == BuildParams::SplitMethod::SpatialSah)
+        split_method_str = "spatial SAH";
+    Debug{} << PRINT_PREFIX << "Built within" << duration_cast<milliseconds>(
+        WallClock::now() - build_start_time).count() / 1000.0f << "seconds using"
+        << split_method_str << "and" << thread_cnt << "thread(s), SAH cost:"
+        << CalcSahCost();
+
+    if (!cache_file_path.empty())
+        SaveToCacheFile(cache_file_path, cache_key);
 }
 
-bool BVH::WasConstructedSuccessfully()
+bool BVH::WasConstructedSuccessfully() const
 {
     // A valid BVH must have at least one node and 2 leaves.
-    return nodes.size() != 0 && total_leaf_cnt >= 2;
+    return GetNodeCount() != 0 && total_leaf_cnt >= 2;
+}
+
+bool BVH::WasLoadedFromCache() const
+{
+    return was_loaded_from_cache;
 }
 
-void BVH::DoTrace(Trace* trace, CollidableWorld& c_world)
+void BVH::PrepareTraceContext(TraceContext& ctx) const
+{
+    if (ctx.leaf_visit_marks.size() < leaves.size())
+        ctx.leaf_visit_marks.resize(leaves.size(), 0);
+}
+
+void BVH::DoTrace(Trace* trace, CollidableWorld& c_world,
+                  TraceContext& ctx) const
 {
     ZoneScoped;
 
-    // @Optimization To improve BVH traversal time, build the BVH in a compact
-    //               and cache-friendly representation. E.g.: Nodes and leafs
-    //               can be stored in a single array, with *depth-first order*.
-    //               Note: After changing layout of the nodes array, take a look
-    //                     at possibly optimizing BVH::SetNodeContentsInfo().
+    // @Optimization To further improve cache-friendliness, leafs could be
+    //               stored in the same array as the depth-first ordered nodes.
 
     if (!WasConstructedSuccessfully())
         return; // Can't trace against non-existent BVH
-    const Node& root_node = nodes[0];
 
     if (0) { // Debugging switch
         // Trace against all leaves for debugging purposes
         for (size_t i = 1; i < leaves.size(); i++)
-            DoTraceAgainstLeaf(trace, leaves[i], c_world);
+            if (GetTraceLeafTypeFlags(*trace) & GetLeafTypeFlags(leaves[i]))
+                DoTraceAgainstLeaf(trace, leaves[i], c_world, ctx);
         return;
     }
 
+    if (!nodes4.empty())
+        DoTraceBvh4(trace, c_world, ctx);
+    else if (build_params.quantize_node_aabbs)
+        DoTraceImpl(trace, quantized_nodes, c_world, ctx);
+    else
+        DoTraceImpl(trace, nodes, c_world, ctx);
+}
+
+template<class NodeType>
+void BVH::DoTraceImpl(Trace* trace, const std::vector<NodeType>& node_array,
+                      CollidableWorld& c_world, TraceContext& ctx) const
+{
+    // Subtrees without any leaf types the trace collides with are skipped
+    const uint32_t collidable_types = GetTraceLeafTypeFlags(*trace);
+    if (!(node_array[0].contained_leaf_types & collidable_types))
+        return;
+
+    Vector3 root_node_mins, root_node_maxs;
+    GetNodeAabb(node_array[0], &root_node_mins, &root_node_maxs);
+
     // @Optimization We should probably assume that the root node is always hit,
     //               tracing outside the world's bounds should never happen.
     float root_node_aabb_hit_fraction;
-    bool is_root_hit = trace->HitsAabb(root_node.mins, root_node.maxs,
+    bool is_root_hit = trace->HitsAabb(root_node_mins, root_node_maxs,
                                        &root_node_aabb_hit_fraction);
     if (!is_root_hit)
         return;
@@ -148,18 +284,27 @@ void BVH::DoTrace(Trace* trace, CollidableWorld& c_world)
         int32_t node_or_leaf_idx; // See Node struct for details
         float aabb_hit_fraction; // When trace hits this leaf's/node's AABB
     };
-    std::stack<TraversalCandidate> traversal_candidates;
 
-    TraversalCandidate root_candidate = {
+    // Fixed-size traversal stack, avoiding any heap allocations.
+    // Depth-first traversal never has more than (tree_depth + 1) candidates on
+    // the stack, and BVH construction ensures that tree_depth doesn't exceed
+    // MAX_TREE_DEPTH.
+    TraversalCandidate traversal_candidates[MAX_TREE_DEPTH + 1];
+    size_t traversal_candidate_cnt = 0;
+    assert(tree_depth <= MAX_TREE_DEPTH);
+
+    traversal_candidates[traversal_candidate_cnt++] = {
         .node_or_leaf_idx = 0, // Root node idx
         .aabb_hit_fraction = root_node_aabb_hit_fraction
     };
-    traversal_candidates.push(root_candidate);
+
+    // Shared leaves can be reached multiple times, only trace them once
+    BeginSharedLeafTracking(ctx);
 
     // Efficiently traverse the BVH tree
-    while (!traversal_candidates.empty()) {
-        TraversalCandidate candidate = traversal_candidates.top();
-        traversal_candidates.pop();
+    while (traversal_candidate_cnt > 0) {
+        TraversalCandidate candidate =
+            traversal_candidates[--traversal_candidate_cnt];
 
         // Check if we can skip candidates
         if (trace->info.isswept) {
@@ -177,77 +322,567 @@ void BVH::DoTrace(Trace* trace, CollidableWorld& c_world)
         if (candidate.node_or_leaf_idx < 0) { // If candidate is a leaf
             int32_t leaf_idx = -candidate.node_or_leaf_idx;
             const Leaf& leaf = leaves[leaf_idx];
+            if (leaf.is_shared && CheckAndMarkSharedLeafVisit(ctx, leaf_idx))
+                continue;
 
             // @Optimization Make sure CDispCollTree code doesn't do the same
             //               AABB check that we already do.
-            coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, leaf_idx);
-            DoTraceAgainstLeaf(trace, leaf, c_world);
-            coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, leaf_idx);
+            DoTraceAgainstLeaf(trace, leaf, c_world, ctx);
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugFinish_BroadPhaseLeafHit();
         }
         else { // If candidate is a node
-            const Node& parent_node = nodes[candidate.node_or_leaf_idx];
-
-            // New candidate entries of children whose AABB is hit by the trace
-            std::vector<TraversalCandidate> child_candidates;
+            const int32_t node_idx = candidate.node_or_leaf_idx;
+            const int32_t child_indices[2] = {
+                GetLeftChildIdx(node_array, node_idx),
+                node_array[node_idx].child_r
+            };
 
             // Trace against AABBs of candidate's children
-            for (int32_t child_idx : { parent_node.child_l, parent_node.child_r }) {
-                Vector3 child_mins;
-                Vector3 child_maxs;
-                if (child_idx < 0) { // If child is a leaf
+            bool  is_child_aabb_hit      [2];
+            float child_aabb_hit_fraction[2];
+            for (int i = 0; i < 2; i++) {
+                int32_t child_idx = child_indices[i];
+                if (!(GetChildLeafTypes(node_array, child_idx) & collidable_types)) {
+                    is_child_aabb_hit[i] = false;
+                    continue;
+                }
+
+                Vector3 child_mins, child_maxs;
+                if (child_idx < 0) {
                     child_mins = leaves[-child_idx].mins;
                     child_maxs = leaves[-child_idx].maxs;
                 }
-                else { // If child is a node
-                    child_mins = nodes[child_idx].mins;
-                    child_maxs = nodes[child_idx].maxs;
+                else {
+                    GetNodeAabb(node_array[child_idx], &child_mins, &child_maxs);
                 }
 
                 // @Optimization Doing an intersection between the AABB that
                 //               encloses the trace sweep and the AABB of BVH
                 //               nodes/leaves is possibly cheaper than doing an
                 //               accurate sweep against the AABB of BVH nodes/leaves.
-                float child_aabb_hit_fraction;
-                bool is_child_aabb_hit = trace->HitsAabb(child_mins, child_maxs,
-                                                         &child_aabb_hit_fraction);
-
-                if (is_child_aabb_hit) {
-                    child_candidates.push_back({
-                        .node_or_leaf_idx = child_idx,
-                        .aabb_hit_fraction = child_aabb_hit_fraction
-                    });
-                }
+                is_child_aabb_hit[i] = trace->HitsAabb(child_mins, child_maxs,
+                                                       &child_aabb_hit_fraction[i]);
             }
 
             // The child with the smaller hit fraction is traversed before the other.
             // This enables us to potentially discard the child that's further
             // away at a later point in time.
-            if (child_candidates.size() == 2) {
-                if (child_candidates[0].aabb_hit_fraction <
-                    child_candidates[1].aabb_hit_fraction) {
-                    traversal_candidates.push(child_candidates[1]);
-                    traversal_candidates.push(child_candidates[0]); // <- Closer child on top of the stack
-                }
-                else {
-                    traversal_candidates.push(child_candidates[0]);
-                    traversal_candidates.push(child_candidates[1]); // <- Closer child on top of the stack
+            if (is_child_aabb_hit[0] && is_child_aabb_hit[1]) {
+                // Index of child that gets traversed first. On equal hit
+                // fractions, the right child is traversed first.
+                int near = child_aabb_hit_fraction[0] < child_aabb_hit_fraction[1] ? 0 : 1;
+                int far = 1 - near;
+                traversal_candidates[traversal_candidate_cnt++] = {
+                    .node_or_leaf_idx  = child_indices[far],
+                    .aabb_hit_fraction = child_aabb_hit_fraction[far]
+                };
+                traversal_candidates[traversal_candidate_cnt++] = { // <- Closer child on top of the stack
+                    .node_or_leaf_idx  = child_indices[near],
+                    .aabb_hit_fraction = child_aabb_hit_fraction[near]
+                };
+            }
+            else { // One or both children did not get hit
+                for (int i = 0; i < 2; i++) {
+                    if (is_child_aabb_hit[i]) {
+                        traversal_candidates[traversal_candidate_cnt++] = {
+                            .node_or_leaf_idx  = child_indices[i],
+                            .aabb_hit_fraction = child_aabb_hit_fraction[i]
+                        };
+                    }
                 }
             }
-            else if (child_candidates.size() == 1) { // One child did not get hit
-                traversal_candidates.push(child_candidates[0]);
+            assert(traversal_candidate_cnt <= tree_depth + 1);
+        }
+    }
+}
+
+void BVH::DoTraceBvh4(Trace* trace, CollidableWorld& c_world,
+                      TraceContext& ctx) const
+{
+    // Same traversal as DoTraceImpl(), but with up to 4 children per node.
+    const uint32_t collidable_types = GetTraceLeafTypeFlags(*trace);
+
+    struct TraversalCandidate {
+        int32_t node_or_leaf_idx; // See Node4 struct for details
+        float aabb_hit_fraction; // When trace hits this leaf's/node's AABB
+    };
+
+    // Each traversed node replaces its candidate with up to 4 new candidates,
+    // so the stack never holds more than (3 * tree_depth + 1) candidates.
+    // (The 4-wide BVH's depth can't exceed the binary BVH's depth.)
+    TraversalCandidate traversal_candidates[3 * MAX_TREE_DEPTH + 1];
+    size_t traversal_candidate_cnt = 0;
+    assert(tree_depth <= MAX_TREE_DEPTH);
+
+    // The root node has no AABB of its own, its children's AABBs get tested
+    traversal_candidates[traversal_candidate_cnt++] = {
+        .node_or_leaf_idx = 0, // Root node idx
+        .aabb_hit_fraction = 0.0f
+    };
+
+    // Shared leaves can be reached multiple times, only trace them once
+    BeginSharedLeafTracking(ctx);
+
+    while (traversal_candidate_cnt > 0) {
+        TraversalCandidate candidate =
+            traversal_candidates[--traversal_candidate_cnt];
+
+        // Check if we can skip candidates, see DoTraceImpl()
+        if (trace->info.isswept) {
+            if (trace->results.fraction < candidate.aabb_hit_fraction)
+                continue;
+        } else {
+            if (trace->results.DidHit())
+                break;
+        }
+
+        if (candidate.node_or_leaf_idx < 0) { // If candidate is a leaf
+            int32_t leaf_idx = -candidate.node_or_leaf_idx;
+            const Leaf& leaf = leaves[leaf_idx];
+            if (leaf.is_shared && CheckAndMarkSharedLeafVisit(ctx, leaf_idx))
+                continue;
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, leaf_idx);
+            DoTraceAgainstLeaf(trace, leaf, c_world, ctx);
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+            continue;
+        }
+
+        // If candidate is a node: Trace against AABBs of all its children
+        const Node4& node = nodes4[candidate.node_or_leaf_idx];
+        float child_aabb_hit_fractions[4];
+        unsigned int hit_mask = HitsFourAabbs(*trace, node, child_aabb_hit_fractions);
+        hit_mask &= (1u << node.child_cnt) - 1; // Ignore unused child slots
+        for (unsigned int i = 0; i < node.child_cnt; i++) // Ignore uncollidable children
+            if (!(node.child_leaf_types[i] & collidable_types))
+                hit_mask &= ~(1u << i);
+
+        // Sort hit children by descending hit fraction, so that the closest
+        // child ends up on top of the stack and is traversed first.
+        TraversalCandidate hit_children[4];
+        size_t hit_child_cnt = 0;
+        for (unsigned int i = 0; i < 4; i++) {
+            if (!(hit_mask & (1u << i)))
+                continue;
+            TraversalCandidate child = {
+                .node_or_leaf_idx  = node.children[i],
+                .aabb_hit_fraction = child_aabb_hit_fractions[i]
+            };
+            size_t insert_pos = hit_child_cnt++;
+            while (insert_pos > 0 &&
+                    hit_children[insert_pos - 1].aabb_hit_fraction < child.aabb_hit_fraction) {
+                hit_children[insert_pos] = hit_children[insert_pos - 1];
+                insert_pos--;
+            }
+            hit_children[insert_pos] = child;
+        }
+        for (size_t i = 0; i < hit_child_cnt; i++)
+            traversal_candidates[traversal_candidate_cnt++] = hit_children[i];
+        assert(traversal_candidate_cnt <= 3 * tree_depth + 1);
+    }
+}
+
+unsigned int BVH::HitsFourAabbs(const Trace& trace, const Node4& node,
+                                float hit_fractions[4])
+{
+    // Same calculations as Trace::HitsAabb(), but for 4 AABBs at once. This is
+    // how source-sdk-2013's IntersectRayWithFourBoxes() originally worked.
+    // Unswept traces take the same point-in-box path as in
+    // Trace::HitsAabbUnswept().
+#if defined(TRACE_USE_SSE)
+    if (!trace.info.isswept) {
+        __m128 is_outside = _mm_setzero_ps();
+        for (int axis = 0; axis < 3; axis++) {
+            const __m128 start   = _mm_set1_ps(trace.info.startpos[axis]);
+            const __m128 extents = _mm_set1_ps(trace.info.extents [axis]);
+            __m128 hit_mins = _mm_load_ps(node.child_mins[axis]);
+            __m128 hit_maxs = _mm_load_ps(node.child_maxs[axis]);
+            hit_mins = _mm_sub_ps(_mm_sub_ps(hit_mins, start), extents);
+            hit_maxs = _mm_add_ps(_mm_sub_ps(hit_maxs, start), extents);
+            is_outside = _mm_or_ps(is_outside,
+                _mm_or_ps(_mm_cmpgt_ps(hit_mins, _mm_setzero_ps()),
+                          _mm_cmplt_ps(hit_maxs, _mm_setzero_ps())));
+        }
+        _mm_storeu_ps(hit_fractions, _mm_setzero_ps());
+        return ~(unsigned int)_mm_movemask_ps(is_outside) & 0xFu;
+    }
+
+    __m128 entry_t = _mm_setzero_ps();
+    __m128 exit_t  = _mm_setzero_ps();
+    for (int axis = 0; axis < 3; axis++) {
+        const __m128 start    = _mm_set1_ps(trace.info.startpos[axis]);
+        const __m128 extents  = _mm_set1_ps(trace.info.extents [axis]);
+        const __m128 invdelta = _mm_set1_ps(trace.info.invdelta[axis]);
+        __m128 hit_mins = _mm_load_ps(node.child_mins[axis]);
+        __m128 hit_maxs = _mm_load_ps(node.child_maxs[axis]);
+        hit_mins = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(hit_mins, start), extents), invdelta);
+        hit_maxs = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(hit_maxs, start), extents), invdelta);
+        __m128 axis_entry_t = _mm_min_ps(hit_mins, hit_maxs);
+        __m128 axis_exit_t  = _mm_max_ps(hit_mins, hit_maxs);
+        entry_t = axis == 0 ? axis_entry_t : _mm_max_ps(entry_t, axis_entry_t);
+        exit_t  = axis == 0 ? axis_exit_t  : _mm_min_ps(exit_t,  axis_exit_t);
+    }
+    entry_t = _mm_max_ps(entry_t, _mm_setzero_ps());
+    exit_t  = _mm_min_ps(exit_t,  _mm_set1_ps(1.0f));
+    _mm_storeu_ps(hit_fractions, entry_t);
+    return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(entry_t, exit_t));
+#elif defined(TRACE_USE_NEON)
+    if (!trace.info.isswept) {
+        uint32x4_t is_outside = vdupq_n_u32(0);
+        for (int axis = 0; axis < 3; axis++) {
+            const float32x4_t start   = vdupq_n_f32(trace.info.startpos[axis]);
+            const float32x4_t extents = vdupq_n_f32(trace.info.extents [axis]);
+            float32x4_t hit_mins = vld1q_f32(node.child_mins[axis]);
+            float32x4_t hit_maxs = vld1q_f32(node.child_maxs[axis]);
+            hit_mins = vsubq_f32(vsubq_f32(hit_mins, start), extents);
+            hit_maxs = vaddq_f32(vsubq_f32(hit_maxs, start), extents);
+            is_outside = vorrq_u32(is_outside,
+                vorrq_u32(vcgtq_f32(hit_mins, vdupq_n_f32(0.0f)),
+                          vcltq_f32(hit_maxs, vdupq_n_f32(0.0f))));
+        }
+        vst1q_f32(hit_fractions, vdupq_n_f32(0.0f));
+        uint32x4_t is_hit = vmvnq_u32(is_outside);
+        return (vgetq_lane_u32(is_hit, 0) & 1u) | (vgetq_lane_u32(is_hit, 1) & 2u)
+             | (vgetq_lane_u32(is_hit, 2) & 4u) | (vgetq_lane_u32(is_hit, 3) & 8u);
+    }
+
+    float32x4_t entry_t = vdupq_n_f32(0.0f);
+    float32x4_t exit_t  = vdupq_n_f32(0.0f);
+    for (int axis = 0; axis < 3; axis++) {
+        const float32x4_t start    = vdupq_n_f32(trace.info.startpos[axis]);
+        const float32x4_t extents  = vdupq_n_f32(trace.info.extents [axis]);
+        const float32x4_t invdelta = vdupq_n_f32(trace.info.invdelta[axis]);
+        float32x4_t hit_mins = vld1q_f32(node.child_mins[axis]);
+        float32x4_t hit_maxs = vld1q_f32(node.child_maxs[axis]);
+        hit_mins = vmulq_f32(vsubq_f32(vsubq_f32(hit_mins, start), extents), invdelta);
+        hit_maxs = vmulq_f32(vaddq_f32(vsubq_f32(hit_maxs, start), extents), invdelta);
+        float32x4_t axis_entry_t = vminq_f32(hit_mins, hit_maxs);
+        float32x4_t axis_exit_t  = vmaxq_f32(hit_mins, hit_maxs);
+        entry_t = axis == 0 ? axis_entry_t : vmaxq_f32(entry_t, axis_entry_t);
+        exit_t  = axis == 0 ? axis_exit_t  : vminq_f32(exit_t,  axis_exit_t);
+    }
+    entry_t = vmaxq_f32(entry_t, vdupq_n_f32(0.0f));
+    exit_t  = vminq_f32(exit_t,  vdupq_n_f32(1.0f));
+    vst1q_f32(hit_fractions, entry_t);
+    uint32x4_t is_hit = vcleq_f32(entry_t, exit_t);
+    return (vgetq_lane_u32(is_hit, 0) & 1u) | (vgetq_lane_u32(is_hit, 1) & 2u)
+         | (vgetq_lane_u32(is_hit, 2) & 4u) | (vgetq_lane_u32(is_hit, 3) & 8u);
+#else
+    unsigned int hit_mask = 0;
+    for (int i = 0; i < 4; i++) {
+        Vector3 mins = { node.child_mins[0][i], node.child_mins[1][i], node.child_mins[2][i] };
+        Vector3 maxs = { node.child_maxs[0][i], node.child_maxs[1][i], node.child_maxs[2][i] };
+        if (trace.HitsAabb(mins, maxs, &hit_fractions[i]))
+            hit_mask |= 1u << i;
+    }
+    return hit_mask;
+#endif
+}
+
+float BVH::CalcSahCost() const
+{
+    if (!WasConstructedSuccessfully())
+        return 0.0f;
+
+    Vector3 root_mins, root_maxs;
+    GetNodeAabb(0, &root_mins, &root_maxs);
+    float root_aabb_surface_area = CalcAabbSurfaceArea(root_mins, root_maxs);
+
+    // Sum costs up in double precision, there might be many small summands
+    double cost = 0.0;
+
+    // Each traversed node tests its two children's AABBs
+    const double aabb_test_cost = build_params.trace_cost_model.aabb_test;
+    for (size_t i = 0; i < GetNodeCount(); i++) {
+        Vector3 node_mins, node_maxs;
+        GetNodeAabb((int32_t)i, &node_mins, &node_maxs);
+        float node_hit_likelihood =
+            CalcAabbSurfaceArea(node_mins, node_maxs) / root_aabb_surface_area;
+        cost += (double)node_hit_likelihood * 2.0 * aabb_test_cost;
+    }
+
+    // Each leaf whose AABB is hit gets traced against
+    for (size_t i = 1; i < leaves.size(); i++) { // Skip dummy leaf at index 0
+        const Leaf& leaf = leaves[i];
+        float leaf_hit_likelihood =
+            CalcAabbSurfaceArea(leaf.mins, leaf.maxs) / root_aabb_surface_area;
+        double leaf_cost = 1e-3 * (double)leaf_trace_costs[i]; // In ns
+        cost += (double)leaf_hit_likelihood * leaf_cost;
+    }
+    return (float)cost;
+}
+
+const char* BVH::GetLeafTypeName(size_t leaf_type)
+{
+    switch (leaf_type) {
+        case Leaf::Type::Brush:        return "brush";
+        case Leaf::Type::Displacement: return "displacement";
+        case Leaf::Type::StaticProp:   return "static_prop";
+        case Leaf::Type::DynamicProp:  return "dynamic_prop";
+        case Leaf::Type::FuncBrush:    return "func_brush";
+    }
+    assert(false && "Unknown leaf type");
+    return "unknown";
+}
+
+BVH::QualityStats BVH::CalcQualityStats(size_t subtree_depth) const
+{
+    QualityStats stats;
+    if (!WasConstructedSuccessfully())
+        return stats;
+
+    stats.node_cnt          = GetNodeCount();
+    stats.leaf_cnt          = total_leaf_cnt;
+    stats.tree_depth        = tree_depth;
+    stats.node_memory_usage = GetNodeMemoryUsage();
+    stats.sah_cost          = CalcSahCost();
+    stats.leaf_depth_histogram.resize(tree_depth + 1, 0);
+
+    Vector3 root_mins, root_maxs;
+    GetNodeAabb(0, &root_mins, &root_maxs);
+    float root_aabb_surface_area = CalcAabbSurfaceArea(root_mins, root_maxs);
+
+    struct StackEntry {
+        int32_t node_idx;
+        size_t depth;       // Number of nodes from the root down to this node
+        size_t subtree_idx; // Index into stats.subtrees, SIZE_MAX if none
+    };
+    std::vector<StackEntry> node_stack = { { 0, 1, SIZE_MAX } };
+    double sibling_overlap = 0.0;
+    size_t leaf_depth_sum = 0;
+    while (!node_stack.empty()) {
+        StackEntry entry = node_stack.back();
+        node_stack.pop_back();
+
+        if (entry.depth == subtree_depth + 1) {
+            entry.subtree_idx = stats.subtrees.size();
+            QualityStats::Subtree& subtree = stats.subtrees.emplace_back();
+            GetNodeAabb(entry.node_idx, &subtree.mins, &subtree.maxs);
+        }
+        if (entry.subtree_idx != SIZE_MAX)
+            stats.subtrees[entry.subtree_idx].node_cnt++;
+
+        int32_t child_indices[2] = {
+            GetLeftChildIdx(entry.node_idx), GetRightChildIdx(entry.node_idx)
+        };
+
+        // Overlap of both children's AABBs
+        Vector3 child_mins[2], child_maxs[2];
+        for (int i = 0; i < 2; i++) {
+            if (child_indices[i] >= 0) {
+                GetNodeAabb(child_indices[i], &child_mins[i], &child_maxs[i]);
+            }
+            else {
+                child_mins[i] = leaves[-child_indices[i]].mins;
+                child_maxs[i] = leaves[-child_indices[i]].maxs;
+            }
+        }
+        if (AabbIntersectsAabb(child_mins[0], child_maxs[0], child_mins[1], child_maxs[1])) {
+            Vector3 node_mins, node_maxs;
+            GetNodeAabb(entry.node_idx, &node_mins, &node_maxs);
+            float overlap_area = CalcAabbSurfaceArea(
+                Math::max(child_mins[0], child_mins[1]),
+                Math::min(child_maxs[0], child_maxs[1]));
+            float node_area = CalcAabbSurfaceArea(node_mins, node_maxs);
+            sibling_overlap += overlap_area / root_aabb_surface_area;
+            if (node_area > 0.0f)
+                stats.max_sibling_overlap_ratio = Math::max(
+                    stats.max_sibling_overlap_ratio, overlap_area / node_area);
+        }
+
+        for (int i = 1; i >= 0; i--) { // Left child ends up on top of the stack
+            if (child_indices[i] >= 0) {
+                node_stack.push_back({
+                    .node_idx = child_indices[i],
+                    .depth = entry.depth + 1,
+                    .subtree_idx = entry.subtree_idx
+                });
+                continue;
+            }
+            const Leaf& leaf = leaves[-child_indices[i]];
+            stats.leaf_depth_histogram[entry.depth]++;
+            stats.leaf_ref_cnt++;
+            leaf_depth_sum += entry.depth;
+            if (entry.subtree_idx != SIZE_MAX) {
+                QualityStats::Subtree& subtree = stats.subtrees[entry.subtree_idx];
+                subtree.leaf_cnt++;
+                subtree.leaf_cnt_by_type[leaf.type]++;
             }
         }
     }
+    for (size_t i = 1; i < leaves.size(); i++) // Skip dummy leaf at index 0
+        stats.leaf_cnt_by_type[leaves[i].type]++;
+    stats.sibling_overlap = (float)sibling_overlap;
+    stats.mean_leaf_depth = (float)leaf_depth_sum / stats.leaf_ref_cnt;
+    return stats;
+}
+
+size_t BVH::GetLeavesOverlappingAabb(const Vector3& mins, const Vector3& maxs,
+    std::span<uint32_t> dest_leaf_indices, TraceContext& ctx,
+    uint32_t collidable_types) const
+{
+    ZoneScoped;
+
+    if (!WasConstructedSuccessfully())
+        return 0;
+    if (build_params.quantize_node_aabbs)
+        return GetLeavesOverlappingAabbImpl(quantized_nodes, mins, maxs,
+                                            dest_leaf_indices, ctx, collidable_types);
+    else
+        return GetLeavesOverlappingAabbImpl(nodes, mins, maxs,
+                                            dest_leaf_indices, ctx, collidable_types);
+}
+
+template<class NodeType>
+size_t BVH::GetLeavesOverlappingAabbImpl(const std::vector<NodeType>& node_array,
+    const Vector3& mins, const Vector3& maxs,
+    std::span<uint32_t> dest_leaf_indices, TraceContext& ctx,
+    uint32_t collidable_types) const
+{
+    size_t overlapping_leaf_cnt = 0;
+
+    // Shared leaves can be reached multiple times, only report them once
+    BeginSharedLeafTracking(ctx);
+
+    // Fixed-size traversal stack, see VisitAabbsContainingPoint()
+    int32_t node_stack[MAX_TREE_DEPTH + 1];
+    size_t node_stack_cnt = 0;
+    assert(tree_depth <= MAX_TREE_DEPTH);
+
+    if (node_array[0].contained_leaf_types & collidable_types)
+        node_stack[node_stack_cnt++] = 0; // Root node idx
+    while (node_stack_cnt > 0) {
+        const int32_t node_idx = node_stack[--node_stack_cnt];
+        Vector3 node_mins, node_maxs;
+        GetNodeAabb(node_array[node_idx], &node_mins, &node_maxs);
+        if (!AabbIntersectsAabb(mins, maxs, node_mins, node_maxs))
+            continue;
+
+        const int32_t child_indices[2] = {
+            GetLeftChildIdx(node_array, node_idx),
+            node_array[node_idx].child_r
+        };
+        for (int32_t child_idx : child_indices) {
+            if (child_idx >= 0)
+                continue;
+            const Leaf& leaf = leaves[-child_idx];
+            if (!(collidable_types & GetLeafTypeFlags(leaf)))
+                continue;
+            if (!AabbIntersectsAabb(mins, maxs, leaf.mins, leaf.maxs))
+                continue;
+            if (leaf.is_shared && CheckAndMarkSharedLeafVisit(ctx, (uint32_t)-child_idx))
+                continue;
+            if (overlapping_leaf_cnt < dest_leaf_indices.size())
+                dest_leaf_indices[overlapping_leaf_cnt] = (uint32_t)-child_idx;
+            overlapping_leaf_cnt++;
+        }
+
+        // Push right child first, so that the left child is visited first
+        for (int i = 1; i >= 0; i--)
+            if (child_indices[i] >= 0 &&
+                    (node_array[child_indices[i]].contained_leaf_types & collidable_types))
+                node_stack[node_stack_cnt++] = child_indices[i];
+        assert(node_stack_cnt <= tree_depth + 1);
+    }
+    return overlapping_leaf_cnt;
 }
 
 void BVH::GetAabbsContainingPoint(const Vector3& pt,
     std::vector<Vector3>* aabb_mins_list,
-    std::vector<Vector3>* aabb_maxs_list)
+    std::vector<Vector3>* aabb_maxs_list) const
 {
     if (!WasConstructedSuccessfully())
         return;
-    const Node& root_node = nodes[0];
-    _GetAabbsContainingPoint_r(root_node, pt, aabb_mins_list, aabb_maxs_list);
+    auto AddAabb = [aabb_mins_list, aabb_maxs_list](const Vector3& mins,
+                                                    const Vector3& maxs) {
+        if (aabb_mins_list) aabb_mins_list->push_back(mins);
+        if (aabb_maxs_list) aabb_maxs_list->push_back(maxs);
+    };
+    std::vector<uint32_t> added_shared_leaves;
+    VisitAabbsContainingPoint(pt, AddAabb,
+        [this, &AddAabb, &added_shared_leaves](uint32_t leaf_idx) {
+            if (leaves[leaf_idx].is_shared) { // Only add shared leaves once
+                if (std::find(added_shared_leaves.begin(), added_shared_leaves.end(),
+                              leaf_idx) != added_shared_leaves.end())
+                    return;
+                added_shared_leaves.push_back(leaf_idx);
+            }
+            AddAabb(leaves[leaf_idx].mins, leaves[leaf_idx].maxs);
+        }
+    );
+}
+
+void BVH::GetLeavesContainingPoints(std::span<const Vector3> points,
+    std::vector<uint32_t>* dest_leaf_indices,
+    std::vector<size_t>* dest_point_offsets) const
+{
+    ZoneScoped;
+
+    dest_leaf_indices->clear();
+    dest_point_offsets->clear();
+    dest_point_offsets->reserve(points.size() + 1);
+    dest_point_offsets->push_back(0);
+    for (const Vector3& pt : points) {
+        // Shared leaves can be reached multiple times, only add them once.
+        // Only the leaves of the current point need to be searched.
+        size_t point_offset = dest_leaf_indices->size();
+        if (WasConstructedSuccessfully())
+            VisitAabbsContainingPoint(pt,
+                [](const Vector3&, const Vector3&) {},
+                [this, dest_leaf_indices, point_offset](uint32_t leaf_idx) {
+                    if (leaves[leaf_idx].is_shared && std::find(
+                            dest_leaf_indices->begin() + point_offset,
+                            dest_leaf_indices->end(), leaf_idx) != dest_leaf_indices->end())
+                        return;
+                    dest_leaf_indices->push_back(leaf_idx);
+                }
+            );
+        dest_point_offsets->push_back(dest_leaf_indices->size());
+    }
+}
+
+template<class NodeCallback, class LeafCallback>
+void BVH::VisitAabbsContainingPoint(const Vector3& pt,
+    NodeCallback on_node, LeafCallback on_leaf) const
+{
+    // Fixed-size traversal stack. Each level below the current node holds at
+    // most one pending right child, see DoTraceImpl().
+    int32_t node_stack[MAX_TREE_DEPTH + 1];
+    size_t node_stack_cnt = 0;
+    assert(tree_depth <= MAX_TREE_DEPTH);
+
+    node_stack[node_stack_cnt++] = 0; // Root node idx
+    while (node_stack_cnt > 0) {
+        const int32_t node_idx = node_stack[--node_stack_cnt];
+        Vector3 node_mins, node_maxs;
+        GetNodeAabb(node_idx, &node_mins, &node_maxs);
+        if (!IsPointInAabb(pt, node_mins, node_maxs))
+            continue;
+        on_node(node_mins, node_maxs);
+
+        const int32_t child_indices[2] = {
+            GetLeftChildIdx(node_idx),
+            GetRightChildIdx(node_idx)
+        };
+        for (int32_t child_idx : child_indices) {
+            if (child_idx >= 0)
+                continue;
+            const Leaf& leaf = leaves[-child_idx];
+            if (!IsPointInAabb(pt, leaf.mins, leaf.maxs))
+                continue;
+            on_leaf((uint32_t)-child_idx);
+        }
+
+        // Push right child first, so that the left child is visited first
+        for (int i = 1; i >= 0; i--)
+            if (child_indices[i] >= 0)
+                node_stack[node_stack_cnt++] = child_indices[i];
+        assert(node_stack_cnt <= tree_depth + 1);
+    }
 }
 
 bool BVH::IsPointInAabb(const Vector3& pt,
@@ -286,7 +921,7 @@ void BVH::CalcAabbOfBvhLeaves(std::span<const uint32_t> leaf_refs,
     if (aabb_maxs) *aabb_maxs = maxs;
 }
 
-uint64_t BVH::GetLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world)
+uint64_t BVH::CalcLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world) const
 {
     // Estimated computation time of tracing a leaf under the assumption that
     // the trace already hits that leaf's AABB.
@@ -297,43 +932,65 @@ uint64_t BVH::GetLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world)
     // floating-point type in order to ensure accuracy.
     // E.g.: Adding many small costs to a large cost sum can cause significant
     // inaccuracies when using floating-point types.
+    // Picoseconds keep enough precision for the cheapest leaves, while even
+    // millions of very expensive leaves can't overflow the sum.
 
-    // @Optimization Develop relative leaf trace cost heuristics and use them
-    //               here. Do they reduce total trace time?
     // @Optimization On leaf trace cost heuristics: Is it beneficial to estimate
     //               average or worst case trace cost? What exactly do we
-    //               optimize? Test both!
+    //               optimize? Test both! The trace cost model is currently
+    //               fitted to average trace durations.
+    float cost_ns = EstimateLeafTraceCost(leaf.type,
+        GetLeafTraceCostFactors(leaf, c_world), build_params.trace_cost_model);
+
+    // Leaves must never be free, the SAH relies on positive costs
+    return Math::max((uint64_t)(1000.0f * Math::max(cost_ns, 0.0f) + 0.5f), (uint64_t)1);
+}
+
+TraceCostModel::Factors BVH::GetLeafTraceCostFactors(const Leaf& leaf,
+                                                     CollidableWorld& c_world)
+{
     switch (leaf.type) {
-    case Leaf::Type::Brush:        return c_world.GetTraceCost_Brush       (leaf.brush_idx);
-    case Leaf::Type::Displacement: return c_world.GetTraceCost_Displacement(leaf.disp_coll_idx);
-    case Leaf::Type::FuncBrush:    return c_world.GetTraceCost_FuncBrush   (leaf.funcbrush_idx);
-    case Leaf::Type::StaticProp:   return c_world.GetTraceCost_StaticProp  (leaf.sprop_idx);
-    case Leaf::Type::DynamicProp:  return c_world.GetTraceCost_DynamicProp (leaf.dprop_idx);
+    case Leaf::Type::Brush:        return c_world.GetTraceCostFactors_Brush       (leaf.brush_idx);
+    case Leaf::Type::Displacement: return c_world.GetTraceCostFactors_Displacement(leaf.disp_coll_idx);
+    case Leaf::Type::FuncBrush:    return c_world.GetTraceCostFactors_FuncBrush   (leaf.funcbrush_idx);
+    case Leaf::Type::StaticProp:   return c_world.GetTraceCostFactors_StaticProp  (leaf.sprop_idx);
+    case Leaf::Type::DynamicProp:  return c_world.GetTraceCostFactors_DynamicProp (leaf.dprop_idx);
     default: // Unknown type
         assert(false && "Unknown Leaf type. Did you forget to add a switch case?");
-        return 1;
+        return {};
     }
 }
 
-BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_split,
-    std::span<uint32_t> leaf_refs_sorted_along_axis[3],
-    CollidableWorld& c_world) const
+float BVH::EstimateLeafTraceCost(Leaf::Type type,
+    const TraceCostModel::Factors& factors, const TraceCostModel& model)
+{
+    switch (type) {
+    case Leaf::Type::Brush:
+        return model.brush_base + model.brush_per_side * (float)factors.side_cnt;
+    case Leaf::Type::Displacement:
+        return model.disp_by_power[Math::min(factors.disp_power, (uint32_t)4)];
+    case Leaf::Type::FuncBrush:
+        return model.func_brush_base + model.func_brush_per_side * (float)factors.side_cnt;
+    case Leaf::Type::StaticProp:
+    case Leaf::Type::DynamicProp:
+        return model.xprop_base
+            + model.xprop_per_section * (float)factors.section_cnt
+            + model.xprop_per_plane   * (float)factors.plane_cnt;
+    default: // Unknown type
+        assert(false && "Unknown Leaf type. Did you forget to add a switch case?");
+        return 1.0f;
+    }
+}
+
+BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const BuildNode& node_to_split,
+    std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const
 {
     const size_t leaf_cnt = leaf_refs_sorted_along_axis[0].size();
     assert(leaf_cnt >= 2);
 
 #if 0 //////// MEDIAN SPLIT METHOD
-    int largest_axis = 0; // Determine axis with the largest AABB extent
-    for (int current_axis = 1; current_axis < 3; current_axis++) {
-        float current_extent = node_to_split.maxs[current_axis] - node_to_split.mins[current_axis];
-        float largest_extent = node_to_split.maxs[largest_axis] - node_to_split.mins[largest_axis];
-        if (current_extent > largest_extent)
-            largest_axis = current_axis;
-    }
-    NodeSplitDetails split_details = {
-        .axis = largest_axis,
-        .elem_idx = leaf_cnt / 2, // Split on the middle element
-    };
+    NodeSplitDetails split_details =
+        DetermineMedianNodeSplit(node_to_split, leaf_cnt);
 #endif
 
 #if 1 //////// SURFACE AREA HEURISTIC (SAH) METHOD
@@ -361,10 +1018,9 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
     //     hull trace as a ray trace by bloating all AABBs by half the player's
     //     hull extents before calculating their surface areas.
     // @Optimization To reduce BVH creation time while slightly worsening BVH
-    //     quality: Use binning/bucket SAH, with whatever bin size. Instead of
-    //     computing SAH cost for a split at every leaf, compute SAH cost for a
-    //     split at every bin. Allegedly a good performance/quality compromise.
-    //     Another option is to perform SAH on only the largest axis, not all 3.
+    //     quality, perform SAH on only the largest axis, not all 3.
+
+    // @Optimization Binned SAH was implemented in DetermineBinnedNodeSplit().
 
     float node_aabb_surface_area =
         CalcAabbSurfaceArea(node_to_split.mins, node_to_split.maxs);
@@ -376,7 +1032,7 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
 
     uint64_t total_leaf_trace_cost = 0;
     for (uint32_t leaf_idx : leaf_refs_sorted_along_axis[0])
-        total_leaf_trace_cost += GetLeafTraceCost(leaves[leaf_idx], c_world);
+        total_leaf_trace_cost += leaf_trace_costs[leaf_idx];
 
     for (int axis = 0; axis < 3; axis++) {
         // Precompute AABB surface area of right child for every split position
@@ -437,8 +1093,7 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
             // Move left-most leaf of right child over to the left child
             uint32_t moved_over_leaf_idx = leaf_refs_sorted_along_axis[axis][split_pos];
             const Leaf& moved_over_leaf = leaves[moved_over_leaf_idx];
-            uint64_t moved_over_leaf_cost =
-                GetLeafTraceCost(moved_over_leaf, c_world);
+            uint64_t moved_over_leaf_cost = leaf_trace_costs[moved_over_leaf_idx];
             total_l_child_cost += moved_over_leaf_cost;
             total_r_child_cost -= moved_over_leaf_cost;
 
@@ -447,18 +1102,415 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
                 l_child_mins[i] = Math::min(l_child_mins[i], moved_over_leaf.mins[i]);
                 l_child_maxs[i] = Math::max(l_child_maxs[i], moved_over_leaf.maxs[i]);
             }
-        }
+        }
+    }
+#endif
+
+    assert(split_details.axis >= 0 && split_details.axis <= 2);
+    assert(split_details.elem_idx > 0);        // Split must not leave  left child with no leaves
+    assert(split_details.elem_idx < leaf_cnt); // Split must not leave right child with no leaves
+    return split_details;
+}
+
+// Returns the bin of the given position. Monotonic in pos. Safe if bin_scale is
+// infinite, i.e. if the binned extent is subnormal.
+static size_t GetBinIdx(float pos, float bin_origin, float bin_scale, size_t bin_cnt)
+{
+    float bin = (pos - bin_origin) * bin_scale;
+    if (!(bin > 0.0f)) // Also catches NaN
+        return 0;
+    if (!(bin < (float)(bin_cnt - 1))) // Also catches infinity
+        return bin_cnt - 1;
+    return (size_t)bin;
+}
+
+BVH::NodeSplitDetails BVH::DetermineBinnedNodeSplit(
+    const BuildNode& node_to_split,
+    std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const
+{
+    // Binned SAH method:
+    // Same cost function as in DetermineBeneficialNodeSplit(), but leaves get
+    // assigned to a fixed number of equally sized bins along each axis,
+    // depending on their centroid position. The SAH is only evaluated at
+    // split positions between bins, making its evaluation much cheaper.
+    // Since leaf refs are already sorted by their centroid, each bin covers a
+    // contiguous range of leaf refs. Splitting between bins is therefor
+    // equivalent to splitting at a certain element index.
+
+    const size_t leaf_cnt = leaf_refs_sorted_along_axis[0].size();
+    assert(leaf_cnt >= 2);
+
+    const size_t bin_cnt = Math::clamp(build_params.sah_bin_cnt, (size_t)2, MAX_SAH_BIN_CNT);
+
+    struct Bin {
+        size_t leaf_cnt = 0;
+        uint64_t leaf_trace_cost = 0; // Summed cost of all leaves in this bin
+        Vector3 mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    };
+
+    float node_aabb_surface_area =
+        CalcAabbSurfaceArea(node_to_split.mins, node_to_split.maxs);
+
+    NodeSplitDetails split_details = {}; // Irrelevant init vals
+    bool found_split = false;
+
+    // Determine split with lowest cost across all 3 axes
+    float cur_lowest_sah_cost = HUGE_VALF;
+
+    for (int axis = 0; axis < 3; axis++) {
+        std::span<uint32_t> sorted_leaf_refs = leaf_refs_sorted_along_axis[axis];
+
+        // Calculate the leaf centroid the same way the leaf sorting did
+        auto GetCentroidPos = [this, axis](uint32_t leaf_idx) {
+            const Leaf& leaf = leaves[leaf_idx];
+            return 0.5f * (leaf.mins[axis] + leaf.maxs[axis]);
+        };
+
+        // Leaf refs are sorted, first and last one determine centroid extent
+        float centroid_min = GetCentroidPos(sorted_leaf_refs.front());
+        float centroid_max = GetCentroidPos(sorted_leaf_refs.back());
+        if (!(centroid_max > centroid_min))
+            continue; // All centroids are equal, can't split on this axis
+        float bin_scale = (float)bin_cnt / (centroid_max - centroid_min);
+
+        // Assign leaves to bins
+        Bin bins[MAX_SAH_BIN_CNT] = {};
+        for (uint32_t leaf_idx : sorted_leaf_refs) {
+            const Leaf& leaf = leaves[leaf_idx];
+            // Monotonic in centroid position, keeping bins contiguous
+            Bin& bin = bins[GetBinIdx(GetCentroidPos(leaf_idx), centroid_min, bin_scale, bin_cnt)];
+            bin.leaf_cnt++;
+            bin.leaf_trace_cost += leaf_trace_costs[leaf_idx];
+            for (int i = 0; i < 3; i++) {
+                bin.mins[i] = Math::min(bin.mins[i], leaf.mins[i]);
+                bin.maxs[i] = Math::max(bin.maxs[i], leaf.maxs[i]);
+            }
+        }
+
+        // Precompute AABB surface area and cost of the right child for every
+        // split position between bins. Go from right to left.
+        float    r_child_aabb_surface_areas[MAX_SAH_BIN_CNT]; // idx is first bin of right child
+        uint64_t r_child_costs             [MAX_SAH_BIN_CNT];
+        Vector3 r_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 r_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        uint64_t r_child_cost = 0;
+        for (size_t split_bin = bin_cnt - 1; split_bin > 0; split_bin--) {
+            const Bin& bin = bins[split_bin];
+            for (int i = 0; i < 3; i++) {
+                r_child_mins[i] = Math::min(r_child_mins[i], bin.mins[i]);
+                r_child_maxs[i] = Math::max(r_child_maxs[i], bin.maxs[i]);
+            }
+            r_child_cost += bin.leaf_trace_cost;
+            r_child_aabb_surface_areas[split_bin] = CalcAabbSurfaceArea(r_child_mins, r_child_maxs);
+            r_child_costs             [split_bin] = r_child_cost;
+        }
+
+        // Check cost of splitting between every pair of neighboring bins.
+        // Go from left to right.
+        Vector3 l_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 l_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        uint64_t l_child_cost = 0;
+        size_t l_child_leaf_cnt = 0;
+        for (size_t split_bin = 1; split_bin < bin_cnt; split_bin++) {
+            // Move bin left of split position into the left child
+            const Bin& moved_over_bin = bins[split_bin - 1];
+            for (int i = 0; i < 3; i++) {
+                l_child_mins[i] = Math::min(l_child_mins[i], moved_over_bin.mins[i]);
+                l_child_maxs[i] = Math::max(l_child_maxs[i], moved_over_bin.maxs[i]);
+            }
+            l_child_cost     += moved_over_bin.leaf_trace_cost;
+            l_child_leaf_cnt += moved_over_bin.leaf_cnt;
+
+            // Skip splits that leave a child with no leaves
+            if (l_child_leaf_cnt == 0 || l_child_leaf_cnt == leaf_cnt)
+                continue;
+
+            float l_child_aabb_surface_area = CalcAabbSurfaceArea(l_child_mins, l_child_maxs);
+            float r_child_aabb_surface_area = r_child_aabb_surface_areas[split_bin]; // Lookup
+
+            // Likelihood of a trace hitting a child AABB, given that the
+            // parent AABB was hit.
+            float l_child_aabb_hit_likelihood = l_child_aabb_surface_area / node_aabb_surface_area;
+            float r_child_aabb_hit_likelihood = r_child_aabb_surface_area / node_aabb_surface_area;
+
+            float sah_cost =
+                (float)l_child_cost           * l_child_aabb_hit_likelihood +
+                (float)r_child_costs[split_bin] * r_child_aabb_hit_likelihood;
+
+            if (sah_cost < cur_lowest_sah_cost) { // Remember best split
+                cur_lowest_sah_cost = sah_cost;
+                split_details = { .axis = axis, .elem_idx = l_child_leaf_cnt };
+                found_split = true;
+            }
+        }
+    }
+
+    // If all leaf centroids are identical, binning can't separate them
+    if (!found_split)
+        return DetermineMedianNodeSplit(node_to_split, leaf_cnt);
+
+    assert(split_details.axis >= 0 && split_details.axis <= 2);
+    assert(split_details.elem_idx > 0);        // Split must not leave  left child with no leaves
+    assert(split_details.elem_idx < leaf_cnt); // Split must not leave right child with no leaves
+    return split_details;
+}
+
+BVH::NodeSplitDetails BVH::DetermineMedianNodeSplit(
+    const BuildNode& node_to_split, size_t leaf_cnt)
+{
+    assert(leaf_cnt >= 2);
+    int largest_axis = 0; // Determine axis with the largest AABB extent
+    for (int current_axis = 1; current_axis < 3; current_axis++) {
+        float current_extent = node_to_split.maxs[current_axis] - node_to_split.mins[current_axis];
+        float largest_extent = node_to_split.maxs[largest_axis] - node_to_split.mins[largest_axis];
+        if (current_extent > largest_extent)
+            largest_axis = current_axis;
+    }
+    return {
+        .axis = largest_axis,
+        .elem_idx = leaf_cnt / 2, // Split on the middle element
+    };
+}
+
+bool BVH::DetermineSpatialNodeSplit(const BuildNode& node_to_split,
+    std::span<const SpatialLeafRef> leaf_refs,
+    float root_aabb_surface_area,
+    size_t max_extra_ref_cnt,
+    SpatialNodeSplit* dest_split) const
+{
+    // Spatial split method (SBVH), see:
+    //   Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies"
+    // Object splits are evaluated like in DetermineBinnedNodeSplit(), except
+    // that leaf refs aren't presorted. Spatial splits instead bin the node's
+    // AABB into equally sized slabs. Leaf refs spanning multiple bins are
+    // clipped to each bin, so a split between bins lets the children's AABBs
+    // only enclose the leaf ref parts on their side of the split plane.
+    // Both kinds of splits are weighed with the same SAH cost function.
+
+    const size_t ref_cnt = leaf_refs.size();
+    assert(ref_cnt >= 2);
+
+    const size_t bin_cnt = Math::clamp(build_params.sah_bin_cnt, (size_t)2, MAX_SAH_BIN_CNT);
+
+    struct Bin {
+        size_t leaf_cnt = 0; // Object splits: Leaf refs with their centroid in this bin
+        uint64_t leaf_trace_cost = 0;
+        size_t entry_cnt = 0; // Spatial splits: Leaf refs starting in this bin
+        size_t  exit_cnt = 0; // Spatial splits: Leaf refs ending in this bin
+        uint64_t entry_cost = 0;
+        uint64_t  exit_cost = 0;
+        Vector3 mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    };
+    auto ExtendAabb = [](Vector3& mins, Vector3& maxs,
+                         const Vector3& add_mins, const Vector3& add_maxs) {
+        mins = Math::min(mins, add_mins);
+        maxs = Math::max(maxs, add_maxs);
+    };
+
+    float node_aabb_surface_area =
+        CalcAabbSurfaceArea(node_to_split.mins, node_to_split.maxs);
+
+    // Leaf trace costs of the references, in the order of leaf_refs
+    std::vector<uint64_t> leaf_ref_costs(ref_cnt);
+    for (size_t i = 0; i < ref_cnt; i++)
+        leaf_ref_costs[i] = leaf_trace_costs[leaf_refs[i].leaf_idx];
+
+    bool found_split = false;
+    float cur_lowest_sah_cost = HUGE_VALF;
+
+    // Children AABBs of the best object split, to determine their overlap
+    Vector3 best_obj_l_mins, best_obj_l_maxs;
+    Vector3 best_obj_r_mins, best_obj_r_maxs;
+
+    // Sweeps over the split positions between bins of one axis. GetLeft and
+    // GetRight return the leaf ref count and cost a bin adds to the left or
+    // right child. on_split_candidate is called for every split position at
+    // which both children have fewer leaf refs than the node.
+    auto SweepBins = [&](const Bin* bins, auto GetLeft, auto GetRight,
+                         auto on_split_candidate) {
+        // Precompute right child properties for every split position.
+        // Go from right to left.
+        float    r_child_aabb_surface_areas[MAX_SAH_BIN_CNT]; // idx is first bin of right child
+        uint64_t r_child_costs             [MAX_SAH_BIN_CNT];
+        size_t   r_child_leaf_cnts         [MAX_SAH_BIN_CNT];
+        Vector3  r_child_minss             [MAX_SAH_BIN_CNT];
+        Vector3  r_child_maxss             [MAX_SAH_BIN_CNT];
+        Vector3 r_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 r_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        uint64_t r_child_cost = 0;
+        size_t r_child_leaf_cnt = 0;
+        for (size_t split_bin = bin_cnt - 1; split_bin > 0; split_bin--) {
+            const Bin& bin = bins[split_bin];
+            ExtendAabb(r_child_mins, r_child_maxs, bin.mins, bin.maxs);
+            auto [cnt, cost] = GetRight(bin);
+            r_child_leaf_cnt += cnt;
+            r_child_cost     += cost;
+            r_child_aabb_surface_areas[split_bin] = CalcAabbSurfaceArea(r_child_mins, r_child_maxs);
+            r_child_costs             [split_bin] = r_child_cost;
+            r_child_leaf_cnts         [split_bin] = r_child_leaf_cnt;
+            r_child_minss             [split_bin] = r_child_mins;
+            r_child_maxss             [split_bin] = r_child_maxs;
+        }
+
+        // Go from left to right
+        Vector3 l_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 l_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        uint64_t l_child_cost = 0;
+        size_t l_child_leaf_cnt = 0;
+        for (size_t split_bin = 1; split_bin < bin_cnt; split_bin++) {
+            const Bin& moved_over_bin = bins[split_bin - 1];
+            ExtendAabb(l_child_mins, l_child_maxs, moved_over_bin.mins, moved_over_bin.maxs);
+            auto [cnt, cost] = GetLeft(moved_over_bin);
+            l_child_leaf_cnt += cnt;
+            l_child_cost     += cost;
+
+            // Skip splits that leave a child with no leaf refs or that don't
+            // reduce the leaf ref count of a child
+            size_t r_child_leaf_cnt = r_child_leaf_cnts[split_bin];
+            if (l_child_leaf_cnt == 0 || l_child_leaf_cnt >= ref_cnt ||
+                r_child_leaf_cnt == 0 || r_child_leaf_cnt >= ref_cnt)
+                continue;
+
+            // Likelihood of a trace hitting a child AABB, given that the
+            // parent AABB was hit.
+            float l_child_aabb_hit_likelihood =
+                CalcAabbSurfaceArea(l_child_mins, l_child_maxs) / node_aabb_surface_area;
+            float r_child_aabb_hit_likelihood =
+                r_child_aabb_surface_areas[split_bin] / node_aabb_surface_area;
+
+            float sah_cost =
+                (float)l_child_cost             * l_child_aabb_hit_likelihood +
+                (float)r_child_costs[split_bin] * r_child_aabb_hit_likelihood;
+            on_split_candidate(split_bin, sah_cost,
+                               l_child_leaf_cnt + r_child_leaf_cnt - ref_cnt,
+                               l_child_mins, l_child_maxs,
+                               r_child_minss[split_bin], r_child_maxss[split_bin]);
+        }
+    };
+
+    // ---- Object splits ----
+    for (int axis = 0; axis < 3; axis++) {
+        float centroid_min = +HUGE_VALF;
+        float centroid_max = -HUGE_VALF;
+        for (const SpatialLeafRef& ref : leaf_refs) {
+            float centroid = 0.5f * (ref.mins[axis] + ref.maxs[axis]);
+            centroid_min = Math::min(centroid_min, centroid);
+            centroid_max = Math::max(centroid_max, centroid);
+        }
+        if (!(centroid_max > centroid_min))
+            continue; // All centroids are equal, can't split on this axis
+        float bin_scale = (float)bin_cnt / (centroid_max - centroid_min);
+
+        // Assign leaf refs to bins
+        Bin bins[MAX_SAH_BIN_CNT] = {};
+        for (size_t i = 0; i < ref_cnt; i++) {
+            const SpatialLeafRef& ref = leaf_refs[i];
+            float centroid = 0.5f * (ref.mins[axis] + ref.maxs[axis]);
+            Bin& bin = bins[GetBinIdx(centroid, centroid_min, bin_scale, bin_cnt)];
+            bin.leaf_cnt++;
+            bin.leaf_trace_cost += leaf_ref_costs[i];
+            ExtendAabb(bin.mins, bin.maxs, ref.mins, ref.maxs);
+        }
+
+        auto GetBinContents = [](const Bin& bin) {
+            return std::pair<size_t, uint64_t>{ bin.leaf_cnt, bin.leaf_trace_cost };
+        };
+        SweepBins(bins, GetBinContents, GetBinContents,
+            [&](size_t split_bin, float sah_cost, size_t /*extra_ref_cnt*/,
+                const Vector3& l_mins, const Vector3& l_maxs,
+                const Vector3& r_mins, const Vector3& r_maxs) {
+                if (sah_cost >= cur_lowest_sah_cost)
+                    return;
+                cur_lowest_sah_cost = sah_cost;
+                found_split = true;
+                *dest_split = {
+                    .is_spatial = false,
+                    .axis = axis,
+                    .bin_origin = centroid_min,
+                    .bin_scale = bin_scale,
+                    .bin_cnt = bin_cnt,
+                    .split_bin = split_bin,
+                    .plane_pos = 0.0f,
+                };
+                best_obj_l_mins = l_mins; best_obj_l_maxs = l_maxs;
+                best_obj_r_mins = r_mins; best_obj_r_maxs = r_maxs;
+            }
+        );
+    }
+
+    // ---- Spatial splits ----
+    // Only worth evaluating if the best object split's children overlap
+    bool consider_spatial_splits = max_extra_ref_cnt > 0;
+    if (found_split && consider_spatial_splits) {
+        Vector3 overlap_mins = Math::max(best_obj_l_mins, best_obj_r_mins);
+        Vector3 overlap_maxs = Math::min(best_obj_l_maxs, best_obj_r_maxs);
+        if (!AabbIntersectsAabb(best_obj_l_mins, best_obj_l_maxs,
+                                best_obj_r_mins, best_obj_r_maxs))
+            consider_spatial_splits = false;
+        else if (CalcAabbSurfaceArea(overlap_mins, overlap_maxs) <
+                 SPATIAL_SPLIT_MIN_OVERLAP * root_aabb_surface_area)
+            consider_spatial_splits = false;
+    }
+    for (int axis = 0; axis < 3 && consider_spatial_splits; axis++) {
+        float bin_origin = node_to_split.mins[axis];
+        float node_extent = node_to_split.maxs[axis] - node_to_split.mins[axis];
+        if (!(node_extent > 0.0f))
+            continue;
+        float bin_scale = (float)bin_cnt / node_extent;
+        float bin_width = node_extent / (float)bin_cnt;
+
+        // Assign clipped parts of leaf refs to every bin they overlap
+        Bin bins[MAX_SAH_BIN_CNT] = {};
+        for (size_t i = 0; i < ref_cnt; i++) {
+            const SpatialLeafRef& ref = leaf_refs[i];
+            size_t entry_bin = GetBinIdx(ref.mins[axis], bin_origin, bin_scale, bin_cnt);
+            size_t  exit_bin = GetBinIdx(ref.maxs[axis], bin_origin, bin_scale, bin_cnt);
+            bins[entry_bin].entry_cnt++;
+            bins[entry_bin].entry_cost += leaf_ref_costs[i];
+            bins[ exit_bin].exit_cnt++;
+            bins[ exit_bin].exit_cost  += leaf_ref_costs[i];
+            for (size_t b = entry_bin; b <= exit_bin; b++) {
+                Vector3 part_mins = ref.mins;
+                Vector3 part_maxs = ref.maxs;
+                if (b > entry_bin)
+                    part_mins[axis] = bin_origin + (float)b * bin_width;
+                if (b < exit_bin)
+                    part_maxs[axis] = bin_origin + (float)(b + 1) * bin_width;
+                part_mins[axis] = Math::min(part_mins[axis], ref.maxs[axis]);
+                part_maxs[axis] = Math::max(part_maxs[axis], ref.mins[axis]);
+                ExtendAabb(bins[b].mins, bins[b].maxs, part_mins, part_maxs);
+            }
+        }
+
+        SweepBins(bins,
+            [](const Bin& bin) { return std::pair<size_t, uint64_t>{ bin.entry_cnt, bin.entry_cost }; },
+            [](const Bin& bin) { return std::pair<size_t, uint64_t>{ bin.exit_cnt, bin.exit_cost }; },
+            [&](size_t split_bin, float sah_cost, size_t extra_ref_cnt,
+                const Vector3&, const Vector3&, const Vector3&, const Vector3&) {
+                if (sah_cost >= cur_lowest_sah_cost || extra_ref_cnt > max_extra_ref_cnt)
+                    return;
+                cur_lowest_sah_cost = sah_cost;
+                found_split = true;
+                *dest_split = {
+                    .is_spatial = true,
+                    .axis = axis,
+                    .bin_origin = bin_origin,
+                    .bin_scale = bin_scale,
+                    .bin_cnt = bin_cnt,
+                    .split_bin = split_bin,
+                    .plane_pos = bin_origin + (float)split_bin * bin_width,
+                };
+            }
+        );
     }
-#endif
 
-    assert(split_details.axis >= 0 && split_details.axis <= 2);
-    assert(split_details.elem_idx > 0);        // Split must not leave  left child with no leaves
-    assert(split_details.elem_idx < leaf_cnt); // Split must not leave right child with no leaves
-    return split_details;
+    return found_split;
 }
 
 void BVH::DoTraceAgainstLeaf(Trace* trace, const Leaf& leaf,
-                             CollidableWorld& c_world) const
+                             CollidableWorld& c_world, TraceContext& ctx) const
 {
     ZoneScoped;
 
@@ -489,7 +1541,7 @@ void BVH::DoTraceAgainstLeaf(Trace* trace, const Leaf& leaf,
         else                     c_world.DoUnsweptTrace_Brush (trace, leaf.brush_idx);
         break;
     case Leaf::Type::Displacement:
-        if (trace->info.isswept) c_world.DoSweptTrace_Displacement  (trace, leaf.disp_coll_idx);
+        if (trace->info.isswept) c_world.DoSweptTrace_Displacement  (trace, leaf.disp_coll_idx, ctx);
         else                     c_world.DoUnsweptTrace_Displacement(trace, leaf.disp_coll_idx);
         break;
     case Leaf::Type::FuncBrush:
@@ -510,6 +1562,25 @@ void BVH::DoTraceAgainstLeaf(Trace* trace, const Leaf& leaf,
     }
 }
 
+void BVH::BeginSharedLeafTracking(TraceContext& ctx)
+{
+    if (++ctx.leaf_traversal_stamp == 0) { // Wrapped around, reset all marks
+        std::fill(ctx.leaf_visit_marks.begin(), ctx.leaf_visit_marks.end(), 0);
+        ctx.leaf_traversal_stamp = 1;
+    }
+}
+
+bool BVH::CheckAndMarkSharedLeafVisit(TraceContext& ctx, uint32_t leaf_idx) const
+{
+    assert(ctx.leaf_visit_marks.size() >= leaves.size()); // See PrepareTraceContext()
+
+    uint32_t& mark = ctx.leaf_visit_marks[leaf_idx];
+    if (mark == ctx.leaf_traversal_stamp)
+        return true;
+    mark = ctx.leaf_traversal_stamp;
+    return false;
+}
+
 bool BVH::CreateLeaves(CollidableWorld& c_world)
 {
     std::shared_ptr<const BspMap> bsp_map = c_world.pImpl->origin_bsp_map;
@@ -518,37 +1589,27 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
     leaves.clear();
     leaves.push_back({}); // Add a dummy leaf at index 0. Needed due to node indexing.
 
-    auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-    auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-    auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
-    auto test_f_4 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
-    auto test_f_5 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::WATER);
-
     Debug{} << PRINT_PREFIX << "Beginning creation...";
 
     // @Optimization Collect leaf types in a different order?
 
     // Collect relevant brushes
     Debug{} << PRINT_PREFIX << "Collecting AABBs of brushes";
-    // @Optimization Collect worldspawn model brush indices only once ever?
-    for (size_t brush_idx : bsp_map->GetModelBrushIndices_worldspawn()) {
-        const BspMap::Brush& brush = bsp_map->brushes[brush_idx];
-        if (!brush.num_sides)
-            continue;
-
-        bool relevant = false;
-        if (test_f_1.first && test_f_1.first(brush)) relevant = true;
-        if (test_f_2.first && test_f_2.first(brush)) relevant = true;
-        if (test_f_3.first && test_f_3.first(brush)) relevant = true;
-        if (test_f_4.first && test_f_4.first(brush)) relevant = true;
-        if (test_f_5.first && test_f_5.first(brush)) relevant = true;
-        if (!relevant)
+    // Test if brush collision data has been compiled
+    if (c_world.pImpl->compiled_brushes == Corrade::Containers::NullOpt) {
+        assert(false && "BVH creation FAILED: Brush collision data is not "
+                        "compiled yet.");
+        return false; // Leaf creation failed
+    }
+    const std::vector<CompiledBrushes::Brush>& compiled_brushes =
+        c_world.pImpl->compiled_brushes->brushes;
+    for (size_t brush_idx = 0; brush_idx < compiled_brushes.size(); brush_idx++) {
+        // Only collidable worldspawn brushes with a valid AABB have one
+        if (!compiled_brushes[brush_idx].has_aabb)
             continue;
 
-        Vector3 mins, maxs;
-        bool valid_aabb = bsp_map->GetBrushAABB(brush_idx, &mins, &maxs);
-        if (!valid_aabb)
-            continue;
+        Vector3 mins = compiled_brushes[brush_idx].mins;
+        Vector3 maxs = compiled_brushes[brush_idx].maxs;
 
         // Bloat AABB a little to account for collision calculation tolerances
         mins -= Vector3{ 1.0f, 1.0f, 1.0f };
@@ -565,16 +1626,21 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
 
     // Collect relevant func_brush entities
     Debug{} << PRINT_PREFIX << "Collecting AABBs of func_brush entities";
-    // If func_brush uses collision caches: TODO Test if fb coll cache exists!
-    for (size_t fb_idx = 0; fb_idx < bsp_map->entities_func_brush.size(); fb_idx++) {
-        const BspMap::Ent_func_brush& func_brush = bsp_map->entities_func_brush[fb_idx];
-        if (!func_brush.IsSolid())
+    // Test if func_brush collision data has been compiled
+    if (c_world.pImpl->compiled_func_brushes == Corrade::Containers::NullOpt) {
+        assert(false && "BVH creation FAILED: func_brush collision data is not "
+                        "compiled yet.");
+        return false; // Leaf creation failed
+    }
+    const std::vector<CompiledFuncBrushes::FuncBrush>& compiled_func_brushes =
+        c_world.pImpl->compiled_func_brushes->func_brushes;
+    for (size_t fb_idx = 0; fb_idx < compiled_func_brushes.size(); fb_idx++) {
+        // Only solid func_brush entities with a valid AABB have one
+        if (!compiled_func_brushes[fb_idx].has_aabb)
             continue;
 
-        Vector3 mins, maxs;
-        bool valid_aabb = CalcAabb_FuncBrush(fb_idx, *bsp_map, &mins, &maxs);
-        if (!valid_aabb)
-            continue;
+        Vector3 mins = compiled_func_brushes[fb_idx].mins;
+        Vector3 maxs = compiled_func_brushes[fb_idx].maxs;
 
         // Bloat AABB a little to account for collision calculation tolerances
         mins -= Vector3{ 1.0f, 1.0f, 1.0f };
@@ -592,12 +1658,12 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
     // Collect relevant displacements
     Debug{} << PRINT_PREFIX << "Collecting AABBs of displacements";
     // Test if displacement collision structures have been constructed
-    if (c_world.pImpl->hull_disp_coll_trees == Corrade::Containers::NullOpt) {
+    if (c_world.pImpl->disp_coll_trees == Corrade::Containers::NullOpt) {
         assert(false && "BVH creation FAILED: Displacement collision structures "
                         "are not created yet.");
         return false; // Leaf creation failed
     }
-    const std::vector<CDispCollTree>& disp_coll_arr = *c_world.pImpl->hull_disp_coll_trees;
+    const std::vector<CDispCollTree>& disp_coll_arr = *c_world.pImpl->disp_coll_trees;
     for (size_t disp_coll_idx = 0; disp_coll_idx < disp_coll_arr.size(); disp_coll_idx++) {
         const CDispCollTree& disp_coll = disp_coll_arr[disp_coll_idx];
         Vector3 aabb_mins, aabb_maxs;
@@ -607,6 +1673,8 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
             .mins = aabb_mins,
             .maxs = aabb_maxs,
             .type = Leaf::Type::Displacement,
+            // Hull traces skip displacements without hull collision
+            .is_ray_only = disp_coll.CheckFlags(BspMap::DispInfo::FLAG_NO_HULL_COLL),
             .disp_coll_idx = (uint32_t)disp_coll_idx,
         };
         leaves.push_back(bvh_leaf);
@@ -619,19 +1687,14 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
                         "not created yet.");
         return false; // Leaf creation failed
     }
-    const std::map<uint32_t, CollisionCache_XProp>& sprop_coll_caches =
+    const std::vector<CollisionCache_XProp>& sprop_coll_caches =
         *c_world.pImpl->coll_caches_sprop;
     Debug{} << PRINT_PREFIX << "Collecting AABBs of static props";
-    for (size_t sprop_idx = 0; sprop_idx < bsp_map->static_props.size(); sprop_idx++) {
-        const BspMap::StaticProp& sprop = bsp_map->static_props[sprop_idx];
-        if (!sprop.IsSolidWithVPhysics())
-            continue;
-
+    for (size_t sprop_idx = 0; sprop_idx < sprop_coll_caches.size(); sprop_idx++) {
         // Get collision cache of this static prop
-        const auto& iter = sprop_coll_caches.find(sprop_idx);
-        if (iter == sprop_coll_caches.end())
-            continue; // Static prop has no collision cache, skip
-        const CollisionCache_XProp& sprop_coll_cache = iter->second;
+        const CollisionCache_XProp& sprop_coll_cache = sprop_coll_caches[sprop_idx];
+        if (!sprop_coll_cache.HasCollision())
+            continue; // Static prop has no collision, skip
 
         // Get exact, non-bloated AABB of static prop
         Vector3 aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
@@ -662,21 +1725,14 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
                         " not created yet.");
         return false; // Leaf creation failed
     }
-    const std::map<uint32_t, CollisionCache_XProp>& dprop_coll_caches =
+    const std::vector<CollisionCache_XProp>& dprop_coll_caches =
         *c_world.pImpl->coll_caches_dprop;
     Debug{} << PRINT_PREFIX << "Collecting AABBs of dynamic props";
-    for (size_t dprop_idx = 0;
-         dprop_idx < bsp_map->relevant_dynamic_props.size();
-         dprop_idx++)
-    {
-        const BspMap::Ent_prop_dynamic& dprop =
-            bsp_map->relevant_dynamic_props[dprop_idx];
-
+    for (size_t dprop_idx = 0; dprop_idx < dprop_coll_caches.size(); dprop_idx++) {
         // Get collision cache of this dynamic prop
-        const auto& iter = dprop_coll_caches.find(dprop_idx);
-        if (iter == dprop_coll_caches.end())
-            continue; // Dynamic prop has no collision cache, skip
-        const CollisionCache_XProp& dprop_coll_cache = iter->second;
+        const CollisionCache_XProp& dprop_coll_cache = dprop_coll_caches[dprop_idx];
+        if (!dprop_coll_cache.HasCollision())
+            continue; // Dynamic prop has no collision, skip
 
         // Get exact, non-bloated AABB of dynamic prop
         Vector3 aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
@@ -703,36 +1759,37 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
     return true; // Leaf creation succeeded
 }
 
-void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
-    std::span<uint32_t> start_node_leaf_refs_sorted_along_axis[3],
-    CollidableWorld& c_world)
+void BVH::CreateNodeHierarchy(std::vector<BuildNode>& build_nodes,
+    const UnsplitNode& start_node,
+    std::vector<UnsplitNode>* deferred_nodes,
+    size_t max_deferred_leaf_cnt) const
 {
-    struct UnsplitNodeStackEntry {
-        // Node in nodes array that needs to be split.
-        // Its AABB is set, its children are yet to be determined.
-        uint32_t unsplit_node_idx; // idx into nodes
-
-        // Leafs assigned to this node, sorted along all 3 axes.
-        std::span<uint32_t> leaf_refs_sorted_along_axis[3];
-    };
     // Keep track of nodes to split
-    std::stack<UnsplitNodeStackEntry> unsplit_node_stack;
+    std::stack<UnsplitNode> unsplit_node_stack;
+    unsplit_node_stack.push(start_node);
 
-    UnsplitNodeStackEntry first_entry{
-        .unsplit_node_idx = start_node_idx,
-        .leaf_refs_sorted_along_axis = {
-            start_node_leaf_refs_sorted_along_axis[0],
-            start_node_leaf_refs_sorted_along_axis[1],
-            start_node_leaf_refs_sorted_along_axis[2]
-        }
-    };
-    unsplit_node_stack.push(first_entry);
+    // LUT to quickly figure out which side a leaf is on during a split.
+    // Allocated only once, each split only updates entries of its own leaves.
+    const bool L_CHILD = true;
+    const bool R_CHILD = false;
+    std::vector<bool> leaf_lut(leaves.size(), R_CHILD);
+
+    // Buffer used to separate leaf refs of both children
+    std::vector<uint32_t> orig_sorted_leaf_refs;
+    orig_sorted_leaf_refs.reserve(start_node.leaf_refs_sorted_along_axis[0].size());
 
     while (!unsplit_node_stack.empty()) {
-        UnsplitNodeStackEntry next = unsplit_node_stack.top();
+        UnsplitNode next = unsplit_node_stack.top();
         unsplit_node_stack.pop();
 
-        Node& current_node = nodes[next.unsplit_node_idx];
+        // Leave small enough nodes to the caller
+        if (deferred_nodes &&
+            next.leaf_refs_sorted_along_axis[0].size() <= max_deferred_leaf_cnt) {
+            deferred_nodes->push_back(next);
+            continue;
+        }
+
+        BuildNode& current_node = build_nodes[next.build_node_idx];
         std::span<uint32_t> leaf_refs_sorted_along_axis[3] = {
             next.leaf_refs_sorted_along_axis[0],
             next.leaf_refs_sorted_along_axis[1],
@@ -744,8 +1801,16 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
 
         // ---- Split this node ----
 
-        NodeSplitDetails split_details = DetermineBeneficialNodeSplit(
-            current_node, leaf_refs_sorted_along_axis, c_world);
+        NodeSplitDetails split_details;
+        if (next.depth >= MAX_SAH_SPLIT_DEPTH) // Limit tree depth
+            split_details = DetermineMedianNodeSplit(
+                current_node, current_node_leaf_cnt);
+        else if (build_params.split_method == BuildParams::SplitMethod::BinnedSah)
+            split_details = DetermineBinnedNodeSplit(
+                current_node, leaf_refs_sorted_along_axis);
+        else
+            split_details = DetermineBeneficialNodeSplit(
+                current_node, leaf_refs_sorted_along_axis);
 
         // Select axis to split on
         int split_axis = split_details.axis;
@@ -771,18 +1836,14 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             r_child_leaf_cnt
         };
 
-        // Create LUT to quickly figure out which side a leaf is on.
-        const bool L_CHILD = true;
-        const bool R_CHILD = false;
-        // @Optimization Only allocate this once? Use BitArray?
-        std::vector<bool> leaf_lut(leaves.size(), R_CHILD);
+        // Update LUT entries of this node's leaves
         for (uint32_t leaf_idx : l_child_leaf_refs_sorted_along_axis[split_axis])
             leaf_lut[leaf_idx] = L_CHILD;
+        for (uint32_t leaf_idx : r_child_leaf_refs_sorted_along_axis[split_axis])
+            leaf_lut[leaf_idx] = R_CHILD;
 
         // On non-split axes, copy leaf refs and first copy back l_child leaves,
         // then r_child leaves, while keeping the sorted order within both children.
-        std::vector<uint32_t> orig_sorted_leaf_refs;
-        orig_sorted_leaf_refs.reserve(current_node_leaf_cnt);
         for (int axis = 0; axis < 3; axis++) {
             if (axis == split_axis) continue;
             // Copy all leaf refs to buffer
@@ -817,9 +1878,9 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             current_node.child_l = -((int32_t)l_child_leaf_idx);
         }
         else if (l_child_leaf_cnt >= 2) { // Make left child a node
-            uint32_t l_child_node_idx = nodes.size();
-            nodes.push_back({});
-            Node& l_child_node = nodes.back();
+            uint32_t l_child_node_idx = build_nodes.size();
+            build_nodes.push_back({});
+            BuildNode& l_child_node = build_nodes.back();
             current_node.child_l = l_child_node_idx;
             // Compute AABB of l_child node
             // @Optimization DetermineBeneficialNodeSplit() already calculated
@@ -827,8 +1888,9 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             CalcAabbOfBvhLeaves(l_child_leaf_refs_sorted_along_axis[0],
                 &l_child_node.mins, &l_child_node.maxs);
 
-            UnsplitNodeStackEntry new_entry{
-                .unsplit_node_idx = l_child_node_idx,
+            UnsplitNode new_entry{
+                .build_node_idx = l_child_node_idx,
+                .depth = next.depth + 1,
                 .leaf_refs_sorted_along_axis = {
                     l_child_leaf_refs_sorted_along_axis[0],
                     l_child_leaf_refs_sorted_along_axis[1],
@@ -844,9 +1906,9 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             current_node.child_r = -((int32_t)r_child_leaf_idx);
         }
         else if (r_child_leaf_cnt >= 2) { // Make right child a node
-            uint32_t r_child_node_idx = nodes.size();
-            nodes.push_back({});
-            Node& r_child_node = nodes.back();
+            uint32_t r_child_node_idx = build_nodes.size();
+            build_nodes.push_back({});
+            BuildNode& r_child_node = build_nodes.back();
             current_node.child_r = r_child_node_idx;
             // Compute AABB of r_child node
             // @Optimization DetermineBeneficialNodeSplit() already calculated
@@ -854,8 +1916,9 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             CalcAabbOfBvhLeaves(r_child_leaf_refs_sorted_along_axis[0],
                 &r_child_node.mins, &r_child_node.maxs);
 
-            UnsplitNodeStackEntry new_entry{
-                .unsplit_node_idx = r_child_node_idx,
+            UnsplitNode new_entry{
+                .build_node_idx = r_child_node_idx,
+                .depth = next.depth + 1,
                 .leaf_refs_sorted_along_axis = {
                     r_child_leaf_refs_sorted_along_axis[0],
                     r_child_leaf_refs_sorted_along_axis[1],
@@ -867,81 +1930,1016 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
     }
 }
 
-void BVH::SetNodeContentsInfo()
+void BVH::CreateNodeHierarchyMultithreaded(std::vector<BuildNode>& build_nodes,
+    const UnsplitNode& start_node,
+    size_t thread_cnt) const
 {
-    if (!WasConstructedSuccessfully()) {
-        assert(0);
-        return;
+    // Splits of a node only depend on the leaves assigned to it. The same
+    // node hierarchy is created regardless of which thread splits a node and
+    // regardless of the order in which nodes are split.
+    // Nodes close to the start node are split on this thread, until the
+    // remaining unsplit nodes have few enough leaves. The subtrees of these
+    // nodes are independent of each other: Their leaf ref ranges are disjoint.
+    // They get built on multiple threads, each into its own build node array,
+    // which are afterwards appended to the given build node array.
+    // Note: The final, compact node layout only depends on the node hierarchy,
+    //       not on the order of build nodes.
+
+    std::vector<UnsplitNode> subtree_roots;
+    CreateNodeHierarchy(build_nodes, start_node,
+                        &subtree_roots, MT_SUBTREE_MAX_LEAF_CNT);
+
+    // Build subtrees. Each subtree root is at index 0 of its build node array.
+    std::vector<std::vector<BuildNode>> subtree_build_nodes(subtree_roots.size());
+    std::atomic<size_t> next_subtree_idx = 0;
+    auto BuildSubtrees = [&]() {
+        while (true) {
+            size_t subtree_idx = next_subtree_idx.fetch_add(1);
+            if (subtree_idx >= subtree_roots.size())
+                break;
+            const UnsplitNode& subtree_root = subtree_roots[subtree_idx];
+            std::vector<BuildNode>& subtree_nodes = subtree_build_nodes[subtree_idx];
+
+            subtree_nodes.reserve(subtree_root.leaf_refs_sorted_along_axis[0].size() - 1);
+            subtree_nodes.push_back(build_nodes[subtree_root.build_node_idx]);
+            UnsplitNode local_root = subtree_root;
+            local_root.build_node_idx = 0;
+            CreateNodeHierarchy(subtree_nodes, local_root);
+        }
+    };
+    std::vector<std::thread> worker_threads;
+    for (size_t i = 1; i < thread_cnt; i++) // This thread is a worker as well
+        worker_threads.emplace_back(BuildSubtrees);
+    BuildSubtrees();
+    for (std::thread& t : worker_threads)
+        t.join();
+
+    // Append subtrees to the given build node array, in a fixed order
+    for (size_t i = 0; i < subtree_roots.size(); i++) {
+        const std::vector<BuildNode>& subtree_nodes = subtree_build_nodes[i];
+
+        // Subtree node at local index idx (idx >= 1) gets moved to index
+        // (idx + idx_offset). The subtree root replaces the unsplit node.
+        const int32_t idx_offset = (int32_t)build_nodes.size() - 1;
+        auto RemapChildIdx = [idx_offset](int32_t child_idx) {
+            return child_idx < 0 ? child_idx : child_idx + idx_offset;
+        };
+
+        BuildNode& root = build_nodes[subtree_roots[i].build_node_idx];
+        root.child_l = RemapChildIdx(subtree_nodes[0].child_l);
+        root.child_r = RemapChildIdx(subtree_nodes[0].child_r);
+        for (size_t idx = 1; idx < subtree_nodes.size(); idx++) {
+            BuildNode node = subtree_nodes[idx];
+            node.child_l = RemapChildIdx(node.child_l);
+            node.child_r = RemapChildIdx(node.child_r);
+            build_nodes.push_back(node);
+        }
+    }
+}
+
+void BVH::CreateNodeHierarchySpatial(std::vector<BuildNode>& build_nodes) const
+{
+    ZoneScoped;
+
+    // A node whose AABB is set and whose children are yet to be determined.
+    // Unlike UnsplitNode, it owns its leaf refs, since spatial splits can put
+    // a leaf into both children.
+    struct SpatialUnsplitNode {
+        uint32_t build_node_idx; // idx into build_nodes
+        size_t depth; // See UnsplitNode
+        std::vector<SpatialLeafRef> leaf_refs;
+    };
+
+    Vector3 root_mins = build_nodes[0].mins;
+    Vector3 root_maxs = build_nodes[0].maxs;
+    float root_aabb_surface_area = CalcAabbSurfaceArea(root_mins, root_maxs);
+
+    // Number of additional leaf refs spatial splits may still create
+    size_t remaining_extra_ref_cnt = (size_t)((float)total_leaf_cnt *
+        Math::clamp(build_params.spatial_split_budget, 0.0f, 1.0f));
+
+    std::stack<SpatialUnsplitNode> unsplit_node_stack;
+    {
+        SpatialUnsplitNode root = { .build_node_idx = 0, .depth = 1, .leaf_refs = {} };
+        root.leaf_refs.reserve(total_leaf_cnt);
+        for (size_t i = 1; i < leaves.size(); i++) // Skip dummy leaf at index 0
+            root.leaf_refs.push_back({
+                .mins = leaves[i].mins,
+                .maxs = leaves[i].maxs,
+                .leaf_idx = (uint32_t)i
+            });
+        unsplit_node_stack.push(std::move(root));
     }
 
-    // Index is the node index
-    std::vector<bool> are_contents_of_node_set(nodes.size(), false);
+    size_t spatial_split_cnt = 0;
+    while (!unsplit_node_stack.empty()) {
+        SpatialUnsplitNode next = std::move(unsplit_node_stack.top());
+        unsplit_node_stack.pop();
 
-    size_t node_contents_set_cnt = 0;
-    while (node_contents_set_cnt < nodes.size()) {
-        // At the time of writing (2023-09-11) the nodes array was ordered in a
-        // breadth-first manner (root node comes first, nodes close to leaves
-        // come last).
-        // Therefor, iterating the nodes array from back to front is faster here
-        // than front to back, since contents info is set starting at the nodes
-        // close to leaves.
-        for (int64_t i = nodes.size() - 1; i >= 0; i--) {
-            if (are_contents_of_node_set[i])
-                continue;
+        std::vector<SpatialLeafRef>& leaf_refs = next.leaf_refs;
+        const size_t ref_cnt = leaf_refs.size();
+        assert(ref_cnt >= 2);
 
-            Node& node = nodes[i];
+        // ---- Split this node ----
 
-            // Don't set contents yet if a child node's contents are not set yet
-            if (node.child_l >= 0 && !are_contents_of_node_set[node.child_l])
-                continue;
-            if (node.child_r >= 0 && !are_contents_of_node_set[node.child_r])
+        std::vector<SpatialLeafRef> l_child_leaf_refs;
+        std::vector<SpatialLeafRef> r_child_leaf_refs;
+
+        SpatialNodeSplit split;
+        bool found_split = false;
+        if (next.depth < MAX_SAH_SPLIT_DEPTH) // Limit tree depth
+            found_split = DetermineSpatialNodeSplit(build_nodes[next.build_node_idx],
+                leaf_refs, root_aabb_surface_area, remaining_extra_ref_cnt,
+                &split);
+
+        if (!found_split) {
+            // Median split on the axis with the largest AABB extent
+            NodeSplitDetails median_split =
+                DetermineMedianNodeSplit(build_nodes[next.build_node_idx], ref_cnt);
+            int axis = median_split.axis;
+            auto median_it = leaf_refs.begin() + median_split.elem_idx;
+            std::nth_element(leaf_refs.begin(), median_it, leaf_refs.end(),
+                [axis](const SpatialLeafRef& a, const SpatialLeafRef& b) {
+                    return a.mins[axis] + a.maxs[axis] < b.mins[axis] + b.maxs[axis];
+                }
+            );
+            l_child_leaf_refs.assign(leaf_refs.begin(), median_it);
+            r_child_leaf_refs.assign(median_it, leaf_refs.end());
+        }
+        else if (!split.is_spatial) {
+            for (const SpatialLeafRef& ref : leaf_refs) {
+                float centroid = 0.5f * (ref.mins[split.axis] + ref.maxs[split.axis]);
+                size_t bin = GetBinIdx(centroid, split.bin_origin, split.bin_scale, split.bin_cnt);
+                if (bin < split.split_bin)
+                    l_child_leaf_refs.push_back(ref);
+                else
+                    r_child_leaf_refs.push_back(ref);
+            }
+        }
+        else {
+            const int axis = split.axis;
+            for (const SpatialLeafRef& ref : leaf_refs) {
+                size_t entry_bin = GetBinIdx(ref.mins[axis], split.bin_origin, split.bin_scale, split.bin_cnt);
+                size_t  exit_bin = GetBinIdx(ref.maxs[axis], split.bin_origin, split.bin_scale, split.bin_cnt);
+                if (entry_bin < split.split_bin) {
+                    SpatialLeafRef l_part = ref;
+                    if (exit_bin >= split.split_bin) // Clip at split plane
+                        l_part.maxs[axis] = Math::max(ref.mins[axis],
+                            Math::min(ref.maxs[axis], split.plane_pos));
+                    l_child_leaf_refs.push_back(l_part);
+                }
+                if (exit_bin >= split.split_bin) {
+                    SpatialLeafRef r_part = ref;
+                    if (entry_bin < split.split_bin) // Clip at split plane
+                        r_part.mins[axis] = Math::min(ref.maxs[axis],
+                            Math::max(ref.mins[axis], split.plane_pos));
+                    r_child_leaf_refs.push_back(r_part);
+                }
+            }
+            size_t extra_ref_cnt = l_child_leaf_refs.size() + r_child_leaf_refs.size() - ref_cnt;
+            assert(extra_ref_cnt <= remaining_extra_ref_cnt);
+            remaining_extra_ref_cnt -= extra_ref_cnt;
+            spatial_split_cnt++;
+        }
+        assert(!l_child_leaf_refs.empty() && l_child_leaf_refs.size() < ref_cnt);
+        assert(!r_child_leaf_refs.empty() && r_child_leaf_refs.size() < ref_cnt);
+
+        // Free this node's leaf refs before its children get split
+        leaf_refs.clear();
+        leaf_refs.shrink_to_fit();
+
+        // Create children. Right child is pushed first, so the left child's
+        // subtree gets built first.
+        int32_t child_indices[2];
+        std::vector<SpatialLeafRef>* child_leaf_refs[2] = {
+            &l_child_leaf_refs, &r_child_leaf_refs
+        };
+        for (int c = 1; c >= 0; c--) {
+            std::vector<SpatialLeafRef>& refs = *child_leaf_refs[c];
+            if (refs.size() == 1) { // Make child a leaf
+                child_indices[c] = -((int32_t)refs[0].leaf_idx);
                 continue;
+            }
+            // Make child a node
+            uint32_t child_node_idx = build_nodes.size();
+            BuildNode child_node = {
+                .mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF },
+                .maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF },
+                .child_l = 0, // Set once this child gets split
+                .child_r = 0,
+            };
+            for (const SpatialLeafRef& ref : refs) {
+                child_node.mins = Math::min(child_node.mins, ref.mins);
+                child_node.maxs = Math::max(child_node.maxs, ref.maxs);
+            }
+            build_nodes.push_back(child_node);
+            child_indices[c] = (int32_t)child_node_idx;
+            unsplit_node_stack.push({
+                .build_node_idx = child_node_idx,
+                .depth = next.depth + 1,
+                .leaf_refs = std::move(refs)
+            });
+        }
+        BuildNode& current_node = build_nodes[next.build_node_idx];
+        current_node.child_l = child_indices[0];
+        current_node.child_r = child_indices[1];
+    }
 
-            // Set contents of current node using contents of its children
-            for (int32_t child_idx : { node.child_l, node.child_r }) {
-                if (child_idx < 0) {
-                    const Leaf& leaf = leaves[-child_idx];
-                    node.contained_leaf_types.set(leaf.type);
+    Debug{} << PRINT_PREFIX << "Performed" << spatial_split_cnt << "spatial "
+        "splits, creating" << build_nodes.size() + 1 - total_leaf_cnt
+        << "additional leaf references";
+}
+
+void BVH::OptimizeTreelets(std::vector<BuildNode>& build_nodes) const
+{
+    ZoneScoped;
+
+    // Treelet restructuring, see:
+    //   Karras & Aila 2013, "Fast Parallel Construction of High-Quality
+    //   Bounding Volume Hierarchies"
+    // Among the SAH cost summands of CalcSahCost(), only node AABB surface
+    // areas depend on the tree's arrangement. Rearranging a treelet with n
+    // treelet leaves always yields (n - 1) treelet nodes, so the best
+    // arrangement is the one with the smallest summed surface area of its
+    // treelet nodes. It's found by dynamic programming over all subsets of
+    // treelet leaves, which takes O(3^n) time per treelet.
+
+    const size_t max_treelet_leaf_cnt = Math::clamp(build_params.treelet_leaf_cnt,
+                                                    (size_t)3, MAX_TREELET_LEAF_CNT);
+    const size_t SUBSET_CNT = (size_t)1 << MAX_TREELET_LEAF_CNT;
+
+    // Treelet leaf: A subtree or a leaf below the treelet's nodes
+    struct TreeletLeaf {
+        int32_t child_idx; // See BuildNode::child_l
+        Vector3 mins;
+        Vector3 maxs;
+    };
+
+    // Per subset of treelet leaves, bit i refers to treelet_leaves[i].
+    // Allocated once, reused for every treelet.
+    std::vector<Vector3> subset_mins(SUBSET_CNT);
+    std::vector<Vector3> subset_maxs(SUBSET_CNT);
+    std::vector<float>   subset_cost(SUBSET_CNT);  // Lowest summed surface area of treelet nodes
+    std::vector<uint32_t> subset_split(SUBSET_CNT); // Subset of left child in best arrangement
+
+    auto GetChildAabb = [&](int32_t child_idx, const BuildNode& parent,
+                            Vector3* mins, Vector3* maxs) {
+        if (child_idx >= 0) {
+            *mins = build_nodes[child_idx].mins;
+            *maxs = build_nodes[child_idx].maxs;
+            return;
+        }
+        // A leaf referenced by this node might have been clipped by a spatial
+        // split, its actual extent within the node is unknown. Limiting it to
+        // the parent node's AABB is conservative.
+        const Leaf& leaf = leaves[-child_idx];
+        *mins = Math::max(leaf.mins, parent.mins);
+        *maxs = Math::min(leaf.maxs, parent.maxs);
+    };
+
+    // Puts all nodes in pre-order into dest_nodes and returns the tree depth
+    auto TraverseTree = [&build_nodes](std::vector<uint32_t>& dest_nodes) {
+        dest_nodes.clear();
+        size_t depth = 0;
+        std::vector<std::pair<uint32_t, size_t>> node_stack = { { 0, 1 } };
+        while (!node_stack.empty()) {
+            auto [node_idx, node_depth] = node_stack.back();
+            node_stack.pop_back();
+            dest_nodes.push_back(node_idx);
+            depth = Math::max(depth, node_depth);
+            const BuildNode& node = build_nodes[node_idx];
+            for (int32_t child_idx : { node.child_r, node.child_l }) // Left child first
+                if (child_idx >= 0)
+                    node_stack.push_back({ (uint32_t)child_idx, node_depth + 1 });
+        }
+        return depth;
+    };
+
+    std::vector<uint32_t> preorder_nodes;
+    preorder_nodes.reserve(build_nodes.size());
+    size_t restructured_treelet_cnt = 0;
+    for (size_t pass = 0; pass < build_params.treelet_optimization_passes; pass++) {
+        TraverseTree(preorder_nodes);
+
+        // Rearranging treelets can increase the tree depth. Undo the pass if
+        // it exceeds the limit.
+        std::vector<BuildNode> orig_build_nodes = build_nodes;
+
+        // Visit nodes bottom-up: When a treelet gets rearranged, its nodes'
+        // subtrees were already optimized and its ancestors weren't yet.
+        for (auto it = preorder_nodes.rbegin(); it != preorder_nodes.rend(); ++it) {
+            const uint32_t root_idx = *it;
+
+            // Form treelet by repeatedly expanding the treelet leaf with the
+            // largest surface area
+            TreeletLeaf treelet_leaves[MAX_TREELET_LEAF_CNT];
+            uint32_t treelet_nodes[MAX_TREELET_LEAF_CNT - 1]; // Root first
+            size_t treelet_leaf_cnt = 0;
+            size_t treelet_node_cnt = 0;
+            float orig_cost = 0.0f;
+
+            treelet_nodes[treelet_node_cnt++] = root_idx;
+            orig_cost += CalcAabbSurfaceArea(build_nodes[root_idx].mins, build_nodes[root_idx].maxs);
+            for (int32_t child_idx : { build_nodes[root_idx].child_l, build_nodes[root_idx].child_r }) {
+                TreeletLeaf& tl = treelet_leaves[treelet_leaf_cnt++];
+                tl.child_idx = child_idx;
+                GetChildAabb(child_idx, build_nodes[root_idx], &tl.mins, &tl.maxs);
+            }
+            while (treelet_leaf_cnt < max_treelet_leaf_cnt) {
+                int expanded = -1;
+                float largest_area = -1.0f;
+                for (size_t i = 0; i < treelet_leaf_cnt; i++) {
+                    if (treelet_leaves[i].child_idx < 0)
+                        continue; // Leaves can't be expanded
+                    float area = CalcAabbSurfaceArea(treelet_leaves[i].mins, treelet_leaves[i].maxs);
+                    if (area > largest_area) {
+                        largest_area = area;
+                        expanded = (int)i;
+                    }
                 }
-                else {
-                    const Node& child_node = nodes[child_idx];
-                    node.contained_leaf_types |= child_node.contained_leaf_types;
+                if (expanded < 0)
+                    break;
+
+                const uint32_t node_idx = (uint32_t)treelet_leaves[expanded].child_idx;
+                const BuildNode& node = build_nodes[node_idx];
+                treelet_nodes[treelet_node_cnt++] = node_idx;
+                orig_cost += largest_area;
+                TreeletLeaf& l = treelet_leaves[expanded];
+                TreeletLeaf& r = treelet_leaves[treelet_leaf_cnt++];
+                l.child_idx = node.child_l;
+                r.child_idx = node.child_r;
+                GetChildAabb(node.child_l, node, &l.mins, &l.maxs);
+                GetChildAabb(node.child_r, node, &r.mins, &r.maxs);
+            }
+            const size_t n = treelet_leaf_cnt;
+            if (n < 3)
+                continue; // Only one possible arrangement
+            const uint32_t full_set = ((uint32_t)1 << n) - 1;
+
+            // Find best arrangement, smaller subsets come first
+            for (uint32_t set = 1; set <= full_set; set++) {
+                uint32_t lowest_bit = set & (~set + 1);
+                uint32_t rest = set ^ lowest_bit;
+                if (rest == 0) { // Single treelet leaf
+                    size_t leaf_i = std::countr_zero(set);
+                    subset_mins[set] = treelet_leaves[leaf_i].mins;
+                    subset_maxs[set] = treelet_leaves[leaf_i].maxs;
+                    subset_cost[set] = 0.0f;
+                    continue;
+                }
+                subset_mins[set] = Math::min(subset_mins[lowest_bit], subset_mins[rest]);
+                subset_maxs[set] = Math::max(subset_maxs[lowest_bit], subset_maxs[rest]);
+
+                // Each partition is considered once: The left subset always
+                // contains the lowest bit.
+                float best_split_cost = HUGE_VALF;
+                uint32_t best_split = lowest_bit;
+                for (uint32_t sub = rest; ; sub = (sub - 1) & rest) {
+                    uint32_t left = lowest_bit | sub;
+                    uint32_t right = set ^ left;
+                    if (right != 0) {
+                        float split_cost = subset_cost[left] + subset_cost[right];
+                        if (split_cost < best_split_cost) {
+                            best_split_cost = split_cost;
+                            best_split = left;
+                        }
+                    }
+                    if (sub == 0)
+                        break;
+                }
+                subset_cost[set] = best_split_cost +
+                    CalcAabbSurfaceArea(subset_mins[set], subset_maxs[set]);
+                subset_split[set] = best_split;
+            }
+
+            // Only rearrange if that's a real improvement, avoiding needless
+            // changes due to rounding errors
+            if (!(subset_cost[full_set] < 0.999f * orig_cost))
+                continue;
+            restructured_treelet_cnt++;
+
+            // Rebuild treelet, reusing its nodes. The root keeps its index.
+            size_t next_free_treelet_node = 1;
+            std::pair<uint32_t, uint32_t> rebuild_stack[MAX_TREELET_LEAF_CNT]; // (node idx, subset)
+            size_t rebuild_stack_cnt = 0;
+            rebuild_stack[rebuild_stack_cnt++] = { root_idx, full_set };
+            while (rebuild_stack_cnt > 0) {
+                auto [node_idx, set] = rebuild_stack[--rebuild_stack_cnt];
+                BuildNode& node = build_nodes[node_idx];
+                node.mins = subset_mins[set];
+                node.maxs = subset_maxs[set];
+                const uint32_t child_sets[2] = { subset_split[set], set ^ subset_split[set] };
+                int32_t child_indices[2];
+                for (int c = 0; c < 2; c++) {
+                    if (std::has_single_bit(child_sets[c])) {
+                        child_indices[c] = treelet_leaves[std::countr_zero(child_sets[c])].child_idx;
+                        continue;
+                    }
+                    uint32_t child_node_idx = treelet_nodes[next_free_treelet_node++];
+                    child_indices[c] = (int32_t)child_node_idx;
+                    rebuild_stack[rebuild_stack_cnt++] = { child_node_idx, child_sets[c] };
                 }
+                node.child_l = child_indices[0];
+                node.child_r = child_indices[1];
             }
+            assert(next_free_treelet_node == treelet_node_cnt);
+        }
 
-            are_contents_of_node_set[i] = true;
-            node_contents_set_cnt++;
+        if (TraverseTree(preorder_nodes) > MAX_TREE_DEPTH) {
+            Debug{} << PRINT_PREFIX << "WARNING: Treelet optimization pass"
+                << pass + 1 << "exceeded the maximum tree depth, undoing it";
+            build_nodes = std::move(orig_build_nodes);
+            break;
         }
     }
+
+    Debug{} << PRINT_PREFIX << "Treelet optimization rearranged"
+        << restructured_treelet_cnt << "treelets";
 }
 
-void BVH::_GetAabbsContainingPoint_r(const Node& node, const Vector3& pt,
-    std::vector<Vector3>* aabb_mins_list,
-    std::vector<Vector3>* aabb_maxs_list)
+size_t BVH::GetBuildThreadCount() const
+{
+#ifdef DZSIM_WEB_PORT
+    return 1; // Multithreading is not used in the web port
+#else
+    if (build_params.split_method == BuildParams::SplitMethod::SpatialSah)
+        return 1; // Spatial split building isn't multithreaded
+    size_t thread_cnt = build_params.max_thread_cnt;
+    if (thread_cnt == 0)
+        thread_cnt = std::thread::hardware_concurrency();
+    return Math::max(thread_cnt, (size_t)1); // hardware_concurrency() may return 0
+#endif
+}
+
+void BVH::CreateCompactNodes(const std::vector<BuildNode>& build_nodes)
+{
+    nodes.clear();
+    nodes.reserve(build_nodes.size());
+
+    struct PendingNode {
+        uint32_t build_node_idx; // idx into build_nodes
+        // Index of the parent node in nodes whose right child this node is,
+        // or -1 if no parent needs to be updated.
+        int64_t parent_node_idx;
+        size_t depth; // Number of nodes from root node to this node
+    };
+    std::stack<PendingNode> pending_nodes;
+    pending_nodes.push({ .build_node_idx = 0, .parent_node_idx = -1, .depth = 1 });
+    tree_depth = 0;
+
+    // Depth-first traversal of build nodes, visiting left children first.
+    // Nodes are appended in the order they are visited.
+    while (!pending_nodes.empty()) {
+        PendingNode pending = pending_nodes.top();
+        pending_nodes.pop();
+
+        const BuildNode& build_node = build_nodes[pending.build_node_idx];
+        const int32_t node_idx = (int32_t)nodes.size();
+        tree_depth = Math::max(tree_depth, pending.depth);
+        if (pending.parent_node_idx >= 0)
+            nodes[pending.parent_node_idx].child_r = node_idx;
+
+        Node node = {
+            .mins = build_node.mins,
+            .maxs = build_node.maxs,
+            .child_r = build_node.child_r, // Gets updated later if it's a node
+            .child_l_leaf_idx = 0,
+            .contained_leaf_types = 0,
+        };
+        if (build_node.child_l < 0)
+            node.child_l_leaf_idx = (uint32_t)(-build_node.child_l);
+        nodes.push_back(node);
+
+        // Push right child first so that the left child gets appended next
+        if (build_node.child_r >= 0)
+            pending_nodes.push({
+                .build_node_idx = (uint32_t)build_node.child_r,
+                .parent_node_idx = node_idx,
+                .depth = pending.depth + 1
+            });
+        if (build_node.child_l >= 0)
+            pending_nodes.push({
+                .build_node_idx = (uint32_t)build_node.child_l,
+                .parent_node_idx = -1, // Left child node is implicitly at node_idx+1
+                .depth = pending.depth + 1
+            });
+    }
+    assert(nodes.size() == build_nodes.size());
+}
+
+void BVH::QuantizeNodes()
+{
+    ZoneScoped;
+
+    // The grid spans the root node's AABB
+    const Node& root_node = nodes[0];
+    quant_grid_origin = root_node.mins;
+    const float MAX_Q = (float)UINT16_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = root_node.maxs[axis] - root_node.mins[axis];
+        float cell_size = Math::max(extent / MAX_Q, 1e-3f);
+        // The last grid coordinate must lie beyond the root node's AABB, with
+        // a margin for rounding differences, see below.
+        while (quant_grid_origin[axis] + MAX_Q * cell_size
+                < std::nextafter(root_node.maxs[axis], INFINITY))
+            cell_size = std::nextafter(cell_size, INFINITY);
+        quant_grid_cell_size[axis] = cell_size;
+    }
+
+    // Round grid coordinates outwards. Dequantization during traversal might
+    // be compiled differently (e.g. using FMA instructions) and be off by one
+    // ulp, hence the one ulp margin. Grid coordinate 0 dequantizes exactly.
+    auto QuantizeMin = [this](float x, int axis) -> uint16_t {
+        float q = std::floor((x - quant_grid_origin[axis]) / quant_grid_cell_size[axis]);
+        uint16_t q_min = (uint16_t)Math::clamp(q, 0.0f, (float)UINT16_MAX);
+        while (q_min > 0 && DequantizeCoord(q_min, axis) > std::nextafter(x, -INFINITY))
+            q_min--;
+        return q_min;
+    };
+    auto QuantizeMax = [this](float x, int axis) -> uint16_t {
+        float q = std::ceil((x - quant_grid_origin[axis]) / quant_grid_cell_size[axis]);
+        uint16_t q_max = (uint16_t)Math::clamp(q, 0.0f, (float)UINT16_MAX);
+        while (q_max < UINT16_MAX && DequantizeCoord(q_max, axis) < std::nextafter(x, INFINITY))
+            q_max++;
+        return q_max;
+    };
+
+    quantized_nodes.clear();
+    quantized_nodes.reserve(nodes.size());
+    for (const Node& node : nodes) {
+        QuantizedNode& q_node = quantized_nodes.emplace_back();
+        for (int axis = 0; axis < 3; axis++) {
+            q_node.q_mins[axis] = QuantizeMin(node.mins[axis], axis);
+            q_node.q_maxs[axis] = QuantizeMax(node.maxs[axis], axis);
+            assert(DequantizeCoord(q_node.q_mins[axis], axis) <= node.mins[axis]);
+            assert(DequantizeCoord(q_node.q_maxs[axis], axis) >= node.maxs[axis]);
+        }
+        q_node.child_r              = node.child_r;
+        q_node.child_l_leaf_idx     = node.child_l_leaf_idx;
+        q_node.contained_leaf_types = node.contained_leaf_types;
+    }
+
+    nodes.clear();
+    nodes.shrink_to_fit();
+}
+
+void BVH::CreateBvh4Nodes()
+{
+    ZoneScoped;
+
+    nodes4.clear();
+
+    struct PendingNode {
+        int32_t node_idx; // idx into nodes
+        // Index of the parent node in nodes4 and the parent's child slot this
+        // node occupies, or -1 if this is the root node.
+        int64_t parent_node4_idx;
+        uint32_t parent_slot;
+    };
+    std::stack<PendingNode> pending_nodes;
+    pending_nodes.push({ .node_idx = 0, .parent_node4_idx = -1, .parent_slot = 0 });
+
+    // Depth-first traversal of binary nodes, like in CreateCompactNodes()
+    while (!pending_nodes.empty()) {
+        PendingNode pending = pending_nodes.top();
+        pending_nodes.pop();
+
+        const int32_t node4_idx = (int32_t)nodes4.size();
+        if (pending.parent_node4_idx >= 0)
+            nodes4[pending.parent_node4_idx].children[pending.parent_slot] = node4_idx;
+
+        // Collect up to 4 children by repeatedly replacing the child node with
+        // the biggest surface area by its own two children
+        int32_t children[4] = {
+            GetLeftChildIdx(nodes, pending.node_idx),
+            nodes[pending.node_idx].child_r
+        };
+        uint32_t child_cnt = 2;
+        while (child_cnt < 4) {
+            int64_t expanded_slot = -1;
+            float max_area = -1.0f;
+            for (uint32_t i = 0; i < child_cnt; i++) {
+                if (children[i] < 0) // Leaves can't be expanded
+                    continue;
+                const Node& child = nodes[children[i]];
+                float area = CalcAabbSurfaceArea(child.mins, child.maxs);
+                if (area > max_area) {
+                    max_area = area;
+                    expanded_slot = i;
+                }
+            }
+            if (expanded_slot < 0)
+                break;
+            int32_t expanded_node_idx = children[expanded_slot];
+            children[expanded_slot] = GetLeftChildIdx(nodes, expanded_node_idx);
+            children[child_cnt++]   = nodes[expanded_node_idx].child_r;
+        }
+
+        Node4 node4 = {};
+        node4.child_cnt = child_cnt;
+        for (uint32_t i = 0; i < child_cnt; i++) {
+            int32_t child_idx = children[i];
+            const Vector3& mins = child_idx < 0 ? leaves[-child_idx].mins : nodes[child_idx].mins;
+            const Vector3& maxs = child_idx < 0 ? leaves[-child_idx].maxs : nodes[child_idx].maxs;
+            for (int axis = 0; axis < 3; axis++) {
+                node4.child_mins[axis][i] = mins[axis];
+                node4.child_maxs[axis][i] = maxs[axis];
+            }
+            node4.child_leaf_types[i] = (uint8_t)GetChildLeafTypes(nodes, child_idx);
+            node4.children[i] = child_idx; // Gets updated later if it's a node
+        }
+        nodes4.push_back(node4);
+
+        // Push in reverse order so that the first child gets appended next
+        for (int64_t i = child_cnt - 1; i >= 0; i--)
+            if (children[i] >= 0)
+                pending_nodes.push({
+                    .node_idx = children[i],
+                    .parent_node4_idx = node4_idx,
+                    .parent_slot = (uint32_t)i
+                });
+    }
+}
+
+float BVH::DequantizeCoord(uint16_t q, int axis) const
+{
+    return quant_grid_origin[axis] + (float)q * quant_grid_cell_size[axis];
+}
+
+void BVH::GetNodeAabb(const Node& node, Vector3* mins, Vector3* maxs) const
+{
+    *mins = node.mins;
+    *maxs = node.maxs;
+}
+
+void BVH::GetNodeAabb(const QuantizedNode& node, Vector3* mins, Vector3* maxs) const
+{
+    for (int axis = 0; axis < 3; axis++) {
+        (*mins)[axis] = DequantizeCoord(node.q_mins[axis], axis);
+        (*maxs)[axis] = DequantizeCoord(node.q_maxs[axis], axis);
+    }
+}
+
+void BVH::GetNodeAabb(int32_t node_idx, Vector3* mins, Vector3* maxs) const
+{
+    if (build_params.quantize_node_aabbs)
+        GetNodeAabb(quantized_nodes[node_idx], mins, maxs);
+    else
+        GetNodeAabb(nodes[node_idx], mins, maxs);
+}
+
+size_t BVH::GetNodeCount() const
+{
+    return build_params.quantize_node_aabbs ? quantized_nodes.size() : nodes.size();
+}
+
+size_t BVH::GetNodeMemoryUsage() const
+{
+    return nodes.size() * sizeof(Node)
+        + quantized_nodes.size() * sizeof(QuantizedNode)
+        + nodes4.size() * sizeof(Node4);
+}
+
+template<class NodeType>
+int32_t BVH::GetLeftChildIdx(const std::vector<NodeType>& node_array,
+                             int32_t node_idx)
+{
+    const NodeType& node = node_array[node_idx];
+    if (node.child_l_leaf_idx != 0)
+        return -((int32_t)node.child_l_leaf_idx);
+    return node_idx + 1;
+}
+
+template<class NodeType>
+uint32_t BVH::GetChildLeafTypes(const std::vector<NodeType>& node_array,
+                                int32_t child_idx) const
+{
+    if (child_idx < 0)
+        return GetLeafTypeFlags(leaves[-child_idx]);
+    return node_array[child_idx].contained_leaf_types;
+}
+
+uint32_t BVH::GetLeafTypeFlags(const Leaf& leaf)
+{
+    if (leaf.is_ray_only)
+        return RAY_ONLY_DISP_LEAF_FLAG;
+    return 1u << leaf.type;
+}
+
+uint32_t BVH::GetTraceLeafTypeFlags(const Trace& trace)
 {
-    if (!IsPointInAabb(pt, node.mins, node.maxs))
+    uint32_t flags = trace.info.collidable_types;
+    if (trace.info.isray && (flags & COLLIDABLE_DISPLACEMENTS))
+        flags |= RAY_ONLY_DISP_LEAF_FLAG;
+    return flags;
+}
+
+int32_t BVH::GetLeftChildIdx(int32_t node_idx) const
+{
+    if (build_params.quantize_node_aabbs)
+        return GetLeftChildIdx(quantized_nodes, node_idx);
+    return GetLeftChildIdx(nodes, node_idx);
+}
+
+int32_t BVH::GetRightChildIdx(int32_t node_idx) const
+{
+    if (build_params.quantize_node_aabbs)
+        return quantized_nodes[node_idx].child_r;
+    return nodes[node_idx].child_r;
+}
+
+void BVH::SetNodeContentsInfo()
+{
+    if (nodes.empty()) {
+        assert(0);
         return;
-    if (aabb_mins_list) aabb_mins_list->push_back(node.mins);
-    if (aabb_maxs_list) aabb_maxs_list->push_back(node.maxs);
+    }
 
-    int32_t l_idx = node.child_l;
-    int32_t r_idx = node.child_r;
+    // Nodes are stored in depth-first order, meaning child nodes always come
+    // after their parent node. Iterating the nodes array from back to front
+    // therefor sets the contents of child nodes before their parent's.
+    for (int64_t i = nodes.size() - 1; i >= 0; i--) {
+        Node& node = nodes[i];
+        uint32_t contained_leaf_types = 0;
+
+        // Set contents of current node using contents of its children
+        for (int32_t child_idx : { GetLeftChildIdx(nodes, (int32_t)i), node.child_r }) {
+            if (child_idx < 0) {
+                contained_leaf_types |= GetLeafTypeFlags(leaves[-child_idx]);
+            }
+            else {
+                assert(child_idx > i);
+                contained_leaf_types |= nodes[child_idx].contained_leaf_types;
+            }
+        }
+        node.contained_leaf_types = contained_leaf_types;
+    }
+}
 
-    if (l_idx < 0) {
-        const Leaf& leaf = leaves[-l_idx];
-        if (IsPointInAabb(pt, leaf.mins, leaf.maxs)) {
-            if (aabb_mins_list) aabb_mins_list->push_back(leaf.mins);
-            if (aabb_maxs_list) aabb_maxs_list->push_back(leaf.maxs);
+void BVH::MarkSharedLeaves()
+{
+    std::vector<uint8_t> leaf_ref_cnts(leaves.size(), 0);
+    for (size_t i = 0; i < GetNodeCount(); i++) {
+        for (int32_t child_idx : { GetLeftChildIdx((int32_t)i), GetRightChildIdx((int32_t)i) }) {
+            if (child_idx < 0 && leaf_ref_cnts[-child_idx] < 2)
+                leaf_ref_cnts[-child_idx]++;
         }
     }
-    if (r_idx < 0) {
-        const Leaf& leaf = leaves[-r_idx];
-        if (IsPointInAabb(pt, leaf.mins, leaf.maxs)) {
-            if (aabb_mins_list) aabb_mins_list->push_back(leaf.mins);
-            if (aabb_maxs_list) aabb_maxs_list->push_back(leaf.maxs);
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaves[i].is_shared = leaf_ref_cnts[i] >= 2;
+}
+
+std::string BVH::GetDefaultCacheDirPath()
+{
+#ifdef DZSIM_WEB_PORT
+    return ""; // No persistent file system
+#else
+    Containers::Optional<Containers::String> cfg_dir =
+        Utility::Path::configurationDirectory("DZSimulator");
+    if (!cfg_dir)
+        return "";
+    return Utility::Path::join(*cfg_dir, "BvhCache");
+#endif
+}
+
+// 64-bit FNV-1a hash of the given bytes, continuing from the given hash
+static uint64_t HashBytes(const void* data, size_t size,
+                          uint64_t hash = 0xcbf29ce484222325)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+template<class T>
+static uint64_t HashValue(const T& value, uint64_t hash)
+{
+    return HashBytes(&value, sizeof(value), hash);
+}
+
+uint64_t BVH::CalcCacheKey() const
+{
+    ZoneScoped;
+
+    uint64_t hash = HashValue(CACHE_FORMAT_VERSION, 0xcbf29ce484222325);
+    hash = HashValue((uint32_t)build_params.split_method, hash);
+    if (build_params.split_method != BuildParams::SplitMethod::ExactSah)
+        hash = HashValue((uint64_t)build_params.sah_bin_cnt, hash);
+    if (build_params.split_method == BuildParams::SplitMethod::SpatialSah)
+        hash = HashValue(build_params.spatial_split_budget, hash);
+    if (build_params.treelet_optimization_passes > 0) {
+        hash = HashValue((uint64_t)build_params.treelet_optimization_passes, hash);
+        hash = HashValue((uint64_t)build_params.treelet_leaf_cnt,            hash);
+    }
+    hash = HashValue(build_params.quantize_node_aabbs, hash);
+    hash = HashValue(build_params.collapse_to_bvh4,    hash);
+    hash = HashValue(build_params.trace_cost_model,    hash); // Only floats
+
+    // The nodes depend on the leaves' AABBs and trace costs. Costs don't
+    // only depend on the BSP map, but also on prop collision models.
+    for (size_t i = 0; i < leaves.size(); i++) {
+        const Leaf& leaf = leaves[i];
+        hash = HashValue(leaf.mins, hash);
+        hash = HashValue(leaf.maxs, hash);
+        hash = HashValue((uint32_t)leaf.type, hash);
+        hash = HashValue(leaf.is_ray_only, hash);
+        hash = HashValue(leaf.brush_idx, hash); // Any member of the union
+        if (i != 0) // Dummy leaf has no cost
+            hash = HashValue(leaf_trace_costs[i], hash);
+    }
+    return hash;
+}
+
+std::string BVH::GetCacheFilePath(uint64_t cache_key) const
+{
+    char file_name[32];
+    std::snprintf(file_name, sizeof(file_name), "%016llx.bvhcache",
+                  (unsigned long long)cache_key);
+    return Utility::Path::join(build_params.cache_dir_path, file_name);
+}
+
+// Cache file paths are UTF-8, like all paths Corrade works with
+static std::filesystem::path Utf8ToFsPath(const std::string& utf8_path)
+{
+    return std::filesystem::path(std::u8string(utf8_path.begin(), utf8_path.end()));
+}
+
+// Cache files consist of this header, followed by the leaves, nodes,
+// quantized_nodes and nodes4 arrays. Everything is stored in the native byte
+// order and struct layout, the cache isn't meant to be portable.
+struct BvhCacheFileHeader {
+    char     magic[8];
+    uint32_t format_version;
+    uint32_t byte_order_mark; // Detects files of platforms with a different byte order
+    uint64_t cache_key;
+    uint64_t payload_hash; // Hash of everything following the header
+    uint64_t leaf_cnt;     // Including dummy leaf
+    uint64_t node_cnt;
+    uint64_t quantized_node_cnt;
+    uint64_t node4_cnt;
+    uint64_t tree_depth;
+    float    quant_grid_origin[3];
+    float    quant_grid_cell_size[3];
+};
+static const char     BVH_CACHE_FILE_MAGIC[8] = { 'D','Z','S','B','V','H','C','\0' };
+static const uint32_t BVH_CACHE_BYTE_ORDER_MARK = 0x01020304;
+
+bool BVH::LoadFromCacheFile(const std::string& file_path, uint64_t cache_key)
+{
+    ZoneScoped;
+
+    if (!Utility::Path::exists(file_path))
+        return false;
+    Containers::Optional<Containers::Array<char>> file = Utility::Path::read(file_path);
+    if (!file || file->size() < sizeof(BvhCacheFileHeader)) {
+        Debug{} << PRINT_PREFIX << "WARNING: Failed to read cache file, rebuilding";
+        return false;
+    }
+
+    BvhCacheFileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    size_t payload_size =
+        header.leaf_cnt           * sizeof(Leaf) +
+        header.node_cnt           * sizeof(Node) +
+        header.quantized_node_cnt * sizeof(QuantizedNode) +
+        header.node4_cnt          * sizeof(Node4);
+    const char* payload = file->data() + sizeof(header);
+
+    bool is_valid =
+        std::memcmp(header.magic, BVH_CACHE_FILE_MAGIC, sizeof(header.magic)) == 0
+        && header.format_version  == CACHE_FORMAT_VERSION
+        && header.byte_order_mark == BVH_CACHE_BYTE_ORDER_MARK
+        && header.cache_key       == cache_key
+        && header.leaf_cnt        == leaves.size()
+        && header.tree_depth      <= MAX_TREE_DEPTH
+        && (header.node_cnt != 0) != build_params.quantize_node_aabbs
+        && (header.quantized_node_cnt != 0) == build_params.quantize_node_aabbs
+        && (header.node4_cnt != 0) == build_params.collapse_to_bvh4
+        && file->size() == sizeof(header) + payload_size
+        && HashBytes(payload, payload_size) == header.payload_hash;
+    if (!is_valid) {
+        Debug{} << PRINT_PREFIX << "Cache file is outdated or corrupt, rebuilding";
+        return false;
+    }
+
+    // Guard against cache key collisions
+    for (size_t i = 0; i < leaves.size(); i++) {
+        Leaf cached;
+        std::memcpy(&cached, payload + i * sizeof(Leaf), sizeof(Leaf));
+        if (cached.mins != leaves[i].mins || cached.maxs != leaves[i].maxs ||
+                cached.type != leaves[i].type || cached.brush_idx != leaves[i].brush_idx) {
+            Debug{} << PRINT_PREFIX << "Cache file has different leaves, rebuilding";
+            return false;
         }
     }
+    payload += leaves.size() * sizeof(Leaf);
+
+    auto ReadArray = [&payload](auto& dest, size_t cnt) {
+        dest.resize(cnt);
+        if (cnt != 0)
+            std::memcpy((void*)dest.data(), payload, cnt * sizeof(dest[0]));
+        payload += cnt * sizeof(dest[0]);
+    };
+    ReadArray(nodes,           header.node_cnt);
+    ReadArray(quantized_nodes, header.quantized_node_cnt);
+    ReadArray(nodes4,          header.node4_cnt);
+    tree_depth = header.tree_depth;
+    for (int axis = 0; axis < 3; axis++) {
+        quant_grid_origin   [axis] = header.quant_grid_origin   [axis];
+        quant_grid_cell_size[axis] = header.quant_grid_cell_size[axis];
+    }
+
+    // Mark cache file as recently used, see LimitCacheFileCount()
+    std::error_code ec;
+    std::filesystem::last_write_time(Utf8ToFsPath(file_path),
+        std::filesystem::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void BVH::SaveToCacheFile(const std::string& file_path, uint64_t cache_key) const
+{
+    ZoneScoped;
+
+    BvhCacheFileHeader header = {
+        .format_version     = CACHE_FORMAT_VERSION,
+        .byte_order_mark    = BVH_CACHE_BYTE_ORDER_MARK,
+        .cache_key          = cache_key,
+        .payload_hash       = 0, // Set below
+        .leaf_cnt           = leaves.size(),
+        .node_cnt           = nodes.size(),
+        .quantized_node_cnt = quantized_nodes.size(),
+        .node4_cnt          = nodes4.size(),
+        .tree_depth         = tree_depth,
+    };
+    std::memcpy(header.magic, BVH_CACHE_FILE_MAGIC, sizeof(header.magic));
+    for (int axis = 0; axis < 3; axis++) {
+        header.quant_grid_origin   [axis] = quant_grid_origin   [axis];
+        header.quant_grid_cell_size[axis] = quant_grid_cell_size[axis];
+    }
+
+    std::string file_content(sizeof(header), '\0');
+    auto AppendArray = [&file_content](const auto& src) {
+        file_content.append((const char*)src.data(), src.size() * sizeof(src[0]));
+    };
+    AppendArray(leaves);
+    AppendArray(nodes);
+    AppendArray(quantized_nodes);
+    AppendArray(nodes4);
+    header.payload_hash = HashBytes(file_content.data() + sizeof(header),
+                                    file_content.size() - sizeof(header));
+    std::memcpy(file_content.data(), &header, sizeof(header));
+
+    // Write to a temporary file first, so that an interrupted write can't
+    // leave a truncated cache file behind
+    std::string tmp_file_path = file_path + ".tmp";
+    bool success = Utility::Path::make(build_params.cache_dir_path) &&
+        Utility::Path::write(tmp_file_path, Containers::ArrayView<const char>{
+            file_content.data(), file_content.size() }) &&
+        Utility::Path::move(tmp_file_path, file_path);
+    if (success)
+        Debug{} << PRINT_PREFIX << "Saved cache file:" << file_path.c_str();
+    else
+        Debug{} << PRINT_PREFIX << "WARNING: Failed to save cache file:"
+            << file_path.c_str();
+
+    LimitCacheFileCount();
+}
+
+void BVH::LimitCacheFileCount() const
+{
+    ZoneScoped;
+
+    auto dir_contents = Utility::Path::list(build_params.cache_dir_path,
+        Utility::Path::ListFlag::SkipDirectories |
+        Utility::Path::ListFlag::SkipDotAndDotDot |
+        Utility::Path::ListFlag::SkipSpecial);
+    if (!dir_contents)
+        return;
+
+    // Cache files and their last write time, which is their last use
+    std::vector<std::pair<std::filesystem::file_time_type, std::string>> cache_files;
+    for (const Containers::String& file_name : *dir_contents) {
+        if (!file_name.hasSuffix(".bvhcache"))
+            continue;
+        std::string file_path = Utility::Path::join(build_params.cache_dir_path, file_name);
+        std::error_code ec;
+        auto last_use = std::filesystem::last_write_time(Utf8ToFsPath(file_path), ec);
+        if (ec)
+            continue;
+        cache_files.emplace_back(last_use, std::move(file_path));
+    }
+    if (cache_files.size() <= build_params.max_cache_file_cnt)
+        return;
 
-    if (l_idx >= 0) _GetAabbsContainingPoint_r(nodes[l_idx], pt, aabb_mins_list, aabb_maxs_list);
-    if (r_idx >= 0) _GetAabbsContainingPoint_r(nodes[r_idx], pt, aabb_mins_list, aabb_maxs_list);
+    // Delete least recently used files first
+    std::sort(cache_files.begin(), cache_files.end());
+    size_t delete_cnt = cache_files.size() - build_params.max_cache_file_cnt;
+    for (size_t i = 0; i < delete_cnt; i++) {
+        if (Utility::Path::remove(cache_files[i].second))
+            Debug{} << PRINT_PREFIX << "Deleted old cache file:"
+                << cache_files[i].second.c_str();
+    }
 }
@@ -3,9 +3,9 @@
 
 #include <cstdint>
 #include <span>
+#include <string>
 #include <vector>
 
-#include <Magnum/Math/BitVector.h>
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/CollidableWorld.h"
@@ -15,36 +15,212 @@ namespace coll {
 
 class BVH {
 public:
+    // Settings that affect how the BVH gets built
+    struct BuildParams {
+        enum class SplitMethod {
+            // Evaluate the SAH at every possible split position. Best BVH
+            // quality, but slowest build time.
+            ExactSah,
+            // Evaluate the SAH only at bin boundaries of leaf centroids.
+            // Much faster build time, usually at slightly lower BVH quality.
+            BinnedSah,
+            // Binned SAH that also considers spatial splits (SBVH): A leaf
+            // straddling the split plane may get referenced by both children,
+            // each child only bounding the leaf's AABB part on its side.
+            // Reduces sibling overlap caused by big or long leaves, e.g. long
+            // brushes and big displacements, at the cost of more nodes.
+            // Traversals make sure not to test such shared leaves twice.
+            // Building is single-threaded.
+            SpatialSah,
+        };
+        SplitMethod split_method = SplitMethod::ExactSah;
+
+        // Number of bins per axis, if split_method is BinnedSah or SpatialSah
+        size_t sah_bin_cnt = 32;
+
+        // If split_method is SpatialSah: Maximum number of additional leaf
+        // references spatial splits may create, relative to the leaf count.
+        // Clamped to [0, 1].
+        float spatial_split_budget = 0.3f;
+
+        // Number of treelet optimization passes after the tree was built.
+        // Each pass visits all nodes bottom-up and rearranges the treelet
+        // below each node (the node's descendants down to treelet_leaf_cnt
+        // treelet leaves) into the arrangement with the lowest SAH cost.
+        // Build time grows linearly with the number of passes. 0 disables it.
+        size_t treelet_optimization_passes = 0;
+
+        // Number of treelet leaves, i.e. subtrees or leaves, a treelet is
+        // rearranged with. Clamped to [3, 10]. Build time
+        // grows roughly threefold with every additional treelet leaf.
+        size_t treelet_leaf_cnt = 7;
+
+        // Maximum number of threads used for building. 0 means the number of
+        // hardware threads. The built BVH is identical regardless of this
+        // setting. Ignored in the web port, where building is single-threaded.
+        size_t max_thread_cnt = 0;
+
+        // Store node AABBs as 16-bit integers instead of floats, see
+        // QuantizedNode. Reduces node memory by more than a third. Trace
+        // results are unaffected, the slightly bigger node AABBs can only
+        // cause additional AABB and leaf tests.
+        bool quantize_node_aabbs = false;
+
+        // Additionally collapse the binary BVH into a 4-wide BVH, which is
+        // then used for traces instead. Its nodes test all children's AABBs
+        // at once using SIMD instructions, if available. The binary nodes are
+        // kept for everything else.
+        bool collapse_to_bvh4 = false;
+
+        // Estimated trace costs of leaves, which the SAH weighs split
+        // positions with. Doesn't affect trace results.
+        TraceCostModel trace_cost_model = {};
+
+        // If not empty, the built BVH is saved to a cache file inside this
+        // directory. Later constructions with identical leaves and build
+        // parameters load that file instead of building the BVH again.
+        // See GetDefaultCacheDirPath().
+        std::string cache_dir_path = "";
+
+        // Maximum number of cache files kept inside cache_dir_path. After
+        // saving a cache file, the least recently used ones beyond this count
+        // get deleted. Every map and parameter combination has its own file.
+        size_t max_cache_file_cnt = 16;
+    };
+
+    // Returns the directory the application keeps BVH cache files in, or an
+    // empty string if caching isn't supported on this platform.
+    // See BuildParams::cache_dir_path.
+    static std::string GetDefaultCacheDirPath();
+
     // Construct BVH of CollidableWorld. It must contain at least 2 collidable
     // objects.
     // CAUTION: BVH must only be created after all other collision data in
     //          CollidableWorld was created!
     BVH(CollidableWorld& c_world);
+    BVH(CollidableWorld& c_world, const BuildParams& params);
 
     // Check whether an error occurred during BVH construction.
     // If construction failed, traces cannot be performed.
-    bool WasConstructedSuccessfully();
+    bool WasConstructedSuccessfully() const;
+
+    // Whether this BVH was loaded from a cache file instead of being built
+    bool WasLoadedFromCache() const;
+
+    // Allocates the scratch memory that traces against this BVH need inside
+    // the given TraceContext. Must be called before the context is used with
+    // this BVH, so that traces don't allocate any memory themselves.
+    void PrepareTraceContext(TraceContext& ctx) const;
 
     // Does nothing if WasConstructedSuccessfully() returns false.
-    // CAUTION: Not thread-safe yet!
-    void DoTrace(Trace* trace, CollidableWorld& c_world);
+    // BVH traversal itself does not allocate any memory, as long as ctx was
+    // prepared with PrepareTraceContext().
+    // Thread-safe, as long as concurrent calls use different TraceContexts.
+    void DoTrace(Trace* trace, CollidableWorld& c_world,
+                 TraceContext& ctx) const;
+
+    // Returns expected duration in nanoseconds of tracing a random ray that
+    // hits the root node's AABB, according to the surface area heuristic (SAH)
+    // and BuildParams::trace_cost_model. Lower is better.
+    // It is the sum of every node's traversal cost and every leaf's trace
+    // cost, each weighted by the likelihood of the ray hitting their AABB.
+    // Returns 0 if WasConstructedSuccessfully() returns false.
+    float CalcSahCost() const;
+
+    // Number of leaf types. Statistics index leaf types by the bit position
+    // of their flag in CollidableTypeFlags.
+    static const size_t LEAF_TYPE_CNT = 5;
+
+    // Returns a name like "static_prop" of the given leaf type index
+    static const char* GetLeafTypeName(size_t leaf_type);
+
+    struct QualityStats {
+        size_t node_cnt = 0;
+        size_t leaf_cnt = 0; // Not counting dummy leaf
+        // Number of times nodes reference leaves. Only exceeds leaf_cnt if
+        // leaves are shared, see BuildParams::SplitMethod::SpatialSah.
+        size_t leaf_ref_cnt = 0;
+        size_t tree_depth = 0;
+        size_t node_memory_usage = 0; // In bytes
+        float sah_cost = 0.0f; // See CalcSahCost()
+
+        // Index d holds the number of leaf references with d nodes above them
+        std::vector<size_t> leaf_depth_histogram;
+        float mean_leaf_depth = 0.0f;
+
+        // Sum of the surface areas of every node's children's AABB
+        // intersection, divided by the root AABB's surface area. That's the
+        // expected number of nodes where a random ray hitting the root AABB
+        // has to test both children. Lower is better.
+        float sibling_overlap = 0.0f;
+        // Largest child AABB intersection surface area of a node, relative to
+        // that node's surface area
+        float max_sibling_overlap_ratio = 0.0f;
+
+        size_t leaf_cnt_by_type[LEAF_TYPE_CNT] = {};
+
+        // Subtrees rooted at the nodes subtree_depth levels below the root
+        // node, in depth-first order. Leaves above that level aren't part of
+        // any subtree.
+        struct Subtree {
+            Magnum::Vector3 mins;
+            Magnum::Vector3 maxs;
+            size_t node_cnt = 0;
+            // Leaf references, leaves shared with other subtrees are counted
+            // in each of them
+            size_t leaf_cnt = 0;
+            size_t leaf_cnt_by_type[LEAF_TYPE_CNT] = {};
+        };
+        std::vector<Subtree> subtrees;
+    };
+
+    // Gathers statistics about the BVH's structure, e.g. to compare BVH
+    // builder variants. Subtrees are listed for nodes subtree_depth levels
+    // below the root node, i.e. there are up to 2^subtree_depth of them.
+    // Returns empty statistics if WasConstructedSuccessfully() returns false.
+    QualityStats CalcQualityStats(size_t subtree_depth = 3) const;
+
+    // Determines all leaves whose AABB overlaps the given AABB, considering
+    // only leaves of the given CollidableTypeFlags. Ray-only leaves (see
+    // Leaf::is_ray_only) are never considered. Their indices are written
+    // into dest_leaf_indices until it is full. Returns the total number of
+    // overlapping leaves, which might exceed the size of dest_leaf_indices.
+    // Shared leaves (see BuildParams::SplitMethod::SpatialSah) are reported
+    // and counted once, ctx keeps track of them.
+    // Doesn't allocate any memory, as long as ctx was prepared with
+    // PrepareTraceContext(). Thread-safe, as long as concurrent calls use
+    // different TraceContexts.
+    // Returns 0 if WasConstructedSuccessfully() returns false.
+    size_t GetLeavesOverlappingAabb(
+        const Magnum::Vector3& mins, const Magnum::Vector3& maxs,
+        std::span<uint32_t> dest_leaf_indices, TraceContext& ctx,
+        uint32_t collidable_types = COLLIDABLE_ALL) const;
 
     // Debug function. Does nothing if WasConstructedSuccessfully() returns false.
     void GetAabbsContainingPoint(const Magnum::Vector3& pt,
         std::vector<Magnum::Vector3>* aabb_mins_list,
-        std::vector<Magnum::Vector3>* aabb_maxs_list);
+        std::vector<Magnum::Vector3>* aabb_maxs_list) const;
 
-private:
-    template<std::size_t size> using BitVector = Magnum::Math::BitVector<size>;
+    // For each given point, determines the indices of all leaves whose AABB
+    // contains it. Leaf indices of points[i] are written to dest_leaf_indices,
+    // from index dest_point_offsets[i] up to (excluding) index
+    // dest_point_offsets[i + 1]. Both vectors are cleared first. Reusing them
+    // for repeated calls avoids reallocations.
+    // If WasConstructedSuccessfully() returns false, no point contains leaves.
+    void GetLeavesContainingPoints(std::span<const Magnum::Vector3> points,
+        std::vector<uint32_t>* dest_leaf_indices,
+        std::vector<size_t>* dest_point_offsets) const;
 
+private:
     struct Leaf {
         // AABB of referenced map object, but slightly bloated.
         Magnum::Vector3 mins;
         Magnum::Vector3 maxs;
 
         // When adding more types, make sure to add cases to switch statements
-        // that check these types. COUNT must remain the last enum entry.
-        enum Type {
+        // that check these types and a matching flag to CollidableTypeFlags.
+        // COUNT must remain the last enum entry.
+        enum Type : uint8_t {
             Brush,
             Displacement,
             StaticProp,
@@ -53,6 +229,16 @@ private:
             COUNT
         } type;
 
+        // Whether more than one node references this leaf. Only spatial
+        // splits create such shared leaves, see BuildParams::SplitMethod.
+        bool is_shared = false;
+
+        // Whether only ray traces can collide with this leaf. Only true for
+        // displacements with the NO_HULL_COLL flag. Hull traces skip these
+        // leaves like leaves of types they don't collide with, see
+        // GetLeafTypeFlags().
+        bool is_ray_only = false;
+
         // Index of referenced map object
         union {
             uint32_t     brush_idx; // if type == Brush:        idx into BspMap.brushes
@@ -63,30 +249,156 @@ private:
         };
     };
 
+    // Compact BVH node, stored in depth-first order inside the nodes array.
+    // Depth-first order means that a node's left child node (if it has one)
+    // is located directly after it in the nodes array. Nodes and their
+    // subtrees therefor occupy contiguous ranges of the nodes array, which is
+    // more cache-friendly during BVH traversal.
     struct Node {
         // AABB encompassing both children's AABB.
         Magnum::Vector3 mins;
         Magnum::Vector3 maxs;
 
-        // Child indices:
+        // Right child index:
         //   Index into nodes  if (idx >= 0).  =>  nodes[idx]
         //   Index into leaves if (idx < 0).   =>  leaves[-idx]
-        int32_t child_l;
         int32_t child_r;
 
+        // Left child: If this is 0, the left child is the node directly
+        // following this node in the nodes array  =>  nodes[this_idx + 1]
+        // Otherwise, the left child is a leaf  =>  leaves[child_l_leaf_idx]
+        // (This works because leaf index 0 refers to the dummy leaf.)
+        uint32_t child_l_leaf_idx : 24;
+
         // Flags indicating which types of leafs are contained in this node.
-        // A leaf type's enum value signifies its bit position in this BitVector.
-        BitVector<Leaf::Type::COUNT> contained_leaf_types{ Magnum::Math::ZeroInit };
+        // A leaf type's enum value signifies its bit position in these flags.
+        // Ray-only leaves use RAY_ONLY_DISP_LEAF_FLAG instead.
+        uint32_t contained_leaf_types : 8;
 
         // @Optimization To speed up BVH traversal, we could add further node
         //               content information to this structure such as OR-ed
         //               'contents' flags of contained brushes.
     };
+    static_assert(sizeof(Node) <= 32, "BVH nodes must fit in 32 bytes");
+    static_assert(Leaf::Type::COUNT + 1 <= 8, "Node's leaf type flags are too small");
+
+    // Leaf type flag of ray-only displacements, see Leaf::is_ray_only. Isn't
+    // part of CollidableTypeFlags, so hull traces and overlap queries never
+    // match it.
+    static const uint32_t RAY_ONLY_DISP_LEAF_FLAG = 1u << Leaf::Type::COUNT;
+
+    // Leaf type flags are compared against Trace::Info::collidable_types
+    static_assert(COLLIDABLE_BRUSHES       == 1u << Leaf::Type::Brush);
+    static_assert(COLLIDABLE_DISPLACEMENTS == 1u << Leaf::Type::Displacement);
+    static_assert(COLLIDABLE_STATIC_PROPS  == 1u << Leaf::Type::StaticProp);
+    static_assert(COLLIDABLE_DYNAMIC_PROPS == 1u << Leaf::Type::DynamicProp);
+    static_assert(COLLIDABLE_FUNC_BRUSHES  == 1u << Leaf::Type::FuncBrush);
+    static_assert(COLLIDABLE_ALL == (1u << Leaf::Type::COUNT) - 1);
+    static_assert(LEAF_TYPE_CNT == Leaf::Type::COUNT);
+    static_assert(sizeof(Leaf) <= 32, "BVH leaves must fit in 32 bytes");
+
+    // Alternative to Node whose AABB is stored as 16-bit integer coordinates
+    // of a grid spanning the root node's AABB. The grid coordinates are
+    // rounded outwards, the dequantized AABB always encloses the exact AABB.
+    // Stored in the same depth-first order, child indices work like in Node.
+    struct QuantizedNode {
+        uint16_t q_mins[3]; // Grid coordinates, see DequantizeCoord()
+        uint16_t q_maxs[3];
+
+        int32_t  child_r;                   // See Node
+        uint32_t child_l_leaf_idx     : 24; // See Node
+        uint32_t contained_leaf_types :  8; // See Node
+    };
+    static_assert(sizeof(QuantizedNode) <= 20, "Quantized BVH nodes must fit in 20 bytes");
+
+    // Node of the 4-wide BVH, see BuildParams::collapse_to_bvh4. Stores the
+    // AABBs of its children in SoA layout, allowing them to be tested at once.
+    // Stored in depth-first order inside the nodes4 array, like Node.
+    struct alignas(16) Node4 {
+        float child_mins[3][4]; // [axis][child slot]
+        float child_maxs[3][4]; // [axis][child slot]
+
+        // Child indices of the first child_cnt slots:
+        //   Index into nodes4 if (idx >= 0).  =>  nodes4[idx]
+        //   Index into leaves if (idx < 0).   =>  leaves[-idx]
+        int32_t children[4];
+        uint32_t child_cnt; // 2 to 4
+
+        // Leaf type flags of each child slot, see Node::contained_leaf_types
+        uint8_t child_leaf_types[4];
+    };
+
+    // Largest leaf index that can be referenced by Node::child_l_leaf_idx
+    static const uint32_t MAX_LEAF_IDX = (1 << 24) - 1;
+
+    // Node representation used during BVH construction, before nodes get
+    // rearranged into their compact depth-first layout.
+    struct BuildNode {
+        // AABB encompassing both children's AABB.
+        Magnum::Vector3 mins;
+        Magnum::Vector3 maxs;
+
+        // Child indices:
+        //   Index into build nodes if (idx >= 0).  =>  build_nodes[idx]
+        //   Index into leaves      if (idx < 0).   =>  leaves[-idx]
+        int32_t child_l;
+        int32_t child_r;
+    };
+
+    // Maximum tree depth the BVH is allowed to have. Construction ensures
+    // that it isn't exceeded, allowing traversal to use a fixed-size stack.
+    static const size_t MAX_TREE_DEPTH = 128;
+
+    // Tree depth up to which nodes are split using the SAH. Deeper nodes are
+    // split at their median, limiting the tree depth in degenerate cases
+    // (e.g. many leaves with identical AABBs).
+    // Must be chosen so that median splits can't exceed MAX_TREE_DEPTH.
+    static const size_t MAX_SAH_SPLIT_DEPTH = 64;
+
+    // Spatial splits at most double the number of leaf references:
+    // log2(2 * MAX_LEAF_IDX) == 25
+    static_assert(MAX_SAH_SPLIT_DEPTH + 25 < MAX_TREE_DEPTH);
+
+    // Maximum of BuildParams::sah_bin_cnt
+    static const size_t MAX_SAH_BIN_CNT = 64;
+
+    // Maximum of BuildParams::treelet_leaf_cnt
+    static const size_t MAX_TREELET_LEAF_CNT = 10;
+
+    // Spatial splits are only considered for nodes whose best object split
+    // yields children whose AABB intersection has at least this surface area,
+    // relative to the root node's surface area. Avoids the cost of evaluating
+    // spatial splits where they can't be beneficial.
+    static constexpr float SPATIAL_SPLIT_MIN_OVERLAP = 1e-5f;
+
+    BuildParams build_params;
 
     std::vector<Leaf> leaves; // Has a dummy leaf at index 0
-    std::vector<Node> nodes;
+    // Indexed like leaves, see CalcLeafTraceCost(). Computed once after leaf
+    // creation, the dummy leaf has no cost.
+    std::vector<uint64_t> leaf_trace_costs;
+
+    // Only one of these arrays is filled, depending on
+    // BuildParams::quantize_node_aabbs
+    std::vector<Node>          nodes;
+    std::vector<QuantizedNode> quantized_nodes;
+
+    // Grid used by quantized nodes. Grid coordinate q on axis i refers to
+    // position (quant_grid_origin[i] + q * quant_grid_cell_size[i]).
+    Magnum::Vector3 quant_grid_origin;
+    Magnum::Vector3 quant_grid_cell_size;
+
+    // Only filled if BuildParams::collapse_to_bvh4 is set
+    std::vector<Node4> nodes4;
     size_t total_leaf_cnt; // Not counting dummy leaf, equal to (leaves.size()-1)
 
+    // Maximum number of nodes along any path from the root node to a leaf.
+    // Traversing the tree depth-first requires a stack of (tree_depth + 1)
+    // entries at most.
+    size_t tree_depth = 0;
+
+    bool was_loaded_from_cache = false;
+
 private:
     static bool IsPointInAabb(const Magnum::Vector3& pt,
         const Magnum::Vector3& mins, const Magnum::Vector3& maxs);
@@ -98,7 +410,18 @@ private:
     void CalcAabbOfBvhLeaves(std::span<const uint32_t> leaf_refs,
         Magnum::Vector3* aabb_mins, Magnum::Vector3* aabb_maxs) const;
 
-    static uint64_t GetLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world);
+    // Estimated duration of tracing against a leaf in picoseconds, given that
+    // the trace hits the leaf's AABB. See BuildParams::trace_cost_model.
+    // Slow, only used to fill leaf_trace_costs.
+    uint64_t CalcLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world) const;
+
+    // Properties of a leaf's object that its trace cost depends on
+    static TraceCostModel::Factors GetLeafTraceCostFactors(const Leaf& leaf,
+                                                   CollidableWorld& c_world);
+
+    // Estimated duration in nanoseconds, see CalcLeafTraceCost()
+    static float EstimateLeafTraceCost(Leaf::Type type,
+        const TraceCostModel::Factors& factors, const TraceCostModel& model);
 
     struct NodeSplitDetails {
         // Axis to split node on. 0 -> X axis, 1 -> Y axis, 2 -> Z axis
@@ -113,30 +436,235 @@ private:
     // At least 2 leafs must be given for the node that gets split.
     // Splits are always determined in a way that ensures that the resulting
     // children have at least one leaf.
-    NodeSplitDetails DetermineBeneficialNodeSplit(const Node& node_to_split,
-        std::span<uint32_t> leaf_refs_sorted_along_axis[3],
-        CollidableWorld& c_world) const;
+    NodeSplitDetails DetermineBeneficialNodeSplit(const BuildNode& node_to_split,
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const;
+
+    // Faster, binned alternative to DetermineBeneficialNodeSplit().
+    // Same requirements and guarantees apply.
+    NodeSplitDetails DetermineBinnedNodeSplit(const BuildNode& node_to_split,
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const;
+
+    // Splits node on its largest axis, assigning half of the leaves to each
+    // child. At least 2 leafs must be given for the node that gets split.
+    static NodeSplitDetails DetermineMedianNodeSplit(
+        const BuildNode& node_to_split, size_t leaf_cnt);
 
     void DoTraceAgainstLeaf(Trace* trace, const Leaf& leaf,
-                            CollidableWorld& c_world) const;
+                            CollidableWorld& c_world, TraceContext& ctx) const;
+
+    // Must be called at the start of every traversal that uses
+    // CheckAndMarkSharedLeafVisit(), it invalidates the marks of previous
+    // traversals.
+    static void BeginSharedLeafTracking(TraceContext& ctx);
+
+    // Returns true if the current traversal already visited the shared leaf,
+    // otherwise marks it as visited.
+    bool CheckAndMarkSharedLeafVisit(TraceContext& ctx, uint32_t leaf_idx) const;
+
+    // Traverses the given nodes array, which must be nodes or quantized_nodes.
+    template<class NodeType>
+    void DoTraceImpl(Trace* trace, const std::vector<NodeType>& node_array,
+                     CollidableWorld& c_world, TraceContext& ctx) const;
+
+    // Overlap query of GetLeavesOverlappingAabb(). The given nodes array must
+    // be nodes or quantized_nodes.
+    template<class NodeType>
+    size_t GetLeavesOverlappingAabbImpl(const std::vector<NodeType>& node_array,
+        const Magnum::Vector3& mins, const Magnum::Vector3& maxs,
+        std::span<uint32_t> dest_leaf_indices, TraceContext& ctx,
+        uint32_t collidable_types) const;
+
+    // Traverses the 4-wide BVH. Must only be called if nodes4 isn't empty.
+    void DoTraceBvh4(Trace* trace, CollidableWorld& c_world,
+                     TraceContext& ctx) const;
+
+    // Tests the trace against all AABBs of the given node's children at once.
+    // Returns a bit mask of hit children, where bit i refers to child slot i.
+    // The hit fraction of hit children is put into hit_fractions. Results are
+    // identical to Trace::HitsAabb().
+    static unsigned int HitsFourAabbs(const Trace& trace, const Node4& node,
+                                      float hit_fractions[4]);
 
     // Fills leaves array with one dummy leaf and further leafs.
     // Returns false if leaf creation failed, true otherwise.
     bool CreateLeaves(CollidableWorld& c_world);
 
-    // start_node_idx is an index into nodes.
-    // Given start node has its AABB set. Start node must have at least 2 leaves.
-    void CreateNodeHierarchy(uint32_t start_node_idx,
-        std::span<uint32_t> start_node_leaf_refs_sorted_along_axis[3],
-        CollidableWorld& c_world);
+    // A node whose AABB is set and whose children are yet to be determined.
+    struct UnsplitNode {
+        uint32_t build_node_idx; // idx into build_nodes
+
+        // Number of nodes from the root node down to this node, including both
+        size_t depth;
+
+        // Leafs assigned to this node, sorted along all 3 axes.
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3];
+    };
+
+    // Nodes with at most this many leaves are split on worker threads, if
+    // the BVH is built using multiple threads.
+    static const size_t MT_SUBTREE_MAX_LEAF_CNT = 2048;
+
+    // Splits given start node and its descendants until all of their children
+    // are leaves. Start node must have at least 2 leaves.
+    // If deferred_nodes is given, nodes with at most max_deferred_leaf_cnt
+    // leaves don't get split, they get appended to deferred_nodes instead.
+    // Concurrent calls are allowed if they build disjoint subtrees into
+    // different build_nodes arrays.
+    void CreateNodeHierarchy(std::vector<BuildNode>& build_nodes,
+        const UnsplitNode& start_node,
+        std::vector<UnsplitNode>* deferred_nodes = nullptr,
+        size_t max_deferred_leaf_cnt = 0) const;
+
+    // Same result as calling CreateNodeHierarchy() on the given start node,
+    // but independent subtrees get built on multiple threads.
+    void CreateNodeHierarchyMultithreaded(std::vector<BuildNode>& build_nodes,
+        const UnsplitNode& start_node,
+        size_t thread_cnt) const;
+
+    // Reference to a leaf during BVH construction with spatial splits. Its
+    // AABB is the leaf's AABB, clipped by the spatial splits of its ancestors.
+    struct SpatialLeafRef {
+        Magnum::Vector3 mins;
+        Magnum::Vector3 maxs;
+        uint32_t leaf_idx; // idx into leaves
+    };
+
+    struct SpatialNodeSplit {
+        // If false, this is an object split: Leaf refs whose AABB centroid
+        // lies in a bin below split_bin go to the left child, the others go
+        // to the right child.
+        // If true, this is a spatial split: Leaf refs whose AABB starts in a
+        // bin below split_bin go to the left child, leaf refs whose AABB ends
+        // in split_bin or above go to the right child. Leaf refs that do both
+        // get clipped at the split plane and go to both children.
+        bool is_spatial;
+
+        // Axis to split node on. 0 -> X axis, 1 -> Y axis, 2 -> Z axis
+        int axis;
+
+        // The bin of position x on the split axis is
+        // floor((x - bin_origin) * bin_scale), clamped to [0, bin_cnt - 1].
+        float bin_origin;
+        float bin_scale;
+        size_t bin_cnt;
+        size_t split_bin;
+
+        // Position of the split plane on the split axis, spatial splits only
+        float plane_pos;
+    };
+
+    // Determines the split with the lowest SAH cost among binned object
+    // splits and, if allowed, spatial splits. Spatial splits may create at
+    // most max_extra_ref_cnt additional leaf refs and always leave both
+    // children with fewer leaf refs than the node has.
+    // At least 2 leaf refs must be given. Returns false if no split separates
+    // them, e.g. if all their centroids are identical.
+    bool DetermineSpatialNodeSplit(const BuildNode& node_to_split,
+        std::span<const SpatialLeafRef> leaf_refs,
+        float root_aabb_surface_area,
+        size_t max_extra_ref_cnt,
+        SpatialNodeSplit* dest_split) const;
+
+    // Alternative to CreateNodeHierarchy() if split_method is SpatialSah.
+    // Splits the root build node, whose AABB must be set, and its descendants
+    // until all their children are leaves.
+    void CreateNodeHierarchySpatial(std::vector<BuildNode>& build_nodes) const;
+
+    // Performs BuildParams::treelet_optimization_passes on the given node
+    // hierarchy. Build node at index 0 must be the root. Only node AABBs and
+    // the arrangement of nodes change, each leaf keeps being referenced the
+    // same number of times.
+    void OptimizeTreelets(std::vector<BuildNode>& build_nodes) const;
+
+    // Returns number of threads that should be used for building
+    size_t GetBuildThreadCount() const;
+
+    // Fills nodes array with the given node hierarchy, rearranged into the
+    // compact depth-first layout. Build node at index 0 must be the root.
+    // Also determines tree_depth.
+    void CreateCompactNodes(const std::vector<BuildNode>& build_nodes);
+
+    // Replaces nodes with quantized_nodes. Node contents info must be set.
+    void QuantizeNodes();
+
+    // Fills nodes4 by collapsing the (non-quantized) binary nodes.
+    void CreateBvh4Nodes();
+
+    // Returns position of the given quantization grid coordinate on an axis
+    float DequantizeCoord(uint16_t q, int axis) const;
+
+    // Returns the node's AABB, dequantized if necessary.
+    void GetNodeAabb(const Node& node,
+        Magnum::Vector3* mins, Magnum::Vector3* maxs) const;
+    void GetNodeAabb(const QuantizedNode& node,
+        Magnum::Vector3* mins, Magnum::Vector3* maxs) const;
+    void GetNodeAabb(int32_t node_idx,
+        Magnum::Vector3* mins, Magnum::Vector3* maxs) const;
+
+    // Number of nodes, regardless of whether they're quantized or not
+    size_t GetNodeCount() const;
+
+    // Returns memory used by the nodes array in use, in bytes
+    size_t GetNodeMemoryUsage() const;
+
+    // Returns index of the given node's left child. See Node struct for details.
+    template<class NodeType>
+    static int32_t GetLeftChildIdx(const std::vector<NodeType>& node_array,
+                                   int32_t node_idx);
+    int32_t GetLeftChildIdx(int32_t node_idx) const;
+    int32_t GetRightChildIdx(int32_t node_idx) const;
+
+    // Returns the flag of the leaf's type, or RAY_ONLY_DISP_LEAF_FLAG if it is
+    // a ray-only leaf. See Node::contained_leaf_types.
+    static uint32_t GetLeafTypeFlags(const Leaf& leaf);
+
+    // Returns leaf type flags of all leaves the trace can collide with: Its
+    // collidable types, plus ray-only displacements if it is a ray trace that
+    // collides with displacements.
+    static uint32_t GetTraceLeafTypeFlags(const Trace& trace);
+
+    // Returns leaf type flags of a child node or leaf, given its index as
+    // returned by GetLeftChildIdx(). See Node::contained_leaf_types.
+    template<class NodeType>
+    uint32_t GetChildLeafTypes(const std::vector<NodeType>& node_array,
+                               int32_t child_idx) const;
 
     // This function assumes that all leaves and nodes have been created and
     // stored in the nodes and leaves arrays.
     void SetNodeContentsInfo();
 
-    void _GetAabbsContainingPoint_r(const Node& node, const Magnum::Vector3& pt,
-        std::vector<Magnum::Vector3>* aabb_mins_list,
-        std::vector<Magnum::Vector3>* aabb_maxs_list);
+    // Sets Leaf::is_shared of all leaves, according to the node arrays.
+    void MarkSharedLeaves();
+
+    // Version of the cache file format. Increment it whenever the file
+    // layout, the node or leaf structs or the build algorithm change!
+    static const uint32_t CACHE_FORMAT_VERSION = 3;
+
+    // Returns hash of everything the built nodes depend on: The leaves, their
+    // trace costs and the build parameters. Leaves must have been created.
+    uint64_t CalcCacheKey() const;
+
+    std::string GetCacheFilePath(uint64_t cache_key) const;
+
+    // Fills the node arrays from the given cache file. Returns false and
+    // leaves nodes untouched if the file is missing, outdated, corrupt or
+    // doesn't match the cache key and leaves.
+    bool LoadFromCacheFile(const std::string& file_path, uint64_t cache_key);
+
+    // Saves the node and leaf arrays to the given cache file
+    void SaveToCacheFile(const std::string& file_path, uint64_t cache_key) const;
+
+    // Deletes the least recently used cache files inside the cache directory
+    // until at most BuildParams::max_cache_file_cnt remain.
+    void LimitCacheFileCount() const;
+
+    // Calls on_node(mins, maxs) for every node and on_leaf(leaf_idx) for every
+    // leaf whose AABB contains the point, in depth-first order. Nodes are
+    // visited before their leaf children, left children before right ones.
+    // Shared leaves are reported once per node that references them.
+    template<class NodeCallback, class LeafCallback>
+    void VisitAabbsContainingPoint(const Magnum::Vector3& pt,
+        NodeCallback on_node, LeafCallback on_leaf) const;
 
 private:
     // Debugger needs to debug, let it access private members.
@@ -12,19 +12,35 @@
 #if COLL_BENCHMARK_ENABLED // When disabled, don't waste time compiling this file
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
 #include <optional>
 #include <random>
-
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Corrade/Containers/Optional.h>
+#include <Corrade/Containers/String.h>
+#include <Corrade/Containers/StringStl.h>
 #include <Corrade/Containers/StringView.h>
 #include <Corrade/Utility/DebugStl.h>
+#include <Corrade/Utility/Path.h>
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Functions.h>
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/CollidableWorld_Impl.h"
+#include "coll/TraceContext.h"
 #include "csgo_parsing/BspMap.h"
 #include "GlobalVars.h"
 
@@ -35,6 +51,23 @@ using namespace Corrade::Containers::Literals;
 using namespace Magnum;
 using Plane = csgo_parsing::BspMap::Plane;
 
+// Replacements of the global allocation functions that count every heap
+// allocation of the program. The array and nothrow variants of operator new
+// call these by default.
+static std::atomic<size_t> g_heap_alloc_cnt = 0;
+
+void* operator new(std::size_t size)
+{
+    g_heap_alloc_cnt.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+    if (void* ptr = std::malloc(size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
 struct SingleSPropBenchmark { // Info of benchmarking a single static prop
     size_t sprop_idx;    // idx into BspMap.static_props
     size_t bvh_leaf_idx; // idx into BVH.leaves
@@ -67,8 +100,7 @@ void Benchmark::StaticPropHullTracing()
 
     if (!g_coll_world) return;
 
-    unsigned int trng_val = std::random_device{}();
-    unsigned int seed = trng_val;
+    unsigned int seed = GetSeed();
     Debug{} << "[Benchmark::StaticPropHullTracing] Used seed:" << seed; // To let user reproduce this benchmark
     std::mt19937 gen{seed};
 
@@ -129,11 +161,9 @@ void Benchmark::StaticPropHullTracing()
                 for (size_t i = 0; i < NUM_ITERATIONS; i++) // Precreate traces with info and empty results
                     iter_traces.emplace_back(u_tr.realistic_trace_info);
 
-                // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
-#ifndef _WIN32
-#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
-#endif
-                // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+                // Run iterations and measure their wall time.
+                // On Windows, std::chrono::high_resolution_clock is the most
+                // precise clock. On Linux, it has nanosecond resolution too.
                 auto method_iters_start = std::chrono::high_resolution_clock::now();
                 for (Trace& trace : iter_traces) {
                     switch (method_idx) {
@@ -226,6 +256,17 @@ void Benchmark::StaticPropHullTracing()
 
     Debug{} << "------------------------";
 
+    // Record durations of all unique traces across all static props
+    for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++) {
+        std::vector<unsigned long long> durations;
+        durations.reserve(total_num_unique_traces);
+        for (const SingleSPropBenchmark& sprop_b : sprop_benchmarks)
+            for (const SingleSPropBenchmark::UniqueTrace& u_tr : sprop_b.unique_traces)
+                durations.push_back(u_tr.mean_duration_ns_per_method[method_idx]);
+        AddResult("StaticPropHullTracing",
+                  "trace_method_" + std::to_string(method_idx), seed, durations);
+    }
+
     // Print statistics across all static props
     for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++) {
         uint64_t overall_sum_ns = 0; // ns
@@ -267,6 +308,1453 @@ void Benchmark::StaticPropHullTracing()
     //      does the sprop mean stabilize?
 }
 
+void Benchmark::BvhTracing()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::BvhTracing] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_REALISTIC_TRACES = 20000;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each trace
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    CreateDispCollCaches(ctx); // Measured traces mustn't create them
+
+    std::vector<Trace> realistic_traces =
+        GenRealisticWorldTraces(gen, bvh, NUM_REALISTIC_TRACES, ctx);
+
+    std::vector<unsigned long long> mean_durations;
+    mean_durations.reserve(NUM_REALISTIC_TRACES);
+    std::vector<Trace> iter_traces;
+    iter_traces.reserve(NUM_ITERATIONS);
+    size_t total_alloc_cnt = 0;
+    size_t num_allocating_traces = 0;
+    size_t num_incorrect = 0;
+    for (const Trace& r_tr : realistic_traces) {
+        // Precreate traces with info and empty results
+        iter_traces.clear();
+        for (size_t i = 0; i < NUM_ITERATIONS; i++)
+            iter_traces.emplace_back(r_tr.info);
+
+        size_t alloc_cnt_start = GetHeapAllocationCount();
+        auto iters_start = std::chrono::high_resolution_clock::now();
+        for (Trace& trace : iter_traces)
+            bvh.DoTrace(&trace, *g_coll_world, ctx);
+        auto iters_end = std::chrono::high_resolution_clock::now();
+        size_t alloc_cnt = GetHeapAllocationCount() - alloc_cnt_start;
+
+        unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(iters_end - iters_start).count();
+        mean_durations.push_back(duration_sum_ns / NUM_ITERATIONS);
+
+        total_alloc_cnt += alloc_cnt;
+        if (alloc_cnt != 0)
+            num_allocating_traces++;
+
+        if (!CompareTraceResults(r_tr.info, r_tr.results, iter_traces[0].results))
+            num_incorrect++;
+    }
+
+    BenchmarkStatistics stats = AddResult("BvhTracing", "trace", seed, mean_durations);
+    Debug d{ Debug::Flag::NoSpace };
+    d << "BVH trace " << GetDurationStr(stats.mean) << " ± " << GetPercentStr(stats.stddev / stats.mean);
+    d << " (max=" << GetDurationStr(stats.max);
+    d << ",95%="  << GetDurationStr(stats._95th_percentile);
+    d << ",50%="  << GetDurationStr(stats.median);
+    d << ",5%="   << GetDurationStr(stats._5th_percentile);
+    d << ",min="  << GetDurationStr(stats.min);
+    d << ")";
+
+    Debug::Color alloc_col = total_alloc_cnt == 0 ? Debug::Color::Green : Debug::Color::Red;
+    Debug{ Debug::Flag::NoSpace } << Debug::color(alloc_col)
+        << "Heap allocations: " << total_alloc_cnt << " in "
+        << NUM_REALISTIC_TRACES * NUM_ITERATIONS << " traces ("
+        << num_allocating_traces << " / " << NUM_REALISTIC_TRACES
+        << " unique traces allocated memory)";
+    if (num_incorrect != 0)
+        Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Red)
+            << num_incorrect << " / " << NUM_REALISTIC_TRACES
+            << " traces produced inconsistent results!";
+    Debug{} << "[Benchmark::BvhTracing] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::XPropTracing()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::XPropTracing] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_TRACES = 20000;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each trace
+
+    // Collect leaves of static and dynamic props
+    std::vector<size_t> xprop_leaf_indices;
+    for (size_t i = 1; i < bvh.leaves.size(); i++)
+        if (bvh.leaves[i].type == BVH::Leaf::Type::StaticProp ||
+            bvh.leaves[i].type == BVH::Leaf::Type::DynamicProp)
+            xprop_leaf_indices.push_back(i);
+    if (xprop_leaf_indices.empty()) {
+        Debug{} << "[Benchmark::XPropTracing] Map has no solid props";
+        return;
+    }
+
+    // Generate hull traces that hit the AABB of randomly picked props
+    std::uniform_int_distribution<size_t> leaf_dis(0, xprop_leaf_indices.size() - 1);
+    std::vector<std::pair<size_t, Trace>> traces; // Leaf idx and trace
+    traces.reserve(NUM_TRACES);
+    while (traces.size() < NUM_TRACES) {
+        size_t leaf_idx = xprop_leaf_indices[leaf_dis(gen)];
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+        Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+        if (tr.HitsAabb(leaf.mins, leaf.maxs))
+            traces.emplace_back(leaf_idx, tr);
+    }
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    std::vector<unsigned long long> mean_durations;
+    mean_durations.reserve(NUM_TRACES);
+    std::vector<Trace> iter_traces;
+    iter_traces.reserve(NUM_ITERATIONS);
+    size_t total_alloc_cnt = 0;
+    size_t num_allocating_traces = 0;
+    for (const auto& [leaf_idx, tr] : traces) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+
+        // Precreate traces with info and empty results
+        iter_traces.clear();
+        for (size_t i = 0; i < NUM_ITERATIONS; i++)
+            iter_traces.emplace_back(tr.info);
+
+        size_t alloc_cnt_start = GetHeapAllocationCount();
+        auto iters_start = std::chrono::high_resolution_clock::now();
+        for (Trace& trace : iter_traces)
+            bvh.DoTraceAgainstLeaf(&trace, leaf, *g_coll_world, ctx);
+        auto iters_end = std::chrono::high_resolution_clock::now();
+        size_t alloc_cnt = GetHeapAllocationCount() - alloc_cnt_start;
+
+        unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(iters_end - iters_start).count();
+        mean_durations.push_back(duration_sum_ns / NUM_ITERATIONS);
+
+        total_alloc_cnt += alloc_cnt;
+        if (alloc_cnt != 0)
+            num_allocating_traces++;
+    }
+
+    BenchmarkStatistics stats = AddResult("XPropTracing", "trace", seed, mean_durations);
+    Debug d{ Debug::Flag::NoSpace };
+    d << "Prop trace " << GetDurationStr(stats.mean) << " ± " << GetPercentStr(stats.stddev / stats.mean);
+    d << " (max=" << GetDurationStr(stats.max);
+    d << ",95%="  << GetDurationStr(stats._95th_percentile);
+    d << ",50%="  << GetDurationStr(stats.median);
+    d << ",5%="   << GetDurationStr(stats._5th_percentile);
+    d << ",min="  << GetDurationStr(stats.min);
+    d << ")";
+
+    size_t total_trace_cnt = NUM_TRACES * NUM_ITERATIONS;
+    Debug::Color alloc_col = total_alloc_cnt == 0 ? Debug::Color::Green : Debug::Color::Red;
+    Debug{ Debug::Flag::NoSpace } << Debug::color(alloc_col)
+        << "Heap allocations: " << total_alloc_cnt << " in "
+        << total_trace_cnt << " prop traces ("
+        << (float)total_alloc_cnt / total_trace_cnt << " per trace, "
+        << num_allocating_traces << " / " << NUM_TRACES
+        << " unique traces allocated memory)";
+    Debug{} << "[Benchmark::XPropTracing] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::MultithreadedTracing()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::MultithreadedTracing] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_REALISTIC_TRACES = 20000;
+    const size_t thread_cnt = std::max(2u, std::thread::hardware_concurrency());
+
+    // Generate realistic traces and their single-threaded results
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    std::vector<Trace> realistic_traces =
+        GenRealisticWorldTraces(gen, bvh, NUM_REALISTIC_TRACES, ctx);
+
+    // Remove displacement collision caches, threads should race to create them
+    for (CDispCollTree& disp_coll : *g_coll_world->pImpl->disp_coll_trees)
+        disp_coll.Uncache();
+
+    // Let all threads perform the same traces in the same order at once
+    std::vector<std::vector<Trace::Results>> thread_results(thread_cnt);
+    std::vector<std::thread> threads;
+    threads.reserve(thread_cnt);
+    auto mt_start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < thread_cnt; t++) {
+        threads.emplace_back([&realistic_traces, &results = thread_results[t]]() {
+            TraceContext thread_ctx;
+            g_coll_world->PrepareTraceContext(thread_ctx);
+            results.reserve(realistic_traces.size());
+            for (const Trace& r_tr : realistic_traces) {
+                Trace trace{ r_tr.info };
+                g_coll_world->DoTrace(&trace, thread_ctx);
+                results.push_back(trace.results);
+            }
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    auto mt_end = std::chrono::high_resolution_clock::now();
+    unsigned long long mt_duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mt_end - mt_start).count();
+
+    // Compare each thread's results to the single-threaded ones
+    size_t num_incorrect = 0;
+    for (const std::vector<Trace::Results>& results : thread_results)
+        for (size_t i = 0; i < realistic_traces.size(); i++)
+            if (!CompareTraceResults(realistic_traces[i].info,
+                                     realistic_traces[i].results, results[i]))
+                num_incorrect++;
+
+    size_t total_trace_cnt = thread_cnt * NUM_REALISTIC_TRACES;
+    Debug{ Debug::Flag::NoSpace } << thread_cnt << " threads performed "
+        << total_trace_cnt << " traces in " << GetDurationStr((float)mt_duration_ns)
+        << " (" << GetDurationStr((float)mt_duration_ns / total_trace_cnt)
+        << " per trace)";
+
+    Debug::Color result_col = num_incorrect == 0 ? Debug::Color::Green : Debug::Color::Red;
+    Debug{ Debug::Flag::NoSpace } << Debug::color(result_col)
+        << num_incorrect << " / " << total_trace_cnt
+        << " multithreaded traces produced results that differ from "
+           "single-threaded traces";
+    Debug{} << "[Benchmark::MultithreadedTracing] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::BvhConstruction()
+{
+    if (!g_coll_world) return;
+
+    using SplitMethod = BVH::BuildParams::SplitMethod;
+    const std::vector<BVH::BuildParams> benchmarked_params = {
+        { .split_method = SplitMethod::ExactSah },
+        { .split_method = SplitMethod::BinnedSah, .sah_bin_cnt = 16 },
+        { .split_method = SplitMethod::BinnedSah, .sah_bin_cnt = 32 },
+        { .split_method = SplitMethod::SpatialSah, .sah_bin_cnt = 32 },
+    };
+
+    for (const BVH::BuildParams& params : benchmarked_params) {
+        auto build_start = std::chrono::high_resolution_clock::now();
+        BVH bvh{ *g_coll_world, params };
+        auto build_end = std::chrono::high_resolution_clock::now();
+        unsigned long long build_duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(build_end - build_start).count();
+
+        Debug d{ Debug::Flag::NoSpace };
+        if (params.split_method == SplitMethod::ExactSah)
+            d << "Exact SAH:        ";
+        else if (params.split_method == SplitMethod::BinnedSah)
+            d << "Binned SAH (" << params.sah_bin_cnt << " bins): ";
+        else
+            d << "Spatial SAH (" << params.sah_bin_cnt << " bins): ";
+        d << "build time " << GetDurationStr((float)build_duration_ns)
+          << ", SAH cost " << bvh.CalcSahCost()
+          << ", tree depth " << bvh.tree_depth;
+    }
+}
+
+void Benchmark::BvhSpatialSplits()
+{
+    if (!g_coll_world) return;
+
+    using SplitMethod = BVH::BuildParams::SplitMethod;
+    BVH exact_bvh  { *g_coll_world, { .split_method = SplitMethod::ExactSah  } };
+    BVH binned_bvh { *g_coll_world, { .split_method = SplitMethod::BinnedSah } };
+    BVH spatial_bvh{ *g_coll_world, { .split_method = SplitMethod::SpatialSah } };
+
+    const std::pair<const char*, const BVH*> bvhs[] = {
+        { "Exact SAH:   ", &exact_bvh   },
+        { "Binned SAH:  ", &binned_bvh  },
+        { "Spatial SAH: ", &spatial_bvh },
+    };
+    for (const auto& [name, bvh] : bvhs) {
+        BVH::QualityStats stats = bvh->CalcQualityStats();
+        Debug{ Debug::Flag::NoSpace } << name << stats.leaf_ref_cnt
+            << " leaf refs to " << stats.leaf_cnt << " leaves, SAH cost "
+            << stats.sah_cost << ", sibling overlap " << stats.sibling_overlap
+            << ", tree depth " << stats.tree_depth;
+    }
+
+    CompareBvhTracing("BvhSpatialSplits", {
+        { "exact_sah",   &exact_bvh   },
+        { "binned_sah",  &binned_bvh  },
+        { "spatial_sah", &spatial_bvh },
+    });
+}
+
+void Benchmark::BvhTreeletOptimization()
+{
+    if (!g_coll_world) return;
+
+    struct Variant {
+        const char* name;
+        BVH::BuildParams params;
+        Containers::Optional<BVH> bvh;
+        unsigned long long build_duration_ns;
+    };
+    Variant variants[] = {
+        { "unoptimized",      { .treelet_optimization_passes = 0 }, {}, 0 },
+        { "treelet_1_pass",   { .treelet_optimization_passes = 1 }, {}, 0 },
+        { "treelet_3_passes", { .treelet_optimization_passes = 3 }, {}, 0 },
+    };
+    for (Variant& v : variants) {
+        auto build_start = std::chrono::high_resolution_clock::now();
+        v.bvh.emplace(*g_coll_world, v.params);
+        auto build_end = std::chrono::high_resolution_clock::now();
+        v.build_duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(build_end - build_start).count();
+        if (!v.bvh->WasConstructedSuccessfully()) return;
+    }
+
+    float unoptimized_sah_cost = variants[0].bvh->CalcSahCost();
+    for (Variant& v : variants) {
+        float sah_cost = v.bvh->CalcSahCost();
+        Debug{ Debug::Flag::NoSpace } << v.name << ": build time "
+            << GetDurationStr((float)v.build_duration_ns) << ", SAH cost "
+            << sah_cost << " (" << GetPercentStr(sah_cost / unoptimized_sah_cost - 1.0f, true)
+            << "), tree depth " << v.bvh->tree_depth;
+    }
+
+    std::vector<std::pair<std::string, const BVH*>> compared_bvhs;
+    for (Variant& v : variants)
+        compared_bvhs.push_back({ v.name, &*v.bvh });
+    CompareBvhTracing("BvhTreeletOptimization", compared_bvhs);
+}
+
+void Benchmark::BvhQuantization()
+{
+    if (!g_coll_world) return;
+
+    BVH float_bvh{ *g_coll_world, { .quantize_node_aabbs = false } };
+    BVH quant_bvh{ *g_coll_world, { .quantize_node_aabbs = true  } };
+    CompareBvhTracing("BvhQuantization", {
+        { "float_nodes",     &float_bvh },
+        { "quantized_nodes", &quant_bvh },
+    });
+}
+
+void Benchmark::Bvh4Tracing()
+{
+    if (!g_coll_world) return;
+
+    BVH bvh2{ *g_coll_world, { .collapse_to_bvh4 = false } };
+    BVH bvh4{ *g_coll_world, { .collapse_to_bvh4 = true  } };
+    CompareBvhTracing("Bvh4Tracing", {
+        { "binary_bvh", &bvh2 },
+        { "bvh4",       &bvh4 },
+    });
+}
+
+void Benchmark::LeafTraceCostCalibration()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    const BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    TraceCostModel calibrated_model = CalibrateTraceCostModel(bvh, seed);
+
+    // Printed in the form of TraceCostModel's member initializers, so that
+    // calibrated values can be copied into CollidableWorld.h as new defaults
+    const TraceCostModel& m = calibrated_model;
+    Debug{ Debug::Flag::NoSpace } << "[Benchmark::LeafTraceCostCalibration] "
+        "Calibrated trace cost model (ns):\n"
+        << "    float aabb_test = " << m.aabb_test << ";\n"
+        << "    float brush_base     = " << m.brush_base     << ";\n"
+        << "    float brush_per_side = " << m.brush_per_side << ";\n"
+        << "    float disp_by_power[5] = { " << m.disp_by_power[0] << ", "
+            << m.disp_by_power[1] << ", " << m.disp_by_power[2] << ", "
+            << m.disp_by_power[3] << ", " << m.disp_by_power[4] << " };\n"
+        << "    float func_brush_base     = " << m.func_brush_base     << ";\n"
+        << "    float func_brush_per_side = " << m.func_brush_per_side << ";\n"
+        << "    float xprop_base        = " << m.xprop_base        << ";\n"
+        << "    float xprop_per_section = " << m.xprop_per_section << ";\n"
+        << "    float xprop_per_plane   = " << m.xprop_per_plane   << ";";
+
+    // NOTE: SAH costs of these BVHs are based on different trace cost models
+    //       and can't be compared to each other.
+    BVH uniform_bvh   { *g_coll_world, { .trace_cost_model = {}               } }; // Default model
+    BVH calibrated_bvh{ *g_coll_world, { .trace_cost_model = calibrated_model } };
+    CompareBvhTracing("LeafTraceCostCalibration", {
+        { "uniform_costs",    &uniform_bvh    },
+        { "calibrated_costs", &calibrated_bvh },
+    });
+}
+
+void Benchmark::BvhCacheLoading()
+{
+    if (!g_coll_world) return;
+
+    Containers::Optional<Containers::String> tmp_dir = Utility::Path::temporaryDirectory();
+    if (!tmp_dir) {
+        Error{} << "[Benchmark::BvhCacheLoading] Failed to find temporary directory";
+        return;
+    }
+
+    // Benchmark settings
+    constexpr size_t NUM_ITERATIONS = 3; // How often to build and load the BVH
+
+    BVH::BuildParams uncached_params = {};
+    BVH::BuildParams cached_params = {};
+    cached_params.cache_dir_path = Utility::Path::join(*tmp_dir, "DZSimBvhCacheBenchmark");
+
+    auto MeasureConstruction = [](const BVH::BuildParams& params,
+                                  Containers::Optional<BVH>& dest_bvh) {
+        auto construction_start = std::chrono::high_resolution_clock::now();
+        dest_bvh.emplace(*g_coll_world, params);
+        auto construction_end = std::chrono::high_resolution_clock::now();
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(construction_end - construction_start).count();
+    };
+
+    Containers::Optional<BVH> built_bvh;
+    Containers::Optional<BVH> loaded_bvh;
+    unsigned long long build_and_save_duration_ns = MeasureConstruction(cached_params, built_bvh);
+    if (!built_bvh->WasConstructedSuccessfully()) return;
+    std::string cache_file_path =
+        built_bvh->GetCacheFilePath(built_bvh->CalcCacheKey());
+    if (built_bvh->WasLoadedFromCache()) {
+        // Cache file was left over from a previous run, remove it and build
+        Utility::Path::remove(cache_file_path);
+        build_and_save_duration_ns = MeasureConstruction(cached_params, built_bvh);
+    }
+    std::vector<unsigned long long> build_durations;
+    std::vector<unsigned long long> load_durations;
+    size_t num_not_loaded = 0;
+    size_t num_incorrect = 0;
+    for (size_t i = 0; i < NUM_ITERATIONS; i++) {
+        build_durations.push_back(MeasureConstruction(uncached_params, built_bvh));
+        load_durations .push_back(MeasureConstruction(cached_params,   loaded_bvh));
+        if (!loaded_bvh->WasLoadedFromCache())
+            num_not_loaded++;
+
+        auto AreArraysEqual = [](const auto& a, const auto& b) {
+            return a.size() == b.size() && (a.empty() ||
+                std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0);
+        };
+        if (!AreArraysEqual(built_bvh->nodes,           loaded_bvh->nodes) ||
+            !AreArraysEqual(built_bvh->quantized_nodes, loaded_bvh->quantized_nodes) ||
+            built_bvh->nodes4.size() != loaded_bvh->nodes4.size() ||
+            built_bvh->tree_depth    != loaded_bvh->tree_depth)
+            num_incorrect++;
+    }
+
+    BenchmarkStatistics build_stats = AddResult("BvhCacheLoading", "build", 0, build_durations);
+    BenchmarkStatistics load_stats  = AddResult("BvhCacheLoading", "cache_load", 0, load_durations);
+    Debug{ Debug::Flag::NoSpace } << "Build and save: " << GetDurationStr((float)build_and_save_duration_ns);
+    Debug{ Debug::Flag::NoSpace } << "Build:          " << GetDurationStr(build_stats.mean);
+    Debug{ Debug::Flag::NoSpace } << "Load from cache: " << GetDurationStr(load_stats.mean)
+        << " (" << GetPercentStr(load_stats.mean / build_stats.mean - 1.0f, true)
+        << " compared to building)";
+
+    Debug::Color result_col = num_not_loaded == 0 && num_incorrect == 0 ?
+        Debug::Color::Green : Debug::Color::Red;
+    Debug{ Debug::Flag::NoSpace } << Debug::color(result_col)
+        << num_not_loaded << " / " << NUM_ITERATIONS << " constructions didn't "
+           "load the cache file, " << num_incorrect << " / " << NUM_ITERATIONS
+        << " loaded BVHs differ from built BVHs";
+
+    Utility::Path::remove(cache_file_path);
+    Utility::Path::remove(cached_params.cache_dir_path);
+}
+
+void Benchmark::BvhOverlapQuery()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::BvhOverlapQuery] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_QUERIES = 20000;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each query
+    constexpr size_t MAX_RESULT_CNT = 4096; // Size of the query result buffer
+    constexpr size_t SMALL_RESULT_CNT = 4; // Result buffer of overflow checks
+
+    // Query boxes: Player hulls and bigger boxes near randomly picked leaves
+    struct QueryBox {
+        Vector3 mins, maxs;
+        uint32_t collidable_types;
+    };
+    const uint32_t TYPE_FILTERS[] = {
+        COLLIDABLE_ALL, COLLIDABLE_ALL, COLLIDABLE_WORLD, COLLIDABLE_STATIC_PROPS
+    };
+    std::uniform_int_distribution<size_t> leaf_idx_dis(1, bvh.leaves.size() - 1);
+    std::uniform_real_distribution<float> unit_dis(0.0f, 1.0f);
+    std::uniform_int_distribution<size_t> filter_dis(0, std::size(TYPE_FILTERS) - 1);
+    std::vector<QueryBox> query_boxes;
+    query_boxes.reserve(NUM_QUERIES);
+    while (query_boxes.size() < NUM_QUERIES) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx_dis(gen)];
+        Vector3 center = leaf.mins + (leaf.maxs - leaf.mins) *
+            Vector3{ unit_dis(gen), unit_dis(gen), unit_dis(gen) };
+        Vector3 half_extents = { 16.0f, 16.0f, 36.0f }; // Standing player hull
+        if (query_boxes.size() % 4 == 0) // Every 4th box is bigger
+            half_extents *= 1.0f + 15.0f * unit_dis(gen);
+        query_boxes.push_back({
+            .mins = center - half_extents,
+            .maxs = center + half_extents,
+            .collidable_types = TYPE_FILTERS[filter_dis(gen)]
+        });
+    }
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    std::vector<uint32_t> bvh_results(MAX_RESULT_CNT);
+    std::vector<uint32_t> small_bvh_results(SMALL_RESULT_CNT);
+    std::vector<uint32_t> brute_force_results;
+    brute_force_results.reserve(bvh.leaves.size());
+
+    // A query result is correct if it counts all overlapping leaves and the
+    // leaves that fit into the result buffer are distinct overlapping leaves.
+    // Expects sorted brute force results.
+    auto IsQueryResultCorrect = [&brute_force_results](size_t overlap_cnt,
+                                                      std::span<uint32_t> results) {
+        if (overlap_cnt != brute_force_results.size())
+            return false;
+        std::span<uint32_t> written = results.first(Math::min(overlap_cnt, results.size()));
+        std::sort(written.begin(), written.end());
+        return std::adjacent_find(written.begin(), written.end()) == written.end() &&
+            std::includes(brute_force_results.begin(), brute_force_results.end(),
+                          written.begin(), written.end());
+    };
+
+    std::vector<unsigned long long>         bvh_mean_durations;
+    std::vector<unsigned long long> brute_force_mean_durations;
+    bvh_mean_durations.reserve(NUM_QUERIES);
+    brute_force_mean_durations.reserve(NUM_QUERIES);
+    size_t total_alloc_cnt = 0;
+    size_t total_overlap_cnt = 0;
+    size_t num_truncated = 0;
+    size_t num_incorrect = 0;
+    size_t num_incorrect_overflowing = 0; // Of queries with small result buffer
+    for (const QueryBox& box : query_boxes) {
+        size_t overlap_cnt = 0;
+        size_t alloc_cnt_start = GetHeapAllocationCount();
+        auto bvh_start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < NUM_ITERATIONS; i++)
+            overlap_cnt = bvh.GetLeavesOverlappingAabb(box.mins, box.maxs,
+                                                       bvh_results, ctx,
+                                                       box.collidable_types);
+        auto bvh_end = std::chrono::high_resolution_clock::now();
+        total_alloc_cnt += GetHeapAllocationCount() - alloc_cnt_start;
+
+        auto brute_force_start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < NUM_ITERATIONS; i++) {
+            brute_force_results.clear();
+            for (size_t leaf_idx = 1; leaf_idx < bvh.leaves.size(); leaf_idx++) {
+                const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+                if ((box.collidable_types & BVH::GetLeafTypeFlags(leaf)) &&
+                    AabbIntersectsAabb(box.mins, box.maxs, leaf.mins, leaf.maxs))
+                    brute_force_results.push_back((uint32_t)leaf_idx);
+            }
+        }
+        auto brute_force_end = std::chrono::high_resolution_clock::now();
+
+        unsigned long long bvh_duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bvh_end - bvh_start).count();
+        unsigned long long brute_force_duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(brute_force_end - brute_force_start).count();
+        bvh_mean_durations        .push_back(bvh_duration_sum_ns         / NUM_ITERATIONS);
+        brute_force_mean_durations.push_back(brute_force_duration_sum_ns / NUM_ITERATIONS);
+
+        total_overlap_cnt += overlap_cnt;
+        if (overlap_cnt > bvh_results.size())
+            num_truncated++;
+        if (!IsQueryResultCorrect(overlap_cnt, bvh_results))
+            num_incorrect++;
+
+        // Shared leaves that are reached again after the result buffer is
+        // full must still only be counted once
+        size_t small_overlap_cnt = bvh.GetLeavesOverlappingAabb(box.mins,
+            box.maxs, small_bvh_results, ctx, box.collidable_types);
+        if (!IsQueryResultCorrect(small_overlap_cnt, small_bvh_results))
+            num_incorrect_overflowing++;
+    }
+
+    BenchmarkStatistics bvh_stats = AddResult("BvhOverlapQuery",
+        "bvh_query", seed, bvh_mean_durations);
+    BenchmarkStatistics brute_force_stats = AddResult("BvhOverlapQuery",
+        "brute_force", seed, brute_force_mean_durations);
+    Debug{ Debug::Flag::NoSpace } << "Mean overlapping leaves per query: "
+        << (float)total_overlap_cnt / NUM_QUERIES;
+    Debug{ Debug::Flag::NoSpace } << "Brute force: "
+        << GetDurationStr(brute_force_stats.mean) << " ± "
+        << GetPercentStr(brute_force_stats.stddev / brute_force_stats.mean);
+    Debug{ Debug::Flag::NoSpace } << "BVH query:   "
+        << GetDurationStr(bvh_stats.mean) << " ± "
+        << GetPercentStr(bvh_stats.stddev / bvh_stats.mean) << " ("
+        << GetPercentStr(bvh_stats.mean / brute_force_stats.mean - 1.0f, true)
+        << " compared to brute force)";
+
+    Debug::Color alloc_col = total_alloc_cnt == 0 ? Debug::Color::Green : Debug::Color::Red;
+    Debug{ Debug::Flag::NoSpace } << Debug::color(alloc_col)
+        << "Heap allocations: " << total_alloc_cnt << " in "
+        << NUM_QUERIES * NUM_ITERATIONS << " BVH queries";
+    if (num_truncated != 0)
+        Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Yellow)
+            << num_truncated << " / " << NUM_QUERIES << " queries exceeded the "
+            << MAX_RESULT_CNT << " element result buffer";
+    if (num_incorrect != 0)
+        Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Red)
+            << num_incorrect << " / " << NUM_QUERIES
+            << " queries produced results different from brute force!";
+    if (num_incorrect_overflowing != 0)
+        Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Red)
+            << num_incorrect_overflowing << " / " << NUM_QUERIES << " queries "
+            << "with a " << SMALL_RESULT_CNT << " element result buffer "
+            << "produced results different from brute force!";
+    Debug{} << "[Benchmark::BvhOverlapQuery] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+// A single trace-AABB test of Benchmark::TraceAabbTest()
+struct TraceAabbTestCase {
+    Trace trace;
+    Vector3 mins, maxs;
+};
+
+void Benchmark::TraceAabbTest()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::TraceAabbTest] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_RANDOM_TESTS = 200000;
+    constexpr size_t NUM_REALISTIC_TRACES = 5000;
+    constexpr size_t MAX_CANDIDATES_PER_TRACE = 64; // AABB tests per realistic trace
+    constexpr size_t BATCH_SIZE = 256; // AABB tests per duration sample
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each batch
+
+    std::uniform_int_distribution<size_t> leaf_idx_dis(1, bvh.leaves.size() - 1);
+    std::uniform_real_distribution<float> unit_dis(0.0f, 1.0f);
+
+    // Random set: Random hull traces near random leaves, tested against that
+    // leaf's AABB. Includes unswept traces, axis-aligned traces (whose
+    // inverse delta contains FLT_MAX) and traces with zero extents.
+    std::vector<TraceAabbTestCase> random_swept_tests;
+    std::vector<TraceAabbTestCase> random_unswept_tests;
+    random_swept_tests.reserve(NUM_RANDOM_TESTS);
+    random_unswept_tests.reserve(NUM_RANDOM_TESTS);
+    while (random_swept_tests.size() < NUM_RANDOM_TESTS) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx_dis(gen)];
+        Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+        Vector3 start = tr.info.startpos;
+        Vector3 delta = tr.info.delta;
+        Vector3 extents = tr.info.extents;
+        if (random_swept_tests.size() % 4 == 1) // Make trace axis-aligned
+            for (int axis = 0; axis < 3; axis++)
+                if (unit_dis(gen) < 0.5f)
+                    delta[axis] = 0.0f;
+        if (random_swept_tests.size() % 8 == 2) // Make trace a point
+            extents = { 0.0f, 0.0f, 0.0f };
+        if (delta.isZero())
+            continue;
+        random_swept_tests.push_back({
+            .trace = Trace{ start, start + delta, -extents, +extents },
+            .mins = leaf.mins, .maxs = leaf.maxs
+        });
+        random_unswept_tests.push_back({
+            .trace = Trace{ start, start, -extents, +extents },
+            .mins = leaf.mins, .maxs = leaf.maxs
+        });
+    }
+
+    // Realistic set: Realistic world traces tested against the AABBs of the
+    // leaves overlapping their swept bounds, i.e. against broadphase
+    // candidates. Their unswept counterparts are tested at their start pos.
+    std::vector<TraceAabbTestCase> realistic_swept_tests;
+    std::vector<TraceAabbTestCase> realistic_unswept_tests;
+    std::vector<uint32_t> candidates(MAX_CANDIDATES_PER_TRACE);
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    for (const Trace& r_tr : GenRealisticWorldTraces(gen, bvh, NUM_REALISTIC_TRACES, ctx)) {
+        Vector3 start = r_tr.info.startpos; // Centered within the extents
+        Vector3 end = start + r_tr.info.delta;
+        Vector3 extents = r_tr.info.extents;
+        Vector3 sweep_mins = Math::min(start, end) - extents;
+        Vector3 sweep_maxs = Math::max(start, end) + extents;
+        size_t candidate_cnt = bvh.GetLeavesOverlappingAabb(sweep_mins,
+                                                            sweep_maxs,
+                                                            candidates, ctx);
+        candidate_cnt = Math::min(candidate_cnt, candidates.size());
+        for (size_t c = 0; c < candidate_cnt; c++) {
+            const BVH::Leaf& leaf = bvh.leaves[candidates[c]];
+            realistic_swept_tests.push_back({
+                .trace = Trace{ r_tr.info },
+                .mins = leaf.mins, .maxs = leaf.maxs
+            });
+            realistic_unswept_tests.push_back({
+                .trace = Trace{ start, start, -extents, +extents },
+                .mins = leaf.mins, .maxs = leaf.maxs
+            });
+        }
+    }
+
+    const std::pair<std::string, const std::vector<TraceAabbTestCase>*> test_sets[] = {
+        { "random_swept",      &random_swept_tests      },
+        { "random_unswept",    &random_unswept_tests    },
+        { "realistic_swept",   &realistic_swept_tests   },
+        { "realistic_unswept", &realistic_unswept_tests },
+    };
+    for (const auto& [set_name, tests] : test_sets) {
+        // Check results against the reference implementation
+        size_t num_incorrect = 0;
+        size_t num_hits = 0;
+        for (const TraceAabbTestCase& test : *tests) {
+            float ref_fraction = -1.0f;
+            float new_fraction = -1.0f;
+            bool ref_hit = test.trace.HitsAabbReference(test.mins, test.maxs, &ref_fraction);
+            bool new_hit = test.trace.HitsAabb         (test.mins, test.maxs, &new_fraction);
+            if (ref_hit != new_hit || ref_fraction != new_fraction)
+                num_incorrect++;
+            if (ref_hit)
+                num_hits++;
+        }
+
+        // Measure durations of both implementations in batches
+        std::vector<unsigned long long> ref_batch_durations;
+        std::vector<unsigned long long> new_batch_durations;
+        // Hit counts keep AABB tests from being optimized away
+        size_t ref_hit_cnt = 0;
+        size_t new_hit_cnt = 0;
+        for (size_t batch_start = 0; batch_start < tests->size(); batch_start += BATCH_SIZE) {
+            size_t batch_end = Math::min(batch_start + BATCH_SIZE, tests->size());
+            if (batch_end - batch_start < BATCH_SIZE)
+                break; // Only measure full batches
+
+            auto ref_start = std::chrono::high_resolution_clock::now();
+            for (size_t it = 0; it < NUM_ITERATIONS; it++)
+                for (size_t t = batch_start; t < batch_end; t++)
+                    ref_hit_cnt += (*tests)[t].trace.HitsAabbReference((*tests)[t].mins, (*tests)[t].maxs);
+            auto ref_end = std::chrono::high_resolution_clock::now();
+
+            auto new_start = std::chrono::high_resolution_clock::now();
+            for (size_t it = 0; it < NUM_ITERATIONS; it++)
+                for (size_t t = batch_start; t < batch_end; t++)
+                    new_hit_cnt += (*tests)[t].trace.HitsAabb((*tests)[t].mins, (*tests)[t].maxs);
+            auto new_end = std::chrono::high_resolution_clock::now();
+
+            unsigned long long ref_duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(ref_end - ref_start).count();
+            unsigned long long new_duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(new_end - new_start).count();
+            ref_batch_durations.push_back(ref_duration_sum_ns / NUM_ITERATIONS);
+            new_batch_durations.push_back(new_duration_sum_ns / NUM_ITERATIONS);
+        }
+        if (ref_batch_durations.empty()) {
+            Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Yellow)
+                << set_name << ": Too few AABB tests (" << tests->size()
+                << ") to measure";
+            continue;
+        }
+
+        BenchmarkStatistics ref_stats = AddResult("TraceAabbTest",
+            set_name + "_reference", seed, ref_batch_durations);
+        BenchmarkStatistics new_stats = AddResult("TraceAabbTest",
+            set_name, seed, new_batch_durations);
+        Debug{ Debug::Flag::NoSpace } << set_name << ": " << tests->size()
+            << " AABB tests, " << GetPercentStr((float)num_hits / tests->size())
+            << " hit";
+        Debug{ Debug::Flag::NoSpace } << "    Reference: "
+            << GetDurationStr(ref_stats.mean / BATCH_SIZE) << " ± "
+            << GetPercentStr(ref_stats.stddev / ref_stats.mean) << " per test";
+        Debug{ Debug::Flag::NoSpace } << "    HitsAabb:  "
+            << GetDurationStr(new_stats.mean / BATCH_SIZE) << " ± "
+            << GetPercentStr(new_stats.stddev / new_stats.mean) << " per test ("
+            << GetPercentStr(new_stats.mean / ref_stats.mean - 1.0f, true)
+            << " compared to reference)";
+        if (ref_hit_cnt != new_hit_cnt)
+            num_incorrect++; // Should be impossible if all checked tests matched
+        Debug::Color result_col = num_incorrect == 0 ? Debug::Color::Green : Debug::Color::Red;
+        Debug{ Debug::Flag::NoSpace } << Debug::color(result_col) << "    "
+            << num_incorrect << " / " << tests->size()
+            << " AABB tests differ from the reference implementation";
+    }
+    Debug{} << "[Benchmark::TraceAabbTest] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::FuncBrushTracing()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::FuncBrushTracing] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_TRACES_PER_FUNC_BRUSH = 200;
+    constexpr size_t MAX_ATTEMPTS_PER_FUNC_BRUSH = 20 * NUM_TRACES_PER_FUNC_BRUSH;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each trace
+
+    std::vector<uint32_t> func_brush_leaf_indices;
+    for (uint32_t leaf_idx = 1; leaf_idx < bvh.leaves.size(); leaf_idx++)
+        if (bvh.leaves[leaf_idx].type == BVH::Leaf::Type::FuncBrush)
+            func_brush_leaf_indices.push_back(leaf_idx);
+    if (func_brush_leaf_indices.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::FuncBrushTracing] Map has no solid func_brush "
+               "entities, choose a map with many of them";
+        return;
+    }
+
+    const CompiledFuncBrushes& compiled = *g_coll_world->pImpl->compiled_func_brushes;
+
+    // Per func_brush: Mean duration of traces that hit its AABB
+    std::vector<unsigned long long>   swept_mean_durations;
+    std::vector<unsigned long long> unswept_mean_durations;
+    swept_mean_durations  .reserve(func_brush_leaf_indices.size());
+    unswept_mean_durations.reserve(func_brush_leaf_indices.size());
+    size_t total_brush_cnt = 0;
+    size_t total_plane_cnt = 0;
+    size_t hit_cnt = 0;
+    size_t trace_cnt = 0;
+
+    std::vector<Trace> traces;
+    std::vector<Trace> iter_traces;
+    traces.reserve(2 * NUM_TRACES_PER_FUNC_BRUSH);
+    iter_traces.reserve(NUM_TRACES_PER_FUNC_BRUSH * NUM_ITERATIONS);
+    for (uint32_t leaf_idx : func_brush_leaf_indices) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+        const CompiledFuncBrushes::FuncBrush& func_brush =
+            compiled.func_brushes[leaf.funcbrush_idx];
+        total_brush_cnt += func_brush.brush_cnt;
+        for (uint32_t b = 0; b < func_brush.brush_cnt; b++)
+            total_plane_cnt += compiled.brushes[func_brush.first_brush + b].plane_cnt;
+
+        // Traces hitting the func_brush's AABB, first swept ones, then
+        // unswept ones at the same start positions
+        traces.clear();
+        for (size_t a = 0; a < MAX_ATTEMPTS_PER_FUNC_BRUSH && traces.size() < NUM_TRACES_PER_FUNC_BRUSH; a++) {
+            Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+            if (tr.HitsAabb(leaf.mins, leaf.maxs))
+                traces.push_back(tr);
+        }
+        size_t swept_trace_cnt = traces.size();
+        for (size_t i = 0; i < swept_trace_cnt; i++) {
+            const Trace::Info& info = traces[i].info;
+            traces.emplace_back(info.startpos, info.startpos, -info.extents, +info.extents);
+        }
+        if (swept_trace_cnt == 0)
+            continue;
+
+        for (bool swept : { true, false }) {
+            iter_traces.clear();
+            for (size_t it = 0; it < NUM_ITERATIONS; it++)
+                for (size_t i = 0; i < swept_trace_cnt; i++)
+                    iter_traces.emplace_back(traces[swept ? i : swept_trace_cnt + i].info);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            if (swept) {
+                for (Trace& trace : iter_traces)
+                    g_coll_world->DoSweptTrace_FuncBrush(&trace, leaf.funcbrush_idx);
+            }
+            else {
+                for (Trace& trace : iter_traces)
+                    g_coll_world->DoUnsweptTrace_FuncBrush(&trace, leaf.funcbrush_idx);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            (swept ? swept_mean_durations : unswept_mean_durations)
+                .push_back(duration_sum_ns / iter_traces.size());
+
+            for (size_t i = 0; i < swept_trace_cnt; i++)
+                if (iter_traces[i].results.DidHit())
+                    hit_cnt++;
+            trace_cnt += swept_trace_cnt;
+        }
+    }
+    if (swept_mean_durations.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::FuncBrushTracing] Failed to generate traces";
+        return;
+    }
+
+    BenchmarkStatistics swept_stats = AddResult("FuncBrushTracing",
+        "swept_trace", seed, swept_mean_durations);
+    BenchmarkStatistics unswept_stats = AddResult("FuncBrushTracing",
+        "unswept_trace", seed, unswept_mean_durations);
+    Debug{ Debug::Flag::NoSpace } << func_brush_leaf_indices.size()
+        << " solid func_brush entities with " << total_brush_cnt
+        << " brushes and " << total_plane_cnt << " planes, "
+        << GetPercentStr((float)hit_cnt / trace_cnt) << " of traces hit";
+    Debug{ Debug::Flag::NoSpace } << "Swept trace:   "
+        << GetDurationStr(swept_stats.mean) << " ± "
+        << GetPercentStr(swept_stats.stddev / swept_stats.mean);
+    Debug{ Debug::Flag::NoSpace } << "Unswept trace: "
+        << GetDurationStr(unswept_stats.mean) << " ± "
+        << GetPercentStr(unswept_stats.stddev / unswept_stats.mean);
+    Debug{} << "[Benchmark::FuncBrushTracing] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::DisplacementRayTracing()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::DisplacementRayTracing] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_TRACES_PER_DISP = 200;
+    constexpr size_t MAX_ATTEMPTS_PER_DISP = 20 * NUM_TRACES_PER_DISP;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each trace
+
+    std::vector<CDispCollTree>& disp_coll_trees = *g_coll_world->pImpl->disp_coll_trees;
+    std::vector<uint32_t> disp_leaf_indices;
+    for (uint32_t leaf_idx = 1; leaf_idx < bvh.leaves.size(); leaf_idx++) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+        if (leaf.type != BVH::Leaf::Type::Displacement)
+            continue;
+        const CDispCollTree& disp_coll = disp_coll_trees[leaf.disp_coll_idx];
+        if (disp_coll.CheckFlags(BspMap::DispInfo::FLAG_NO_RAY_COLL))
+            continue;
+        disp_leaf_indices.push_back(leaf_idx);
+    }
+    if (disp_leaf_indices.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::DisplacementRayTracing] Map has no ray-collidable "
+               "displacements, choose a map with many of them";
+        return;
+    }
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    CreateDispCollCaches(ctx); // Measured traces mustn't create them
+
+    // Per displacement: Mean duration of traces that hit its AABB
+    std::vector<unsigned long long>        ray_mean_durations;
+    std::vector<unsigned long long> point_hull_mean_durations;
+    ray_mean_durations       .reserve(disp_leaf_indices.size());
+    point_hull_mean_durations.reserve(disp_leaf_indices.size());
+    size_t ray_hit_cnt = 0;
+    size_t point_hull_hit_cnt = 0;
+    size_t trace_cnt = 0;
+
+    std::vector<Trace> rays;
+    std::vector<Trace> iter_traces;
+    rays.reserve(NUM_TRACES_PER_DISP);
+    iter_traces.reserve(NUM_TRACES_PER_DISP * NUM_ITERATIONS);
+    for (uint32_t leaf_idx : disp_leaf_indices) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+
+        // Rays along the paths of random hull traces, hitting the
+        // displacement's AABB
+        rays.clear();
+        for (size_t a = 0; a < MAX_ATTEMPTS_PER_DISP && rays.size() < NUM_TRACES_PER_DISP; a++) {
+            Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+            if (!tr.info.isswept)
+                continue;
+            Trace ray{ tr.info.startpos, tr.info.startpos + tr.info.delta };
+            if (ray.HitsAabb(leaf.mins, leaf.maxs))
+                rays.push_back(ray);
+        }
+        if (rays.empty())
+            continue;
+
+        for (bool is_ray : { true, false }) {
+            iter_traces.clear();
+            for (size_t it = 0; it < NUM_ITERATIONS; it++) {
+                for (const Trace& ray : rays) {
+                    if (is_ray) {
+                        iter_traces.emplace_back(ray.info);
+                    }
+                    else {
+                        const Vector3 end = ray.info.startpos + ray.info.delta;
+                        iter_traces.emplace_back(ray.info.startpos, end,
+                                                 Vector3{ 0.0f }, Vector3{ 0.0f });
+                    }
+                }
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (Trace& trace : iter_traces)
+                g_coll_world->DoSweptTrace_Displacement(&trace, leaf.disp_coll_idx, ctx);
+            auto end = std::chrono::high_resolution_clock::now();
+            unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            (is_ray ? ray_mean_durations : point_hull_mean_durations)
+                .push_back(duration_sum_ns / iter_traces.size());
+
+            for (size_t i = 0; i < rays.size(); i++)
+                if (iter_traces[i].results.DidHit())
+                    (is_ray ? ray_hit_cnt : point_hull_hit_cnt)++;
+        }
+        trace_cnt += rays.size();
+    }
+    if (ray_mean_durations.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::DisplacementRayTracing] Failed to generate traces";
+        return;
+    }
+
+    BenchmarkStatistics ray_stats = AddResult("DisplacementRayTracing",
+        "ray_trace", seed, ray_mean_durations);
+    BenchmarkStatistics point_hull_stats = AddResult("DisplacementRayTracing",
+        "point_hull_trace", seed, point_hull_mean_durations);
+    Debug{ Debug::Flag::NoSpace } << disp_leaf_indices.size()
+        << " ray-collidable displacements, "
+        << GetPercentStr((float)ray_hit_cnt / trace_cnt) << " of rays and "
+        << GetPercentStr((float)point_hull_hit_cnt / trace_cnt)
+        << " of zero-extent hull traces hit";
+    Debug{ Debug::Flag::NoSpace } << "Ray trace:              "
+        << GetDurationStr(ray_stats.mean) << " ± "
+        << GetPercentStr(ray_stats.stddev / ray_stats.mean);
+    Debug{ Debug::Flag::NoSpace } << "Zero-extent hull trace: "
+        << GetDurationStr(point_hull_stats.mean) << " ± "
+        << GetPercentStr(point_hull_stats.stddev / point_hull_stats.mean);
+    Debug{} << "[Benchmark::DisplacementRayTracing] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+void Benchmark::DispCollCacheBudget()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) return;
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (!bvh.WasConstructedSuccessfully()) return;
+
+    unsigned int seed = GetSeed();
+    Debug{} << "[Benchmark::DispCollCacheBudget] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_AREAS = 20;
+    constexpr size_t NUM_FRAMES_PER_AREA = 50;
+    constexpr size_t NUM_TRACES_PER_FRAME = 100;
+    constexpr float  AREA_HALF_WIDTH = 1024.0f;
+    constexpr size_t MAX_AREA_LEAF_CNT = 4096;
+    // Budgets relative to the memory usage of all displacement caches
+    const std::vector<float> budget_fractions = { 1.0f, 0.5f, 0.25f, 0.1f, 0.05f };
+
+    std::vector<CDispCollTree>& disp_coll_trees = *g_coll_world->pImpl->disp_coll_trees;
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+
+    // Memory usage if every displacement that hull traces use has a cache
+    CreateDispCollCaches(ctx);
+    size_t full_memory_usage = g_coll_world->GetDispCollCacheStats().memory_usage;
+    if (full_memory_usage == 0) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::DispCollCacheBudget] Map has no displacements with "
+               "hull collision, choose a map with many of them";
+        return;
+    }
+
+    // Generate realistic traces, frame by frame. Each area is centered at a
+    // random leaf and traces are generated near random leaves within it.
+    std::uniform_int_distribution<size_t> leaf_idx_dis(1, bvh.leaves.size() - 1);
+    std::vector<uint32_t> area_leaves(MAX_AREA_LEAF_CNT);
+    std::vector<Trace> traces; // Frames are stored consecutively
+    traces.reserve(NUM_AREAS * NUM_FRAMES_PER_AREA * NUM_TRACES_PER_FRAME);
+    for (size_t area = 0; area < NUM_AREAS; area++) {
+        const BVH::Leaf& center_leaf = bvh.leaves[leaf_idx_dis(gen)];
+        Vector3 area_center = 0.5f * (center_leaf.mins + center_leaf.maxs);
+        size_t area_leaf_cnt = bvh.GetLeavesOverlappingAabb(
+            area_center - Vector3{ AREA_HALF_WIDTH },
+            area_center + Vector3{ AREA_HALF_WIDTH },
+            area_leaves, ctx);
+        area_leaf_cnt = Math::min(area_leaf_cnt, area_leaves.size());
+        assert(area_leaf_cnt > 0); // Center leaf itself overlaps
+        std::uniform_int_distribution<size_t> area_leaf_dis(0, area_leaf_cnt - 1);
+
+        size_t area_trace_cnt = NUM_FRAMES_PER_AREA * NUM_TRACES_PER_FRAME;
+        for (size_t i = 0; i < area_trace_cnt; ) {
+            const BVH::Leaf& leaf = bvh.leaves[area_leaves[area_leaf_dis(gen)]];
+            std::optional<Trace> r_tr = GenRealisticWorldTrace(gen, leaf, ctx);
+            if (!r_tr) continue; // Failed to generate realistic trace
+            traces.emplace_back(r_tr->info);
+            i++;
+        }
+    }
+    size_t frame_cnt = traces.size() / NUM_TRACES_PER_FRAME;
+
+    size_t prev_budget = g_coll_world->GetDispCollCacheBudget();
+    std::vector<Trace> frame_traces;
+    frame_traces.reserve(NUM_TRACES_PER_FRAME);
+    std::vector<unsigned long long> frame_durations(frame_cnt);
+    Debug{ Debug::Flag::NoSpace } << "Memory usage of all "
+        << g_coll_world->GetDispCollCacheStats().cache_cnt
+        << " displacement caches: " << (full_memory_usage / 1024) << " KiB";
+    for (float budget_fraction : budget_fractions) {
+        size_t budget = budget_fraction == 1.0f ?
+            CollidableWorld::DISP_COLL_CACHE_BUDGET_UNLIMITED :
+            (size_t)(budget_fraction * full_memory_usage);
+        g_coll_world->SetDispCollCacheBudget(budget);
+
+        // Start without caches, every budget pays the same creation cost
+        for (CDispCollTree& disp_coll : disp_coll_trees)
+            disp_coll.Uncache();
+
+        TraceContext budget_ctx;
+        g_coll_world->PrepareTraceContext(budget_ctx);
+        uint64_t eviction_cnt_start = g_coll_world->pImpl->disp_coll_cache_eviction_cnt;
+        size_t max_memory_usage = 0;
+        for (size_t f = 0; f < frame_cnt; f++) {
+            frame_traces.clear();
+            for (size_t i = 0; i < NUM_TRACES_PER_FRAME; i++)
+                frame_traces.emplace_back(traces[f * NUM_TRACES_PER_FRAME + i].info);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (Trace& trace : frame_traces)
+                g_coll_world->DoTrace(&trace, budget_ctx);
+            g_coll_world->EvictDispCollCaches();
+            auto end = std::chrono::high_resolution_clock::now();
+            frame_durations[f] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+            max_memory_usage = Math::max(max_memory_usage,
+                g_coll_world->GetDispCollCacheStats().memory_usage);
+        }
+
+        std::string metric = budget_fraction == 1.0f ? "budget_unlimited" :
+            "budget_" + std::to_string((int)std::round(100.0f * budget_fraction)) + "pct";
+        BenchmarkStatistics stats = AddResult("DispCollCacheBudget", metric,
+                                              seed, frame_durations);
+        uint64_t hit_cnt  = budget_ctx.disp_coll_cache_hit_cnt;
+        uint64_t miss_cnt = budget_ctx.disp_coll_cache_miss_cnt;
+        uint64_t eviction_cnt =
+            g_coll_world->pImpl->disp_coll_cache_eviction_cnt - eviction_cnt_start;
+        Containers::String budget_str = budget_fraction == 1.0f ?
+            Containers::String{ "unlimited" } : GetPercentStr(budget_fraction);
+        Debug{ Debug::Flag::NoSpace } << "Budget " << budget_str << ": " << GetDurationStr(stats.mean) << " ± "
+            << GetPercentStr(stats.stddev / stats.mean) << " per frame ("
+            << GetDurationStr(stats.mean / NUM_TRACES_PER_FRAME) << " per trace), "
+            << GetPercentStr((float)hit_cnt / Math::max<uint64_t>(1, hit_cnt + miss_cnt))
+            << " cache hits, " << miss_cnt << " misses, " << eviction_cnt
+            << " evictions, max " << (max_memory_usage / 1024) << " KiB";
+    }
+    g_coll_world->SetDispCollCacheBudget(prev_budget);
+
+    Debug{} << "[Benchmark::DispCollCacheBudget] Used seed:" << seed; // To let user reproduce this benchmark
+}
+
+// Least-squares fit of  y = c[0] + c[1] * x[0] + c[2] * x[1] + ...
+// Returns nothing if there are too few samples or the features are linearly
+// dependent.
+static std::optional<std::vector<double>> FitLinearModel(
+    const std::vector<std::vector<double>>& xs, const std::vector<double>& ys)
+{
+    assert(xs.size() == ys.size());
+    if (xs.empty())
+        return std::nullopt;
+    const size_t n = xs[0].size() + 1; // Number of coefficients
+    if (xs.size() < n)
+        return std::nullopt;
+
+    // Normal equations (A^T * A) * c = A^T * y, with A's rows being (1, x...)
+    std::vector<std::vector<double>> mat(n, std::vector<double>(n + 1, 0.0));
+    for (size_t s = 0; s < xs.size(); s++) {
+        for (size_t i = 0; i < n; i++) {
+            double a_i = i == 0 ? 1.0 : xs[s][i - 1];
+            for (size_t j = 0; j < n; j++)
+                mat[i][j] += a_i * (j == 0 ? 1.0 : xs[s][j - 1]);
+            mat[i][n] += a_i * ys[s];
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (size_t col = 0; col < n; col++) {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < n; row++)
+            if (std::abs(mat[row][col]) > std::abs(mat[pivot][col]))
+                pivot = row;
+        if (std::abs(mat[pivot][col]) < 1e-9 * std::abs(mat[0][0]))
+            return std::nullopt; // Singular
+        std::swap(mat[col], mat[pivot]);
+        for (size_t row = 0; row < n; row++) {
+            if (row == col) continue;
+            double factor = mat[row][col] / mat[col][col];
+            for (size_t j = col; j <= n; j++)
+                mat[row][j] -= factor * mat[col][j];
+        }
+    }
+    std::vector<double> coefficients(n);
+    for (size_t i = 0; i < n; i++)
+        coefficients[i] = mat[i][n] / mat[i][i];
+    return coefficients;
+}
+
+TraceCostModel Benchmark::CalibrateTraceCostModel(const BVH& bvh,
+                                                  unsigned int seed)
+{
+    Debug{} << "[Benchmark::CalibrateTraceCostModel] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Calibration settings
+    constexpr size_t MAX_LEAVES_PER_TYPE = 2000; // Randomly sampled
+    constexpr size_t NUM_TRACES_PER_LEAF = 16;   // Each one hits the leaf's AABB
+    constexpr size_t NUM_ITERATIONS = 8; // How often to repeat each trace
+    constexpr size_t MAX_ATTEMPTS_PER_LEAF = 50 * NUM_TRACES_PER_LEAF;
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    CreateDispCollCaches(ctx); // Measured traces mustn't create them
+
+    // Sample leaves of each type
+    std::vector<uint32_t> leaf_indices_by_type[BVH::Leaf::Type::COUNT];
+    for (uint32_t i = 1; i < bvh.leaves.size(); i++) // Skip dummy leaf at index 0
+        leaf_indices_by_type[bvh.leaves[i].type].push_back(i);
+    for (std::vector<uint32_t>& leaf_indices : leaf_indices_by_type) {
+        std::shuffle(leaf_indices.begin(), leaf_indices.end(), gen);
+        if (leaf_indices.size() > MAX_LEAVES_PER_TYPE)
+            leaf_indices.resize(MAX_LEAVES_PER_TYPE);
+    }
+
+    // Measured mean trace duration of each sampled leaf, with its factors
+    struct LeafSample {
+        TraceCostModel::Factors factors;
+        double duration_ns;
+    };
+    std::vector<LeafSample> samples_by_type[BVH::Leaf::Type::COUNT];
+
+    double aabb_test_duration_sum_ns = 0.0;
+    size_t aabb_test_cnt = 0;
+    size_t aabb_hit_cnt = 0; // Keeps AABB tests from being optimized away
+
+    std::vector<Trace> traces;
+    std::vector<Trace> iter_traces;
+    traces.reserve(NUM_TRACES_PER_LEAF);
+    iter_traces.reserve(NUM_TRACES_PER_LEAF * NUM_ITERATIONS);
+    for (size_t type = 0; type < BVH::Leaf::Type::COUNT; type++) {
+        for (uint32_t leaf_idx : leaf_indices_by_type[type]) {
+            const BVH::Leaf& leaf = bvh.leaves[leaf_idx];
+
+            // The cost model assumes the trace already hits the leaf's AABB
+            traces.clear();
+            for (size_t a = 0; a < MAX_ATTEMPTS_PER_LEAF && traces.size() < NUM_TRACES_PER_LEAF; a++) {
+                Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+                if (tr.HitsAabb(leaf.mins, leaf.maxs))
+                    traces.push_back(tr);
+            }
+            if (traces.empty())
+                continue;
+
+            iter_traces.clear();
+            for (size_t i = 0; i < NUM_ITERATIONS; i++)
+                for (const Trace& tr : traces)
+                    iter_traces.emplace_back(tr.info);
+
+            auto iters_start = std::chrono::high_resolution_clock::now();
+            for (Trace& trace : iter_traces)
+                bvh.DoTraceAgainstLeaf(&trace, leaf, *g_coll_world, ctx);
+            auto iters_end = std::chrono::high_resolution_clock::now();
+            unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(iters_end - iters_start).count();
+
+            samples_by_type[type].push_back({
+                .factors = BVH::GetLeafTraceCostFactors(leaf, *g_coll_world),
+                .duration_ns = (double)duration_sum_ns / iter_traces.size()
+            });
+
+            auto aabb_tests_start = std::chrono::high_resolution_clock::now();
+            for (const Trace& trace : iter_traces)
+                if (trace.HitsAabb(leaf.mins, leaf.maxs))
+                    aabb_hit_cnt++;
+            auto aabb_tests_end = std::chrono::high_resolution_clock::now();
+            aabb_test_duration_sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(aabb_tests_end - aabb_tests_start).count();
+            aabb_test_cnt += iter_traces.size();
+        }
+    }
+    if (aabb_hit_cnt != aabb_test_cnt)
+        Warning{} << "[Benchmark::CalibrateTraceCostModel]"
+            << aabb_test_cnt - aabb_hit_cnt << "traces missed their leaf's AABB";
+
+    // Fit model to measurements. Negative costs are meaningless and clamped.
+    using LeafType = BVH::Leaf::Type;
+    TraceCostModel model = {};
+    if (aabb_test_cnt > 0)
+        model.aabb_test = (float)(aabb_test_duration_sum_ns / aabb_test_cnt);
+
+    auto FitSamples = [&samples_by_type](LeafType type,
+        auto GetFeatures, std::initializer_list<float*> coefficients) {
+        std::vector<std::vector<double>> xs;
+        std::vector<double> ys;
+        for (const LeafSample& sample : samples_by_type[type]) {
+            xs.push_back(GetFeatures(sample.factors));
+            ys.push_back(sample.duration_ns);
+        }
+        std::optional<std::vector<double>> fit = FitLinearModel(xs, ys);
+        if (!fit) {
+            // Too few or too similar leaves, only determine a constant cost
+            if (ys.empty())
+                return; // Keep default model values
+            double mean = 0.0;
+            for (double y : ys) mean += y / ys.size();
+            fit = std::vector<double>(coefficients.size(), 0.0);
+            (*fit)[0] = mean;
+        }
+        size_t i = 0;
+        for (float* coefficient : coefficients)
+            *coefficient = Math::max((float)(*fit)[i++], 0.0f);
+    };
+    FitSamples(LeafType::Brush,
+        [](const TraceCostModel::Factors& f) { return std::vector<double>{ (double)f.side_cnt }; },
+        { &model.brush_base, &model.brush_per_side });
+    FitSamples(LeafType::FuncBrush,
+        [](const TraceCostModel::Factors& f) { return std::vector<double>{ (double)f.side_cnt }; },
+        { &model.func_brush_base, &model.func_brush_per_side });
+
+    // Static and dynamic props share the same trace code
+    samples_by_type[LeafType::StaticProp].insert(samples_by_type[LeafType::StaticProp].end(),
+        samples_by_type[LeafType::DynamicProp].begin(), samples_by_type[LeafType::DynamicProp].end());
+    FitSamples(LeafType::StaticProp,
+        [](const TraceCostModel::Factors& f) {
+            return std::vector<double>{ (double)f.section_cnt, (double)f.plane_cnt };
+        },
+        { &model.xprop_base, &model.xprop_per_section, &model.xprop_per_plane });
+
+    // Each displacement power has its own cost
+    for (uint32_t power = 0; power < 5; power++) {
+        double duration_sum_ns = 0.0;
+        size_t sample_cnt = 0;
+        for (const LeafSample& sample : samples_by_type[LeafType::Displacement]) {
+            if (sample.factors.disp_power == power) {
+                duration_sum_ns += sample.duration_ns;
+                sample_cnt++;
+            }
+        }
+        if (sample_cnt > 0)
+            model.disp_by_power[power] = (float)(duration_sum_ns / sample_cnt);
+    }
+
+    Debug{ Debug::Flag::NoSpace } << "[Benchmark::CalibrateTraceCostModel] Measured "
+        << samples_by_type[LeafType::Brush].size() << " brushes, "
+        << samples_by_type[LeafType::Displacement].size() << " displacements, "
+        << samples_by_type[LeafType::FuncBrush].size() << " func_brushes and "
+        << samples_by_type[LeafType::StaticProp].size() << " props";
+    return model;
+}
+
+void Benchmark::CreateDispCollCaches(TraceContext& ctx)
+{
+    for (CDispCollTree& disp_coll : *g_coll_world->pImpl->disp_coll_trees)
+        if (!disp_coll.CheckFlags(BspMap::DispInfo::FLAG_NO_HULL_COLL))
+            disp_coll.EnsureCacheIsCreated(ctx);
+}
+
+template<class Generator>
+std::vector<Trace> Benchmark::GenRealisticWorldTraces(Generator& gen,
+    const BVH& bvh, size_t trace_cnt, TraceContext& ctx)
+{
+    std::uniform_int_distribution<size_t> leaf_idx_dis(1, bvh.leaves.size() - 1);
+    std::vector<Trace> realistic_traces;
+    realistic_traces.reserve(trace_cnt);
+    while (realistic_traces.size() < trace_cnt) {
+        std::optional<Trace> r_tr = GenRealisticWorldTrace(gen, bvh.leaves[leaf_idx_dis(gen)], ctx);
+        if (r_tr)
+            realistic_traces.push_back(*r_tr);
+    }
+    return realistic_traces;
+}
+
+void Benchmark::CompareBvhTracing(const std::string& benchmark,
+    const std::vector<std::pair<std::string, const BVH*>>& bvhs)
+{
+    if (bvhs.empty()) return;
+    for (const auto& [name, bvh] : bvhs)
+        if (!bvh->WasConstructedSuccessfully()) return;
+    const BVH& reference_bvh = *bvhs[0].second;
+
+    unsigned int seed = GetSeed();
+    Debug{ Debug::Flag::NoSpace } << "[Benchmark::" << benchmark.c_str() << "] Used seed: " << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    // Benchmark settings
+    constexpr size_t NUM_REALISTIC_TRACES = 20000;
+    constexpr size_t NUM_ITERATIONS = 20; // How often to repeat each trace
+
+    TraceContext ctx;
+    g_coll_world->PrepareTraceContext(ctx);
+    for (const auto& [name, bvh] : bvhs)
+        bvh->PrepareTraceContext(ctx);
+    CreateDispCollCaches(ctx); // Measured traces mustn't create them
+
+    std::vector<Trace> realistic_traces =
+        GenRealisticWorldTraces(gen, reference_bvh, NUM_REALISTIC_TRACES, ctx);
+
+    // Returns mean duration of tracing the given trace NUM_ITERATIONS times
+    std::vector<Trace> iter_traces;
+    iter_traces.reserve(NUM_ITERATIONS);
+    auto MeasureTrace = [&](const BVH& bvh, const Trace& r_tr) {
+        iter_traces.clear();
+        for (size_t i = 0; i < NUM_ITERATIONS; i++)
+            iter_traces.emplace_back(r_tr.info);
+        auto iters_start = std::chrono::high_resolution_clock::now();
+        for (Trace& trace : iter_traces)
+            bvh.DoTrace(&trace, *g_coll_world, ctx);
+        auto iters_end = std::chrono::high_resolution_clock::now();
+        unsigned long long duration_sum_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(iters_end - iters_start).count();
+        return duration_sum_ns / NUM_ITERATIONS;
+    };
+
+    // Alternate between BVHs for each trace to spread out noise evenly.
+    // Results of the first BVH are the reference for the other BVHs.
+    std::vector<std::vector<unsigned long long>> mean_durations(bvhs.size());
+    std::vector<size_t> num_incorrect(bvhs.size(), 0);
+    for (std::vector<unsigned long long>& durations : mean_durations)
+        durations.reserve(NUM_REALISTIC_TRACES);
+    for (const Trace& r_tr : realistic_traces) {
+        Trace::Results reference_results;
+        for (size_t b = 0; b < bvhs.size(); b++) {
+            mean_durations[b].push_back(MeasureTrace(*bvhs[b].second, r_tr));
+            if (b == 0)
+                reference_results = iter_traces[0].results;
+            else if (!CompareTraceResults(r_tr.info, reference_results, iter_traces[0].results))
+                num_incorrect[b]++;
+        }
+    }
+
+    std::vector<BenchmarkStatistics> stats;
+    for (size_t b = 0; b < bvhs.size(); b++) {
+        const auto& [name, bvh] = bvhs[b];
+        stats.push_back(AddResult(benchmark, "trace_" + name, seed, mean_durations[b]));
+        size_t node_mem = bvh->GetNodeMemoryUsage();
+        size_t reference_node_mem = reference_bvh.GetNodeMemoryUsage();
+
+        Debug d{ Debug::Flag::NoSpace };
+        d << name.c_str() << ": node memory " << node_mem / 1024 << " KiB, SAH cost "
+          << bvh->CalcSahCost() << ", trace "
+          << GetDurationStr(stats[b].mean) << " ± "
+          << GetPercentStr(stats[b].stddev / stats[b].mean)
+          << " (50%=" << GetDurationStr(stats[b].median) << ")";
+        if (b != 0) {
+            Debug::Color speedup_col = stats[b].mean <= stats[0].mean ?
+                Debug::Color::Green : Debug::Color::Red;
+            Debug{ Debug::Flag::NoSpace } << Debug::color(speedup_col)
+                << "  Compared to " << bvhs[0].first.c_str() << ": node memory "
+                << GetPercentStr((float)node_mem / reference_node_mem - 1.0f, true)
+                << ", trace time "
+                << GetPercentStr(stats[b].mean / stats[0].mean - 1.0f, true);
+        }
+        if (num_incorrect[b] != 0)
+            Debug{ Debug::Flag::NoSpace } << Debug::color(Debug::Color::Red)
+                << "  " << num_incorrect[b] << " / " << NUM_REALISTIC_TRACES
+                << " traces produced results that differ from "
+                << bvhs[0].first.c_str() << "!";
+    }
+    Debug{ Debug::Flag::NoSpace } << "[Benchmark::" << benchmark.c_str() << "] Used seed: " << seed; // To let user reproduce this benchmark
+}
+
 static std::vector<Plane> GenAllBevelPlanesOfSPropSection(
     const CollisionModel&            sprop_coll_model,
     const CollisionCache_XProp& sprop_coll_cache,
@@ -286,7 +1774,7 @@ static std::vector<Plane> GenAllBevelPlanesOfSPropSection(
 
 void Benchmark::StaticPropBevelPlaneGen()
 {
-    if (!g_coll_world || !g_coll_world->pImpl->sprop_coll_models) {
+    if (!g_coll_world || !g_coll_world->pImpl->xprop_coll_models) {
         assert(false);
         return;
     }
@@ -296,6 +1784,7 @@ void Benchmark::StaticPropBevelPlaneGen()
     std::vector<unsigned long long> method_durations_ns(NUM_BENCHMARKED_METHODS, 0);
     std::vector<size_t> method_num_planes(NUM_BENCHMARKED_METHODS, 0);
     std::vector<bool> method_incorrect(NUM_BENCHMARKED_METHODS, false); // Whether a method produced incorrect output
+    std::vector<std::vector<unsigned long long>> method_section_durations_ns(NUM_BENCHMARKED_METHODS); // Mean duration per section
 
     size_t total_num_sprop_tris = 0; // # of triangles of all solid sprops in map
     size_t total_num_sprop_sections = 0; // # of sections of all solid sprops in map
@@ -305,23 +1794,16 @@ void Benchmark::StaticPropBevelPlaneGen()
     std::vector<size_t> sprop_leaf_indices = GetBvhLeafIndicesOfStaticPropsByTriCount(START_WITH_BIG_SPROPS);
     for (size_t e = 0; e < sprop_leaf_indices.size(); e++) {
         Debug{} << "sprop" << e << "/" << sprop_leaf_indices.size();
-        const BVH::Leaf&          leaf     = g_coll_world->pImpl->bvh->leaves[sprop_leaf_indices[e]];
-        const BspMap::StaticProp& sprop    = g_coll_world->pImpl->origin_bsp_map->static_props[leaf.sprop_idx];
-        const std::string&        mdl_path = g_coll_world->pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
-
-        const auto& iter = g_coll_world->pImpl->sprop_coll_models->find(mdl_path);
-        if (iter == g_coll_world->pImpl->sprop_coll_models->end())
-            continue; // This static prop has no collision model, skip
-        const CollisionModel& collmodel = iter->second;
-        const size_t num_sections = collmodel.section_tri_meshes.size();
+        const BVH::Leaf& leaf = g_coll_world->pImpl->bvh->leaves[sprop_leaf_indices[e]];
 
-        auto coll_cache_it = g_coll_world->pImpl->coll_caches_sprop->find(leaf.sprop_idx);
-        assert(coll_cache_it != g_coll_world->pImpl->coll_caches_sprop->end());
-        const CollisionCache_XProp& coll_cache = coll_cache_it->second;
+        const CollisionCache_XProp& coll_cache = (*g_coll_world->pImpl->coll_caches_sprop)[leaf.sprop_idx];
+        assert(coll_cache.HasCollision());
+        const CollisionModel& collmodel = (*g_coll_world->pImpl->xprop_coll_models)[coll_cache.coll_model_id];
+        const size_t num_sections = collmodel.GetSectionCount();
 
         // For each section
         for (size_t section_idx = 0; section_idx < num_sections; section_idx++) {
-            total_num_sprop_tris += collmodel.section_tri_meshes[section_idx].tris.size();
+            total_num_sprop_tris += collmodel.GetSection(section_idx).tri_planes.size();
             total_num_sprop_sections++;
 
             // For each method, generate section's bevel planes
@@ -347,6 +1829,7 @@ void Benchmark::StaticPropBevelPlaneGen()
                 auto gen_end = std::chrono::high_resolution_clock::now();
                 auto gen_duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(gen_end - gen_start).count();
                 method_durations_ns[method_idx] += gen_duration_ns;
+                method_section_durations_ns[method_idx].push_back(gen_duration_ns / NUM_ITERATIONS);
                 method_num_planes[method_idx] += results.size();
             }
 
@@ -420,8 +1903,12 @@ void Benchmark::StaticPropBevelPlaneGen()
         }
     }
     // Print time measurements
-    for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++)
+    for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++) {
         Debug{} << "Method" << method_idx << "took" << GetDurationStr((float)method_durations_ns[method_idx]);
+        AddResult("StaticPropBevelPlaneGen",
+                  "section_method_" + std::to_string(method_idx), 0,
+                  method_section_durations_ns[method_idx]);
+    }
     // Calculate bevel plane LUT memory size
     size_t num_unique_edges = (total_num_sprop_tris * 3) / 2; // Every edge is used by 2 triangles
     // Print bevel plane details
@@ -447,6 +1934,42 @@ void Benchmark::StaticPropBevelPlaneGen()
         " timing errors!";
 }
 
+static std::optional<unsigned int> g_fixed_seed = std::nullopt;
+static std::vector<Benchmark::Result> g_results;
+
+void Benchmark::SetSeed(unsigned int seed)
+{
+    g_fixed_seed = seed;
+}
+
+unsigned int Benchmark::GetSeed()
+{
+    if (g_fixed_seed)
+        return *g_fixed_seed;
+    return std::random_device{}();
+}
+
+const std::vector<Benchmark::Result>& Benchmark::GetResults()
+{
+    return g_results;
+}
+
+Benchmark::BenchmarkStatistics Benchmark::AddResult(const std::string& benchmark,
+    const std::string& metric, unsigned int seed,
+    std::vector<unsigned long long> durations)
+{
+    size_t sample_cnt = durations.size();
+    BenchmarkStatistics stats = CalcDurationStats(std::move(durations));
+    g_results.push_back({
+        .benchmark  = benchmark,
+        .metric     = metric,
+        .seed       = seed,
+        .sample_cnt = sample_cnt,
+        .stats      = stats
+    });
+    return stats;
+}
+
 // Format nanosecond duration. Examples: " 2.82s", "978.0ms", " 12.3µs", "811.9ns"
 // TODO This function should be useful elsewhere too, move it out of here.
 Containers::String Benchmark::GetDurationStr(float duration_ns) {
@@ -523,22 +2046,25 @@ Benchmark::BenchmarkStatistics Benchmark::CalcDurationStats(
     };
 }
 
+size_t Benchmark::GetHeapAllocationCount()
+{
+    return g_heap_alloc_cnt.load(std::memory_order_relaxed);
+}
+
 // Returns BVH leaf indices of all static props, sorted by their triangle count,
 // descending.
 std::vector<size_t> Benchmark::GetBvhLeafIndicesOfStaticPropsByTriCount(bool big_sprops_first)
 {
     auto GetSPropTriCount = [](size_t sprop_leaf_idx) -> size_t {
         const BVH::Leaf& leaf = g_coll_world->pImpl->bvh->leaves[sprop_leaf_idx];
-        const BspMap::StaticProp& sprop =
-            g_coll_world->pImpl->origin_bsp_map->static_props[leaf.sprop_idx];
-        const std::string& mdlpath =
-            g_coll_world->pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
+        const CollisionCache_XProp& coll_cache =
+            (*g_coll_world->pImpl->coll_caches_sprop)[leaf.sprop_idx];
         const CollisionModel& collmodel =
-            g_coll_world->pImpl->sprop_coll_models->at(mdlpath);
+            (*g_coll_world->pImpl->xprop_coll_models)[coll_cache.coll_model_id];
 
         size_t num_tris = 0;
-        for (const auto& section_tri_mesh : collmodel.section_tri_meshes)
-            num_tris += section_tri_mesh.tris.size();
+        for (size_t i = 0; i < collmodel.GetSectionCount(); i++)
+            num_tris += collmodel.GetSection(i).tri_planes.size(); // One plane per triangle
         return num_tris;
     };
 
@@ -574,14 +2100,12 @@ Vector3 Benchmark::GenRandomDir(Generator& gen) {
     return out.normalized();
 }
 
-// Tries to generate a realistic trace against a BVH leaf.
-// Returns nothing if unrealistic trace was generated.
+// Generates a random player hull trace in the vicinity of a BVH leaf.
+// The trace doesn't necessarily hit the leaf's AABB.
 template<class Generator>
-std::optional<Trace> Benchmark::GenRealisticTrace(
+Trace Benchmark::GenRandomHullTraceNearLeaf(
     Generator& gen, const BVH::Leaf& leaf)
 {
-    assert(leaf.type == BVH::Leaf::Type::StaticProp); // Other types not tested
-
     static Vector3 trace_extents = {16.0f, 16.0f, 36.0f}; // Traced hull's half extents
     //static Vector3 trace_extents = {8.0f, 8.0f, 36.0f}; // Traced hull's half extents
 
@@ -602,7 +2126,18 @@ std::optional<Trace> Benchmark::GenRealisticTrace(
         trace_start[axis] = distr(gen);
     }
 
-    Trace tr{trace_start, trace_start + trace_delta, -trace_extents, +trace_extents};
+    return Trace{trace_start, trace_start + trace_delta, -trace_extents, +trace_extents};
+}
+
+// Tries to generate a realistic trace against a BVH leaf.
+// Returns nothing if unrealistic trace was generated.
+template<class Generator>
+std::optional<Trace> Benchmark::GenRealisticTrace(
+    Generator& gen, const BVH::Leaf& leaf)
+{
+    assert(leaf.type == BVH::Leaf::Type::StaticProp); // Other types not tested
+
+    Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
 
     // Filter out traces that don't hit the static prop's AABB
     if (!tr.HitsAabb(leaf.mins, leaf.maxs))
@@ -619,6 +2154,30 @@ std::optional<Trace> Benchmark::GenRealisticTrace(
     return tr;
 }
 
+// Tries to generate a realistic trace near a BVH leaf of any type, traced
+// against the entire world.
+// Returns nothing if unrealistic trace was generated.
+template<class Generator>
+std::optional<Trace> Benchmark::GenRealisticWorldTrace(
+    Generator& gen, const BVH::Leaf& leaf, TraceContext& ctx)
+{
+    Trace tr = GenRandomHullTraceNearLeaf(gen, leaf);
+
+    // Filter out traces that don't hit the leaf's AABB
+    if (!tr.HitsAabb(leaf.mins, leaf.maxs))
+        return std::nullopt;
+
+    // Trace against entire world using the BVH
+    g_coll_world->pImpl->bvh->DoTrace(&tr, *g_coll_world, ctx);
+
+    // Filter out traces that start inside map geometry
+    if (tr.results.startsolid)
+        return std::nullopt;
+
+    // Return realistic trace with its results
+    return tr;
+}
+
 // Returns true if the results are (near) identical, false otherwise.
 bool Benchmark::CompareTraceResults(
     const Trace::Info& trace_info,
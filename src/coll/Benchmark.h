@@ -2,11 +2,16 @@
 #define COLL_BENCHMARK_H_
 
 // CAUTION: Remember to disable this when making a public release!
+// Headless benchmark builds enable this through a compile definition instead.
+#ifndef COLL_BENCHMARK_ENABLED
 #define COLL_BENCHMARK_ENABLED 0 // Turn compilation of collision benchmarks on/off
+#endif
 
 #if COLL_BENCHMARK_ENABLED
 
 #include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <Corrade/Containers/String.h>
@@ -30,13 +35,108 @@ public:
     // NOTE: Other threads shouldn't be running, they might mess up measurements.
     static void StaticPropBevelPlaneGen();
 
+    // Benchmark BVH traversal of realistic hull traces against the entire
+    // world and count heap allocations that occur during these traces.
+    // Performs tests using BVH leaves of currently loaded map.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhTracing();
+
+    // Benchmark hull traces against single static and dynamic props and count
+    // heap allocations that occur during these traces.
+    // Performs tests using static and dynamic props of currently loaded map.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void XPropTracing();
+
+    // Stress test concurrent tracing: Multiple threads perform the same
+    // realistic traces against the entire world at the same time, starting
+    // without any displacement collision caches. Their results are compared to
+    // single-threaded results.
+    static void MultithreadedTracing();
+
+    // Benchmark BVH construction time and resulting BVH quality (SAH cost) of
+    // different BVH build methods, using the currently loaded map.
+    static void BvhConstruction();
+
+    // Compare BVH quality, node memory usage and trace performance of BVHs
+    // built with object splits only and with spatial splits, using the
+    // currently loaded map. Spatial splits matter most on maps with long or
+    // big brushes and displacements.
+    // Also checks that all BVHs produce identical trace results.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhSpatialSplits();
+
+    // Compare build time, SAH cost and trace performance of BVHs built with
+    // and without treelet optimization passes, using the currently loaded map.
+    // Also checks that all BVHs produce identical trace results.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhTreeletOptimization();
+
+    // Compare node memory usage and trace performance of BVHs with float node
+    // AABBs and with quantized node AABBs, using the currently loaded map.
+    // Also checks that both produce identical trace results.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhQuantization();
+
+    // Compare node memory usage and trace performance of the binary BVH and
+    // the 4-wide BVH, using the currently loaded map.
+    // Also checks that both produce identical trace results.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void Bvh4Tracing();
+
+    // Calibrate the leaf trace cost model of BVH construction: Measure trace
+    // durations against a sample of the currently loaded map's leaves and fit
+    // TraceCostModel to them. Then compare trace performance of BVHs built
+    // with the default model (uniform leaf costs) and the calibrated model.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void LeafTraceCostCalibration();
+
+    // Compare the time it takes to build the currently loaded map's BVH with
+    // the time it takes to load it from a BVH cache file instead.
+    // Also checks that both produce identical nodes.
+    static void BvhCacheLoading();
+
+    // Benchmark BVH AABB overlap queries, as used for box-vs-world
+    // broadphases, against brute-force iteration over all BVH leaves and count
+    // heap allocations that occur during these queries. Results are checked
+    // against brute force, also with result buffers too small to hold them.
+    // Performs tests using BVH leaves of currently loaded map.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhOverlapQuery();
+
+    // Check Trace::HitsAabb() against its reference implementation and compare
+    // their performance, using random traces near the currently loaded map's
+    // leaves and realistic world traces tested against their broadphase
+    // candidates. Swept and unswept traces are measured separately.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void TraceAabbTest();
+
+    // Benchmark swept and unswept traces against each solid func_brush entity
+    // of the currently loaded map, using random traces that hit the
+    // func_brush's AABB. Best used with maps that have many func_brush
+    // entities, does nothing on maps without them.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void FuncBrushTracing();
+
+    // Compare ray traces against each ray-collidable displacement of the
+    // currently loaded map with hull traces of zero extent along the same
+    // paths, using random traces that hit the displacement's AABB.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void DisplacementRayTracing();
+
+    // Measure the cost of limiting the memory of displacement collision
+    // caches to different budgets, see
+    // CollidableWorld::SetDispCollCacheBudget(). Replays frames of realistic
+    // traces near the currently loaded map's leaves, each frame is followed
+    // by an eviction pass. Traces stay in one area of the map for a while
+    // before moving on to the next one.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void DispCollCacheBudget();
+
     ////////////////////////////////////////////////////////////////////////////
 
-    // TODO This function should be useful elsewhere too, move it out of here.
-    static Corrade::Containers::String GetDurationStr(float duration_ns);
-    // TODO This function should be useful elsewhere too, move it out of here.
-    static Corrade::Containers::String GetPercentStr(float fraction,
-                                                bool include_plus_sign = false);
+    // Seed benchmarks use for random trace generation. If no seed was set,
+    // each benchmark uses a new random seed.
+    static void SetSeed(unsigned int seed);
 
     struct BenchmarkStatistics {
         float mean;
@@ -46,20 +146,89 @@ public:
         unsigned long long _5th_percentile;  // 5% of durations are less than or equal to this
         unsigned long long _95th_percentile; // 5% of durations are more than or equal to this
     };
+
+    // Duration statistics of a benchmark, in nanoseconds
+    struct Result {
+        std::string benchmark; // Name of benchmark function, e.g. "BvhTracing"
+        std::string metric;    // What was measured, e.g. "trace"
+        unsigned int seed;     // 0 if benchmark doesn't use random numbers
+        size_t sample_cnt;     // Number of durations the statistics are based on
+        BenchmarkStatistics stats;
+    };
+
+    // Results of all benchmarks that were run so far, in the order they were
+    // measured. Meant for machine-readable reports.
+    static const std::vector<Result>& GetResults();
+
+    ////////////////////////////////////////////////////////////////////////////
+
+    // TODO This function should be useful elsewhere too, move it out of here.
+    static Corrade::Containers::String GetDurationStr(float duration_ns);
+    // TODO This function should be useful elsewhere too, move it out of here.
+    static Corrade::Containers::String GetPercentStr(float fraction,
+                                                bool include_plus_sign = false);
+
     // TODO This function should be useful elsewhere too, move it out of here.
     static BenchmarkStatistics CalcDurationStats(
                                      std::vector<unsigned long long> durations);
 
+    // Returns the seed set with SetSeed() or, if none was set, a random one.
+    static unsigned int GetSeed();
+
+    // Calculates statistics of the given durations and adds them to results
+    static BenchmarkStatistics AddResult(const std::string& benchmark,
+        const std::string& metric, unsigned int seed,
+        std::vector<unsigned long long> durations);
+
+    // Performs the same realistic traces with all given BVHs, which must be
+    // built from the currently loaded map, and compares their trace durations
+    // and node memory usage. Trace results of the first BVH are the reference
+    // the other BVHs' results are checked against.
+    // Durations are added to results with metric "trace_<name>".
+    static void CompareBvhTracing(const std::string& benchmark,
+        const std::vector<std::pair<std::string, const BVH*>>& bvhs);
+
+    // Creates the collision caches of all displacements that hull traces use.
+    // Caches are otherwise created on demand during traces, which allocates
+    // memory and must not happen during measurements.
+    static void CreateDispCollCaches(TraceContext& ctx);
+
+    // Generates realistic traces against the entire world near randomly
+    // picked leaves of all types of the given BVH, see GenRealisticWorldTrace().
+    template<class Generator>
+    static std::vector<Trace> GenRealisticWorldTraces(Generator& gen,
+        const BVH& bvh, size_t trace_cnt, TraceContext& ctx);
+
+    // Measures trace durations against the given BVH's leaves and fits a
+    // trace cost model to them. Model values of leaf types that don't occur
+    // in the map are taken from the default model.
+    static TraceCostModel CalibrateTraceCostModel(const BVH& bvh,
+                                                  unsigned int seed);
+
     static std::vector<size_t> GetBvhLeafIndicesOfStaticPropsByTriCount(
                                                          bool big_sprops_first);
 
     template<class Generator>
     static Magnum::Vector3 GenRandomDir(Generator& gen);
 
+    // Number of heap allocations done by the entire program so far.
+    // While collision benchmarks are enabled, global operator new is replaced
+    // in order to count them.
+    static size_t GetHeapAllocationCount();
+
+    template<class Generator>
+    static Trace GenRandomHullTraceNearLeaf(Generator& gen,
+                                            const BVH::Leaf& leaf);
+
     template<class Generator>
     static std::optional<Trace> GenRealisticTrace(Generator& gen,
                                                        const BVH::Leaf& leaf);
 
+    template<class Generator>
+    static std::optional<Trace> GenRealisticWorldTrace(Generator& gen,
+                                                       const BVH::Leaf& leaf,
+                                                       TraceContext& ctx);
+
     static bool CompareTraceResults(
         const Trace::Info& trace_info,
         const Trace::Results& ground_truth,
@@ -1,8 +1,13 @@
 #include "coll/CollidableWorld-brush.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
 #include <Tracy.hpp>
 
 #include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
 
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
@@ -17,10 +22,11 @@ using Plane     = BspMap::Plane;
 using Brush     = BspMap::Brush;
 using BrushSide = BspMap::BrushSide;
 
-uint64_t CollidableWorld::GetTraceCost_Brush(uint32_t brush_idx)
+TraceCostModel::Factors CollidableWorld::GetTraceCostFactors_Brush(uint32_t brush_idx)
 {
-    // See BVH::GetLeafTraceCost() for details and considerations.
-    return 1; // Is brush trace cost dependent on brushside count?
+    // See BVH::CalcLeafTraceCost() for details and considerations.
+    const Brush& brush = pImpl->origin_bsp_map->brushes[brush_idx];
+    return { .side_cnt = brush.num_sides };
 }
 
 static bool IsBrushSolidToPlayer(const Brush& brush)
@@ -34,13 +40,85 @@ static bool IsBrushSolidToPlayer(const Brush& brush)
     return false;
 }
 
+// Whether any kind of trace (players, grenades, ...) collides with the brush
+static bool IsBrushCollidable(const Brush& brush)
+{
+    static auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
+    static auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
+    static auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
+    static auto test_f_4 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
+    static auto test_f_5 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::WATER);
+    if (test_f_1.first && test_f_1.first(brush)) return true;
+    if (test_f_2.first && test_f_2.first(brush)) return true;
+    if (test_f_3.first && test_f_3.first(brush)) return true;
+    if (test_f_4.first && test_f_4.first(brush)) return true;
+    if (test_f_5.first && test_f_5.first(brush)) return true;
+    return false;
+}
+
+static bool IsAxialPlane(const Plane& plane)
+{
+    return Math::abs(plane.normal.x()) == 1.0f
+        || Math::abs(plane.normal.y()) == 1.0f
+        || Math::abs(plane.normal.z()) == 1.0f;
+}
+
+CompiledBrushes::CompiledBrushes(const BspMap& bsp_map)
+{
+    ZoneScoped;
+
+    brushes.resize(bsp_map.brushes.size(), Brush{
+        .mins = { 0.0f, 0.0f, 0.0f },
+        .maxs = { 0.0f, 0.0f, 0.0f },
+        .first_plane = 0,
+        .plane_cnt = 0,
+        .is_solid_to_player = false,
+        .has_aabb = false,
+    });
+
+    for (size_t brush_idx : bsp_map.GetModelBrushIndices_worldspawn()) {
+        const BspMap::Brush& bsp_brush = bsp_map.brushes[brush_idx];
+        Brush& brush = brushes[brush_idx];
+        if (!bsp_brush.num_sides)
+            continue;
+
+        if (IsBrushCollidable(bsp_brush))
+            brush.has_aabb = bsp_map.GetBrushAABB(brush_idx, &brush.mins, &brush.maxs);
+
+        brush.is_solid_to_player = IsBrushSolidToPlayer(bsp_brush);
+        if (!brush.is_solid_to_player)
+            continue; // Never traced against, no planes needed
+
+        // Axial planes first, all planes keep their original relative order
+        assert(bsp_brush.num_sides <= UINT16_MAX);
+        brush.first_plane = (uint32_t)planes.size();
+        brush.plane_cnt   = bsp_brush.num_sides;
+        for (int pass = 0; pass < 2; pass++) {
+            for (uint32_t i = 0; i < bsp_brush.num_sides; i++) {
+                const BrushSide& side = bsp_map.brushsides[bsp_brush.first_side + i];
+                const BspMap::Plane& plane = bsp_map.planes[side.plane_num];
+                if (IsAxialPlane(plane) != (pass == 0))
+                    continue;
+                planes.push_back({
+                    .normal   = plane.normal,
+                    .dist     = plane.dist,
+                    .texinfo  = side.texinfo,
+                    .side_num = (uint16_t)i,
+                    .bevel    = side.bevel == 1,
+                });
+            }
+        }
+    }
+}
+
 void CollidableWorld::DoSweptTrace_Brush(Trace* trace, uint32_t brush_idx)
 {
     assert(trace->info.isswept);
     ZoneScoped;
 
-    const Brush& brush = pImpl->origin_bsp_map->brushes[brush_idx];
-    if (!IsBrushSolidToPlayer(brush))
+    const CompiledBrushes& compiled_brushes = *pImpl->compiled_brushes;
+    const CompiledBrushes::Brush& brush = compiled_brushes.brushes[brush_idx];
+    if (!brush.is_solid_to_player)
         return;
 
     // -------- start of source-sdk-2013 code --------
@@ -56,11 +134,10 @@ void CollidableWorld::DoSweptTrace_Brush(Trace* trace, uint32_t brush_idx)
     const Vector3 mins = -trace->info.extents; // Box case only (!trace->info.isray)
     const Vector3 maxs = +trace->info.extents; // Box case only (!trace->info.isray)
 
-    if (!brush.num_sides)
+    if (!brush.plane_cnt)
         return;
 
-    const BrushSide* leadside  = nullptr;
-    const Plane*     clipplane = nullptr;
+    const CompiledBrushes::Plane* clipplane = nullptr;
     float enterfrac = NEVER_UPDATED;
     float leavefrac = 1.0f;
     bool  getout    = false;
@@ -71,15 +148,17 @@ void CollidableWorld::DoSweptTrace_Brush(Trace* trace, uint32_t brush_idx)
     float   d1, d2;
     float   f;
 
-    // @Optimization Ensure the 6 axial brushsides/planes are processed first
-    for (int i = 0; i < brush.num_sides; i++)
+    // Planes aren't in their original order, axial planes come first. If
+    // multiple planes have the same enter fraction, pick the one whose
+    // brushside comes first, like when processing planes in original order.
+    const CompiledBrushes::Plane* planes = &compiled_brushes.planes[brush.first_plane];
+    for (uint32_t i = 0; i < brush.plane_cnt; i++)
     {
-        const BrushSide& side = pImpl->origin_bsp_map->brushsides[brush.first_side + i];
-        const Plane& plane    = pImpl->origin_bsp_map->planes[side.plane_num];
+        const CompiledBrushes::Plane& plane = planes[i];
 
         if (trace->info.isray) // Special point case
         {
-            if (side.bevel == 1) // Don't ray trace against bevel planes
+            if (plane.bevel) // Don't ray trace against bevel planes
                 continue;
 
             dist = plane.dist;
@@ -114,10 +193,10 @@ void CollidableWorld::DoSweptTrace_Brush(Trace* trace, uint32_t brush_idx)
         if (d1 > d2) {
             // Enter
             f = (d1 - DIST_EPSILON) / (d1 - d2);
-            if (f > enterfrac) {
+            if (f > enterfrac || (f == enterfrac && clipplane &&
+                                  plane.side_num < clipplane->side_num)) {
                 enterfrac = f;
                 clipplane = &plane;
-                leadside = &side;
             }
         }
         else {
@@ -142,7 +221,7 @@ void CollidableWorld::DoSweptTrace_Brush(Trace* trace, uint32_t brush_idx)
                 enterfrac = 0.0f;
             trace->results.fraction     = enterfrac;
             trace->results.plane_normal = clipplane->normal;
-            trace->results.surface      = leadside->texinfo; // Might be -1
+            trace->results.surface      = clipplane->texinfo; // Might be -1
             //trace->contents = brush.contents; // TODO: Return hit contents in a better way
         }
     }
@@ -154,8 +233,9 @@ void CollidableWorld::DoUnsweptTrace_Brush(Trace* trace, uint32_t brush_idx)
     assert(trace->info.isswept == false);
     ZoneScoped;
 
-    const Brush& brush = pImpl->origin_bsp_map->brushes[brush_idx];
-    if (!IsBrushSolidToPlayer(brush))
+    const CompiledBrushes& compiled_brushes = *pImpl->compiled_brushes;
+    const CompiledBrushes::Brush& brush = compiled_brushes.brushes[brush_idx];
+    if (!brush.is_solid_to_player)
         return;
 
     // -------- start of source-sdk-2013 code --------
@@ -164,21 +244,20 @@ void CollidableWorld::DoUnsweptTrace_Brush(Trace* trace, uint32_t brush_idx)
     const Vector3 mins = -trace->info.extents; // Box case only (!trace->info.isray)
     const Vector3 maxs = +trace->info.extents; // Box case only (!trace->info.isray)
 
-    if (!brush.num_sides)
+    if (!brush.plane_cnt)
         return;
 
     float   dist;
     Vector3 ofs;
 
-    // @Optimization Ensure the 6 axial brushsides/planes are processed first
-    for (int i = 0; i < brush.num_sides; i++)
+    const CompiledBrushes::Plane* planes = &compiled_brushes.planes[brush.first_plane];
+    for (uint32_t i = 0; i < brush.plane_cnt; i++)
     {
-        const BrushSide& side = pImpl->origin_bsp_map->brushsides[brush.first_side + i];
-        const Plane& plane    = pImpl->origin_bsp_map->planes[side.plane_num];
+        const CompiledBrushes::Plane& plane = planes[i];
 
         if (trace->info.isray) // Special point case
         {
-            if (side.bevel == 1) // Don't ray trace against bevel planes
+            if (plane.bevel) // Don't ray trace against bevel planes
                 continue;
 
             dist = plane.dist;
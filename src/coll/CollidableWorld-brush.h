@@ -1,11 +1,52 @@
 #ifndef COLL_COLLIDABLEWORLD_BRUSH_H_
 #define COLL_COLLIDABLEWORLD_BRUSH_H_
 
+#include <cstdint>
+#include <vector>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "csgo_parsing/BspMap.h"
+
 namespace coll {
 
+// Collision data of the worldspawn brushes, compiled once at world creation.
+// Brush traces read everything they need from here instead of following
+// BspMap's brush -> brushside -> plane indices and running BrushSeparation
+// tests on every trace.
+// All planes are stored in a single flat array, each brush's planes are
+// contiguous and its axial planes come first. Axial planes reject traces
+// that don't touch the brush's AABB, so most rejections happen after
+// reading few planes.
+struct CompiledBrushes {
+    // Compiles all worldspawn brushes of the given map.
+    explicit CompiledBrushes(const csgo_parsing::BspMap& bsp_map);
+
+    struct Plane {
+        Magnum::Vector3 normal;
+        float dist; // distance from origin
+        int16_t  texinfo;  // Of the plane's brushside, index into BspMap's texinfos array
+        uint16_t side_num; // Position of the plane's brushside within its brush
+        bool     bevel;    // If true, plane is only used for collisions with AABBs
+    };
 
-    // ... (Add further brush-related collision code here)
+    struct Brush {
+        Magnum::Vector3 mins, maxs; // AABB, only valid if has_aabb is true
+        uint32_t first_plane; // index into planes array
+        uint32_t plane_cnt;   // 0 if the brush isn't solid to players
+        bool is_solid_to_player;
+        // If true, the brush collides with at least one kind of trace
+        // (players, grenades, ...) and has a valid AABB. Only these brushes
+        // are put into the BVH.
+        bool has_aabb;
+    };
 
+    // Indexed like BspMap::brushes. Brushes that aren't part of worldspawn
+    // have no planes and no AABB.
+    std::vector<Brush> brushes;
+    std::vector<Plane> planes;
+};
 
 } // namespace coll
 
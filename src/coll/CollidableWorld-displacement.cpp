@@ -1,5 +1,6 @@
 #include "coll/CollidableWorld-displacement.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <functional> // for std::hash
@@ -17,6 +18,7 @@
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/Debugger.h"
 #include "coll/Trace.h"
+#include "coll/TraceContext.h"
 #include "csgo_parsing/BspMap.h"
 #include "utils_3d.h"
 
@@ -52,41 +54,115 @@ static bool SourceSdkVectorEqual(const Vector3& vec1, const Vector3& vec2) {
 }
 
 
-uint64_t CollidableWorld::GetTraceCost_Displacement(uint32_t dispcoll_idx)
+TraceCostModel::Factors CollidableWorld::GetTraceCostFactors_Displacement(uint32_t dispcoll_idx)
 {
-    // See BVH::GetLeafTraceCost() for details and considerations.
-    return 1; // Is displacement trace cost dependent on triangle count?
+    // See BVH::CalcLeafTraceCost() for details and considerations.
+    assert(pImpl->disp_coll_trees != Corrade::Containers::NullOpt);
+    const CDispCollTree& disp_coll = (*pImpl->disp_coll_trees)[dispcoll_idx];
+    return { .disp_power = (uint32_t)disp_coll.GetPower() };
 }
 
 void CollidableWorld::DoSweptTrace_Displacement(Trace* trace,
-                                                uint32_t dispcoll_idx)
+                                                uint32_t dispcoll_idx,
+                                                TraceContext& ctx)
 {
     assert(trace->info.isswept);
     ZoneScoped;
 
-    assert(pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
-    std::vector<CDispCollTree>& hull_disp_coll_trees = *pImpl->hull_disp_coll_trees;
-    CDispCollTree& hull_dispcoll = hull_disp_coll_trees[dispcoll_idx];
+    assert(pImpl->disp_coll_trees != Corrade::Containers::NullOpt);
+    std::vector<CDispCollTree>& disp_coll_trees = *pImpl->disp_coll_trees;
+    CDispCollTree& dispcoll = disp_coll_trees[dispcoll_idx];
 
     if (trace->info.isray) { // ray trace
-        // NOTE: Right now, only collision structures of displacements required
-        //       for *hull* collision are initialized! Once you need to perform
-        //       *ray* collisions on displacements, initialize the displacements
-        //       that don't have the NO_RAY_COLL flag as well and use them here!
-        assert(0 && "ERROR: Unable to perform ray traces on displacements! See "
-            "surrounding comment.");
-        return;
-
-        // Displacements with NO_RAY_COLL flag are not considered by AABBTree_Ray
-        //hull_dispcoll.AABBTree_Ray(trace); // Returns true on hit
+        // Displacements with NO_RAY_COLL flag are not considered by
+        // AABBTree_Ray. Ray traces don't use displacement collision caches.
+        dispcoll.AABBTree_Ray(trace); // Returns true on hit
     }
     else { // hull trace
         // Displacements with NO_HULL_COLL flag are not considered by
         // AABBTree_SweepAABB.
         // Displacement collision cache might be created.
-        // CAUTION: Not thread-safe yet!
-        hull_dispcoll.AABBTree_SweepAABB(trace); // Returns true on hit
+        ctx.disp_coll_cache_use_stamp = pImpl->disp_coll_cache_clock;
+        dispcoll.AABBTree_SweepAABB(trace, ctx); // Returns true on hit
+    }
+}
+
+void CollidableWorld::SetDispCollCacheBudget(size_t budget_bytes)
+{
+    pImpl->disp_coll_cache_budget = budget_bytes;
+}
+
+size_t CollidableWorld::GetDispCollCacheBudget() const
+{
+    return pImpl->disp_coll_cache_budget;
+}
+
+void CollidableWorld::EvictDispCollCaches()
+{
+    ZoneScoped;
+
+    // Traces after this eviction pass mark caches as more recently used than
+    // all traces before it
+    pImpl->disp_coll_cache_clock++;
+
+    if (pImpl->disp_coll_cache_budget == DISP_COLL_CACHE_BUDGET_UNLIMITED)
+        return;
+    if (pImpl->disp_coll_trees == Corrade::Containers::NullOpt)
+        return;
+    std::vector<CDispCollTree>& disp_coll_trees = *pImpl->disp_coll_trees;
+
+    // Collect created caches and their total memory usage
+    std::vector<uint32_t>& lru_order = pImpl->disp_coll_cache_lru_order;
+    lru_order.clear();
+    size_t memory_usage = 0;
+    for (uint32_t i = 0; i < disp_coll_trees.size(); i++) {
+        if (!disp_coll_trees[i].IsCacheGenerated())
+            continue;
+        lru_order.push_back(i);
+        memory_usage += disp_coll_trees[i].GetCacheMemoryUsage();
+    }
+    if (memory_usage <= pImpl->disp_coll_cache_budget)
+        return;
+
+    // Evict least recently used caches first. Caches used since the previous
+    // pass are only evicted if the budget can't be met otherwise.
+    std::sort(lru_order.begin(), lru_order.end(),
+        [&disp_coll_trees](uint32_t a, uint32_t b) {
+            uint64_t last_use_a = disp_coll_trees[a].GetCacheLastUse();
+            uint64_t last_use_b = disp_coll_trees[b].GetCacheLastUse();
+            if (last_use_a != last_use_b)
+                return last_use_a < last_use_b;
+            return a < b;
+        }
+    );
+    for (uint32_t disp_coll_idx : lru_order) {
+        if (memory_usage <= pImpl->disp_coll_cache_budget)
+            break;
+        CDispCollTree& dispcoll = disp_coll_trees[disp_coll_idx];
+        memory_usage -= dispcoll.GetCacheMemoryUsage();
+        dispcoll.Uncache();
+        pImpl->disp_coll_cache_eviction_cnt++;
+    }
+}
+
+CollidableWorld::DispCollCacheStats CollidableWorld::GetDispCollCacheStats() const
+{
+    DispCollCacheStats stats{
+        .hit_cnt      = pImpl->main_thread_trace_ctx.disp_coll_cache_hit_cnt,
+        .miss_cnt     = pImpl->main_thread_trace_ctx.disp_coll_cache_miss_cnt,
+        .eviction_cnt = pImpl->disp_coll_cache_eviction_cnt,
+        .cache_cnt    = 0,
+        .memory_usage = 0,
+    };
+    if (pImpl->disp_coll_trees != Corrade::Containers::NullOpt) {
+        for (const CDispCollTree& dispcoll : *pImpl->disp_coll_trees) {
+            if (!dispcoll.IsCacheGenerated())
+                continue;
+            stats.cache_cnt++;
+            stats.memory_usage += dispcoll.GetCacheMemoryUsage();
+        }
     }
+    return stats;
 }
 
 void CollidableWorld::DoUnsweptTrace_Displacement(Trace* trace,
@@ -99,16 +175,16 @@ void CollidableWorld::DoUnsweptTrace_Displacement(Trace* trace,
     if (trace->info.isray)
         return; // An unswept point trace against a displacement makes no sense.
 
-    assert(pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
-    std::vector<CDispCollTree>& hull_disp_coll_trees = *pImpl->hull_disp_coll_trees;
-    CDispCollTree& hull_dispcoll = hull_disp_coll_trees[dispcoll_idx];
+    assert(pImpl->disp_coll_trees != Corrade::Containers::NullOpt);
+    std::vector<CDispCollTree>& disp_coll_trees = *pImpl->disp_coll_trees;
+    CDispCollTree& dispcoll = disp_coll_trees[dispcoll_idx];
 
     Vector3 abs_aabb_mins = trace->info.startpos - trace->info.extents;
     Vector3 abs_aabb_maxs = trace->info.startpos + trace->info.extents;
 
     // AABBTree_IntersectAABB() does nothing and returns false if displacement
     // has NO_HULL_COLL flag set.
-    if (hull_dispcoll.AABBTree_IntersectAABB(abs_aabb_mins, abs_aabb_maxs)) {
+    if (dispcoll.AABBTree_IntersectAABB(abs_aabb_mins, abs_aabb_maxs)) {
         // We're intersecting the displacement!
         trace->results.startsolid   = true;
         trace->results.allsolid     = true;
@@ -669,43 +745,28 @@ static const Vector3 g_Vec3DispCollEpsilons{
     DISPCOLL_DIST_EPSILON
 };
 
-struct DispCollPlaneIndex_t
+bool DispCollPlaneIndex_t::operator==(const DispCollPlaneIndex_t& other) const
 {
-    Vector3 vecPlane;
-    int index;
-
-    // Compare
-    bool operator==(const DispCollPlaneIndex_t& other) const {
-        return (SourceSdkVectorEqual(this->vecPlane,  other.vecPlane) ||
-                SourceSdkVectorEqual(this->vecPlane, -other.vecPlane));
-    }
-};
+    return (SourceSdkVectorEqual(this->vecPlane,  other.vecPlane) ||
+            SourceSdkVectorEqual(this->vecPlane, -other.vecPlane));
+}
 
-class CPlaneIndexHashFuncs
+size_t CPlaneIndexHashFuncs::operator()(const DispCollPlaneIndex_t& item) const
 {
-public:
-    // Hash
-    size_t operator()(const DispCollPlaneIndex_t& item) const {
-        return HashVector3(item.vecPlane) ^ HashVector3(-item.vecPlane);
-    }
-private:
-    size_t HashVector3(const Vector3& vec) const {
-        // Create std::string_view of the vector's values
-        const char* ptr = reinterpret_cast<const char*>(vec.data());
-        constexpr size_t byte_count = Vector3::Size * sizeof(Vector3::Type);
-        std::string_view sv{ ptr, byte_count };
-
-        // Compute vector hash value using std::hash specialization for
-        // std::string_view
-        return std::hash<std::string_view>{}(sv);
-    }
-};
+    return HashVector3(item.vecPlane) ^ HashVector3(-item.vecPlane);
+}
 
-// @Optimization Is 512 a good default bucket count?
-//               Theoretical max of unique keys during current usage is 672.
-//               Test if 512 are enough buckets? Do allocations occur?
-static std::unordered_set<DispCollPlaneIndex_t, CPlaneIndexHashFuncs>
-                                                  g_DispCollPlaneIndexHash(512);
+size_t CPlaneIndexHashFuncs::HashVector3(const Vector3& vec) const
+{
+    // Create std::string_view of the vector's values
+    const char* ptr = reinterpret_cast<const char*>(vec.data());
+    constexpr size_t byte_count = Vector3::Size * sizeof(Vector3::Type);
+    std::string_view sv{ ptr, byte_count };
+
+    // Compute vector hash value using std::hash specialization for
+    // std::string_view
+    return std::hash<std::string_view>{}(sv);
+}
 
 
 // Displacement Collision Triangle
@@ -1104,29 +1165,73 @@ void CDispCollTree::AABBTree_CalcBounds()
 
 bool CDispCollTree::IsCacheGenerated() const
 {
-    return m_aTrisCache.size() == GetTriSize();
+    return m_cacheState.val.load(std::memory_order_acquire) == CACHE_CREATED;
 }
 
-void CDispCollTree::EnsureCacheIsCreated()
+void CDispCollTree::EnsureCacheIsCreated(TraceContext& ctx)
 {
-    if (m_aTrisCache.size() == GetTriSize())
+    // Avoid writing to memory shared with other threads if the stamp is the
+    // same already, which is the case for most calls
+    uint64_t use_stamp = ctx.disp_coll_cache_use_stamp;
+    if (m_cacheLastUse.val.load(std::memory_order_relaxed) != use_stamp)
+        m_cacheLastUse.val.store(use_stamp, std::memory_order_relaxed);
+
+    uint8_t state = m_cacheState.val.load(std::memory_order_acquire);
+    if (state == CACHE_CREATED) {
+        ctx.disp_coll_cache_hit_cnt++;
         return;
+    }
+    ctx.disp_coll_cache_miss_cnt++;
+
+    while (state != CACHE_CREATED) {
+        if (state == CACHE_CREATING) {
+            // Another thread is creating the cache, wait for it to finish
+            m_cacheState.val.wait(CACHE_CREATING, std::memory_order_acquire);
+            state = m_cacheState.val.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // Try to become the thread that creates the cache. On failure, state
+        // gets updated and we try again.
+        if (!m_cacheState.val.compare_exchange_strong(state, CACHE_CREATING,
+                                                      std::memory_order_acquire))
+            continue;
 
-    // Alloc.
-    //int nSize = sizeof( CDispCollTriCache ) * GetTriSize();
-    int nTriCount = GetTriSize();
-    m_aTrisCache = std::vector<CDispCollTriCache>(nTriCount);
+        // Alloc.
+        //int nSize = sizeof( CDispCollTriCache ) * GetTriSize();
+        int nTriCount = GetTriSize();
+        m_aTrisCache = std::vector<CDispCollTriCache>(nTriCount);
 
-    for (int iTri = 0; iTri < nTriCount; iTri++)
-        Cache_Create(&m_aTris[iTri], iTri);
+        for (int iTri = 0; iTri < nTriCount; iTri++)
+            Cache_Create(&m_aTris[iTri], iTri, ctx.disp_coll_plane_index_hash);
 
-    // Clear temporary lookup table that was used by Cache_Create()
-    g_DispCollPlaneIndexHash.clear();
+        // Clear temporary lookup table that was used by Cache_Create()
+        ctx.disp_coll_plane_index_hash.clear();
+
+        // Publish cache to other threads
+        m_cacheState.val.store(CACHE_CREATED, std::memory_order_release);
+        m_cacheState.val.notify_all();
+        return;
+    }
 }
 
 void CDispCollTree::Uncache() {
     m_aTrisCache  = {};
     m_aEdgePlanes = {};
+    m_cacheState.val.store(CACHE_NONE, std::memory_order_release);
+}
+
+uint64_t CDispCollTree::GetCacheLastUse() const
+{
+    return m_cacheLastUse.val.load(std::memory_order_relaxed);
+}
+
+size_t CDispCollTree::GetCacheMemoryUsage() const
+{
+    if (!IsCacheGenerated())
+        return 0;
+    return m_aTrisCache .capacity() * sizeof(CDispCollTriCache)
+         + m_aEdgePlanes.capacity() * sizeof(Vector3);
 }
 
 bool CDispCollTree::AABBTree_Ray(Trace* trace, bool bSide)
@@ -1290,7 +1395,7 @@ bool CDispCollTree::AABBTree_IntersectAABB(const Vector3& absMins,
     return false;  // No collision
 }
 
-bool CDispCollTree::AABBTree_SweepAABB(Trace* trace)
+bool CDispCollTree::AABBTree_SweepAABB(Trace* trace, TraceContext& ctx)
 {
     // Check for hull test.
     if (CheckFlags(BspMap::DispInfo::FLAG_NO_HULL_COLL))
@@ -1315,7 +1420,7 @@ bool CDispCollTree::AABBTree_SweepAABB(Trace* trace)
     int listIndex = BuildRayLeafList(0, list);
 
     if (listIndex <= list.maxIndex) {
-        EnsureCacheIsCreated();
+        EnsureCacheIsCreated(ctx);
         for (; listIndex <= list.maxIndex; listIndex++) {
             int leafIndex = list.nodeList[listIndex] - m_nodes.size();
             int iTri0 = m_leaves[leafIndex].m_tris[0];
@@ -1323,10 +1428,12 @@ bool CDispCollTree::AABBTree_SweepAABB(Trace* trace)
             CDispCollTri* pTri0 = &m_aTris[iTri0];
             CDispCollTri* pTri1 = &m_aTris[iTri1];
 
-            coll::Debugger::DebugStart_DispCollLeafHit(*this, leafIndex);
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugStart_DispCollLeafHit(*this, leafIndex);
             SweepAABBTriIntersect(trace, iTri0, pTri0);
             SweepAABBTriIntersect(trace, iTri1, pTri1);
-            coll::Debugger::DebugFinish_DispCollLeafHit();
+            if (ctx.is_debugger_enabled)
+                coll::Debugger::DebugFinish_DispCollLeafHit();
         }
     }
 
@@ -1430,7 +1537,8 @@ bool FORCEINLINE CDispCollTree::AxisPlanesXYZ(const Trace& trace,
     return true;
 }
 
-void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri)
+void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri,
+    DispCollPlaneIndexHash& planeIndexHash)
 {
     Vector3* pVerts[3];
     pVerts[0] = &m_aVerts[pTri->GetVert(0)];
@@ -1442,29 +1550,30 @@ void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri)
 
     // Edge 1
     vecEdge = *pVerts[1] - *pVerts[0];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossX[0]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossY[0]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossZ[0]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossX[0], planeIndexHash);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossY[0], planeIndexHash);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossZ[0], planeIndexHash);
     // Edge 2
     vecEdge = *pVerts[2] - * pVerts[1];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossX[1]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossY[1]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossZ[1]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossX[1], planeIndexHash);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossY[1], planeIndexHash);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossZ[1], planeIndexHash);
     // Edge 3
     vecEdge = *pVerts[0] - * pVerts[2];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossX[2]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossY[2]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossZ[2]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossX[2], planeIndexHash);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossY[2], planeIndexHash);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossZ[2], planeIndexHash);
 }
 
-int CDispCollTree::AddPlane(const Vector3& vecNormal)
+int CDispCollTree::AddPlane(const Vector3& vecNormal,
+    DispCollPlaneIndexHash& planeIndexHash)
 {
     DispCollPlaneIndex_t planeIndex;
 
     planeIndex.vecPlane = vecNormal;
     planeIndex.index = m_aEdgePlanes.size();
 
-    auto insert_result = g_DispCollPlaneIndexHash.insert(planeIndex);
+    auto insert_result = planeIndexHash.insert(planeIndex);
     bool bDidInsert = insert_result.second;
 
     if (!bDidInsert) {
@@ -1484,7 +1593,7 @@ int CDispCollTree::AddPlane(const Vector3& vecNormal)
 //       used.
 bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash)
 {
     // Calculate the normal: edge x axisX = ( 0.0, edgeZ, -edgeY )
     Vector3 vecNormal{ 0.0f, vecEdge.z(), -vecEdge.y() };
@@ -1523,7 +1632,7 @@ bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeIndexHash));
     // Created the cached edge.
     return true;
 }
@@ -1532,7 +1641,7 @@ bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
 //       used.
 bool CDispCollTree::Cache_EdgeCrossAxisY(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash)
 {
     // Calculate the normal: edge x axisY = ( -edgeZ, 0.0, edgeX )
     Vector3 vecNormal{ -vecEdge.z(), 0.0f, vecEdge.x() };
@@ -1571,14 +1680,14 @@ bool CDispCollTree::Cache_EdgeCrossAxisY(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeIndexHash));
     // Created the cached edge.
     return true;
 }
 
 bool CDispCollTree::Cache_EdgeCrossAxisZ(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash)
 {
     // Calculate the normal: edge x axisZ = ( edgeY, -edgeX, 0.0 )
     Vector3 vecNormal{ vecEdge.y(), -vecEdge.x(), 0.0f };
@@ -1617,7 +1726,7 @@ bool CDispCollTree::Cache_EdgeCrossAxisZ(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeIndexHash));
     // Created the cached edge.
     return true;
 }
@@ -1,8 +1,10 @@
 #ifndef COLL_COLLIDABLEWORLD_DISPLACEMENT_H_
 #define COLL_COLLIDABLEWORLD_DISPLACEMENT_H_
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <unordered_set>
 #include <vector>
 
 #include <Magnum/Magnum.h>
@@ -20,6 +22,8 @@
 
 namespace coll {
 
+class TraceContext;
+
 // -------- start of source-sdk-2013 code --------
 // (taken and modified from source-sdk-2013/<...>/src/public/dispcoll_common.h)
 
@@ -78,6 +82,28 @@ public:
     float            m_flImpactDist;
 };
 
+// Plane lookup used during collision cache creation to share edge planes
+struct DispCollPlaneIndex_t
+{
+    Magnum::Vector3 vecPlane;
+    int index;
+
+    // Compare
+    bool operator==(const DispCollPlaneIndex_t& other) const;
+};
+
+class CPlaneIndexHashFuncs
+{
+public:
+    // Hash
+    size_t operator()(const DispCollPlaneIndex_t& item) const;
+private:
+    size_t HashVector3(const Magnum::Vector3& vec) const;
+};
+
+using DispCollPlaneIndexHash =
+                   std::unordered_set<DispCollPlaneIndex_t, CPlaneIndexHashFuncs>;
+
 // Cache
 #pragma pack(1)
 class CDispCollTriCache
@@ -141,8 +167,8 @@ public:
 
     // Hull Sweeps. DOES utilize collision caches and might create one.
     // Does nothing and returns false if displacement has NO_HULL_COLL flag set.
-    // CAUTION: Not thread-safe yet! (Due to unprotected g_DispCollPlaneIndexHash)
-    bool AABBTree_SweepAABB(Trace* trace);
+    // Thread-safe, as long as concurrent calls use different TraceContexts.
+    bool AABBTree_SweepAABB(Trace* trace, TraceContext& ctx);
 
     // Hull Intersection. DOES NOT utilize collision caches.
     // Does nothing and returns false if displacement has NO_HULL_COLL flag set.
@@ -154,6 +180,7 @@ public:
     inline int  GetFlags()             const { return m_nFlags; }
     inline bool CheckFlags(int nFlags) const { return ((nFlags & GetFlags()) != 0) ? true : false; }
 
+    inline int GetPower()   const { return m_nPower; }
     inline int GetWidth()   const { return ((1 << m_nPower) + 1); }
     inline int GetHeight()  const { return ((1 << m_nPower) + 1); }
     inline int GetSize()    const { return ((1 << m_nPower) + 1) * ((1 << m_nPower) + 1); }
@@ -167,9 +194,23 @@ public:
     inline int Nodes_GetIndexFromComponents(int x, int y) const;
 
     bool IsCacheGenerated() const;
-    void EnsureCacheIsCreated();
+    // Thread-safe, as long as concurrent calls use different TraceContexts.
+    // If multiple threads want the same cache, one of them creates it while
+    // the others wait for it.
+    // Marks the cache as used with the context's disp_coll_cache_use_stamp
+    // and counts a cache hit or miss in the context.
+    void EnsureCacheIsCreated(TraceContext& ctx);
+    // CAUTION: Must not be called while other threads might use the cache!
     void Uncache();
 
+    // Stamp of the latest EnsureCacheIsCreated() call, see
+    // TraceContext::disp_coll_cache_use_stamp.
+    uint64_t GetCacheLastUse() const;
+    // Heap memory occupied by the collision cache, in bytes. 0 if no cache
+    // is created.
+    // CAUTION: Must not be called while other threads might create the cache!
+    size_t GetCacheMemoryUsage() const;
+
 private:
     void AABBTree_Create      (const std::vector<Magnum::Vector3>& disp_vertices);
     void AABBTree_CopyDispData(const std::vector<Magnum::Vector3>& disp_vertices);
@@ -184,10 +225,10 @@ private:
 private:
     void SweepAABBTriIntersect(Trace* trace, int iTri, CDispCollTri* pTri);
 
-    void Cache_Create(CDispCollTri* pTri, int iTri);
-    bool Cache_EdgeCrossAxisX(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
-    bool Cache_EdgeCrossAxisY(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
-    bool Cache_EdgeCrossAxisZ(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
+    void Cache_Create(CDispCollTri* pTri, int iTri, DispCollPlaneIndexHash& planeIndexHash);
+    bool Cache_EdgeCrossAxisX(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash);
+    bool Cache_EdgeCrossAxisY(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash);
+    bool Cache_EdgeCrossAxisZ(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, DispCollPlaneIndexHash& planeIndexHash);
 
     inline bool FacePlane(const Trace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
     bool FORCEINLINE AxisPlanesXYZ(const Trace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
@@ -200,7 +241,7 @@ private:
 
     // Utility
     inline void CalcClosestExtents(const Magnum::Vector3& vecPlaneNormal, const Magnum::Vector3& vecBoxExtents, Magnum::Vector3& vecBoxPoint);
-    int AddPlane(const Magnum::Vector3& vecNormal);
+    int AddPlane(const Magnum::Vector3& vecNormal, DispCollPlaneIndexHash& planeIndexHash);
     bool FORCEINLINE IsLeafNode(int iNode);
 
 public:
@@ -222,6 +263,29 @@ private:
     std::vector<CDispCollTriCache> m_aTrisCache;
     std::vector<Magnum::Vector3>   m_aEdgePlanes;
 
+    // Atomics are wrapped to keep CDispCollTree movable, moving it is only
+    // allowed while no other thread uses it.
+    template<class T> struct MovableAtomic {
+        std::atomic<T> val;
+
+        MovableAtomic(T initial_val) : val{ initial_val } {}
+        MovableAtomic(MovableAtomic&& other) noexcept
+            : val{ other.val.load(std::memory_order_relaxed) } {}
+        MovableAtomic& operator=(MovableAtomic&& other) noexcept {
+            val.store(other.val.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+            return *this;
+        }
+    };
+
+    // Whether the collision cache is created, used to safely publish it to
+    // other threads.
+    enum CacheState : uint8_t { CACHE_NONE, CACHE_CREATING, CACHE_CREATED };
+    MovableAtomic<uint8_t> m_cacheState{ CACHE_NONE };
+
+    // Stamp of the latest cache use, see GetCacheLastUse()
+    MovableAtomic<uint64_t> m_cacheLastUse{ 0 };
+
 private:
     // Debugger needs to debug, let it access private members.
     friend class Debugger;
@@ -27,10 +27,106 @@ using Brush          = BspMap::Brush;
 using BrushSide      = BspMap::BrushSide;
 using Ent_func_brush = BspMap::Ent_func_brush;
 
-uint64_t CollidableWorld::GetTraceCost_FuncBrush(uint32_t func_brush_idx)
+TraceCostModel::Factors CollidableWorld::GetTraceCostFactors_FuncBrush(uint32_t func_brush_idx)
 {
-    // See BVH::GetLeafTraceCost() for details and considerations.
-    return 1; // Is func_brush trace cost dependent on total brushside count?
+    // See BVH::CalcLeafTraceCost() for details and considerations.
+    // Traces clip against the compiled planes, count those. Invalid and
+    // non-solid func_brushes have no brushes, traces abort early.
+    const CompiledFuncBrushes& compiled = *pImpl->compiled_func_brushes;
+    const CompiledFuncBrushes::FuncBrush& func_brush = compiled.func_brushes[func_brush_idx];
+    uint32_t side_cnt = 0;
+    for (uint32_t b = 0; b < func_brush.brush_cnt; b++)
+        side_cnt += compiled.brushes[func_brush.first_brush + b].plane_cnt;
+    return { .side_cnt = side_cnt };
+}
+
+CompiledFuncBrushes::CompiledFuncBrushes(const BspMap& bsp_map)
+{
+    ZoneScoped;
+
+    // NOTE: Rarely in CSGO maps, brushes have invalid brushsides/planes, i.e.
+    //       they result in an AABB where (maxs[i] <= mins[i]) for some i.
+    //       For the most part, we don't care about these rare cases, except for
+    //       one func_brush in CSGO's "Only Up!" map by leander.
+    //       (https://steamcommunity.com/sharedfiles/filedetails/?id=3012684086)
+    bool are_we_in_csgo_only_up_map =
+        bsp_map.map_version == 2915 && bsp_map.sky_name.compare("vertigoblue_hdr") == 0;
+
+    auto test_f_exclude = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
+    auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
+    auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
+    auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
+
+    func_brushes.reserve(bsp_map.entities_func_brush.size());
+    for (size_t fb_idx = 0; fb_idx < bsp_map.entities_func_brush.size(); fb_idx++) {
+        const Ent_func_brush& ent = bsp_map.entities_func_brush[fb_idx];
+        FuncBrush& func_brush = func_brushes.emplace_back(FuncBrush{
+            .origin = ent.origin,
+            .mins = { 0.0f, 0.0f, 0.0f },
+            .maxs = { 0.0f, 0.0f, 0.0f },
+            .first_brush = (uint32_t)brushes.size(),
+            .brush_cnt = 0,
+            .has_aabb = false,
+        });
+        if (!ent.IsSolid())
+            continue; // Traces skip this func_brush
+
+        if (ent.model.size() == 0 || ent.model[0] != '*')
+            continue; // Invalid
+        int64_t model_idx = utils::ParseIntFromString(ent.model.substr(1), -1);
+        if (model_idx <= 0 || model_idx >= (int64_t)bsp_map.models.size())
+            continue; // Invalid model index
+
+        func_brush.has_aabb = CalcAabb_FuncBrush(fb_idx, bsp_map,
+                                                 &func_brush.mins,
+                                                 &func_brush.maxs);
+
+        // Order of axis rotations is important! First roll, then pitch, then yaw rotation!
+        Matrix4 rot_transformation =
+            Matrix4::rotationZ(Deg{ ent.angles[1] }) * // (yaw)   rotation around z axis
+            Matrix4::rotationY(Deg{ ent.angles[0] }) * // (pitch) rotation around y axis
+            Matrix4::rotationX(Deg{ ent.angles[2] });  // (roll)  rotation around x axis
+
+        for (size_t brush_idx : bsp_map.GetModelBrushIndices(model_idx)) {
+            const BspMap::Brush& bsp_brush = bsp_map.brushes[brush_idx];
+
+            // Special case: grenadeclip brushes don't work in func_brush entities
+            // (for unknown reasons)
+            if (test_f_exclude.first && test_f_exclude.first(bsp_brush))
+                continue;
+
+            bool solid_to_player = false;
+            if (test_f_1.first && test_f_1.first(bsp_brush)) solid_to_player = true;
+            if (test_f_2.first && test_f_2.first(bsp_brush)) solid_to_player = true;
+            if (test_f_3.first && test_f_3.first(bsp_brush)) solid_to_player = true;
+            if (!solid_to_player)
+                continue;
+
+            Brush& brush = brushes.emplace_back(Brush{
+                .first_plane = (uint32_t)planes.size(),
+                .plane_cnt = 0,
+            });
+            func_brush.brush_cnt++;
+
+            for (uint32_t i = 0; i < bsp_brush.num_sides; i++) {
+                const BrushSide& side = bsp_map.brushsides[bsp_brush.first_side + i];
+
+                // HACKHACK A specific brush in the CSGO Only Up map (by leander)
+                //          has 2 invalid planes that cause issues, skip these.
+                if (are_we_in_csgo_only_up_map && brush_idx == 2537)
+                    if (i == 26 || i == 30)
+                        continue;
+
+                const BspMap::Plane& plane = bsp_map.planes[side.plane_num];
+                planes.push_back({
+                    .normal = rot_transformation.transformVector(plane.normal),
+                    .dist   = plane.dist,
+                    .bevel  = side.bevel != 0,
+                });
+                brush.plane_cnt++;
+            }
+        }
+    }
 }
 
 void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
@@ -48,78 +144,15 @@ void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
     //       Maybe like this: https://github.com/ValveSoftware/source-sdk-2013/blob/master/sp/src/utils/vbsp/map.cpp#L463-L611
     //       Maybe useful:    https://github.com/ValveSoftware/source-sdk-2013/blob/master/sp/src/utils/vbsp/ivp.cpp#L1340
 
-    // @OPTIMIZATION This function is pretty inefficient. However, there are
-    //               only very few func_brush entities in DZ maps, so it might
-    //               not matter.
-
-    std::shared_ptr<const BspMap> bsp_map = pImpl->origin_bsp_map;
-    const Ent_func_brush& func_brush = bsp_map->entities_func_brush[func_brush_idx];
-    if (!func_brush.IsSolid())
-        return; // Skip this func_brush
+    const CompiledFuncBrushes& compiled = *pImpl->compiled_func_brushes;
+    const CompiledFuncBrushes::FuncBrush& func_brush = compiled.func_brushes[func_brush_idx];
 
+    // Planes are relative to the func_brush's origin
     Vector3 translated_trace_start = trace->info.startpos - func_brush.origin;
 
-    // Order of axis rotations is important! First roll, then pitch, then yaw rotation!
-    // @Optimization Use 3x3 rotation matrix, not 4x4, or quaternions
-    Matrix4 rot_transformation =
-        Matrix4::rotationZ(Deg{ func_brush.angles[1] }) * // (yaw)   rotation around z axis
-        Matrix4::rotationY(Deg{ func_brush.angles[0] }) * // (pitch) rotation around y axis
-        Matrix4::rotationX(Deg{ func_brush.angles[2] });  // (roll)  rotation around x axis
-
-    if (func_brush.model.size() == 0 || func_brush.model[0] != '*')
-        return; // Invalid, abort
-    std::string idxStr = func_brush.model.substr(1);
-    int64_t modelIdx = utils::ParseIntFromString(idxStr, -1);
-    if (modelIdx <= 0 || modelIdx >= (int64_t)bsp_map->models.size())
-        return; // Invalid model index, abort
-
-    // NOTE: Rarely in CSGO maps, brushes have invalid brushsides/planes, i.e.
-    //       they result in an AABB where (maxs[i] <= mins[i]) for some i.
-    //       For the most part, we don't care about these rare cases, except for
-    //       one func_brush in CSGO's "Only Up!" map by leander.
-    //       (https://steamcommunity.com/sharedfiles/filedetails/?id=3012684086)
-    bool are_we_in_csgo_only_up_map =
-        bsp_map->map_version == 2915 && bsp_map->sky_name.compare("vertigoblue_hdr") == 0;
-
-    for (size_t brush_idx : bsp_map->GetModelBrushIndices(modelIdx)) {
-        const Brush& brush = bsp_map->brushes[brush_idx];
-
-        // Special case: grenadeclip brushes don't work in func_brush entities
-        // (for unknown reasons)
-        static auto test_f_exclude =
-            BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
-        if (test_f_exclude.first && test_f_exclude.first(brush))
-            continue;
-
-        static auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-        static auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-        static auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
-
-        bool solid_to_player = false;
-        if (test_f_1.first && test_f_1.first(brush)) solid_to_player = true;
-        if (test_f_2.first && test_f_2.first(brush)) solid_to_player = true;
-        if (test_f_3.first && test_f_3.first(brush)) solid_to_player = true;
-        if (!solid_to_player)
-            continue;
-
-        // @Optimization Ensure the 6 axial brushsides/planes are processed first.
-        std::vector<Plane> planes;
-        for (int i = 0; i < brush.num_sides; i++) {
-            const BrushSide& side = bsp_map->brushsides[brush.first_side + i];
-
-            if (trace->info.isray && side.bevel)
-                continue;
-
-            // HACKHACK A specific brush in the CSGO Only Up map (by leander)
-            //          has 2 invalid planes that cause issues, skip these.
-            if (are_we_in_csgo_only_up_map && brush_idx == 2537)
-                if (i == 26 || i == 30)
-                    continue;
-
-            Plane plane = bsp_map->planes[side.plane_num];
-            plane.normal = rot_transformation.transformVector(plane.normal);
-            planes.push_back(plane);
-        }
+    for (uint32_t b = 0; b < func_brush.brush_cnt; b++) {
+        const CompiledFuncBrushes::Brush& brush = compiled.brushes[func_brush.first_brush + b];
+        const CompiledFuncBrushes::Plane* planes = &compiled.planes[brush.first_plane];
 
         // -------- start of source-sdk-2013 code --------
         // (taken and modified from source-sdk-2013/<...>/src/utils/vrad/trace.cpp)
@@ -134,8 +167,7 @@ void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
         const Vector3 mins = -trace->info.extents; // Box case only (!trace->info.isray)
         const Vector3 maxs = +trace->info.extents; // Box case only (!trace->info.isray)
 
-        //const BrushSide* leadside = nullptr;
-        Plane clipplane;
+        const CompiledFuncBrushes::Plane* clipplane = nullptr;
         float enterfrac = NEVER_UPDATED;
         float leavefrac = 1.0f;
         bool  getout = false;
@@ -147,12 +179,13 @@ void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
         float   f;
 
         bool skip_brush = false;
-        for (const Plane& plane : planes) {
+        for (uint32_t i = 0; i < brush.plane_cnt; i++) {
+            const CompiledFuncBrushes::Plane& plane = planes[i];
+
             if (trace->info.isray) // Special point case
             {
-                // Commented out because bevel planes were sorted out earlier
-                //if (side.bevel == 1) // Don't ray trace against bevel planes
-                //    continue;
+                if (plane.bevel) // Don't ray trace against bevel planes
+                    continue;
 
                 dist = plane.dist;
             }
@@ -188,8 +221,7 @@ void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
                 f = (d1 - DIST_EPSILON) / (d1 - d2);
                 if (f > enterfrac) {
                     enterfrac = f;
-                    clipplane = plane;
-                    //leadside = &side;
+                    clipplane = &plane;
                 }
             }
             else {
@@ -218,102 +250,31 @@ void CollidableWorld::DoSweptTrace_FuncBrush(Trace* trace,
                 trace->results.fraction = enterfrac;
                 //trace->results.surface = leadside->texinfo; // Might be -1
                 //trace->contents = brush.contents; // TODO: Return hit contents in a better way
-                trace->results.plane_normal = clipplane.normal;
+                trace->results.plane_normal = clipplane->normal;
             }
         }
         // --------- end of source-sdk-2013 code ---------
     }
 }
 
-// This function has an awful amount of  code duplication, but func_brush
-// entities aren't that important and this code won't ever be touched again >:)
 void CollidableWorld::DoUnsweptTrace_FuncBrush(Trace* trace,
                                                uint32_t func_brush_idx)
 {
     assert(trace->info.isswept == false);
     ZoneScoped;
 
-    // NOTE: Collision with func_brush entities was not thoroughly tested and
-    //       the Source engine might be using an entirely different collision
-    //       algorithm for func_brush specifically. (?)
-    //       It's possible that further bevel planes need to be created and
-    //       tested against when doing hull traces, in the same way we already
-    //       do it for collisions with static/dynamic props.
-    //       Maybe like this: https://github.com/ValveSoftware/source-sdk-2013/blob/master/sp/src/utils/vbsp/map.cpp#L463-L611
-    //       Maybe useful:    https://github.com/ValveSoftware/source-sdk-2013/blob/master/sp/src/utils/vbsp/ivp.cpp#L1340
+    // NOTE: See DoSweptTrace_FuncBrush() about the accuracy of func_brush
+    //       collisions.
 
-    // @OPTIMIZATION This function is pretty inefficient. However, there are
-    //               only very few func_brush entities in DZ maps, so it might
-    //               not matter.
-
-    std::shared_ptr<const BspMap> bsp_map = pImpl->origin_bsp_map;
-    const Ent_func_brush& func_brush = bsp_map->entities_func_brush[func_brush_idx];
-    if (!func_brush.IsSolid())
-        return; // Skip this func_brush
+    const CompiledFuncBrushes& compiled = *pImpl->compiled_func_brushes;
+    const CompiledFuncBrushes::FuncBrush& func_brush = compiled.func_brushes[func_brush_idx];
 
+    // Planes are relative to the func_brush's origin
     Vector3 translated_trace_start = trace->info.startpos - func_brush.origin;
 
-    // Order of axis rotations is important! First roll, then pitch, then yaw rotation!
-    // @Optimization Use 3x3 rotation matrix, not 4x4, or quaternions
-    Matrix4 rot_transformation =
-        Matrix4::rotationZ(Deg{ func_brush.angles[1] }) * // (yaw)   rotation around z axis
-        Matrix4::rotationY(Deg{ func_brush.angles[0] }) * // (pitch) rotation around y axis
-        Matrix4::rotationX(Deg{ func_brush.angles[2] });  // (roll)  rotation around x axis
-
-    if (func_brush.model.size() == 0 || func_brush.model[0] != '*')
-        return; // Invalid, abort
-    std::string idxStr = func_brush.model.substr(1);
-    int64_t modelIdx = utils::ParseIntFromString(idxStr, -1);
-    if (modelIdx <= 0 || modelIdx >= (int64_t)bsp_map->models.size())
-        return; // Invalid model index, abort
-
-    // NOTE: Rarely in CSGO maps, brushes have invalid brushsides/planes, i.e.
-    //       they result in an AABB where (maxs[i] <= mins[i]) for some i.
-    //       For the most part, we don't care about these rare cases, except for
-    //       one func_brush in CSGO's "Only Up!" map by leander.
-    //       (https://steamcommunity.com/sharedfiles/filedetails/?id=3012684086)
-    bool are_we_in_csgo_only_up_map =
-        bsp_map->map_version == 2915 && bsp_map->sky_name.compare("vertigoblue_hdr") == 0;
-
-    for (size_t brush_idx : bsp_map->GetModelBrushIndices(modelIdx)) {
-        const Brush& brush = bsp_map->brushes[brush_idx];
-
-        // Special case: grenadeclip brushes don't work in func_brush entities
-        // (for unknown reasons)
-        static auto test_f_exclude =
-            BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
-        if (test_f_exclude.first && test_f_exclude.first(brush))
-            continue;
-
-        static auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-        static auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-        static auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
-
-        bool solid_to_player = false;
-        if (test_f_1.first && test_f_1.first(brush)) solid_to_player = true;
-        if (test_f_2.first && test_f_2.first(brush)) solid_to_player = true;
-        if (test_f_3.first && test_f_3.first(brush)) solid_to_player = true;
-        if (!solid_to_player)
-            continue;
-
-        // @Optimization Ensure the 6 axial brushsides/planes are processed first.
-        std::vector<Plane> planes;
-        for (int i = 0; i < brush.num_sides; i++) {
-            const BrushSide& side = bsp_map->brushsides[brush.first_side + i];
-
-            if (trace->info.isray && side.bevel)
-                continue;
-
-            // HACKHACK A specific brush in the CSGO Only Up map (by leander)
-            //          has 2 invalid planes that cause issues, skip these.
-            if (are_we_in_csgo_only_up_map && brush_idx == 2537)
-                if (i == 26 || i == 30)
-                    continue;
-
-            Plane plane = bsp_map->planes[side.plane_num];
-            plane.normal = rot_transformation.transformVector(plane.normal);
-            planes.push_back(plane);
-        }
+    for (uint32_t b = 0; b < func_brush.brush_cnt; b++) {
+        const CompiledFuncBrushes::Brush& brush = compiled.brushes[func_brush.first_brush + b];
+        const CompiledFuncBrushes::Plane* planes = &compiled.planes[brush.first_plane];
 
         // -------- start of source-sdk-2013 code --------
         // (taken and modified from source-sdk-2013/<...>/src/utils/vrad/trace.cpp)
@@ -326,12 +287,13 @@ void CollidableWorld::DoUnsweptTrace_FuncBrush(Trace* trace,
         Vector3 ofs;
 
         bool skip_brush = false;
-        for (const Plane& plane : planes) {
+        for (uint32_t i = 0; i < brush.plane_cnt; i++) {
+            const CompiledFuncBrushes::Plane& plane = planes[i];
+
             if (trace->info.isray) // Special point case
             {
-                // Commented out because bevel planes were sorted out earlier
-                //if (side.bevel == 1) // Don't ray trace against bevel planes
-                //    continue;
+                if (plane.bevel) // Don't ray trace against bevel planes
+                    continue;
 
                 dist = plane.dist;
             }
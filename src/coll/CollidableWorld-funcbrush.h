@@ -1,6 +1,9 @@
 #ifndef COLL_COLLIDABLEWORLD_FUNCBRUSH_H_
 #define COLL_COLLIDABLEWORLD_FUNCBRUSH_H_
 
+#include <cstdint>
+#include <vector>
+
 #include <Magnum/Math/Vector3.h>
 
 #include "csgo_parsing/BspMap.h"
@@ -15,9 +18,46 @@ namespace coll {
         Magnum::Vector3* aabb_mins,
         Magnum::Vector3* aabb_maxs);
 
+    // Collision data of all func_brush entities, compiled once at world
+    // creation. Traces against a func_brush only clip against its compiled
+    // planes, they don't parse its model index, build its rotation matrix,
+    // collect its brushes or run BrushSeparation tests anymore.
+    // All data is stored in a few flat arrays. Brushes and planes of a
+    // func_brush are contiguous and in the same order as in the BspMap.
+    struct CompiledFuncBrushes {
+        // Compiles all func_brush entities of the given map.
+        explicit CompiledFuncBrushes(const csgo_parsing::BspMap& bsp_map);
+
+        // Plane of a brush, rotated like the func_brush. Planes are relative
+        // to the func_brush's origin, traces get translated by -origin
+        // before clipping against them.
+        struct Plane {
+            Magnum::Vector3 normal;
+            float dist;
+            bool  bevel; // If true, plane is only used for collisions with AABBs
+        };
+
+        struct Brush {
+            uint32_t first_plane; // index into planes array
+            uint32_t plane_cnt;
+        };
 
-    // ... (Add further func_brush-related collision code here)
+        struct FuncBrush {
+            Magnum::Vector3 origin;
+            Magnum::Vector3 mins, maxs; // World-space AABB, only valid if has_aabb is true
+            uint32_t first_brush; // index into brushes array
+            uint32_t brush_cnt;   // 0 if the func_brush isn't solid or is invalid
+            // If true, the func_brush is solid and has a valid AABB. Only
+            // these func_brush entities are put into the BVH.
+            bool has_aabb;
+        };
 
+        // Indexed like BspMap::entities_func_brush
+        std::vector<FuncBrush> func_brushes;
+        // Only brushes that are solid to players
+        std::vector<Brush> brushes;
+        std::vector<Plane> planes;
+    };
 
 } // namespace coll
 
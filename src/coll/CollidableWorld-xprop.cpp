@@ -69,16 +69,98 @@ static bool PlaneEqual(const Plane& p, const Vector3& normal, float dist,
 ////////////////////////////////////////////////////////////////////////////////
 
 
-uint64_t CollidableWorld::GetTraceCost_StaticProp(uint32_t sprop_idx)
+CollisionModel::CollisionModel(const std::vector<TriMesh>& section_tri_meshes)
 {
-    // See BVH::GetLeafTraceCost() for details and considerations.
-    return 1; // Is sprop trace cost dependent on triangle count?
+    ZoneScoped;
+    const size_t NUM_SECTIONS = section_tri_meshes.size();
+
+    size_t total_vertex_cnt = 0;
+    size_t total_edge_cnt   = 0;
+    size_t total_tri_cnt    = 0;
+    for (const TriMesh& section_tri_mesh : section_tri_meshes) {
+        total_vertex_cnt += section_tri_mesh.vertices.size();
+        total_edge_cnt   += section_tri_mesh.edges.size();
+        total_tri_cnt    += section_tri_mesh.tris.size();
+    }
+    sections  .reserve(NUM_SECTIONS);
+    vertices  .reserve(total_vertex_cnt);
+    edges     .reserve(total_edge_cnt);
+    tri_planes.reserve(total_tri_cnt);
+
+    // For each section, get its AABB and create plane of each triangle
+    for (const TriMesh& section_tri_mesh : section_tri_meshes) {
+        const std::vector<Vector3>& section_vertices = section_tri_mesh.vertices;
+
+        Vector3 section_aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 section_aabb_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        for (const Vector3& vert : section_vertices) {
+            for (int axis = 0; axis < 3; axis++) { // Add vertex to section's AABB
+                section_aabb_mins[axis] = Math::min(section_aabb_mins[axis], vert[axis]);
+                section_aabb_maxs[axis] = Math::max(section_aabb_maxs[axis], vert[axis]);
+            }
+        }
+
+        sections.push_back({
+            .first_vertex    = (uint32_t)vertices.size(),
+            .vertex_cnt      = (uint32_t)section_vertices.size(),
+            .first_edge      = (uint32_t)edges.size(),
+            .edge_cnt        = (uint32_t)section_tri_mesh.edges.size(),
+            .first_tri_plane = (uint32_t)tri_planes.size(),
+            .tri_plane_cnt   = (uint32_t)section_tri_mesh.tris.size(),
+            .aabb = { .mins = section_aabb_mins, .maxs = section_aabb_maxs }
+        });
+
+        vertices.insert(vertices.end(),
+            section_vertices.begin(), section_vertices.end());
+        edges.insert(edges.end(),
+            section_tri_mesh.edges.begin(), section_tri_mesh.edges.end());
+
+        for (const TriMesh::Tri& triangle : section_tri_mesh.tris) {
+            const Vector3& v1 = section_vertices[triangle.verts[0]];
+            const Vector3& v2 = section_vertices[triangle.verts[1]];
+            const Vector3& v3 = section_vertices[triangle.verts[2]];
+            Vector3 plane_normal = CalcNormalCwFront(v1, v2, v3);
+            float   plane_dist = Math::dot(plane_normal, v1);
+            tri_planes.push_back({
+                .normal = plane_normal,
+                .dist   = plane_dist
+            });
+        }
+    }
 }
 
-uint64_t CollidableWorld::GetTraceCost_DynamicProp(uint32_t dprop_idx)
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+static TraceCostModel::Factors GetTraceCostFactors_XProp(
+    const CollisionCache_XProp& coll_cache,
+    const std::vector<CollisionModel>& coll_models)
 {
-    // See BVH::GetLeafTraceCost() for details and considerations.
-    return 1; // Is dprop trace cost dependent on triangle count?
+    // See BVH::CalcLeafTraceCost() for details and considerations.
+    if (!coll_cache.HasCollision())
+        return {};
+    const CollisionModel& cmodel = coll_models[coll_cache.coll_model_id];
+    TraceCostModel::Factors factors = {
+        .section_cnt = (uint32_t)cmodel.GetSectionCount()
+    };
+    for (size_t i = 0; i < cmodel.GetSectionCount(); i++)
+        factors.plane_cnt += (uint32_t)cmodel.GetSection(i).tri_planes.size();
+    return factors;
+}
+
+TraceCostModel::Factors CollidableWorld::GetTraceCostFactors_StaticProp(uint32_t sprop_idx)
+{
+    assert(pImpl->coll_caches_sprop != Corrade::Containers::NullOpt);
+    return GetTraceCostFactors_XProp((*pImpl->coll_caches_sprop)[sprop_idx],
+                                     *pImpl->xprop_coll_models);
+}
+
+TraceCostModel::Factors CollidableWorld::GetTraceCostFactors_DynamicProp(uint32_t dprop_idx)
+{
+    assert(pImpl->coll_caches_dprop != Corrade::Containers::NullOpt);
+    return GetTraceCostFactors_XProp((*pImpl->coll_caches_dprop)[dprop_idx],
+                                     *pImpl->xprop_coll_models);
 }
 
 
@@ -114,7 +196,7 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
                             float          xprop_uniform_scale)
 {
     ZoneScoped;
-    const size_t NUM_SECTIONS = cmodel.section_tri_meshes.size();
+    const size_t NUM_SECTIONS = cmodel.GetSectionCount();
 
     float inv_scale = 1.0f / xprop_uniform_scale;
 
@@ -133,7 +215,7 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
     for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++) {
         Vector3 aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
         Vector3 aabb_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
-        for (const Vector3& vert : cmodel.section_tri_meshes[section_idx].vertices) {
+        for (const Vector3& vert : cmodel.GetSection(section_idx).vertices) {
             no_vertex_found = false;
             Vector3 transformed_v = xprop_transf.transformPoint(vert);
 
@@ -150,22 +232,28 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
         return Containers::NullOpt;
     }
 
-    // Create bevel plane LUT of each section
-    std::vector<XPropSectionBevelPlaneLut> section_bevel_luts;
-    section_bevel_luts.reserve(NUM_SECTIONS);
+    // Create bevel plane LUT of each section, store them back to back
+    std::vector<XPropSectionBevelPlaneLut::RecIdxType> bevel_luts;
+    std::vector<uint32_t> section_bevel_lut_offsets;
+    section_bevel_lut_offsets.reserve(NUM_SECTIONS + 1);
+    section_bevel_lut_offsets.push_back(0);
     for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++) {
         // Create LUT of section
-        section_bevel_luts.emplace_back(rotationscaling, inv_rotation, inv_scale,
-            cmodel.section_tri_meshes[section_idx],
-            cmodel.section_planes[section_idx]
-        );
+        XPropSectionBevelPlaneLut lut(rotationscaling, inv_rotation, inv_scale,
+                                      cmodel.GetSection(section_idx));
+        std::span<const XPropSectionBevelPlaneLut::RecIdxType> lut_data = lut.GetData();
+        bevel_luts.insert(bevel_luts.end(), lut_data.begin(), lut_data.end());
+        section_bevel_lut_offsets.push_back(bevel_luts.size());
     }
+    bevel_luts.shrink_to_fit();
 
     return CollisionCache_XProp{
+        .origin       = xprop_origin,
         .inv_rotation = inv_rotation,
         .inv_scale    = inv_scale,
-        .section_aabbs      = std::move(section_aabbs),
-        .section_bevel_luts = std::move(section_bevel_luts)
+        .section_aabbs             = std::move(section_aabbs),
+        .bevel_luts                = std::move(bevel_luts),
+        .section_bevel_lut_offsets = std::move(section_bevel_lut_offsets)
     };
 }
 
@@ -174,63 +262,40 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
 
 
 void DoTrace_XProp(Trace* trace,
-                   const Vector3&       xprop_origin,
-                   CollisionModel       xprop_collmodel,
-                   CollisionCache_XProp xprop_collcache);
+                   const Vector3&              xprop_origin,
+                   const CollisionModel&       xprop_collmodel,
+                   const CollisionCache_XProp& xprop_collcache);
 
 void coll::DoTrace_StaticProp(Trace* trace, uint32_t sprop_idx, CollidableWorld& c_world)
 {
-    const BspMap::StaticProp& sprop = c_world.pImpl->origin_bsp_map->static_props[sprop_idx];
-    const std::string&     mdl_path = c_world.pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
-    if (!sprop.IsSolidWithVPhysics()) return; // Skip this static prop
-
-    // Ensure that the required collision model and cache have been created
+    // Ensure that the required collision models and caches have been created
     assert(c_world.pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
     assert(c_world.pImpl->coll_caches_sprop != Corrade::Containers::NullOpt);
 
-    // Get collision model
-    const auto& collmodel_iter = c_world.pImpl->xprop_coll_models->find(mdl_path);
-    if (collmodel_iter == c_world.pImpl->xprop_coll_models->end())
-        return; // This static prop has no collision model, skip
-    const CollisionModel& collmodel = collmodel_iter->second;
-
-    // Get collision cache
-    const auto& collcache_iter = c_world.pImpl->coll_caches_sprop->find(sprop_idx);
-    if (collcache_iter == c_world.pImpl->coll_caches_sprop->end()) {
-        assert(false); // Shouldn't happen
-        return; // This static prop has no collision cache, skip
-    }
-    const CollisionCache_XProp& collcache = collcache_iter->second;
+    const CollisionCache_XProp& collcache = (*c_world.pImpl->coll_caches_sprop)[sprop_idx];
+    if (!collcache.HasCollision())
+        return; // This static prop has no collision, skip
+    const CollisionModel& collmodel =
+        (*c_world.pImpl->xprop_coll_models)[collcache.coll_model_id];
 
     // Do trace
-    DoTrace_XProp(trace, sprop.origin, collmodel, collcache);
+    DoTrace_XProp(trace, collcache.origin, collmodel, collcache);
 }
 
 void coll::DoTrace_DynamicProp(Trace* trace, uint32_t dprop_idx, CollidableWorld& c_world)
 {
-    const BspMap::Ent_prop_dynamic& dprop =
-        c_world.pImpl->origin_bsp_map->relevant_dynamic_props[dprop_idx];
-
-    // Ensure that the required collision model and cache have been created
+    // Ensure that the required collision models and caches have been created
     assert(c_world.pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
     assert(c_world.pImpl->coll_caches_dprop != Corrade::Containers::NullOpt);
 
-    // Get collision model
-    const auto& collmodel_iter = c_world.pImpl->xprop_coll_models->find(dprop.model);
-    if (collmodel_iter == c_world.pImpl->xprop_coll_models->end())
-        return; // This dynamic prop has no collision model, skip
-    const CollisionModel& collmodel = collmodel_iter->second;
-
-    // Get collision cache
-    const auto& collcache_iter = c_world.pImpl->coll_caches_dprop->find(dprop_idx);
-    if (collcache_iter == c_world.pImpl->coll_caches_dprop->end()) {
-        assert(false); // Shouldn't happen
-        return; // This dynamic prop has no collision cache, skip
-    }
-    const CollisionCache_XProp& collcache = collcache_iter->second;
+    const CollisionCache_XProp& collcache = (*c_world.pImpl->coll_caches_dprop)[dprop_idx];
+    if (!collcache.HasCollision())
+        return; // This dynamic prop has no collision, skip
+    const CollisionModel& collmodel =
+        (*c_world.pImpl->xprop_coll_models)[collcache.coll_model_id];
 
     // Do trace
-    DoTrace_XProp(trace, dprop.origin, collmodel, collcache);
+    DoTrace_XProp(trace, collcache.origin, collmodel, collcache);
 }
 
 // NOTE: DoTrace_XProp() checks whether the trace is swept or not and handles it
@@ -261,11 +326,11 @@ void CollidableWorld::DoUnsweptTrace_DynamicProp(Trace *trace, uint32_t dprop_id
 }
 
 void DoTrace_XProp(Trace* trace,
-                   const Vector3&       xprop_origin,
-                   CollisionModel       xprop_collmodel,
-                   CollisionCache_XProp xprop_collcache)
+                   const Vector3&              xprop_origin,
+                   const CollisionModel&       xprop_collmodel,
+                   const CollisionCache_XProp& xprop_collcache)
 {
-    const size_t NUM_SECTIONS = xprop_collmodel.section_tri_meshes.size();
+    const size_t NUM_SECTIONS = xprop_collmodel.GetSectionCount();
 
     // TODO: Look at https://doc.magnum.graphics/magnum/transformations.html to
     //       possibly improve/optimize the transformations in this method.
@@ -341,8 +406,9 @@ void DoTrace_XProp(Trace* trace,
                              bloated_xprop_section_maxs))
             continue;
 
-        const std::vector<Plane>& tri_planes_of_section =
-            xprop_collmodel.section_planes[section_idx];
+        const CollisionModel::SectionView section =
+            xprop_collmodel.GetSection(section_idx);
+        std::span<const Plane> tri_planes_of_section = section.tri_planes;
 
         XPropSectionBevelPlaneGenerator bevel_gen(
             xprop_collmodel, xprop_collcache, section_idx);
@@ -424,8 +490,8 @@ void DoTrace_XProp(Trace* trace,
                     //               a bit with these removed. Keeping them for
                     //               now. I'm not sure how thorough those earlier
                     //               comparisons with CSGO trace results were.
-                    const Vector3& non_transf_aabb_mins = xprop_collmodel.section_aabbs[section_idx].mins;
-                    const Vector3& non_transf_aabb_maxs = xprop_collmodel.section_aabbs[section_idx].maxs;
+                    const Vector3& non_transf_aabb_mins = section.aabb.mins;
+                    const Vector3& non_transf_aabb_maxs = section.aabb.maxs;
                     if (plane_idx > 5) break; // Exit this category
                     switch(plane_idx) {
                         case 0: next_plane = { Vector3{ +1.0f,  0.0f,  0.0f },  non_transf_aabb_maxs[0] }; break;
@@ -572,8 +638,7 @@ XPropSectionBevelPlaneLut::XPropSectionBevelPlaneLut(
     const Matrix3&    xprop_rotationscaling,
     const Quaternion& xprop_inv_rotation,
     float             xprop_inv_scale,
-    const TriMesh& tri_mesh_of_xprop_section,
-    const std::vector<BspMap::Plane>& planes_of_xprop_section)
+    const CollisionModel::SectionView& xprop_section)
 {
     assert(xprop_inv_rotation.isNormalized());
 
@@ -602,12 +667,12 @@ XPropSectionBevelPlaneLut::XPropSectionBevelPlaneLut(
 
     // For every unique edge of the section's triangle mesh
     for (size_t unique_edge_idx = 0;
-         unique_edge_idx < tri_mesh_of_xprop_section.edges.size();
+         unique_edge_idx < xprop_section.edges.size();
          unique_edge_idx++)
     {
-        const TriMesh::Edge& u_edge = tri_mesh_of_xprop_section.edges[unique_edge_idx];
-        Vector3 mesh_edge_v1 = tri_mesh_of_xprop_section.vertices[u_edge.verts[0]];
-        Vector3 mesh_edge_v2 = tri_mesh_of_xprop_section.vertices[u_edge.verts[1]];
+        const TriMesh::Edge& u_edge = xprop_section.edges[unique_edge_idx];
+        Vector3 mesh_edge_v1 = xprop_section.vertices[u_edge.verts[0]];
+        Vector3 mesh_edge_v2 = xprop_section.vertices[u_edge.verts[1]];
         // Transform points without translation!
         // @Optimization Is scaling + quaternion rotation faster than 3x3 mult?
         //               --> First test of this led to output differences
@@ -659,25 +724,25 @@ XPropSectionBevelPlaneLut::XPropSectionBevelPlaneLut(
                 // If all the points on all the sides are behind
                 // this plane, it is a proper edge bevel
                 size_t n;
-                for (n = 0; n < tri_mesh_of_xprop_section.vertices.size(); n++) {
+                for (n = 0; n < xprop_section.vertices.size(); n++) {
                     // @Optimization Is this redundant? Does this filter out planes at all?
-                    float d = Math::dot(tri_mesh_of_xprop_section.vertices[n], final_normal) - final_dist;
+                    float d = Math::dot(xprop_section.vertices[n], final_normal) - final_dist;
                     if (d > 0.1f)
                         break; // Point in front
                 }
-                if (n != tri_mesh_of_xprop_section.vertices.size())
+                if (n != xprop_section.vertices.size())
                     continue; // Wasn't part of the outer hull
 
                 size_t m;
-                for (m = 0; m < planes_of_xprop_section.size(); m++) {
-                    const Plane& other_tri_plane = planes_of_xprop_section[m];
+                for (m = 0; m < xprop_section.tri_planes.size(); m++) {
+                    const Plane& other_tri_plane = xprop_section.tri_planes[m];
 
                     // If this plane has already been used, skip it
                     // NOTE: Use a larger tolerance for collision planes than for rendering planes
                     if (PlaneEqual(other_tri_plane, final_normal, final_dist, 0.01f, 0.01f))
                         break;
                 }
-                if (m != planes_of_xprop_section.size())
+                if (m != xprop_section.tri_planes.size())
                     continue; // Wasn't part of the outer hull
 
                 // Skip if this new plane is identical to a previous bevel plane
@@ -775,11 +840,9 @@ XPropSectionBevelPlaneGenerator::XPropSectionBevelPlaneGenerator(
     : cur_candidate_idx { 0 }
     , cur_lut_pos       { 0 }
     , xprop_inv_rotation{ xprop_coll_cache.inv_rotation }
-    , tri_mesh_of_xprop_section{
-        xprop_coll_model.section_tri_meshes[idx_of_xprop_section]
-    }
+    , xprop_section{ xprop_coll_model.GetSection(idx_of_xprop_section) }
     , valid_candidate_index_steps_recidx{
-        xprop_coll_cache.section_bevel_luts[idx_of_xprop_section].valid_candidate_index_steps_recidx
+        xprop_coll_cache.GetSectionBevelLut(idx_of_xprop_section)
     }
 {
 }
@@ -824,9 +887,9 @@ bool XPropSectionBevelPlaneGenerator::GetNext(BspMap::Plane* out)
     //       to calculate the same result, but faster.
 
     const TriMesh::Edge& unique_edge =
-        tri_mesh_of_xprop_section.edges[gen_params.unique_edge_idx];
-    Vector3 mesh_edge_v1 = tri_mesh_of_xprop_section.vertices[unique_edge.verts[0]];
-    Vector3 mesh_edge_v2 = tri_mesh_of_xprop_section.vertices[unique_edge.verts[1]];
+        xprop_section.edges[gen_params.unique_edge_idx];
+    Vector3 mesh_edge_v1 = xprop_section.vertices[unique_edge.verts[0]];
+    Vector3 mesh_edge_v2 = xprop_section.vertices[unique_edge.verts[1]];
     Vector3 vec = mesh_edge_v1 - mesh_edge_v2;
 
     // Construct the axial normal
@@ -1,6 +1,8 @@
 #ifndef COLL_COLLIDABLEWORLD_XPROP_H_
 #define COLL_COLLIDABLEWORLD_XPROP_H_
 
+#include <cstdint>
+#include <span>
 #include <vector>
 
 #include <Corrade/Containers/Optional.h>
@@ -19,32 +21,62 @@ namespace coll {
 
 // A collision model consists of a list of sections. A section is a list of
 // triangles that describe a convex shape.
+// All section data is stored in a few flat arrays and never changes after
+// creation. Traces access a section's data through a lightweight SectionView.
 struct CollisionModel {
     // NOTE: Collision models might have *slightly* concave sections!
     //       Effects of this are unknown.
 
-    // Section indexing is identical between section_tri_meshes, section_planes,
-    // and section_aabbs.
-
-    // Triangle mesh of each (convex) section.
+    // Creates collision model from the triangle mesh of each (convex) section.
     // 2024-02-18:
     //   Properties of these TriMesh objects parsed from CSGO's prop PHYs:
     //     - 'edges' array holds unique edges (GUARANTEED)
     //     - 'tris' array likely holds unique tris (not guaranteed)
     //     - 'vertices' array likely holds unique verts (not guaranteed)
-    std::vector<utils_3d::TriMesh> section_tri_meshes;
+    explicit CollisionModel(const std::vector<utils_3d::TriMesh>& section_tri_meshes);
 
-    // For the sake of precomputation, we store each section's planes and AABBs
-    // as well.
+    struct AABB { Magnum::Vector3 mins, maxs; };
 
-    // Planes of the triangles of each (convex) section.
-    std::vector<std::vector<csgo_parsing::BspMap::Plane>> section_planes;
+    // Read-only view of a single (convex) section's data
+    struct SectionView {
+        std::span<const Magnum::Vector3>             vertices;
+        std::span<const utils_3d::TriMesh::Edge>     edges; // Index into vertices
+        std::span<const csgo_parsing::BspMap::Plane> tri_planes; // Plane of each triangle
 
-    // AABB of each (convex) section. Note that these are different from AABBs
-    // of xprop sections, since xprop sections have been scaled, rotated and
-    // translated.
-    struct AABB { Magnum::Vector3 mins, maxs; };
-    std::vector<AABB> section_aabbs;
+        // AABB of the section. Note that these are different from AABBs of
+        // xprop sections, since xprop sections have been scaled, rotated and
+        // translated.
+        AABB aabb;
+    };
+
+    size_t GetSectionCount() const { return sections.size(); }
+
+    // View is valid as long as this collision model exists
+    SectionView GetSection(size_t section_idx) const {
+        const Section& s = sections[section_idx];
+        return {
+            .vertices   = { vertices  .data() + s.first_vertex,    s.vertex_cnt    },
+            .edges      = { edges     .data() + s.first_edge,      s.edge_cnt      },
+            .tri_planes = { tri_planes.data() + s.first_tri_plane, s.tri_plane_cnt },
+            .aabb       = s.aabb
+        };
+    }
+
+private:
+    // Ranges of a section's data inside the flat arrays below
+    struct Section {
+        uint32_t first_vertex;    uint32_t vertex_cnt;
+        uint32_t first_edge;      uint32_t edge_cnt;
+        uint32_t first_tri_plane; uint32_t tri_plane_cnt;
+        AABB aabb;
+    };
+    std::vector<Section> sections;
+
+    // Data of all sections, stored section after section.
+    // Edges refer to vertices by their index within the section.
+    std::vector<Magnum::Vector3>             vertices;
+    std::vector<utils_3d::TriMesh::Edge>     edges;
+    std::vector<csgo_parsing::BspMap::Plane> tri_planes;
 };
 
 
@@ -56,11 +88,18 @@ public:
         const Magnum::Matrix3&    xprop_rotationscaling,
         const Magnum::Quaternion& xprop_inv_rotation, // Must be normalized!
         float                     xprop_inv_scale,
-        const utils_3d::TriMesh& tri_mesh_of_xprop_section,
-        const std::vector<csgo_parsing::BspMap::Plane>& planes_of_xprop_section);
+        const CollisionModel::SectionView& xprop_section);
 
     size_t GetMemorySize() const;
 
+    // 'Recursive indexing' int type of the LUT, see below
+    using RecIdxType = uint8_t;
+
+    // Returns LUT representation, see below
+    std::span<const RecIdxType> GetData() const {
+        return valid_candidate_index_steps_recidx;
+    }
+
 private:
     // Essentially, this LUT represents the information of whether a 'bevel
     // plane candidate' (identified by its index OR generation parameters) is
@@ -106,20 +145,35 @@ private:
     //                  LUT's layout were chosen to optimize memory usage and
     //                  lookup time when used for static props as found inside
     //                  CSGO DZ maps.
-    using RecIdxType = uint8_t; // 'Recursive indexing' int type
     std::vector<RecIdxType> valid_candidate_index_steps_recidx; // <- LUT representation
 
     friend class XPropSectionBevelPlaneGenerator;
 };
 
+// Collision models of a CollidableWorld are identified by their index inside
+// the CollidableWorld's collision model array. IDs are assigned once during
+// world creation, each MDL path used by a solid prop getting its own ID.
+using CollisionModelId = uint32_t;
+constexpr CollisionModelId INVALID_COLLISION_MODEL_ID = UINT32_MAX;
+
 // Precomputed data per static/dynamic prop to speed up collision calculations
 // Note: Up to ~10000 static props in a CSGO map have been encountered.
 // Note: Up to 160000 total static prop sections in a CSGO map have been
 //       encountered.
 struct CollisionCache_XProp {
+    // Index of the CollisionModel this static/dynamic prop uses, inside
+    // CollidableWorld's collision model array. INVALID_COLLISION_MODEL_ID if
+    // this static/dynamic prop has no collision.
+    CollisionModelId coll_model_id = INVALID_COLLISION_MODEL_ID;
+
     // Transformation data
+    Magnum::Vector3    origin;
     Magnum::Quaternion inv_rotation; // Normalized. Reverses xprop rotation
-    float              inv_scale;    // (1 / scale)
+    float              inv_scale = 1.0f; // (1 / scale)
+
+    bool HasCollision() const {
+        return coll_model_id != INVALID_COLLISION_MODEL_ID;
+    }
 
     // Exact, non-bloated AABB of each section of this static/dynamic prop.
     // Note that these are different from a CollisionModel's section AABBs!
@@ -140,9 +194,20 @@ struct CollisionCache_XProp {
     struct AABB { Magnum::Vector3 mins, maxs; };
     std::vector<AABB> section_aabbs;
 
-    // Bevel plane LUT of each section of this static/dynamic prop
+    // Bevel plane LUTs of all sections of this static/dynamic prop, stored
+    // section after section. The LUT of section i is located inside
+    // bevel_luts[section_bevel_lut_offsets[i] ... section_bevel_lut_offsets[i+1]).
     // @Optimization Memory: There are possibly a number of duplicate LUTs in here
-    std::vector<XPropSectionBevelPlaneLut> section_bevel_luts;
+    std::vector<XPropSectionBevelPlaneLut::RecIdxType> bevel_luts;
+    std::vector<uint32_t> section_bevel_lut_offsets; // Has (section count + 1) entries
+
+    // View is valid as long as this collision cache exists
+    std::span<const XPropSectionBevelPlaneLut::RecIdxType>
+    GetSectionBevelLut(size_t section_idx) const {
+        uint32_t begin = section_bevel_lut_offsets[section_idx];
+        uint32_t end   = section_bevel_lut_offsets[section_idx + 1];
+        return { bevel_luts.data() + begin, end - begin };
+    }
 };
 
 // Returns an empty Optional if collision cache creation fails.
@@ -185,8 +250,8 @@ private:
 
     // Stored info for generation
     const Magnum::Quaternion xprop_inv_rotation; // Normalized
-    const utils_3d::TriMesh& tri_mesh_of_xprop_section;
-    const std::vector<XPropSectionBevelPlaneLut::RecIdxType>&
+    const CollisionModel::SectionView xprop_section;
+    const std::span<const XPropSectionBevelPlaneLut::RecIdxType>
                                              valid_candidate_index_steps_recidx;
 };
 
@@ -9,6 +9,7 @@
 
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/Debugger.h"
+#include "coll/TraceContext.h"
 
 using namespace coll;
 using namespace Magnum;
@@ -21,6 +22,11 @@ CollidableWorld::CollidableWorld(std::shared_ptr<const BspMap> bsp_map)
 }
 
 void CollidableWorld::DoTrace(Trace* trace)
+{
+    DoTrace(trace, pImpl->main_thread_trace_ctx);
+}
+
+void CollidableWorld::DoTrace(Trace* trace, TraceContext& ctx)
 {
     ZoneScoped;
 
@@ -30,9 +36,23 @@ void CollidableWorld::DoTrace(Trace* trace)
         return;
     }
 
-    coll::Debugger::DebugStart_Trace(trace->info);
-    pImpl->bvh->DoTrace(trace, *this);
-    coll::Debugger::DebugFinish_Trace(trace->results);
+    if (ctx.is_debugger_enabled)
+        coll::Debugger::DebugStart_Trace(trace->info);
+    ctx.trace_cnt++;
+    pImpl->bvh->DoTrace(trace, *this, ctx);
+    if (ctx.is_debugger_enabled)
+        coll::Debugger::DebugFinish_Trace(trace->results);
+}
+
+void CollidableWorld::PrepareTraceContext(TraceContext& ctx) const
+{
+    if (pImpl->bvh)
+        pImpl->bvh->PrepareTraceContext(ctx);
+}
+
+uint64_t CollidableWorld::GetMainThreadTraceCount() const
+{
+    return pImpl->main_thread_trace_ctx.trace_cnt;
 }
 
 bool coll::AabbIntersectsAabb(
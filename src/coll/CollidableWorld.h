@@ -1,6 +1,8 @@
 #ifndef COLL_COLLIDABLEWORLD_H_
 #define COLL_COLLIDABLEWORLD_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #include <Magnum/Magnum.h>
@@ -9,16 +11,53 @@
 #include "coll/Trace.h"
 #include "csgo_parsing/BspMap.h"
 
-// Forward-declare WorldCreator outside namespace to avoid ambiguity
-class WorldCreator;
-
 namespace coll {
 
+class TraceContext;
+
 // Test whether two axis-aligned bounding boxes (AABBs) intersect.
 bool AabbIntersectsAabb(const Magnum::Vector3& mins0, const Magnum::Vector3& maxs0,
                         const Magnum::Vector3& mins1, const Magnum::Vector3& maxs1);
 
 
+// Linear model of the time it takes to trace against a single collidable
+// object, given that the trace already hits the object's AABB. Used as leaf
+// cost by the BVH's surface area heuristic (SAH). All durations are in
+// nanoseconds. Benchmark::LeafTraceCostCalibration() measures them on the
+// loaded map.
+// By default, every leaf costs the same. Keep it that way until calibrated
+// coefficients of real maps are known to reduce trace times: Run
+// LeafTraceCostCalibration on several DZ maps (e.g. with DZSimCollBenchmark),
+// then adopt the printed coefficients if "calibrated_costs" traces faster
+// than "uniform_costs" on all of them.
+struct TraceCostModel {
+    float aabb_test = 2.0f; // Testing a trace against a BVH node's/leaf's AABB
+
+    float brush_base     = 20.0f;
+    float brush_per_side =  0.0f;
+
+    // Indexed by displacement power, which determines the triangle count.
+    // Valid displacement powers are 2, 3 and 4.
+    float disp_by_power[5] = { 20.0f, 20.0f, 20.0f, 20.0f, 20.0f };
+
+    float func_brush_base     = 20.0f; // Includes transforming the trace
+    float func_brush_per_side =  0.0f;
+
+    float xprop_base        = 20.0f; // Includes transforming the trace
+    float xprop_per_section =  0.0f;
+    float xprop_per_plane   =  0.0f; // Plane of each section triangle
+
+    // Properties of a single object that its trace cost depends on. Members
+    // that don't apply to the object's type are 0.
+    struct Factors {
+        uint32_t side_cnt    = 0; // Of brushes, compiled planes of func_brushes
+        uint32_t disp_power  = 0; // Of displacements
+        uint32_t section_cnt = 0; // Of static and dynamic props
+        uint32_t plane_cnt   = 0; // Of static and dynamic props, all sections
+    };
+};
+
+
 // Map-specific collision-related data container
 class CollidableWorld {
 public:
@@ -26,20 +65,65 @@ public:
     CollidableWorld(std::shared_ptr<const csgo_parsing::BspMap> bsp_map);
 
     // Perform a swept or unswept trace against the entire world.
-    // CAUTION: Not thread-safe yet!
+    // Uses this world's own TraceContext, which reports to coll::Debugger.
+    // CAUTION: Must only be called from the main thread!
     void DoTrace(Trace* trace);
 
+    // Same as above, but uses the given TraceContext for scratch state, which
+    // must have been prepared with PrepareTraceContext().
+    // Multiple threads can trace concurrently, as long as each of them uses
+    // its own TraceContext and the world isn't modified meanwhile.
+    void DoTrace(Trace* trace, TraceContext& ctx);
+
+    // Allocates the scratch memory that traces against this world need
+    // inside the given TraceContext, so that traces themselves don't allocate
+    // any memory. Must be called before the context's first trace. This
+    // world's own TraceContext is prepared when the world is created.
+    void PrepareTraceContext(TraceContext& ctx) const;
+
+    // Returns the number of traces that were performed with this world's own
+    // TraceContext, i.e. by DoTrace(Trace*).
+    uint64_t GetMainThreadTraceCount() const;
+
+    // Displacement collision caches are created on demand during hull traces
+    // and take up memory until they are evicted. Their total memory usage can
+    // be limited by a budget in bytes, which is enforced by
+    // EvictDispCollCaches(). By default, the budget is unlimited.
+    static constexpr size_t DISP_COLL_CACHE_BUDGET_UNLIMITED = SIZE_MAX;
+    void   SetDispCollCacheBudget(size_t budget_bytes);
+    size_t GetDispCollCacheBudget() const;
+
+    // Deletes the caches of the least recently traced displacements until
+    // the total memory usage of displacement collision caches is within
+    // budget. Caches count as used when a trace used them since the previous
+    // call of this function. Meant to be called regularly, e.g. once per frame.
+    // CAUTION: Must not be called while other threads trace against this world!
+    void EvictDispCollCaches();
+
+    struct DispCollCacheStats {
+        // Cache hits and misses of traces that were performed with this
+        // world's own TraceContext, see GetMainThreadTraceCount(). Other
+        // TraceContexts count their own, see TraceContext.
+        uint64_t hit_cnt;
+        uint64_t miss_cnt;
+        uint64_t eviction_cnt; // Caches deleted by EvictDispCollCaches()
+        size_t   cache_cnt;    // Caches that are currently created
+        size_t   memory_usage; // Of currently created caches, in bytes
+    };
+    // CAUTION: Must not be called while other threads trace against this world!
+    DispCollCacheStats GetDispCollCacheStats() const;
+
 private:
-    // Estimate trace cost of each object type
-    uint64_t GetTraceCost_Brush       (uint32_t      brush_idx); // idx into BspMap.brushes
-    uint64_t GetTraceCost_Displacement(uint32_t   dispcoll_idx); // idx into CDispCollTree array
-    uint64_t GetTraceCost_FuncBrush   (uint32_t func_brush_idx); // idx into BspMap.entities_func_brush
-    uint64_t GetTraceCost_StaticProp  (uint32_t      sprop_idx); // idx into BspMap.static_props
-    uint64_t GetTraceCost_DynamicProp (uint32_t      dprop_idx); // idx into BspMap.relevant_dynamic_props
+    // Properties of single objects that their trace cost depends on
+    TraceCostModel::Factors GetTraceCostFactors_Brush       (uint32_t      brush_idx); // idx into BspMap.brushes
+    TraceCostModel::Factors GetTraceCostFactors_Displacement(uint32_t   dispcoll_idx); // idx into CDispCollTree array
+    TraceCostModel::Factors GetTraceCostFactors_FuncBrush   (uint32_t func_brush_idx); // idx into BspMap.entities_func_brush
+    TraceCostModel::Factors GetTraceCostFactors_StaticProp  (uint32_t      sprop_idx); // idx into BspMap.static_props
+    TraceCostModel::Factors GetTraceCostFactors_DynamicProp (uint32_t      dprop_idx); // idx into BspMap.relevant_dynamic_props
 
     // Sweep trace against single objects
     void DoSweptTrace_Brush       (Trace* trace, uint32_t      brush_idx); // idx into BspMap.brushes
-    void DoSweptTrace_Displacement(Trace* trace, uint32_t   dispcoll_idx); // idx into CDispCollTree array
+    void DoSweptTrace_Displacement(Trace* trace, uint32_t   dispcoll_idx, TraceContext& ctx); // idx into CDispCollTree array
     void DoSweptTrace_FuncBrush   (Trace* trace, uint32_t func_brush_idx); // idx into BspMap.entities_func_brush
     void DoSweptTrace_StaticProp  (Trace* trace, uint32_t      sprop_idx); // idx into BspMap.static_props
     void DoSweptTrace_DynamicProp (Trace* trace, uint32_t      dprop_idx); // idx into BspMap.relevant_dynamic_props
@@ -57,7 +141,7 @@ private:
     std::unique_ptr<Impl> pImpl;
 
     // Let some classes access private members:
-    friend class ::WorldCreator; // WorldCreator initializes this class
+    friend class CollidableWorldCreator; // Initializes this class
     friend class BVH;            // BVH is heavily tied to this class
     friend class Debugger;       // Debugger needs to debug
     friend class Benchmark;      // Benchmarks need to benchmark
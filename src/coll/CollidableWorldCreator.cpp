@@ -0,0 +1,359 @@
+#include "coll/CollidableWorldCreator.h"
+
+#include <algorithm>
+#include <utility>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <Tracy.hpp>
+
+#include <Corrade/Containers/Optional.h>
+#include <Magnum/Magnum.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "coll/CollidableWorld_Impl.h"
+#include "coll/CollidableWorld-brush.h"
+#include "coll/CollidableWorld-displacement.h"
+#include "coll/CollidableWorld-funcbrush.h"
+#include "coll/CollidableWorld-xprop.h"
+#include "csgo_parsing/AssetFileReader.h"
+#include "csgo_parsing/AssetFinder.h"
+#include "csgo_parsing/BspMap.h"
+#include "csgo_parsing/PhyModelParsing.h"
+#include "csgo_parsing/utils.h"
+#include "utils_3d.h"
+
+using namespace Magnum;
+using namespace csgo_parsing;
+using namespace coll;
+using namespace utils_3d;
+
+std::shared_ptr<CollidableWorld>
+CollidableWorldCreator::InitFromBspMap(
+    std::shared_ptr<const BspMap> bsp_map,
+    const Corrade::Containers::Optional<BVH::BuildParams>& bvh_params,
+    std::string* dest_errors,
+    XPropCollMeshes* dest_xprop_coll_meshes)
+{
+    ZoneScoped;
+
+    std::string error_msgs = "";
+
+    // Only look up assets in the game's directory and its VPK archives if it
+    // isn't an embedded map. Embedded maps are supposed to be independent and
+    // self-contained, not requiring any external files.
+    bool use_game_dir_assets = !bsp_map->is_embedded_map;
+
+    // Compile collision data of worldspawn brushes
+    CompiledBrushes compiled_brushes{ *bsp_map };
+
+    // Compile collision data of func_brush entities
+    CompiledFuncBrushes compiled_func_brushes{ *bsp_map };
+
+    // Init collision structures of displacements that collide with hull
+    // traces, ray traces or both
+    auto is_disp_collidable = [&bsp_map](size_t disp_idx) {
+        const BspMap::DispInfo& dispinfo = bsp_map->dispinfos[disp_idx];
+        return !dispinfo.HasFlag_NO_HULL_COLL() || !dispinfo.HasFlag_NO_RAY_COLL();
+    };
+    std::vector<CDispCollTree> disp_coll_trees;
+    size_t relevant_disp_cnt = 0;
+    for (size_t i = 0; i < bsp_map->dispinfos.size(); i++) {
+        if (!is_disp_collidable(i))
+            continue;
+        relevant_disp_cnt++;
+    }
+    disp_coll_trees.reserve(relevant_disp_cnt);
+    for (size_t i = 0; i < bsp_map->dispinfos.size(); i++) {
+        if (!is_disp_collidable(i))
+            continue;
+        // @Optimization Only get disp vertices once and use it for mesh and coll init
+        disp_coll_trees.emplace_back(i, *bsp_map);
+    }
+    
+    // ---- Collect all ".mdl" and ".phy" files from the packed files
+    std::vector<uint16_t> packed_mdl_file_indices; // indices into BspMap::packed_files
+    std::vector<uint16_t> packed_phy_file_indices; // indices into BspMap::packed_files
+    for (size_t i = 0; i < bsp_map->packed_files.size(); i++) {
+        const std::string& fname = bsp_map->packed_files[i].file_name;
+        if (fname.length() >= 5) {
+            if      (fname.ends_with(".mdl")) packed_mdl_file_indices.push_back(i);
+            else if (fname.ends_with(".phy")) packed_phy_file_indices.push_back(i);
+        }
+    }
+    // ---- Sort packed file indices by file name to enable fast lookup later
+    auto comp__packed_file_name = [&](uint16_t idx_a, uint16_t idx_b) {
+        return bsp_map->packed_files[idx_a].file_name < bsp_map->packed_files[idx_b].file_name;
+    };
+    std::sort(
+        packed_mdl_file_indices.begin(),
+        packed_mdl_file_indices.end(),
+        comp__packed_file_name);
+    std::sort(
+        packed_phy_file_indices.begin(),
+        packed_phy_file_indices.end(),
+        comp__packed_file_name);
+
+    for (auto packed_file_idx : packed_mdl_file_indices)
+        Debug{} << "packed MDL:" << bsp_map->packed_files[packed_file_idx].file_name.c_str();
+    for (auto packed_file_idx : packed_phy_file_indices)
+        Debug{} << "packed PHY:" << bsp_map->packed_files[packed_file_idx].file_name.c_str();
+
+    // predicate function used for binary lookup of packed file idx with file name
+    auto comp__find_packed_file_name_idx =
+        [&](uint16_t packed_file_idx, const std::string& file_name) {
+            return bsp_map->packed_files[packed_file_idx].file_name < file_name;
+        };
+
+    // ---- Load collision models of solid prop_static and prop_dynamic entities
+
+    // Get MDL paths referenced by at least one solid prop (static or dynamic)
+    std::set<std::string> solid_xprop_mdl_paths;
+    for (const BspMap::StaticProp& sprop : bsp_map->static_props)
+        if (sprop.IsSolidWithVPhysics())
+            solid_xprop_mdl_paths.insert(bsp_map->static_prop_model_dict[sprop.model_idx]);
+    for (const BspMap::Ent_prop_dynamic& dprop : bsp_map->relevant_dynamic_props)
+        solid_xprop_mdl_paths.insert(dprop.model);
+
+    // Collision models used in at least one solid prop (static or dynamic).
+    // Indices are collision model IDs.
+    std::vector<CollisionModel> xprop_coll_models;
+
+    // Interns MDL paths of collision models into collision model IDs.
+    // Only needed during world creation, traces don't look up paths.
+    std::map<std::string, CollisionModelId> xprop_coll_model_ids;
+
+    // When loading regular (non-embedded) maps, a requirement to consider a
+    // prop as solid is the existence of the MDL file it references.
+    // This is done to faithfully represent how CSGO would load a map.
+    // When loading embedded maps, we don't require an MDL file for solid props
+    // because these maps are custom-made to only be loaded by DZSimulator and
+    // MDL files themselves are not read and they would unnecessarily increase
+    // embedded file size.
+    bool require_existing_mdl_file = !bsp_map->is_embedded_map;
+
+    // Now attempt to load required collision models
+    for (const std::string& mdl_path : solid_xprop_mdl_paths) {
+        ZoneScopedN("xprop phy load");
+
+        if (mdl_path.length() < 5) // Ensure valid file path
+            continue;
+        std::string phy_path = mdl_path;
+        phy_path[phy_path.length() - 3] = 'p';
+        phy_path[phy_path.length() - 2] = 'h';
+        phy_path[phy_path.length() - 1] = 'y';
+
+        // Search for MDL file in packed files
+        auto it_packed_mdl_idx = std::lower_bound(
+            packed_mdl_file_indices.begin(),
+            packed_mdl_file_indices.end(),
+            mdl_path,
+            comp__find_packed_file_name_idx);
+        bool is_mdl_in_packed_files =
+            it_packed_mdl_idx != packed_mdl_file_indices.end() &&
+            mdl_path.compare(bsp_map->packed_files[*it_packed_mdl_idx].file_name) == 0;
+
+        // Search for PHY file in packed files
+        auto it_packed_phy_idx = std::lower_bound(
+            packed_phy_file_indices.begin(),
+            packed_phy_file_indices.end(),
+            phy_path,
+            comp__find_packed_file_name_idx);
+        bool is_phy_in_packed_files =
+            it_packed_phy_idx != packed_phy_file_indices.end() &&
+            phy_path.compare(bsp_map->packed_files[*it_packed_phy_idx].file_name) == 0;
+
+        bool is_mdl_in_game_files = use_game_dir_assets ?
+            AssetFinder::ExistsInGameFiles(mdl_path) : false;
+
+        // Sometimes we require every prop to have an existing ".mdl" file
+        if (require_existing_mdl_file
+            && !is_mdl_in_game_files && !is_mdl_in_packed_files)
+        {
+            error_msgs += "Failed to find MDL file '" + mdl_path + "', "
+                "referenced by at least one solid prop. "
+                "All props with this model will be missing from the world.\n";
+            continue;
+        }
+
+        // Open the PHY file at the correct location
+        AssetFileReader phy_file_reader;
+        std::string phy_file_read_err = ""; // empty means no error occurred
+
+        if (is_phy_in_packed_files) {
+            // Depending on where we parsed the original '.bsp' file from,
+            // we need to read its packed files accordingly.
+            switch (bsp_map->file_origin.type) {
+            case BspMap::FileOrigin::FILE_SYSTEM: {
+                auto& abs_bsp_file_path = bsp_map->file_origin.abs_file_path;
+                if (!phy_file_reader.OpenFileFromAbsolutePath(abs_bsp_file_path))
+                    phy_file_read_err = "Failed to open BSP file for parsing a "
+                    "packed PHY file: " + abs_bsp_file_path;
+                break;
+            }
+            case BspMap::FileOrigin::MEMORY: {
+                auto& bsp_file_mem = bsp_map->file_origin.file_content_mem;
+                if (!phy_file_reader.OpenFileFromMemory(bsp_file_mem))
+                    phy_file_read_err = "Failed to open BSP file from memory to"
+                    " parse packed PHY file";
+                break;
+            }
+            default:
+                phy_file_read_err = "Failed to read packed PHY file: Unknown "
+                    "BSP file origin: " + std::to_string(bsp_map->file_origin.type);
+                break;
+            }
+
+            // If opening the original bsp file succeeded without errors
+            if (phy_file_read_err.empty()) {
+                bool x = phy_file_reader.OpenSubFileFromCurrentlyOpenedFile(
+                    bsp_map->packed_files[*it_packed_phy_idx].file_offset,
+                    bsp_map->packed_files[*it_packed_phy_idx].file_len
+                ); // This can't fail because phy_file_reader is opened in a file
+            }
+        }
+        else {
+            // Look for PHY file in game directory and VPK archives
+            bool is_phy_in_game_files = use_game_dir_assets ?
+                AssetFinder::ExistsInGameFiles(phy_path) : false;
+
+            // Prop is non-solid if their model's PHY doesn't exist anywhere
+            if (!is_phy_in_game_files)
+                continue; // Not an error, we just skip this non-solid model
+
+            if (!phy_file_reader.OpenFileFromGameFiles(phy_path))
+                phy_file_read_err = "Failed to open PHY file from game files";
+        }
+
+        if (phy_file_read_err.empty()) { // If no error occurred on file open
+            // A collision model consists of one or more "sections".
+            // A "section" is a triangle mesh that describes a convex shape.
+            std::vector<TriMesh> section_tri_meshes;
+            std::string surface_property;
+            // CSGO loads the phy model even if checksum of MDL and PHY are not identical.
+            // NOTE: If you change the way PHY models are parsed, please see
+            //       whether comments of CollisionModel's constructor
+            //       need to be updated! E.g. regarding edge duplicate-freeness guarantees.
+            // NOTE: Static props' phy model always have a single solid.
+            //       Dynamic props' phy model very rarely have multiple solids.
+            auto ret = ParseSingleSolidPhyModel(
+                &section_tri_meshes, &surface_property, phy_file_reader);
+
+            // Special case: We treat this error as a non-error because maps
+            // rarely have dynamic props with a phy model with multiple solids.
+            // These are mostly hostage/character models or an animated garage
+            // doors. It's not worth supporting these, so skip without error.
+            if (ret.code == csgo_parsing::utils::RetCode::ERROR_PHY_MULTIPLE_SOLIDS) {
+                Debug{} << "Skipped multi-solid collision model:" << phy_path.c_str();
+                continue; // Not an error
+            }
+
+            if (ret.successful()) {
+                ZoneScopedN("gen collmodel");
+
+                // Construct CollisionModel object
+                auto id_it = xprop_coll_model_ids.find(mdl_path);
+                if (id_it != xprop_coll_model_ids.end()) {
+                    xprop_coll_models[id_it->second] =
+                        CollisionModel{ section_tri_meshes };
+                }
+                else {
+                    xprop_coll_model_ids[mdl_path] = xprop_coll_models.size();
+                    xprop_coll_models.emplace_back(section_tri_meshes);
+                }
+
+                if (dest_xprop_coll_meshes)
+                    (*dest_xprop_coll_meshes)[mdl_path] = std::move(section_tri_meshes);
+            }
+            else { // If parsing failed for other reasons, get error msg
+                phy_file_read_err = ret.desc_msg;
+            }
+        }
+
+        if (!phy_file_read_err.empty()) { // If anything failed
+            error_msgs += "All prop_static/prop_dynamic using the model '"
+                + mdl_path + "' will be missing from the world because loading "
+                "their collision model failed:\n    " + phy_file_read_err + "\n";
+        }
+    }
+
+    // Precompute collision caches of each solid prop (static or dynamic).
+    // MUST HAPPEN AFTER COLL MODEL CREATION!
+    Debug{} << "Creating collision caches of static props";
+    // Indexed like BspMap::static_props. Props without collision keep an
+    // empty cache.
+    std::vector<CollisionCache_XProp> coll_caches_sprop(bsp_map->static_props.size());
+    for (size_t sprop_idx = 0; sprop_idx < bsp_map->static_props.size(); sprop_idx++) {
+        const BspMap::StaticProp& sprop = bsp_map->static_props[sprop_idx];
+        if (!sprop.IsSolidWithVPhysics())
+            continue;
+
+        // Path to ".mdl" file used by static prop
+        const std::string& mdl_path = bsp_map->static_prop_model_dict[sprop.model_idx];
+
+        auto coll_model_id_it = xprop_coll_model_ids.find(mdl_path);
+        if (coll_model_id_it == xprop_coll_model_ids.end())
+            continue; // No collision model
+        CollisionModelId coll_model_id = coll_model_id_it->second;
+
+        auto sprop_coll_cache = coll::Create_CollisionCache_StaticProp(
+            sprop, xprop_coll_models[coll_model_id]);
+        if (sprop_coll_cache == Corrade::Containers::NullOpt)
+            continue; // Cache creation failed
+        sprop_coll_cache->coll_model_id = coll_model_id;
+        coll_caches_sprop[sprop_idx] = std::move(*sprop_coll_cache);
+    }
+    Debug{} << "Creating collision caches of dynamic props";
+    // Indexed like BspMap::relevant_dynamic_props. Props without collision keep
+    // an empty cache.
+    std::vector<CollisionCache_XProp> coll_caches_dprop(bsp_map->relevant_dynamic_props.size());
+    for (size_t dprop_idx = 0; dprop_idx < bsp_map->relevant_dynamic_props.size(); dprop_idx++) {
+        const BspMap::Ent_prop_dynamic& dprop = bsp_map->relevant_dynamic_props[dprop_idx];
+
+        auto coll_model_id_it = xprop_coll_model_ids.find(dprop.model);
+        if (coll_model_id_it == xprop_coll_model_ids.end())
+            continue; // No collision model
+        CollisionModelId coll_model_id = coll_model_id_it->second;
+
+        auto dprop_coll_cache = coll::Create_CollisionCache_DynamicProp(
+            dprop, xprop_coll_models[coll_model_id]);
+        if (dprop_coll_cache == Corrade::Containers::NullOpt)
+            continue; // Cache creation failed
+        dprop_coll_cache->coll_model_id = coll_model_id;
+        coll_caches_dprop[dprop_idx] = std::move(*dprop_coll_cache);
+    }
+
+
+    // Create CollidableWorld object and move all collision structures into it.
+    std::shared_ptr<CollidableWorld> c_world = std::make_shared<CollidableWorld>(bsp_map);
+    c_world->pImpl->compiled_brushes      = std::move(compiled_brushes);
+    c_world->pImpl->compiled_func_brushes = std::move(compiled_func_brushes);
+    c_world->pImpl->disp_coll_trees       = std::move(disp_coll_trees);
+    c_world->pImpl->xprop_coll_models    = std::move(xprop_coll_models);
+    c_world->pImpl->coll_caches_sprop    = std::move(coll_caches_sprop);
+    c_world->pImpl->coll_caches_dprop    = std::move(coll_caches_dprop);
+    // ...
+
+    // BVH must be created *after* all other collision structures were created
+    // and moved into the CollidableWorld object!
+    assert(c_world->pImpl->compiled_brushes      != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->compiled_func_brushes != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->disp_coll_trees       != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->xprop_coll_models    != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->coll_caches_sprop    != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->coll_caches_dprop    != Corrade::Containers::NullOpt);
+    // ...
+    if (bvh_params) {
+        c_world->pImpl->bvh = BVH(*c_world, *bvh_params);
+        c_world->PrepareTraceContext(c_world->pImpl->main_thread_trace_ctx);
+    }
+
+
+    if (dest_errors)
+        *dest_errors = std::move(error_msgs);
+    return c_world;
+}
@@ -0,0 +1,43 @@
+#ifndef COLL_COLLIDABLEWORLDCREATOR_H_
+#define COLL_COLLIDABLEWORLDCREATOR_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Corrade/Containers/Optional.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "csgo_parsing/BspMap.h"
+#include "utils_3d.h"
+
+namespace coll {
+
+class CollidableWorldCreator {
+public:
+    // key:   ".mdl" file path referenced by at least one solid prop (static or dynamic)
+    // value: Sections of the corresponding collision model, as triangle meshes
+    using XPropCollMeshes = std::map<std::string, std::vector<utils_3d::TriMesh>>;
+
+    // Creates a CollidableWorld object, including its BVH, from a parsed CSGO
+    // '.bsp' map file. Doesn't use any graphics API, so it can be used by
+    // headless tools too.
+    // The BVH is built with the given parameters. Set their cache_dir_path to
+    // reuse previous builds. If bvh_params is NullOpt, no BVH is built and
+    // the world can't be traced against, e.g. for tools that build their own.
+    // Error messages are put into the string pointed to by dest_errors.
+    // If dest_xprop_coll_meshes is given, the meshes of all successfully
+    // loaded prop collision models are put into it, e.g. for rendering them.
+    static std::shared_ptr<CollidableWorld> InitFromBspMap(
+        std::shared_ptr<const csgo_parsing::BspMap> bsp_map,
+        const Corrade::Containers::Optional<BVH::BuildParams>& bvh_params,
+        std::string* dest_errors = nullptr,
+        XPropCollMeshes* dest_xprop_coll_meshes = nullptr);
+
+};
+
+} // namespace coll
+
+#endif // COLL_COLLIDABLEWORLDCREATOR_H_
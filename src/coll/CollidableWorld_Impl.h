@@ -1,16 +1,18 @@
 #ifndef COLL_COLLIDABLEWORLD_IMPL_H_
 #define COLL_COLLIDABLEWORLD_IMPL_H_
 
-#include <map>
 #include <memory>
-#include <string>
+#include <vector>
 
 #include <Corrade/Containers/Optional.h>
 
 #include "coll/BVH.h"
 #include "coll/CollidableWorld.h"
+#include "coll/CollidableWorld-brush.h"
+#include "coll/CollidableWorld-funcbrush.h"
 #include "coll/CollidableWorld-xprop.h"
 #include "coll/CollidableWorld-displacement.h"
+#include "coll/TraceContext.h"
 #include "csgo_parsing/BspMap.h"
 
 namespace coll {
@@ -23,29 +25,55 @@ struct CollidableWorld::Impl {
     // Original CSGO map file this CollidableWorld object was created from
     std::shared_ptr<const csgo_parsing::BspMap> origin_bsp_map;
 
+    // Scratch state of traces that are done on the main thread
+    TraceContext main_thread_trace_ctx{ true };
+
+    // Eviction of displacement collision caches, see
+    // CollidableWorld::EvictDispCollCaches()
+    size_t disp_coll_cache_budget =
+                            CollidableWorld::DISP_COLL_CACHE_BUDGET_UNLIMITED;
+    uint64_t disp_coll_cache_clock = 1; // Advanced by each eviction pass
+    uint64_t disp_coll_cache_eviction_cnt = 0;
+    // Indices of displacements with cache, reused across eviction passes
+    std::vector<uint32_t> disp_coll_cache_lru_order;
+
 
 
     // Before using these collision structures, make sure they hold a value!
     // I.e.:  if (var != Corrade::Containers::NullOpt) { ... }
     template<class T> using Optional = Corrade::Containers::Optional<T>;
 
-    // Collision structures of displacements without the NO_HULL_COLL flag.
-    Optional< std::vector<CDispCollTree> > hull_disp_coll_trees =
+    // Collision data of worldspawn brushes, see CompiledBrushes.
+    Optional< CompiledBrushes > compiled_brushes =
+                                               { Corrade::Containers::NullOpt };
+
+    // Collision data of func_brush entities, see CompiledFuncBrushes.
+    Optional< CompiledFuncBrushes > compiled_func_brushes =
+                                               { Corrade::Containers::NullOpt };
+
+    // Collision structures of displacements that don't have both the
+    // NO_HULL_COLL and NO_RAY_COLL flag. Hull and ray traces skip
+    // displacements whose flags exclude them. Hull traces don't even
+    // traverse the BVH leaves of NO_HULL_COLL displacements, see
+    // BVH::Leaf::is_ray_only.
+    Optional< std::vector<CDispCollTree> > disp_coll_trees =
                                                { Corrade::Containers::NullOpt };
 
-    // Collision models used in at least one solid prop (solid or dynamic).
-    // Keys are MDL paths, values are collision models.
-    Optional< std::map<std::string, CollisionModel> > xprop_coll_models =
+    // Collision models used in at least one solid prop (static or dynamic).
+    // Indices are collision model IDs, see CollisionCache_XProp::coll_model_id.
+    Optional< std::vector<CollisionModel> > xprop_coll_models =
                                                { Corrade::Containers::NullOpt };
 
-    // Collision caches of each solid *static* prop.
-    // Keys are indices into BspMap::static_props, values are the caches.
-    Optional< std::map<uint32_t, CollisionCache_XProp> > coll_caches_sprop =
+    // Collision caches of each *static* prop, indexed like
+    // BspMap::static_props. Caches of props without collision are empty,
+    // see CollisionCache_XProp::HasCollision().
+    Optional< std::vector<CollisionCache_XProp> > coll_caches_sprop =
                                                { Corrade::Containers::NullOpt };
 
-    // Collision caches of each solid *dynamic* prop.
-    // Keys are indices into BspMap::relevant_dynamic_props, values are the caches.
-    Optional< std::map<uint32_t, CollisionCache_XProp> > coll_caches_dprop =
+    // Collision caches of each *dynamic* prop, indexed like
+    // BspMap::relevant_dynamic_props. Caches of props without collision are
+    // empty, see CollisionCache_XProp::HasCollision().
+    Optional< std::vector<CollisionCache_XProp> > coll_caches_dprop =
                                                { Corrade::Containers::NullOpt };
 
     // Bounding volume hierarchy (BVH) that accelerates traces.
@@ -545,8 +545,8 @@ void Debugger::Draw(
 
     if (gui_state.coll_debug.IN_showDispsForHullColl) {
         const Color3 color = Color3{ 1.0f, 0.0f, 1.0f };
-        if (g_coll_world && g_coll_world->pImpl->hull_disp_coll_trees) {
-            for (const CDispCollTree& dispcoll : *g_coll_world->pImpl->hull_disp_coll_trees) {
+        if (g_coll_world && g_coll_world->pImpl->disp_coll_trees) {
+            for (const CDispCollTree& dispcoll : *g_coll_world->pImpl->disp_coll_trees) {
                 if (dispcoll.CheckFlags(DispInfo::FLAG_NO_HULL_COLL))
                     continue;
 
@@ -562,8 +562,8 @@ void Debugger::Draw(
     //       overdraw them. The following visualization is more important.
     if (gui_state.coll_debug.IN_showDispsWithCollCache && g_coll_world) {
         const Color3 color = Color3{ 1.0f, 1.0f, 0.0f };
-        if (g_coll_world && g_coll_world->pImpl->hull_disp_coll_trees) {
-            for (const CDispCollTree& dispcoll : *g_coll_world->pImpl->hull_disp_coll_trees) {
+        if (g_coll_world && g_coll_world->pImpl->disp_coll_trees) {
+            for (const CDispCollTree& dispcoll : *g_coll_world->pImpl->disp_coll_trees) {
                 if (!dispcoll.IsCacheGenerated())
                     continue;
 
@@ -618,6 +618,7 @@ void Debugger::DrawImGuiElements(gui::GuiState& gui_state)
     ImGui::Text(tr_info.isray ? "tr.isray = true" : "tr.isray = false");
     ImGui::SameLine();
     ImGui::Text(tr_info.isswept ? "tr.isswept = true" : "tr.isswept = false");
+    ImGui::Text("tr.collidable_types = 0x%X", tr_info.collidable_types);
 
     ImGui::Text(tr_results.startsolid ? "tr.startsolid = true" : "tr.startsolid = false");
     ImGui::Text(tr_results.allsolid ? "tr.allsolid = true" : "tr.allsolid = false");
@@ -9,16 +9,20 @@
 #include "coll/BVH.h"
 #include "coll/CollidableWorld-displacement.h"
 #include "coll/Trace.h"
+#ifndef COLL_DEBUGGER_DISABLED
 #include "gui/GuiState.h"
 #include "ren/WideLineRenderer.h"
+#endif
 
 // Collision procedure visualizer, debug build only 
+// Builds without graphics (e.g. headless tools) define COLL_DEBUGGER_DISABLED,
+// which turns all debugging functions into no-ops that don't need Debugger.cpp.
 namespace coll {
 
 class Debugger {
 public:
 
-#ifdef NDEBUG
+#if defined(NDEBUG) || defined(COLL_DEBUGGER_DISABLED)
     static constexpr bool IS_ENABLED = false;
 #else
     static constexpr bool IS_ENABLED = true;
@@ -60,6 +64,7 @@ public:
 
     // -------------------------------------------------------------------------
 
+#ifndef COLL_DEBUGGER_DISABLED
     // Draw visualizations
     static void Draw(
         const Magnum::Vector3& cam_pos,
@@ -71,6 +76,7 @@ public:
 
     // Handle/show the collision debugging menu elements
     static void DrawImGuiElements(gui::GuiState& gui_state);
+#endif
 
     // -------------------------------------------------------------------------
 
@@ -79,6 +85,18 @@ public:
     struct UnfinishedTraceData;
 };
 
+#ifdef COLL_DEBUGGER_DISABLED
+inline void Debugger::Reset() {}
+inline void Debugger::DebugStart_Trace(const Trace::Info&) {}
+inline void Debugger::DebugStart_BroadPhaseLeafHit(const BVH::Leaf&, int32_t) {}
+inline void Debugger::DebugStart_DispCollLeafHit(const CDispCollTree&, int) {}
+inline void Debugger::DebugFinish_DispCollLeafHit() {}
+inline void Debugger::DebugFinish_BroadPhaseLeafHit() {}
+inline void Debugger::DebugFinish_Trace(const Trace::Results&) {}
+inline bool Debugger::DidUsageErrorOccur() { return false; }
+inline std::string Debugger::GetUsageErrorDesc() { return ""; }
+#endif
+
 } // namespace coll
 
 #endif // COLL_DEBUGGER_H_
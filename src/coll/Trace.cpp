@@ -10,25 +10,22 @@
 using namespace coll;
 using namespace Magnum;
 
-bool Trace::HitsAabb(const Magnum::Vector3 &aabb_mins,
-                     const Magnum::Vector3 &aabb_maxs,
-                     float* hit_fraction) const
+bool Trace::HitsAabbReference(const Magnum::Vector3 &aabb_mins,
+                              const Magnum::Vector3 &aabb_maxs,
+                              float* hit_fraction) const
 {
     // NOTE: The code in this method was written for swept traces, but also
     //       works for unswept traces.
 
-    // @Optimization If this trace is unswept, just do a simple AABB-point
-    //               intersection test?
-    // @Optimization Make these trace tests inline? Use __forceinline on
-    //               windows, like displacement collision code?
-
     // -------- start of source-sdk-2013 code --------
     // (taken and modified from source-sdk-2013/<...>/src/public/dispcoll_common.cpp)
     // (AABB trace code was originally found in IntersectRayWithFourBoxes())
 
-    // NOTE: The original code was SIMD optimized. DZSimulator does not utilize
-    //       SIMD for now. Furthermore, all CDispVector that were 16-aligned
-    //       have been replaced with unaligned std::vector. Is their alignment
+    // NOTE: The original code was SIMD optimized. This is the scalar version
+    //       for a single AABB, Trace::HitsAabb() and BVH::HitsFourAabbs() are
+    //       the SIMD versions for 1 and 4 AABBs and must produce identical
+    //       results. Furthermore, all CDispVector that were 16-aligned have
+    //       been replaced with unaligned std::vector. Is their alignment
     //       necessary for SIMD?
 
     Vector3 hit_mins = aabb_mins;
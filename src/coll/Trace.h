@@ -5,10 +5,47 @@
 #include <cstdint>
 
 #include <Magnum/Magnum.h>
+#include <Magnum/Math/Functions.h>
 #include <Magnum/Math/Vector3.h>
 
+// SIMD instruction set used by trace code, e.g. Trace::HitsAabb() and
+// BVH::HitsFourAabbs(). The NEON code uses AArch64-only instructions.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRACE_USE_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define TRACE_USE_NEON
+#include <arm_neon.h>
+#endif
+
+// Trace-AABB tests are performed for every visited BVH node, they must get
+// inlined into the traversal loops.
+#if defined(_MSC_VER)
+#define TRACE_FORCEINLINE __forceinline
+#elif defined(__GNUC__) || defined(__clang__)
+#define TRACE_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define TRACE_FORCEINLINE inline
+#endif
+
 namespace coll {
 
+// Bit flags of map object types that a trace can collide with.
+// See Trace::Info::collidable_types.
+enum CollidableTypeFlags : uint32_t {
+    COLLIDABLE_BRUSHES       = 1 << 0, // Brushes of the worldspawn entity
+    COLLIDABLE_DISPLACEMENTS = 1 << 1,
+    COLLIDABLE_STATIC_PROPS  = 1 << 2,
+    COLLIDABLE_DYNAMIC_PROPS = 1 << 3,
+    COLLIDABLE_FUNC_BRUSHES  = 1 << 4,
+
+    // Static map geometry, without any props or brush entities
+    COLLIDABLE_WORLD = COLLIDABLE_BRUSHES | COLLIDABLE_DISPLACEMENTS,
+    COLLIDABLE_ALL   = COLLIDABLE_BRUSHES | COLLIDABLE_DISPLACEMENTS
+                     | COLLIDABLE_STATIC_PROPS | COLLIDABLE_DYNAMIC_PROPS
+                     | COLLIDABLE_FUNC_BRUSHES,
+};
+
 // -------- start of source-sdk-2013 code --------
 // (taken and modified from Ray_t, CBaseTrace and CToolTrace in
 // source-sdk-2013/<...>/src/public/cmodel.h and
@@ -38,7 +75,7 @@ struct Trace
         Magnum::Vector3 extents;     // Describes an axis aligned box extruded along a ray
         bool            isray;       // Are the extents zero?
         bool            isswept;     // Is delta != 0?
-        //uint32_t        contents;    // Only collide with objects with these contents
+        uint32_t        collidable_types; // Only collide with these object types, see CollidableTypeFlags
     } info;
 
 
@@ -69,7 +106,8 @@ struct Trace
     // If start pos is equal to end pos, this becomes an unswept point trace instead.
     Trace(
         const Magnum::Vector3& ray_trace_start,
-        const Magnum::Vector3& ray_trace_end)
+        const Magnum::Vector3& ray_trace_end,
+        uint32_t collidable_types = COLLIDABLE_ALL)
         : info{
             .startpos    = ray_trace_start,
             .startoffset = { 0.0f, 0.0f, 0.0f },
@@ -78,21 +116,21 @@ struct Trace
             .extents     = { 0.0f, 0.0f, 0.0f },
             .isray       = true,
             .isswept     = (ray_trace_end - ray_trace_start).dot() != 0.0f,
+            .collidable_types = collidable_types,
         }
         , results{}
     {
-        assert(0 && "WARNING: Ray traces are currently not accurate against some"
-            " displacements due to required displacement collision structures "
-            " not being initialized because ray traces are currently not used!");
     }
 
     // Init a hull trace (aka moving an AABB through the world until it hits something)
     // If start pos is equal to end pos, this becomes an unswept hull trace instead.
+    // Object types that aren't in collidable_types are ignored by the trace.
     Trace(
         const Magnum::Vector3& hull_trace_start,
         const Magnum::Vector3& hull_trace_end,
         const Magnum::Vector3& hull_mins,
-        const Magnum::Vector3& hull_maxs)
+        const Magnum::Vector3& hull_maxs,
+        uint32_t collidable_types = COLLIDABLE_ALL)
         : info{
             // Offset start position to make it centered within the extents
             .startpos    = hull_trace_start + 0.5f * (hull_mins + hull_maxs),
@@ -102,6 +140,7 @@ struct Trace
             .extents     = (hull_maxs - hull_mins) * 0.5f,
             .isray       = false,
             .isswept     = (hull_trace_end - hull_trace_start).dot() != 0.0f,
+            .collidable_types = collidable_types,
         }
         , results{}
     {
@@ -118,14 +157,140 @@ struct Trace
     // trace hits the given AABB, ignoring all other collidable objects.
     // If the AABB is hit, hit_fraction gets set to the fraction of the point in
     // time of collision. hit_fraction is not modified otherwise!
-    bool HitsAabb(const Magnum::Vector3& aabb_mins,
-                  const Magnum::Vector3& aabb_maxs,
-                  float* hit_fraction = nullptr) const;
+    TRACE_FORCEINLINE bool HitsAabb(const Magnum::Vector3& aabb_mins,
+                                    const Magnum::Vector3& aabb_maxs,
+                                    float* hit_fraction = nullptr) const
+    {
+        if (!info.isswept)
+            return HitsAabbUnswept(aabb_mins, aabb_maxs, hit_fraction);
+        return HitsAabbSwept(aabb_mins, aabb_maxs, hit_fraction);
+    }
+
+    // Original scalar implementation of HitsAabb(), without any fast paths.
+    // Only used to verify HitsAabb(), see Benchmark::TraceAabbTest().
+    bool HitsAabbReference(const Magnum::Vector3& aabb_mins,
+                           const Magnum::Vector3& aabb_maxs,
+                           float* hit_fraction = nullptr) const;
 
 private:
     static Magnum::Vector3 ComputeInverseVec(const Magnum::Vector3& vec);
+    // --------- end of source-sdk-2013 code ---------
+
+    // SIMD implementations of HitsAabb(), defined below
+    TRACE_FORCEINLINE bool HitsAabbSwept(const Magnum::Vector3& aabb_mins,
+                                         const Magnum::Vector3& aabb_maxs,
+                                         float* hit_fraction) const;
+    TRACE_FORCEINLINE bool HitsAabbUnswept(const Magnum::Vector3& aabb_mins,
+                                           const Magnum::Vector3& aabb_maxs,
+                                           float* hit_fraction) const;
+
+    // Loads the vector as (x, y, z, z), without reading past its end
+#if defined(TRACE_USE_SSE)
+    static TRACE_FORCEINLINE __m128 LoadVec3(const Magnum::Vector3& v) {
+        return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)v.data()),
+                             _mm_load1_ps(v.data() + 2));
+    }
+#elif defined(TRACE_USE_NEON)
+    static TRACE_FORCEINLINE float32x4_t LoadVec3(const Magnum::Vector3& v) {
+        return vcombine_f32(vld1_f32(v.data()), vld1_dup_f32(v.data() + 2));
+    }
+#endif
 };
-// --------- end of source-sdk-2013 code ---------
+
+TRACE_FORCEINLINE bool Trace::HitsAabbSwept(const Magnum::Vector3& aabb_mins,
+                                            const Magnum::Vector3& aabb_maxs,
+                                            float* hit_fraction) const
+{
+    // Slab test, see HitsAabbReference() for an explanation of each step.
+    // The SIMD versions process all 3 axes at once. All versions perform
+    // the same float operations in the same order as HitsAabbReference() and
+    // BVH::HitsFourAabbs() and therefore produce identical results.
+    float box_entry_t, box_exit_t;
+#if defined(TRACE_USE_SSE)
+    const __m128 start    = LoadVec3(info.startpos);
+    const __m128 extents  = LoadVec3(info.extents);
+    const __m128 invdelta = LoadVec3(info.invdelta);
+    __m128 hit_mins = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(LoadVec3(aabb_mins), start), extents), invdelta);
+    __m128 hit_maxs = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(LoadVec3(aabb_maxs), start), extents), invdelta);
+    __m128 entry_t = _mm_min_ps(hit_mins, hit_maxs);
+    __m128 exit_t  = _mm_max_ps(hit_mins, hit_maxs);
+    // Horizontal max/min of lanes 0, 1 and 2
+    entry_t = _mm_max_ss(_mm_max_ss(entry_t, _mm_shuffle_ps(entry_t, entry_t, _MM_SHUFFLE(1, 1, 1, 1))),
+                         _mm_movehl_ps(entry_t, entry_t));
+    exit_t  = _mm_min_ss(_mm_min_ss(exit_t,  _mm_shuffle_ps(exit_t,  exit_t,  _MM_SHUFFLE(1, 1, 1, 1))),
+                         _mm_movehl_ps(exit_t,  exit_t));
+    box_entry_t = _mm_cvtss_f32(entry_t);
+    box_exit_t  = _mm_cvtss_f32(exit_t);
+#elif defined(TRACE_USE_NEON)
+    const float32x4_t start    = LoadVec3(info.startpos);
+    const float32x4_t extents  = LoadVec3(info.extents);
+    const float32x4_t invdelta = LoadVec3(info.invdelta);
+    float32x4_t hit_mins = LoadVec3(aabb_mins);
+    float32x4_t hit_maxs = LoadVec3(aabb_maxs);
+    hit_mins = vmulq_f32(vsubq_f32(vsubq_f32(hit_mins, start), extents), invdelta);
+    hit_maxs = vmulq_f32(vaddq_f32(vsubq_f32(hit_maxs, start), extents), invdelta);
+    box_entry_t = vmaxvq_f32(vminq_f32(hit_mins, hit_maxs));
+    box_exit_t  = vminvq_f32(vmaxq_f32(hit_mins, hit_maxs));
+#else
+    Magnum::Vector3 hit_mins = (aabb_mins - info.startpos - info.extents) * info.invdelta;
+    Magnum::Vector3 hit_maxs = (aabb_maxs - info.startpos + info.extents) * info.invdelta;
+    box_entry_t =                        Magnum::Math::min(hit_mins.x(), hit_maxs.x());
+    box_entry_t = Magnum::Math::max(box_entry_t, Magnum::Math::min(hit_mins.y(), hit_maxs.y()));
+    box_entry_t = Magnum::Math::max(box_entry_t, Magnum::Math::min(hit_mins.z(), hit_maxs.z()));
+    box_exit_t  =                        Magnum::Math::max(hit_mins.x(), hit_maxs.x());
+    box_exit_t  = Magnum::Math::min(box_exit_t,  Magnum::Math::max(hit_mins.y(), hit_maxs.y()));
+    box_exit_t  = Magnum::Math::min(box_exit_t,  Magnum::Math::max(hit_mins.z(), hit_maxs.z()));
+#endif
+    box_entry_t = Magnum::Math::max(box_entry_t, 0.0f);
+    box_exit_t  = Magnum::Math::min(box_exit_t,  1.0f);
+
+    if (box_entry_t <= box_exit_t) {
+        if (hit_fraction) *hit_fraction = box_entry_t;
+        return true;
+    }
+    return false;
+}
+
+TRACE_FORCEINLINE bool Trace::HitsAabbUnswept(const Magnum::Vector3& aabb_mins,
+                                              const Magnum::Vector3& aabb_maxs,
+                                              float* hit_fraction) const
+{
+    // An unswept trace hits the AABB if its start point lies inside the AABB
+    // enlarged by the trace's extents. The slab test would multiply these
+    // same differences with invdelta = FLT_MAX, so both tests only disagree
+    // for distances below ~1e-38 (where the slab test's result depends on
+    // float rounding).
+#if defined(TRACE_USE_SSE)
+    const __m128 start   = LoadVec3(info.startpos);
+    const __m128 extents = LoadVec3(info.extents);
+    __m128 hit_mins = LoadVec3(aabb_mins);
+    __m128 hit_maxs = LoadVec3(aabb_maxs);
+    hit_mins = _mm_sub_ps(_mm_sub_ps(hit_mins, start), extents);
+    hit_maxs = _mm_add_ps(_mm_sub_ps(hit_maxs, start), extents);
+    __m128 is_outside = _mm_or_ps(_mm_cmpgt_ps(hit_mins, _mm_setzero_ps()),
+                                  _mm_cmplt_ps(hit_maxs, _mm_setzero_ps()));
+    if (_mm_movemask_ps(is_outside) != 0)
+        return false;
+#elif defined(TRACE_USE_NEON)
+    const float32x4_t start   = LoadVec3(info.startpos);
+    const float32x4_t extents = LoadVec3(info.extents);
+    float32x4_t hit_mins = vsubq_f32(vsubq_f32(LoadVec3(aabb_mins), start), extents);
+    float32x4_t hit_maxs = vaddq_f32(vsubq_f32(LoadVec3(aabb_maxs), start), extents);
+    uint32x4_t is_outside = vorrq_u32(vcgtq_f32(hit_mins, vdupq_n_f32(0.0f)),
+                                      vcltq_f32(hit_maxs, vdupq_n_f32(0.0f)));
+    if (vmaxvq_u32(is_outside) != 0)
+        return false;
+#else
+    Magnum::Vector3 hit_mins = aabb_mins - info.startpos - info.extents;
+    Magnum::Vector3 hit_maxs = aabb_maxs - info.startpos + info.extents;
+    bool is_outside = (hit_mins.x() > 0.0f) | (hit_mins.y() > 0.0f) | (hit_mins.z() > 0.0f)
+                    | (hit_maxs.x() < 0.0f) | (hit_maxs.y() < 0.0f) | (hit_maxs.z() < 0.0f);
+    if (is_outside)
+        return false;
+#endif
+    if (hit_fraction) *hit_fraction = 0.0f;
+    return true;
+}
 
 } // namespace coll
 
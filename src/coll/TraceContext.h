@@ -0,0 +1,58 @@
+#ifndef COLL_TRACECONTEXT_H_
+#define COLL_TRACECONTEXT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "coll/CollidableWorld-displacement.h"
+
+namespace coll {
+
+// Scratch state that is needed while performing traces against a
+// CollidableWorld. Traces that run concurrently on different threads must use
+// different TraceContext objects, e.g. one per thread.
+// Before its first trace, a TraceContext must be prepared with
+// CollidableWorld::PrepareTraceContext().
+class TraceContext {
+public:
+    // If enable_debugger is true, traces using this context report to
+    // coll::Debugger. coll::Debugger isn't thread-safe, so only contexts used
+    // by a single thread may enable it.
+    explicit TraceContext(bool enable_debugger = false)
+        : is_debugger_enabled{ enable_debugger }
+        , disp_coll_plane_index_hash(512)
+    {}
+
+    const bool is_debugger_enabled;
+
+    // Temporary lookup table used by displacement collision cache creation.
+    // @Optimization Is 512 a good default bucket count?
+    //               Theoretical max of unique keys during current usage is 672.
+    //               Test if 512 are enough buckets? Do allocations occur?
+    DispCollPlaneIndexHash disp_coll_plane_index_hash;
+
+    // Number of traces that were performed using this context so far.
+    uint64_t trace_cnt = 0;
+
+    // Number of times traces using this context needed a displacement
+    // collision cache that was already created (hit) or that had to be
+    // created first (miss).
+    uint64_t disp_coll_cache_hit_cnt  = 0;
+    uint64_t disp_coll_cache_miss_cnt = 0;
+
+    // Displacement collision caches used by traces of this context are marked
+    // with this stamp. Set by CollidableWorld before each use, see
+    // CollidableWorld::EvictDispCollCaches().
+    uint64_t disp_coll_cache_use_stamp = 0;
+
+    // Lets a BVH traversal skip shared leaves it already visited through
+    // another node, see BVH::Leaf::is_shared. Indexed by leaf index, sized by
+    // BVH::PrepareTraceContext(). A leaf was visited by the current traversal
+    // if its mark equals leaf_traversal_stamp, every traversal uses a new stamp.
+    std::vector<uint32_t> leaf_visit_marks;
+    uint32_t leaf_traversal_stamp = 0;
+};
+
+} // namespace coll
+
+#endif // COLL_TRACECONTEXT_H_
@@ -925,6 +925,21 @@ void DZSimApplication::ConfigureExtraKeyBindings()
 #if COLL_BENCHMARK_ENABLED
         coll::Benchmark::StaticPropHullTracing();
         //coll::Benchmark::StaticPropBevelPlaneGen();
+        //coll::Benchmark::BvhTracing();
+        //coll::Benchmark::BvhConstruction();
+        //coll::Benchmark::BvhSpatialSplits();
+        //coll::Benchmark::BvhTreeletOptimization();
+        //coll::Benchmark::BvhQuantization();
+        //coll::Benchmark::Bvh4Tracing();
+        //coll::Benchmark::LeafTraceCostCalibration();
+        //coll::Benchmark::BvhCacheLoading();
+        //coll::Benchmark::BvhOverlapQuery();
+        //coll::Benchmark::TraceAabbTest();
+        //coll::Benchmark::FuncBrushTracing();
+        //coll::Benchmark::DisplacementRayTracing();
+        //coll::Benchmark::DispCollCacheBudget();
+        //coll::Benchmark::XPropTracing();
+        //coll::Benchmark::MultithreadedTracing();
         return;
 #endif
 
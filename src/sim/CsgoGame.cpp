@@ -39,12 +39,17 @@ bool CsgoGame::HasBeenStarted() {
 
 void CsgoGame::Start(SimTimeDur simtime_step_size, float simtime_scale,
                      const WorldState& initial_worldstate)
+{
+    Start(simtime_step_size, simtime_scale, initial_worldstate, WallClock::now());
+}
+
+void CsgoGame::Start(SimTimeDur simtime_step_size, float simtime_scale,
+                     const WorldState& initial_worldstate,
+                     WallClock::time_point realtime_game_start)
 {
     assert(simtime_step_size > 0.0_sec);
     assert(simtime_scale > 0.0f);
 
-    WallClock::time_point current_realtime = WallClock::now();
-
     // NOTE: The simulation time point of the initial worldstate can be
     //       arbitrary!
     //       Real time and simulation time are distinct!
@@ -53,7 +58,7 @@ void CsgoGame::Start(SimTimeDur simtime_step_size, float simtime_scale,
     m_realtime_game_tick_interval = std::chrono::nanoseconds{
         Nanoseconds{ simtime_step_size / simtime_scale }
     };
-    m_realtime_game_start = current_realtime;
+    m_realtime_game_start = realtime_game_start;
 
     m_prev_finalized_game_tick_id = 0;
     m_prev_finalized_game_tick = initial_worldstate;
@@ -67,7 +72,7 @@ void CsgoGame::Start(SimTimeDur simtime_step_size, float simtime_scale,
     m_prev_predicted_game_tick.AdvanceSimulation(simtime_step_size, {});
 
     m_prev_drawable_worldstate = initial_worldstate;
-    m_prev_drawable_worldstate_timepoint = current_realtime;
+    m_prev_drawable_worldstate_timepoint = realtime_game_start;
 }
 
 void CsgoGame::ModifyWorldStateHarshly(const std::function<void(WorldState&)>& f)
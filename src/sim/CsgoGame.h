@@ -33,6 +33,13 @@ public:
     void Start(SimTimeDur simtime_step_size, float simtime_scale,
                const WorldState& initial_worldstate);
 
+    // Same as above, but the initial worldstate is placed at the given realtime
+    // time point instead of the current time. Useful for feeding player inputs
+    // with artificial sample times, e.g. recorded ones.
+    void Start(SimTimeDur simtime_step_size, float simtime_scale,
+               const WorldState& initial_worldstate,
+               WallClock::time_point realtime_game_start);
+
     // Modify this game's worldstate in a 'harsh' way, i.e. no interpolation
     // between the previous worldstate and the new worldstate will occur (Good
     // for teleporting the player!). This method must be called after this CSGO
@@ -6,11 +6,14 @@
 
 #include "common.h"
 
+// Headless tools only use the input state, not the event handling
+#ifndef DZSIM_HEADLESS
 #ifdef DZSIM_WEB_PORT
 #include <Magnum/Platform/EmscriptenApplication.h>
 #else
 #include <Magnum/Platform/Sdl2Application.h>
 #endif
+#endif
 
 // -------- start of source-sdk-2013 code --------
 // (taken and modified from source-sdk-2013/<...>/src/game/shared/in_buttons.h)
@@ -31,6 +34,7 @@ const unsigned int IN_TOGGLE_NOCLIP = 1 << 18;
 // game input state to be consumed by the game simulation.
 namespace sim::PlayerInput {
 
+#ifndef DZSIM_HEADLESS
 #ifdef DZSIM_WEB_PORT
         using Application = Magnum::Platform::EmscriptenApplication;
 #else
@@ -49,6 +53,7 @@ namespace sim::PlayerInput {
     bool HandleMouseMoveEvent   (Application::MouseMoveEvent& event,
                                  float mouse_sensitivity);
     bool HandleMouseScrollEvent (Application::MouseScrollEvent& event);
+#endif // DZSIM_HEADLESS
 
     // Set all buttons to be unpressed.
     void ClearAllButtons();
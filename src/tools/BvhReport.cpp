@@ -0,0 +1,156 @@
+// Headless BVH quality report: Loads a map, creates its collision world
+// without any graphics API, builds its BVH with one or more builder variants
+// and prints statistics about the resulting trees as JSON to stdout (or
+// writes them to a file), all other output goes to stderr. This gives
+// objective numbers when tuning BVH construction.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Corrade/Containers/StringStl.h>
+#include <Corrade/Utility/Arguments.h>
+#include <Corrade/Utility/Debug.h>
+#include <json.hpp>
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "csgo_parsing/BspMap.h"
+#include "tools/ToolCommon.h"
+
+using namespace Corrade;
+using namespace Magnum;
+using json = nlohmann::json;
+using SplitMethod = coll::BVH::BuildParams::SplitMethod;
+
+// Builder variants that can be compared. Cache files are never used, every
+// variant is built from scratch.
+static const std::pair<std::string, coll::BVH::BuildParams> VARIANTS[] = {
+    { "exact_sah",     { .split_method = SplitMethod::ExactSah } },
+    { "binned_sah_16", { .split_method = SplitMethod::BinnedSah, .sah_bin_cnt = 16 } },
+    { "binned_sah_32", { .split_method = SplitMethod::BinnedSah, .sah_bin_cnt = 32 } },
+    { "spatial_sah",   { .split_method = SplitMethod::SpatialSah, .sah_bin_cnt = 32 } },
+    { "treelet_opt",   { .split_method = SplitMethod::ExactSah, .treelet_optimization_passes = 1 } },
+    { "quantized",     { .quantize_node_aabbs = true } },
+    { "bvh4",          { .collapse_to_bvh4 = true } },
+};
+
+static json LeafTypeCountsToJson(const size_t (&leaf_cnt_by_type)[coll::BVH::LEAF_TYPE_CNT])
+{
+    json counts = json::object();
+    for (size_t type = 0; type < coll::BVH::LEAF_TYPE_CNT; type++)
+        counts[coll::BVH::GetLeafTypeName(type)] = leaf_cnt_by_type[type];
+    return counts;
+}
+
+static json QualityStatsToJson(const coll::BVH::QualityStats& stats)
+{
+    json subtrees = json::array();
+    for (const coll::BVH::QualityStats::Subtree& subtree : stats.subtrees) {
+        subtrees.push_back({
+            { "mins",             tools::Vector3ToJson(subtree.mins) },
+            { "maxs",             tools::Vector3ToJson(subtree.maxs) },
+            { "nodes",            subtree.node_cnt },
+            { "leaves",           subtree.leaf_cnt },
+            { "leaves_by_type",   LeafTypeCountsToJson(subtree.leaf_cnt_by_type) },
+        });
+    }
+    return {
+        { "nodes",                     stats.node_cnt },
+        { "leaves",                    stats.leaf_cnt },
+        { "leaf_refs",                 stats.leaf_ref_cnt },
+        { "leaves_by_type",            LeafTypeCountsToJson(stats.leaf_cnt_by_type) },
+        { "tree_depth",                stats.tree_depth },
+        { "node_memory_bytes",         stats.node_memory_usage },
+        { "sah_cost",                  stats.sah_cost },
+        { "mean_leaf_depth",           stats.mean_leaf_depth },
+        { "leaf_depth_histogram",      stats.leaf_depth_histogram },
+        { "sibling_overlap",           stats.sibling_overlap },
+        { "max_sibling_overlap_ratio", stats.max_sibling_overlap_ratio },
+        { "subtrees",                  subtrees },
+    };
+}
+
+int main(int argc, char** argv)
+{
+    std::string all_variant_names;
+    for (const auto& [variant_name, variant_params] : VARIANTS)
+        all_variant_names += (all_variant_names.empty() ? "" : ",") + variant_name;
+
+    Utility::Arguments args;
+    args.addArgument("map")
+            .setHelp("map", "path to the .bsp map file", "MAP")
+        .addOption("variants", "exact_sah")
+            .setHelp("variants", "comma-separated list of BVH builder variants "
+                "to report on, available: " + all_variant_names, "LIST")
+        .addOption("subtree-depth", "3")
+            .setHelp("subtree-depth", "report subtrees rooted this many levels "
+                "below the root node", "N")
+        .addOption("output")
+            .setHelp("output", "write JSON report to this file instead of stdout", "FILE")
+        .setGlobalHelp("Prints statistics about a map's BVH, without graphics.")
+        .parse(argc, argv);
+
+    // Keep stdout clean for the JSON output
+    Utility::Debug redirect_debug_output{ &std::cerr };
+
+    // Determine variants to build
+    std::vector<std::pair<std::string, coll::BVH::BuildParams>> variants_to_build;
+    for (const std::string& name : tools::SplitCommaSeparatedList(args.value<std::string>("variants"))) {
+        bool found = false;
+        for (const auto& variant : VARIANTS) {
+            if (variant.first == name) {
+                variants_to_build.push_back(variant);
+                found = true;
+            }
+        }
+        if (!found) {
+            Error{} << "Unknown BVH builder variant:" << name.c_str();
+            return EXIT_FAILURE;
+        }
+    }
+    size_t subtree_depth = args.value<size_t>("subtree-depth");
+
+    // Every variant's BVH gets built below, don't build a default one
+    std::string map_path = args.value<std::string>("map");
+    std::shared_ptr<csgo_parsing::BspMap> bsp_map;
+    std::shared_ptr<coll::CollidableWorld> c_world;
+    if (!tools::LoadMapAndCollidableWorld(map_path, Containers::NullOpt,
+                                          &bsp_map, &c_world))
+        return EXIT_FAILURE;
+
+    json variant_reports = json::array();
+    for (const auto& [name, params] : variants_to_build) {
+        Debug{} << "Building BVH variant" << name.c_str();
+        auto build_start = std::chrono::high_resolution_clock::now();
+        coll::BVH bvh{ *c_world, params };
+        auto build_end = std::chrono::high_resolution_clock::now();
+        if (!bvh.WasConstructedSuccessfully()) {
+            Error{} << "Failed to build BVH variant" << name.c_str();
+            return EXIT_FAILURE;
+        }
+        unsigned long long build_duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(build_end - build_start).count();
+
+        json report = QualityStatsToJson(bvh.CalcQualityStats(subtree_depth));
+        report["variant"] = name;
+        report["build_time_ns"] = build_duration_ns;
+        variant_reports.push_back(report);
+    }
+
+    json report = {
+        { "map",           map_path },
+        { "subtree_depth", subtree_depth },
+        { "variants",      variant_reports },
+    };
+
+    if (!tools::WriteJsonReport(report, args.value<std::string>("output")))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
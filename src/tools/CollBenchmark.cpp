@@ -0,0 +1,132 @@
+// Headless collision benchmark runner: Loads a map, creates its collision
+// world without any graphics API and runs collision benchmarks on it.
+// Benchmark results are printed as JSON to stdout (or written to a file),
+// all other output goes to stderr. This makes it usable on machines without a
+// display, e.g. to track trace performance over time.
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Corrade/Utility/Arguments.h>
+#include <Corrade/Utility/Debug.h>
+#include <json.hpp>
+#include <Magnum/Magnum.h>
+
+#include "coll/Benchmark.h"
+#include "coll/BVH.h"
+#include "csgo_parsing/BspMap.h"
+#include "GlobalVars.h"
+#include "tools/ToolCommon.h"
+
+#if !COLL_BENCHMARK_ENABLED
+#error Collision benchmarks must be enabled to build the headless benchmark runner
+#endif
+
+using namespace Corrade;
+using namespace Magnum;
+using json = nlohmann::json;
+
+static const std::pair<std::string, void(*)()> BENCHMARKS[] = {
+    { "StaticPropHullTracing",   coll::Benchmark::StaticPropHullTracing   },
+    { "StaticPropBevelPlaneGen", coll::Benchmark::StaticPropBevelPlaneGen },
+    { "BvhTracing",              coll::Benchmark::BvhTracing              },
+    { "BvhConstruction",         coll::Benchmark::BvhConstruction         },
+    { "BvhSpatialSplits",        coll::Benchmark::BvhSpatialSplits        },
+    { "BvhTreeletOptimization",  coll::Benchmark::BvhTreeletOptimization  },
+    { "BvhQuantization",         coll::Benchmark::BvhQuantization         },
+    { "Bvh4Tracing",             coll::Benchmark::Bvh4Tracing             },
+    { "LeafTraceCostCalibration", coll::Benchmark::LeafTraceCostCalibration },
+    { "BvhCacheLoading",         coll::Benchmark::BvhCacheLoading         },
+    { "BvhOverlapQuery",         coll::Benchmark::BvhOverlapQuery         },
+    { "TraceAabbTest",           coll::Benchmark::TraceAabbTest           },
+    { "FuncBrushTracing",        coll::Benchmark::FuncBrushTracing        },
+    { "DisplacementRayTracing",  coll::Benchmark::DisplacementRayTracing  },
+    { "DispCollCacheBudget",     coll::Benchmark::DispCollCacheBudget     },
+    { "XPropTracing",            coll::Benchmark::XPropTracing            },
+    { "MultithreadedTracing",    coll::Benchmark::MultithreadedTracing    },
+};
+
+static json BenchmarkResultToJson(const coll::Benchmark::Result& result)
+{
+    return {
+        { "benchmark",       result.benchmark },
+        { "metric",          result.metric },
+        { "unit",            "ns" },
+        { "seed",            result.seed },
+        { "samples",         result.sample_cnt },
+        { "mean",            result.stats.mean },
+        { "stddev",          result.stats.stddev },
+        { "min",             result.stats.min },
+        { "5th_percentile",  result.stats._5th_percentile },
+        { "median",          result.stats.median },
+        { "95th_percentile", result.stats._95th_percentile },
+        { "max",             result.stats.max },
+    };
+}
+
+int main(int argc, char** argv)
+{
+    Utility::Arguments args;
+    args.addArgument("map")
+            .setHelp("map", "path to the .bsp map file", "MAP")
+        .addOption("benchmarks", "StaticPropHullTracing,StaticPropBevelPlaneGen,"
+                                 "BvhTracing,XPropTracing")
+            .setHelp("benchmarks", "comma-separated list of benchmarks to run", "LIST")
+        .addOption("seed")
+            .setHelp("seed", "seed of random trace generation, random if empty", "N")
+        .addOption("output")
+            .setHelp("output", "write JSON results to this file instead of stdout", "FILE")
+        .setGlobalHelp("Runs collision benchmarks on a map, without graphics.")
+        .parse(argc, argv);
+
+    // Keep stdout clean for the JSON output
+    Utility::Debug redirect_debug_output{ &std::cerr };
+
+    // Determine benchmarks to run
+    std::vector<void(*)()> benchmarks_to_run;
+    for (const std::string& name : tools::SplitCommaSeparatedList(args.value<std::string>("benchmarks"))) {
+        void(*benchmark)() = nullptr;
+        for (const auto& [benchmark_name, benchmark_func] : BENCHMARKS)
+            if (benchmark_name == name)
+                benchmark = benchmark_func;
+        if (!benchmark) {
+            Error{} << "Unknown benchmark:" << name.c_str();
+            return EXIT_FAILURE;
+        }
+        benchmarks_to_run.push_back(benchmark);
+    }
+
+    std::string seed_str = args.value<std::string>("seed");
+    if (!seed_str.empty())
+        coll::Benchmark::SetSeed(args.value<unsigned int>("seed"));
+
+    // Don't use the application's BVH cache, results must not depend on
+    // previous runs and tools shouldn't leave cache files behind
+    std::string map_path = args.value<std::string>("map");
+    std::shared_ptr<csgo_parsing::BspMap> bsp_map;
+    if (!tools::LoadMapAndCollidableWorld(map_path, coll::BVH::BuildParams{},
+                                          &bsp_map, &g_coll_world))
+        return EXIT_FAILURE;
+
+    for (void(*benchmark)() : benchmarks_to_run)
+        benchmark();
+
+    json results = json::array();
+    for (const coll::Benchmark::Result& result : coll::Benchmark::GetResults())
+        results.push_back(BenchmarkResultToJson(result));
+    json report = {
+        { "map",     map_path },
+        { "results", results },
+    };
+
+    if (!tools::WriteJsonReport(report, args.value<std::string>("output")))
+        return EXIT_FAILURE;
+
+    g_coll_world.reset();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,358 @@
+// Headless simulation runner: Loads a map, creates its collision world without
+// any graphics API and feeds a recorded or scripted sequence of player inputs
+// through sim::CsgoGame as fast as possible.
+// Tick timings, trace counts and a hash of the final worldstate are printed as
+// JSON to stdout (or written to a file), all other output goes to stderr. This
+// makes it usable on machines without a display, e.g. to track simulation
+// performance over time and to detect unintended changes in behavior.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Corrade/Containers/Optional.h>
+#include <Corrade/Utility/Arguments.h>
+#include <Corrade/Utility/Debug.h>
+#include <json.hpp>
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Time.h>
+#include <Magnum/Math/TimeStl.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "common.h"
+#include "csgo_parsing/BspMap.h"
+#include "GlobalVars.h"
+#include "sim/CsgoConfig.h"
+#include "sim/CsgoConstants.h"
+#include "sim/CsgoGame.h"
+#include "sim/Entities/Player.h"
+#include "sim/PlayerInput.h"
+#include "sim/Sim.h"
+#include "sim/WorldState.h"
+#include "tools/ToolCommon.h"
+
+using namespace Corrade;
+using namespace Magnum;
+using namespace Magnum::Math::Literals;
+using json = nlohmann::json;
+
+const sim::SimTimeDur SIM_TIME_STEP_SIZE = 1.0_sec / sim::CSGO_TICKRATE;
+const float SIM_TIME_SCALE = 1.0f;
+
+static const std::pair<std::string, unsigned int> BUTTON_NAMES[] = {
+    { "attack",    IN_ATTACK    },
+    { "attack2",   IN_ATTACK2   },
+    { "jump",      IN_JUMP      },
+    { "duck",      IN_DUCK      },
+    { "forward",   IN_FORWARD   },
+    { "back",      IN_BACK      },
+    { "moveleft",  IN_MOVELEFT  },
+    { "moveright", IN_MOVERIGHT },
+    { "use",       IN_USE       },
+    { "speed",     IN_SPEED     },
+};
+
+using Weapon = sim::Entities::Player::Loadout::Weapon;
+static const std::pair<std::string, Weapon> WEAPON_NAMES[] = {
+    { "fists",    Weapon::Fists    },
+    { "knife",    Weapon::Knife    },
+    { "bumpmine", Weapon::BumpMine },
+    { "taser",    Weapon::Taser    },
+    { "xm1014",   Weapon::XM1014   },
+};
+
+// Player input of a single game tick. Sample time is determined by the runner.
+struct TickInput {
+    unsigned int nButtons = 0;
+    bool scrollwheel_jumped = false;
+    Vector3 viewing_angles; // pitch, yaw, roll
+};
+
+// Parses recorded player inputs. Expected format is an array of objects like:
+//   { "buttons": ["forward", "jump"], "pitch": 0.0, "yaw": 90.0,
+//     "scrollwheel_jump": false, "repeat": 1 }
+// where each object describes the input of "repeat" consecutive game ticks.
+// Returns false and prints an error if the file can't be parsed.
+static bool LoadRecordedInputs(const std::string& file_path,
+                               std::vector<TickInput>* dest)
+{
+    std::ifstream input_file(file_path);
+    if (!input_file) {
+        Error{} << "Failed to open input file:" << file_path.c_str();
+        return false;
+    }
+
+    try {
+        json input_json = json::parse(input_file);
+        for (const json& entry : input_json) {
+            TickInput input;
+            for (const json& button : entry.value("buttons", json::array())) {
+                std::string button_name = button.get<std::string>();
+                unsigned int flag = 0;
+                for (const auto& [name, in_flag] : BUTTON_NAMES)
+                    if (name == button_name)
+                        flag = in_flag;
+                if (flag == 0) {
+                    Error{} << "Unknown button in input file:" << button_name.c_str();
+                    return false;
+                }
+                input.nButtons |= flag;
+            }
+            input.scrollwheel_jumped = entry.value("scrollwheel_jump", false);
+            input.viewing_angles = { entry.value("pitch", 0.0f),
+                                     entry.value("yaw",   0.0f),
+                                     0.0f };
+            size_t repeat = entry.value("repeat", (size_t)1);
+            dest->insert(dest->end(), repeat, input);
+        }
+    }
+    catch (const json::exception& e) {
+        Error{} << "Failed to parse input file:" << e.what();
+        return false;
+    }
+    return true;
+}
+
+// Generates a deterministic input sequence: The player runs forward while
+// turning, jumps every second and ducks periodically.
+static std::vector<TickInput> CreateScriptedInputs(size_t tick_cnt,
+                                                   const Vector3& spawn_angles)
+{
+    std::vector<TickInput> inputs(tick_cnt);
+    for (size_t i = 0; i < tick_cnt; i++) {
+        TickInput& input = inputs[i];
+        input.nButtons = IN_FORWARD;
+        if (i % 64 == 0)
+            input.nButtons |= IN_JUMP;
+        if (i % 256 >= 192)
+            input.nButtons |= IN_DUCK;
+        if (i % 512 >= 256)
+            input.nButtons |= IN_MOVELEFT;
+        input.viewing_angles = spawn_angles;
+        input.viewing_angles.y() += 0.5f * (float)(i % 720);
+    }
+    return inputs;
+}
+
+// 64-bit FNV-1a hash
+class StateHasher {
+public:
+    template<typename T>
+    void Add(const T& value) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        for (unsigned char b : bytes) {
+            hash ^= b;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    void Add(const Vector3& v) { Add(v.x()); Add(v.y()); Add(v.z()); }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+};
+
+// Hash of the worldstate's properties that result from the simulation.
+static uint64_t HashWorldState(const sim::WorldState& ws)
+{
+    StateHasher h;
+    h.Add(static_cast<Long>(ws.simtime));
+    h.Add(ws.csgo_mv.m_vecAbsOrigin);
+    h.Add(ws.csgo_mv.m_vecVelocity);
+    h.Add(ws.csgo_mv.m_vecViewOffset);
+    h.Add(ws.csgo_mv.m_vecViewAngles);
+    h.Add((int)ws.csgo_mv.m_MoveType);
+    h.Add(ws.csgo_mv.m_fFlags);
+    h.Add(ws.csgo_mv.m_flDucktime);
+    h.Add(ws.csgo_mv.m_flFallVelocity);
+    h.Add(static_cast<Long>(ws.csgo_mv.m_nextBumpBoost));
+    h.Add(ws.bumpmine_projectiles.size());
+    for (const sim::Entities::BumpmineProjectile& bm : ws.bumpmine_projectiles) {
+        h.Add(bm.position);
+        h.Add(bm.velocity);
+        h.Add(bm.has_detonated);
+    }
+    return h.hash;
+}
+
+int main(int argc, char** argv)
+{
+    Utility::Arguments args;
+    args.addArgument("map")
+            .setHelp("map", "path to the .bsp map file", "MAP")
+        .addOption("input")
+            .setHelp("input", "JSON file with recorded player inputs, a "
+                "scripted input sequence is used if empty", "FILE")
+        .addOption("ticks")
+            .setHelp("ticks", "number of game ticks to simulate, defaults to "
+                "the length of the recorded inputs or 6400 without them. The "
+                "last recorded input is repeated if needed.", "N")
+        .addOption("game-mode", "dz")
+            .setHelp("game-mode", "game mode settings to simulate, dz or comp", "MODE")
+        .addOption("weapon", "xm1014")
+            .setHelp("weapon", "weapon held by the player: fists, knife, "
+                "bumpmine, taser or xm1014", "WEAPON")
+        .addOption("output")
+            .setHelp("output", "write JSON results to this file instead of stdout", "FILE")
+        .setGlobalHelp("Simulates player inputs on a map as fast as possible, "
+                       "without graphics.")
+        .parse(argc, argv);
+
+    // Keep stdout clean for the JSON output
+    Utility::Debug redirect_debug_output{ &std::cerr };
+
+    std::string game_mode = args.value<std::string>("game-mode");
+    if (game_mode == "dz") {
+        g_csgo_game_sim_cfg = sim::CsgoConfig(InitWithDzDefaults);
+    }
+    else if (game_mode == "comp") {
+        g_csgo_game_sim_cfg = sim::CsgoConfig(InitWithCompDefaults);
+    }
+    else {
+        Error{} << "Unknown game mode:" << game_mode.c_str();
+        return EXIT_FAILURE;
+    }
+
+    Containers::Optional<Weapon> weapon;
+    for (const auto& [name, w] : WEAPON_NAMES)
+        if (name == args.value<std::string>("weapon"))
+            weapon = w;
+    if (!weapon) {
+        Error{} << "Unknown weapon:" << args.value<std::string>("weapon").c_str();
+        return EXIT_FAILURE;
+    }
+
+    // Don't use the application's BVH cache, results must not depend on
+    // previous runs and tools shouldn't leave cache files behind
+    std::string map_path = args.value<std::string>("map");
+    std::shared_ptr<csgo_parsing::BspMap> bsp_map;
+    if (!tools::LoadMapAndCollidableWorld(map_path, coll::BVH::BuildParams{},
+                                          &bsp_map, &g_coll_world))
+        return EXIT_FAILURE;
+
+    sim::WorldState initial_worldstate;
+    if (bsp_map->player_spawns.size() > 0) {
+        const csgo_parsing::BspMap::PlayerSpawn& playerSpawn = bsp_map->player_spawns[0];
+        initial_worldstate.csgo_mv.m_vecAbsOrigin  = playerSpawn.origin;
+        initial_worldstate.csgo_mv.m_vecViewAngles = playerSpawn.angles;
+    }
+    else {
+        Warning{} << "Map has no player spawns, starting at the origin";
+    }
+    initial_worldstate.player.loadout.active_weapon = *weapon;
+
+    // Determine the player input of every game tick
+    std::vector<TickInput> inputs;
+    std::string input_path = args.value<std::string>("input");
+    std::string ticks_str  = args.value<std::string>("ticks");
+    if (input_path.empty()) {
+        size_t tick_cnt = ticks_str.empty() ? 6400 : args.value<size_t>("ticks");
+        inputs = CreateScriptedInputs(tick_cnt,
+                                      initial_worldstate.csgo_mv.m_vecViewAngles);
+    }
+    else {
+        if (!LoadRecordedInputs(input_path, &inputs))
+            return EXIT_FAILURE;
+        if (inputs.empty()) {
+            Error{} << "Input file contains no inputs:" << input_path.c_str();
+            return EXIT_FAILURE;
+        }
+        if (!ticks_str.empty())
+            inputs.resize(args.value<size_t>("ticks"), inputs.back());
+    }
+
+    // Run the simulation on a virtual clock: Every input is sampled in the
+    // middle between two game ticks, so that each ProcessNewPlayerInput() call
+    // finalizes exactly one game tick and predicts the next one.
+    WallClock::duration tick_interval = std::chrono::nanoseconds{
+        Nanoseconds{ SIM_TIME_STEP_SIZE / SIM_TIME_SCALE }
+    };
+    WallClock::time_point game_start = WallClock::now();
+
+    sim::CsgoGame game;
+    game.Start(SIM_TIME_STEP_SIZE, SIM_TIME_SCALE, initial_worldstate, game_start);
+
+    Debug{} << "Simulating" << inputs.size() << "game ticks";
+
+    std::vector<long long> tick_durations_ns(inputs.size());
+    std::vector<uint64_t>  tick_trace_cnts  (inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        sim::PlayerInput::State input_state;
+        input_state.sample_time = game_start + i * tick_interval + tick_interval / 2;
+        input_state.nButtons           = inputs[i].nButtons;
+        input_state.scrollwheel_jumped = inputs[i].scrollwheel_jumped;
+        input_state.viewing_angles     = inputs[i].viewing_angles;
+
+        uint64_t trace_cnt_before = g_coll_world->GetMainThreadTraceCount();
+        auto t0 = std::chrono::steady_clock::now();
+        game.ProcessNewPlayerInput(input_state);
+        auto t1 = std::chrono::steady_clock::now();
+
+        tick_durations_ns[i] =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        tick_trace_cnts[i] = g_coll_world->GetMainThreadTraceCount() - trace_cnt_before;
+    }
+
+    // Evaluate
+    long long total_ns = 0;
+    for (long long duration_ns : tick_durations_ns)
+        total_ns += duration_ns;
+    uint64_t total_traces = 0;
+    for (uint64_t cnt : tick_trace_cnts)
+        total_traces += cnt;
+
+    std::vector<long long> sorted_durations = tick_durations_ns;
+    std::sort(sorted_durations.begin(), sorted_durations.end());
+    size_t tick_cnt = sorted_durations.size();
+    auto percentile = [&](double p) {
+        return tick_cnt == 0 ? 0 : sorted_durations[(size_t)(p * (tick_cnt - 1))];
+    };
+    double mean_ns     = tick_cnt == 0 ? 0.0 : (double)total_ns / tick_cnt;
+    double mean_traces = tick_cnt == 0 ? 0.0 : (double)total_traces / tick_cnt;
+
+    const sim::WorldState& final_ws = game.GetLatestActualWorldState();
+    char hash_str[17];
+    std::snprintf(hash_str, sizeof(hash_str), "%016llx",
+                  (unsigned long long)HashWorldState(final_ws));
+
+    json report = {
+        { "map",       map_path },
+        { "input",     input_path.empty() ? "scripted" : input_path },
+        { "game_mode", game_mode },
+        { "ticks",     tick_cnt },
+        { "ns_per_tick", {
+            { "mean",            mean_ns },
+            { "min",             percentile(0.0) },
+            { "median",          percentile(0.5) },
+            { "95th_percentile", percentile(0.95) },
+            { "max",             percentile(1.0) },
+        }},
+        { "traces_per_tick", {
+            { "mean",  mean_traces },
+            { "max",   tick_cnt == 0 ? 0 : *std::max_element(
+                           tick_trace_cnts.begin(), tick_trace_cnts.end()) },
+            { "total", total_traces },
+        }},
+        { "final_state", {
+            { "hash",     hash_str },
+            { "origin",   tools::Vector3ToJson(final_ws.csgo_mv.m_vecAbsOrigin) },
+            { "velocity", tools::Vector3ToJson(final_ws.csgo_mv.m_vecVelocity) },
+        }},
+    };
+
+    if (!tools::WriteJsonReport(report, args.value<std::string>("output")))
+        return EXIT_FAILURE;
+
+    g_coll_world.reset();
+    return EXIT_SUCCESS;
+}
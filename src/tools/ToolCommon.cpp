@@ -0,0 +1,94 @@
+#include "tools/ToolCommon.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Corrade/Containers/Optional.h>
+#include <Corrade/Utility/Debug.h>
+#include <json.hpp>
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "coll/CollidableWorldCreator.h"
+#include "csgo_parsing/AssetFinder.h"
+#include "csgo_parsing/BspMap.h"
+#include "csgo_parsing/BspMapParsing.h"
+
+using namespace Corrade;
+using namespace Magnum;
+using json = nlohmann::json;
+
+std::vector<std::string> tools::SplitCommaSeparatedList(const std::string& list)
+{
+    std::vector<std::string> elements;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            elements.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return elements;
+}
+
+json tools::Vector3ToJson(const Vector3& v)
+{
+    return { v.x(), v.y(), v.z() };
+}
+
+bool tools::LoadMapAndCollidableWorld(const std::string& map_path,
+    const Containers::Optional<coll::BVH::BuildParams>& bvh_params,
+    std::shared_ptr<csgo_parsing::BspMap>* dest_bsp_map,
+    std::shared_ptr<coll::CollidableWorld>* dest_coll_world)
+{
+    // Props might use collision models from the game's files
+    if (csgo_parsing::AssetFinder::FindCsgoPath()) {
+        std::vector<std::string> required_file_ext = { "mdl", "phy" };
+        csgo_parsing::AssetFinder::RefreshVpkArchiveIndex(required_file_ext);
+    }
+    else {
+        Warning{} << "CSGO installation not found, props can only use "
+            "collision models packed into the map file";
+    }
+
+    Debug{} << "Loading map file:" << map_path.c_str();
+    std::shared_ptr<csgo_parsing::BspMap> bsp_map;
+    auto bsp_parse_status = csgo_parsing::ParseBspMapFile(&bsp_map, map_path);
+    if (!bsp_parse_status.successful()) {
+        Error{} << "Failed to load the map:" << bsp_parse_status.desc_msg.c_str();
+        return false;
+    }
+
+    std::string world_init_errors;
+    *dest_coll_world = coll::CollidableWorldCreator::InitFromBspMap(
+        bsp_map, bvh_params, &world_init_errors);
+    if (!world_init_errors.empty())
+        Warning{} << world_init_errors.c_str();
+
+    *dest_bsp_map = std::move(bsp_map);
+    return true;
+}
+
+bool tools::WriteJsonReport(const json& report, const std::string& output_path)
+{
+    if (output_path.empty()) {
+        std::cout << report.dump(4) << std::endl;
+        return true;
+    }
+
+    std::ofstream output_file(output_path);
+    if (!output_file) {
+        Error{} << "Failed to open output file:" << output_path.c_str();
+        return false;
+    }
+    output_file << report.dump(4) << std::endl;
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef TOOLS_TOOLCOMMON_H_
+#define TOOLS_TOOLCOMMON_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Corrade/Containers/Optional.h>
+#include <json.hpp>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "csgo_parsing/BspMap.h"
+
+// Functionality shared by the headless tools (DZSimCollBenchmark,
+// DZSimBvhReport and DZSimSimRunner)
+namespace tools {
+
+// Splits command line list arguments like "a,b,c". Empty elements are skipped.
+std::vector<std::string> SplitCommaSeparatedList(const std::string& list);
+
+nlohmann::json Vector3ToJson(const Magnum::Vector3& v);
+
+// Loads the given map file and creates its collision world. Props might use
+// collision models from the game's files, if a CSGO installation is found.
+// The BVH is built with the given parameters, see
+// coll::CollidableWorldCreator::InitFromBspMap().
+// Returns false and prints an error if the map can't be loaded.
+bool LoadMapAndCollidableWorld(const std::string& map_path,
+    const Corrade::Containers::Optional<coll::BVH::BuildParams>& bvh_params,
+    std::shared_ptr<csgo_parsing::BspMap>* dest_bsp_map,
+    std::shared_ptr<coll::CollidableWorld>* dest_coll_world);
+
+// Writes the JSON report to the given file, or to stdout if output_path is
+// empty. Returns false and prints an error if the file can't be opened.
+bool WriteJsonReport(const nlohmann::json& report, const std::string& output_path);
+
+} // namespace tools
+
+#endif // TOOLS_TOOLCOMMON_H_